@@ -0,0 +1,200 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TrajectoryMetrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include <Eigen/Geometry>
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+// Numbers of a line separated by spaces and/or commas
+std::vector<double> ParseNumbers(std::string s) {
+  std::replace(s.begin(), s.end(), ',', ' ');
+  std::stringstream ss(s);
+  std::vector<double> vValues;
+  double value;
+  while (ss >> value) vValues.push_back(value);
+  return vValues;
+}
+
+bool ByTime(const StampedPose& a, const StampedPose& b) { return a.t < b.t; }
+
+double Rmse(const std::vector<double>& vErrors) {
+  double sum = 0.0;
+  for (double e : vErrors) sum += e * e;
+  return vErrors.empty() ? 0.0 : std::sqrt(sum / vErrors.size());
+}
+
+}  // namespace
+
+bool LoadEstimatedTrajectory(const std::string& strFile, Trajectory& traj) {
+  traj.clear();
+  std::ifstream f(strFile.c_str());
+  std::string s;
+  while (std::getline(f, s)) {
+    if (s.empty() || s[0] == '#') continue;
+    const std::vector<double> v = ParseNumbers(s);
+    if (v.size() < 8) continue;
+
+    StampedPose pose;
+    pose.t = v[0] / 1e9;
+    pose.p = Eigen::Vector3d(v[1], v[2], v[3]);
+    pose.q = Eigen::Quaterniond(v[7], v[4], v[5], v[6]).normalized();
+    traj.push_back(pose);
+  }
+  std::sort(traj.begin(), traj.end(), ByTime);
+  return !traj.empty();
+}
+
+bool LoadGroundTruth(const std::string& strFile,
+                     const std::vector<double>& vFrameTimes, Trajectory& traj) {
+  traj.clear();
+  std::ifstream f(strFile.c_str());
+  std::string s;
+  size_t nLine = 0;
+  while (std::getline(f, s)) {
+    if (s.empty() || s[0] == '#') continue;
+    const bool bCsv = s.find(',') != std::string::npos;
+    const std::vector<double> v = ParseNumbers(s);
+
+    StampedPose pose;
+    if (v.size() == 12 && !bCsv) {
+      // KITTI, one pose per frame
+      if (nLine >= vFrameTimes.size()) break;
+      Eigen::Matrix3d R;
+      R << v[0], v[1], v[2], v[4], v[5], v[6], v[8], v[9], v[10];
+      pose.t = vFrameTimes[nLine];
+      pose.p = Eigen::Vector3d(v[3], v[7], v[11]);
+      pose.q = Eigen::Quaterniond(R).normalized();
+    } else if (bCsv && v.size() >= 8) {
+      // EuRoC / TUM-VI
+      pose.t = v[0] / 1e9;
+      pose.p = Eigen::Vector3d(v[1], v[2], v[3]);
+      pose.q = Eigen::Quaterniond(v[4], v[5], v[6], v[7]).normalized();
+    } else if (v.size() == 8) {
+      // TUM RGB-D
+      pose.t = v[0];
+      pose.p = Eigen::Vector3d(v[1], v[2], v[3]);
+      pose.q = Eigen::Quaterniond(v[7], v[4], v[5], v[6]).normalized();
+    } else {
+      continue;
+    }
+    traj.push_back(pose);
+    nLine++;
+  }
+  std::sort(traj.begin(), traj.end(), ByTime);
+  return !traj.empty();
+}
+
+bool ComputeTrajectoryErrors(const Trajectory& estimate,
+                             const Trajectory& groundTruth, bool bEstimateScale,
+                             double dMaxDt, double dRpeDelta,
+                             TrajectoryErrors& errors) {
+  errors = TrajectoryErrors();
+
+  // Nearest ground truth pose of every estimated pose
+  std::vector<const StampedPose*> vpEst, vpGt;
+  for (const StampedPose& est : estimate) {
+    Trajectory::const_iterator it = std::lower_bound(
+        groundTruth.begin(), groundTruth.end(), est, ByTime);
+    const StampedPose* pBest = nullptr;
+    if (it != groundTruth.end()) pBest = &(*it);
+    if (it != groundTruth.begin() &&
+        (!pBest || est.t - (it - 1)->t < pBest->t - est.t))
+      pBest = &(*(it - 1));
+    if (!pBest || std::fabs(pBest->t - est.t) > dMaxDt) continue;
+
+    vpEst.push_back(&est);
+    vpGt.push_back(pBest);
+  }
+
+  const size_t N = vpEst.size();
+  errors.nMatched = N;
+  if (N < 3) return false;
+
+  // Similarity (or rigid) transformation from the estimate to the ground truth
+  Eigen::Matrix3Xd src(3, N), dst(3, N);
+  for (size_t i = 0; i < N; ++i) {
+    src.col(i) = vpEst[i]->p;
+    dst.col(i) = vpGt[i]->p;
+  }
+  const Eigen::Matrix4d T = Eigen::umeyama(src, dst, bEstimateScale);
+  const Eigen::Matrix3d sR = T.block<3, 3>(0, 0);
+  const double s = bEstimateScale ? std::cbrt(sR.determinant()) : 1.0;
+  const Eigen::Matrix3d R = sR / s;
+  const Eigen::Vector3d t = T.block<3, 1>(0, 3);
+  errors.scale = s;
+
+  std::vector<Eigen::Isometry3d> vTwcEst(N), vTwcGt(N);
+  std::vector<double> vAte(N);
+  for (size_t i = 0; i < N; ++i) {
+    vTwcEst[i].setIdentity();
+    vTwcEst[i].linear() = R * vpEst[i]->q.toRotationMatrix();
+    vTwcEst[i].translation() = sR * vpEst[i]->p + t;
+
+    vTwcGt[i].setIdentity();
+    vTwcGt[i].linear() = vpGt[i]->q.toRotationMatrix();
+    vTwcGt[i].translation() = vpGt[i]->p;
+
+    vAte[i] = (vTwcEst[i].translation() - vTwcGt[i].translation()).norm();
+  }
+
+  double sum = 0.0;
+  for (double e : vAte) sum += e;
+  errors.ate_rmse = Rmse(vAte);
+  errors.ate_mean = sum / N;
+  errors.ate_max = *std::max_element(vAte.begin(), vAte.end());
+  std::vector<double> vSorted = vAte;
+  std::nth_element(vSorted.begin(), vSorted.begin() + N / 2, vSorted.end());
+  errors.ate_median = vSorted[N / 2];
+
+  // Relative pose error between each pose and the first one dRpeDelta later
+  std::vector<double> vRpeTrans, vRpeRot;
+  size_t j = 0;
+  for (size_t i = 0; i < N; ++i) {
+    if (j <= i) j = i + 1;
+    while (j < N && vpEst[j]->t - vpEst[i]->t < dRpeDelta) j++;
+    if (j >= N) break;
+
+    const Eigen::Isometry3d Eij = vTwcEst[i].inverse() * vTwcEst[j];
+    const Eigen::Isometry3d Gij = vTwcGt[i].inverse() * vTwcGt[j];
+    const Eigen::Isometry3d D = Gij.inverse() * Eij;
+
+    vRpeTrans.push_back(D.translation().norm());
+    const double c = std::max(
+        -1.0, std::min(1.0, (D.linear().trace() - 1.0) / 2.0));
+    vRpeRot.push_back(std::acos(c) * 180.0 / M_PI);
+  }
+  errors.nRpePairs = vRpeTrans.size();
+  errors.rpe_trans_rmse = Rmse(vRpeTrans);
+  errors.rpe_rot_rmse_deg = Rmse(vRpeRot);
+
+  return true;
+}
+
+}  // namespace ORB_SLAM3
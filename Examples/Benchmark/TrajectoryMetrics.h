@@ -0,0 +1,79 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAJECTORYMETRICS_H
+#define TRAJECTORYMETRICS_H
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace ORB_SLAM3 {
+
+struct StampedPose {
+  double t;
+  Eigen::Vector3d p;
+  Eigen::Quaterniond q;
+};
+
+typedef std::vector<StampedPose> Trajectory;
+
+// Trajectory written by System::SaveTrajectoryEuRoC: "t[ns] x y z qx qy qz qw"
+bool LoadEstimatedTrajectory(const std::string& strFile, Trajectory& traj);
+
+// Ground truth in any of the formats of the supported datasets:
+// - EuRoC / TUM-VI csv: t[ns],x,y,z,qw,qx,qy,qz[,...]
+// - TUM RGB-D: t[s] x y z qx qy qz qw
+// - KITTI: 3x4 row-major pose per line, timestamped with vFrameTimes
+bool LoadGroundTruth(const std::string& strFile,
+                     const std::vector<double>& vFrameTimes, Trajectory& traj);
+
+struct TrajectoryErrors {
+  size_t nMatched = 0;
+  // Scale of the alignment, 1 unless it is estimated
+  double scale = 1.0;
+
+  // Absolute trajectory error after alignment [m]
+  double ate_rmse = 0.0;
+  double ate_mean = 0.0;
+  double ate_median = 0.0;
+  double ate_max = 0.0;
+
+  // Relative pose error over the given time interval
+  size_t nRpePairs = 0;
+  double rpe_trans_rmse = 0.0;    // [m]
+  double rpe_rot_rmse_deg = 0.0;  // [deg]
+};
+
+// Associates the estimate with the ground truth by nearest timestamp (within
+// dMaxDt seconds), aligns it with Umeyama's method (with scale for monocular
+// runs) and computes the ATE, and the RPE between poses dRpeDelta seconds
+// apart. Returns false if fewer than three poses could be associated.
+bool ComputeTrajectoryErrors(const Trajectory& estimate,
+                             const Trajectory& groundTruth, bool bEstimateScale,
+                             double dMaxDt, double dRpeDelta,
+                             TrajectoryErrors& errors);
+
+}  // namespace ORB_SLAM3
+
+#endif  // TRAJECTORYMETRICS_H
@@ -0,0 +1,492 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Replays a recorded sequence through System and reports throughput, latency,
+// stage times, memory, map size and trajectory accuracy as JSON. A second mode
+// compares two reports and fails if the second one regressed.
+//
+//   benchmark run --dataset euroc|tumvi|tum_rgbd|kitti
+//                 --sensor mono|stereo|rgbd|imu_mono|imu_stereo
+//                 --vocabulary FILE --settings FILE
+//                 [--sequence DIR] [--times FILE] [--associations FILE]
+//                 [--left DIR] [--right DIR] [--imu FILE]
+//                 [--groundtruth FILE] [--output FILE] [--realtime]
+//   benchmark compare BASE.json NEW.json [--tolerance 0.1]
+//
+// EuRoC uses --sequence and --times, TUM-VI --left, --right, --times and
+// --imu, TUM RGB-D --sequence and --associations and KITTI --sequence. Runs
+// use the offline mode of System (deterministic, as fast as possible) unless
+// --realtime is given.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <DatasetReader.h>
+#include <System.h>
+
+#include "TrajectoryMetrics.h"
+
+using namespace std;
+
+namespace {
+
+void WriteStats(ostream& out, vector<double> vValues) {
+  out << "{\"count\": " << vValues.size();
+  if (!vValues.empty()) {
+    sort(vValues.begin(), vValues.end());
+    double total = 0.0;
+    for (double v : vValues) total += v;
+    const size_t n = vValues.size();
+    out << ", \"total\": " << total << ", \"mean\": " << total / n
+        << ", \"median\": " << vValues[n / 2]
+        << ", \"p95\": " << vValues[min(n - 1, size_t(0.95 * n))]
+        << ", \"max\": " << vValues.back();
+  }
+  out << "}";
+}
+
+void WriteArray(ostream& out, const vector<double>& vValues) {
+  out << "[";
+  for (size_t i = 0; i < vValues.size(); ++i)
+    out << (i ? ", " : "") << vValues[i];
+  out << "]";
+}
+
+// Minimal JSON reader for the reports written by Run: numeric leaves are
+// flattened into "a.b.c" keys, strings and arrays are skipped.
+class JsonFlattener {
+ public:
+  explicit JsonFlattener(const string& s) : ms(s), mnPos(0) {}
+
+  bool Parse(map<string, double>& mValues) {
+    mpValues = &mValues;
+    return ParseValue("") && (SkipSpace(), mnPos == ms.size());
+  }
+
+ protected:
+  void SkipSpace() {
+    while (mnPos < ms.size() && isspace(static_cast<unsigned char>(ms[mnPos])))
+      mnPos++;
+  }
+
+  bool ParseString(string& str) {
+    if (ms[mnPos] != '"') return false;
+    str.clear();
+    for (mnPos++; mnPos < ms.size() && ms[mnPos] != '"'; mnPos++) {
+      if (ms[mnPos] == '\\') mnPos++;
+      str += ms[mnPos];
+    }
+    return mnPos++ < ms.size();
+  }
+
+  bool ParseValue(const string& strKey) {
+    SkipSpace();
+    if (mnPos >= ms.size()) return false;
+    const char c = ms[mnPos];
+    if (c == '{' || c == '[') {
+      const bool bObject = c == '{';
+      mnPos++;
+      SkipSpace();
+      if (mnPos < ms.size() && ms[mnPos] == (bObject ? '}' : ']')) {
+        mnPos++;
+        return true;
+      }
+      while (true) {
+        string strChild;
+        if (bObject) {
+          SkipSpace();
+          if (!ParseString(strChild)) return false;
+          SkipSpace();
+          if (mnPos >= ms.size() || ms[mnPos++] != ':') return false;
+          strChild = strKey.empty() ? strChild : strKey + "." + strChild;
+        }
+        // Array elements are parsed but not recorded
+        if (!ParseValue(bObject ? strChild : string("[]"))) return false;
+        SkipSpace();
+        if (mnPos >= ms.size()) return false;
+        if (ms[mnPos] == ',') {
+          mnPos++;
+          continue;
+        }
+        return ms[mnPos++] == (bObject ? '}' : ']');
+      }
+    }
+    if (c == '"') {
+      string str;
+      return ParseString(str);
+    }
+
+    const char* pStart = ms.c_str() + mnPos;
+    char* pEnd;
+    const double value = strtod(pStart, &pEnd);
+    if (pEnd == pStart) {
+      // true, false or null
+      while (mnPos < ms.size() &&
+             isalpha(static_cast<unsigned char>(ms[mnPos])))
+        mnPos++;
+      return ms.c_str() + mnPos != pStart;
+    }
+    mnPos += pEnd - pStart;
+    if (strKey.find("[]") == string::npos) (*mpValues)[strKey] = value;
+    return true;
+  }
+
+  const string& ms;
+  size_t mnPos;
+  map<string, double>* mpValues;
+};
+
+bool EndsWith(const string& s, const string& strSuffix) {
+  return s.size() >= strSuffix.size() &&
+         s.compare(s.size() - strSuffix.size(), strSuffix.size(), strSuffix) ==
+             0;
+}
+
+// +1 if larger values are worse, -1 if smaller ones are, 0 if informational
+int Direction(const string& strKey) {
+  if (strKey == "throughput_fps") return -1;
+  if (strKey == "wall_time_s" || strKey == "peak_rss_mb" ||
+      strKey == "untracked_frames")
+    return 1;
+  if (strKey.compare(0, 9, "accuracy.") == 0)
+    return (strKey.find("ate_") != string::npos ||
+            strKey.find("rpe_trans") != string::npos ||
+            strKey.find("rpe_rot") != string::npos)
+               ? 1
+               : 0;
+  if (EndsWith(strKey, ".mean") || EndsWith(strKey, ".median") ||
+      EndsWith(strKey, ".p95") || EndsWith(strKey, ".max"))
+    return 1;
+  return 0;
+}
+
+int Compare(const string& strBase, const string& strNew, double tolerance) {
+  map<string, double> mBase, mNew;
+  for (int i = 0; i < 2; ++i) {
+    const string& strFile = i == 0 ? strBase : strNew;
+    ifstream f(strFile.c_str());
+    stringstream ss;
+    ss << f.rdbuf();
+    const string strJson = ss.str();
+    if (!f || !JsonFlattener(strJson).Parse(i == 0 ? mBase : mNew)) {
+      cerr << "ERROR: could not parse " << strFile << endl;
+      return 2;
+    }
+  }
+
+  vector<string> vstrRegressions;
+  cout << setprecision(6);
+  cout << "{\n  \"base\": \"" << strBase << "\",\n  \"new\": \"" << strNew
+       << "\",\n  \"tolerance\": " << tolerance << ",\n  \"metrics\": {";
+  bool bFirst = true;
+  for (const pair<const string, double>& base : mBase) {
+    const int direction = Direction(base.first);
+    map<string, double>::const_iterator it = mNew.find(base.first);
+    if (it == mNew.end()) {
+      // A tracked metric missing from the new run (e.g. the accuracy when the
+      // trajectory could not be aligned) is a regression
+      if (direction == 0) continue;
+      vstrRegressions.push_back(base.first);
+      cout << (bFirst ? "\n" : ",\n") << "    \"" << base.first
+           << "\": {\"base\": " << base.second
+           << ", \"new\": null, \"change\": null}";
+      bFirst = false;
+      continue;
+    }
+
+    // Any move away from a zero base is an infinite relative change, counted
+    // in the bad direction of the metric (e.g. the first untracked frame)
+    double change = 0.0;
+    if (base.second != 0.0)
+      change = (it->second - base.second) / fabs(base.second);
+    else if (it->second != base.second)
+      change = (direction != 0 ? direction : (it->second > 0.0 ? 1 : -1)) *
+               numeric_limits<double>::infinity();
+    if (direction != 0 && direction * change > tolerance)
+      vstrRegressions.push_back(base.first);
+
+    // JSON has no infinity, the change is null then
+    cout << (bFirst ? "\n" : ",\n") << "    \"" << base.first
+         << "\": {\"base\": " << base.second << ", \"new\": " << it->second
+         << ", \"change\": ";
+    if (std::isinf(change))
+      cout << "null";
+    else
+      cout << change;
+    cout << "}";
+    bFirst = false;
+  }
+  cout << "\n  },\n  \"regressions\": [";
+  for (size_t i = 0; i < vstrRegressions.size(); ++i)
+    cout << (i ? ", " : "") << "\"" << vstrRegressions[i] << "\"";
+  cout << "]\n}" << endl;
+
+  return vstrRegressions.empty() ? 0 : 1;
+}
+
+int Run(map<string, string>& opts) {
+  const string strDataset = opts["dataset"];
+  const string strSensor = opts["sensor"];
+
+  map<string, ORB_SLAM3::CameraType::eSensor> mSensors = {
+      {"mono", ORB_SLAM3::CameraType::MONOCULAR},
+      {"stereo", ORB_SLAM3::CameraType::STEREO},
+      {"rgbd", ORB_SLAM3::CameraType::RGBD},
+      {"imu_mono", ORB_SLAM3::CameraType::IMU_MONOCULAR},
+      {"imu_stereo", ORB_SLAM3::CameraType::IMU_STEREO}};
+  if (!mSensors.count(strSensor)) {
+    cerr << "ERROR: unknown sensor " << strSensor << endl;
+    return 2;
+  }
+  const ORB_SLAM3::CameraType::eSensor sensor = mSensors[strSensor];
+  const bool bImu = strSensor.compare(0, 4, "imu_") == 0;
+  const bool bStereo = strSensor.find("stereo") != string::npos;
+  const bool bRgbd = sensor == ORB_SLAM3::CameraType::RGBD;
+
+  ORB_SLAM3::DatasetIndex index;
+  bool bLoaded = false;
+  if (strDataset == "euroc" && !bRgbd)
+    bLoaded = ORB_SLAM3::LoadEuRoC(opts["sequence"], opts["times"], bStereo,
+                                   bImu, index);
+  else if (strDataset == "tumvi" && !bRgbd)
+    bLoaded = ORB_SLAM3::LoadTumVI(opts["left"],
+                                   bStereo ? opts["right"] : string(),
+                                   opts["times"],
+                                   bImu ? opts["imu"] : string(), index);
+  else if (strDataset == "tum_rgbd" && bRgbd)
+    bLoaded =
+        ORB_SLAM3::LoadTumRgbd(opts["sequence"], opts["associations"], index);
+  else if (strDataset == "kitti" && !bImu && !bRgbd)
+    bLoaded = ORB_SLAM3::LoadKitti(opts["sequence"], bStereo, index);
+  else {
+    cerr << "ERROR: sensor " << strSensor << " is not available for dataset "
+         << strDataset << endl;
+    return 2;
+  }
+  if (!bLoaded) {
+    cerr << "ERROR: failed to load the sequence" << endl;
+    return 2;
+  }
+
+  const bool bRealTime = opts.count("realtime") > 0;
+  string strOutput = opts.count("output") ? opts["output"] : "benchmark.json";
+  string strTrajectory = strOutput;
+  if (EndsWith(strTrajectory, ".json"))
+    strTrajectory.resize(strTrajectory.size() - 5);
+  strTrajectory += "_trajectory.txt";
+
+  ORB_SLAM3::System_ptr SLAM = std::make_shared<ORB_SLAM3::System>(
+      opts["vocabulary"], opts["settings"], sensor);
+  SLAM->SetOfflineMode(!bRealTime);
+  SLAM->SetStageTimesEnabled(true);
+
+  // Same preprocessing as the example of each dataset
+  const bool bTumVI = strDataset == "tumvi";
+  ORB_SLAM3::DatasetReader reader(
+      index, bTumVI ? cv::IMREAD_GRAYSCALE : cv::IMREAD_UNCHANGED,
+      bRealTime ? ORB_SLAM3::DatasetReader::REAL_TIME
+                : ORB_SLAM3::DatasetReader::AS_FAST_AS_POSSIBLE);
+  if (bTumVI) {
+    reader.SetPreprocessing([](cv::Mat& im) {
+      thread_local cv::Ptr<cv::CLAHE> clahe =
+          cv::createCLAHE(3.0, cv::Size(8, 8));
+      clahe->apply(im, im);
+    });
+  }
+  reader.SetScale(SLAM->GetImageScale());
+  cv::Mat M1l, M2l, M1r, M2r;
+  if (bStereo && SLAM->GetRectificationMaps(M1l, M2l, M1r, M2r)) {
+    reader.SetRectification(M1l, M2l, M1r, M2r);
+    SLAM->SetExternalRectification(true);
+  }
+
+  vector<double> vTimestamps, vFrameMs;
+  vTimestamps.reserve(index.size());
+  vFrameMs.reserve(index.size());
+  int nUntracked = 0;
+
+  const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+  ORB_SLAM3::DatasetFrame frame;
+  while (reader.Next(frame)) {
+    const chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    if (bRgbd)
+      SLAM->TrackRGBD(frame.imLeft, frame.imRight, frame.timestamp);
+    else if (bStereo)
+      SLAM->TrackStereo(frame.imLeft, frame.imRight, frame.timestamp,
+                        frame.vImuMeas);
+    else
+      SLAM->TrackMonocular(frame.imLeft, frame.timestamp, frame.vImuMeas);
+    const chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+    vTimestamps.push_back(frame.timestamp);
+    vFrameMs.push_back(
+        chrono::duration<double, milli>(t2 - t1).count());
+    if (SLAM->GetTrackingState() != ORB_SLAM3::Tracker::OK) nUntracked++;
+  }
+  const double wallTime =
+      chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+  if (!reader.GetError().empty()) {
+    cerr << "ERROR: " << reader.GetError() << endl;
+    return 2;
+  }
+
+  SLAM->SaveTrajectoryEuRoC(strTrajectory);
+
+  ORB_SLAM3::TrajectoryErrors errors;
+  bool bAccuracy = false;
+  if (opts.count("groundtruth")) {
+    ORB_SLAM3::Trajectory estimate, groundTruth;
+    if (!ORB_SLAM3::LoadEstimatedTrajectory(strTrajectory, estimate) ||
+        !ORB_SLAM3::LoadGroundTruth(opts["groundtruth"], index.vTimestamps,
+                                    groundTruth))
+      cerr << "WARNING: could not load the trajectories, no accuracy" << endl;
+    else
+      bAccuracy = ORB_SLAM3::ComputeTrajectoryErrors(
+          estimate, groundTruth, sensor == ORB_SLAM3::CameraType::MONOCULAR,
+          0.02, 1.0, errors);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  int nMaps;
+  size_t nKeyFrames, nMapPoints;
+  SLAM->GetAtlasSize(nMaps, nKeyFrames, nMapPoints);
+  const ORB_SLAM3::StageTimes::Samples stageTimes = SLAM->GetStageTimes();
+
+  ofstream out(strOutput.c_str());
+  out << setprecision(9);
+  out << "{\n  \"dataset\": \"" << strDataset << "\",\n  \"sensor\": \""
+      << strSensor << "\",\n  \"mode\": \""
+      << (bRealTime ? "realtime" : "offline") << "\",\n";
+  out << "  \"frames\": " << vFrameMs.size() << ",\n";
+  out << "  \"untracked_frames\": " << nUntracked << ",\n";
+  out << "  \"wall_time_s\": " << wallTime << ",\n";
+  out << "  \"throughput_fps\": " << vFrameMs.size() / wallTime << ",\n";
+  out << "  \"peak_rss_mb\": " << usage.ru_maxrss / 1024.0 << ",\n";
+  out << "  \"maps\": " << nMaps << ",\n";
+  out << "  \"keyframes\": " << nKeyFrames << ",\n";
+  out << "  \"map_points\": " << nMapPoints << ",\n";
+  out << "  \"frame_ms\": ";
+  WriteStats(out, vFrameMs);
+  out << ",\n  \"stages\": {";
+  bool bFirstStage = true;
+  for (int i = 0; i < ORB_SLAM3::StageTimes::NUM_STAGES; i++) {
+    if (stageTimes[i].empty()) continue;
+    out << (bFirstStage ? "\n" : ",\n") << "    \""
+        << ORB_SLAM3::StageTimes::Name(
+               static_cast<ORB_SLAM3::StageTimes::Stage>(i))
+        << "\": ";
+    WriteStats(out, stageTimes[i]);
+    bFirstStage = false;
+  }
+  out << "\n  },\n";
+  // With a ground truth the accuracy is always written, only with the number
+  // of matched poses if it could not be computed
+  if (opts.count("groundtruth")) {
+    out << "  \"accuracy\": {\"matched_poses\": " << errors.nMatched;
+    if (bAccuracy)
+      out << ", \"scale\": " << errors.scale
+          << ", \"ate_rmse_m\": " << errors.ate_rmse
+          << ", \"ate_mean_m\": " << errors.ate_mean
+          << ", \"ate_median_m\": " << errors.ate_median
+          << ", \"ate_max_m\": " << errors.ate_max
+          << ", \"rpe_pairs\": " << errors.nRpePairs
+          << ", \"rpe_trans_rmse_m\": " << errors.rpe_trans_rmse
+          << ", \"rpe_rot_rmse_deg\": " << errors.rpe_rot_rmse_deg;
+    out << "},\n";
+  }
+  out << "  \"per_frame\": {\n    \"timestamp\": ";
+  WriteArray(out, vTimestamps);
+  out << ",\n    \"frame_ms\": ";
+  WriteArray(out, vFrameMs);
+  out << ",\n    \"tracking_ms\": ";
+  WriteArray(out, stageTimes[ORB_SLAM3::StageTimes::TRACKING]);
+  out << "\n  }\n}" << endl;
+
+  cout << "Benchmark written to " << strOutput << endl;
+  return 0;
+}
+
+void Usage() {
+  cerr << endl
+       << "Usage: ./benchmark run --dataset euroc|tumvi|tum_rgbd|kitti "
+          "--sensor mono|stereo|rgbd|imu_mono|imu_stereo --vocabulary FILE "
+          "--settings FILE [--sequence DIR] [--times FILE] "
+          "[--associations FILE] [--left DIR] [--right DIR] [--imu FILE] "
+          "[--groundtruth FILE] [--output FILE] [--realtime]"
+       << endl
+       << "       ./benchmark compare BASE.json NEW.json [--tolerance 0.1]"
+       << endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    Usage();
+    return 2;
+  }
+
+  const string strCommand = argv[1];
+  vector<string> vstrPositional;
+  map<string, string> opts;
+  for (int i = 2; i < argc; ++i) {
+    const string strArg = argv[i];
+    if (strArg.compare(0, 2, "--") != 0) {
+      vstrPositional.push_back(strArg);
+    } else if (strArg == "--realtime") {
+      opts["realtime"] = "1";
+    } else if (i + 1 < argc) {
+      opts[strArg.substr(2)] = argv[++i];
+    } else {
+      Usage();
+      return 2;
+    }
+  }
+
+  if (strCommand == "run" && vstrPositional.empty() &&
+      opts.count("dataset") && opts.count("sensor") &&
+      opts.count("vocabulary") && opts.count("settings"))
+    return Run(opts);
+
+  if (strCommand == "compare" && vstrPositional.size() == 2)
+    return Compare(vstrPositional[0], vstrPositional[1],
+                   opts.count("tolerance") ? stod(opts["tolerance"]) : 0.1);
+
+  Usage();
+  return 2;
+}
@@ -0,0 +1,340 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DatasetReader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+// Reads a "ts,wx,wy,wz,ax,ay,az" csv with nanosecond timestamps, as written
+// by EuRoC and TUM-VI
+void LoadImuCsv(const std::string& strImuPath, std::vector<IMU::Point>& vImu) {
+  std::ifstream fImu(strImuPath.c_str());
+  vImu.reserve(50000);
+
+  std::string s;
+  while (std::getline(fImu, s)) {
+    if (s.empty() || s[0] == '#') continue;
+
+    double data[7];
+    int count = 0;
+    std::stringstream ss(s);
+    std::string item;
+    while (count < 7 && std::getline(ss, item, ','))
+      data[count++] = std::stod(item);
+    if (count < 7) continue;
+
+    vImu.push_back(IMU::Point(data[4], data[5], data[6], data[1], data[2],
+                              data[3], data[0] / 1e9));
+  }
+}
+
+// Splits the IMU stream into the measurements each frame has to integrate
+// since the previous one. Frame 0 gets none, frame 1 starts at the last
+// measurement not after frame 0.
+void AssociateImu(const std::vector<IMU::Point>& vImu, DatasetIndex& index) {
+  index.vvImu.assign(index.size(), std::vector<IMU::Point>());
+  if (vImu.empty() || index.empty()) return;
+
+  size_t nFirst = 0;
+  while (nFirst < vImu.size() && vImu[nFirst].t <= index.vTimestamps[0])
+    nFirst++;
+  if (nFirst > 0) nFirst--;
+
+  for (size_t i = 1; i < index.size(); ++i) {
+    while (nFirst < vImu.size() && vImu[nFirst].t <= index.vTimestamps[i])
+      index.vvImu[i].push_back(vImu[nFirst++]);
+  }
+}
+
+// Lines of <ns>[ ...] naming <ns>.png images, '#' lines are comments
+void LoadNanosecondTimes(const std::string& strTimes,
+                         std::vector<std::string>& vstrNames,
+                         std::vector<double>& vTimestamps) {
+  std::ifstream fTimes(strTimes.c_str());
+  vstrNames.reserve(5000);
+  vTimestamps.reserve(5000);
+
+  std::string s;
+  while (std::getline(fTimes, s)) {
+    if (s.empty() || s[0] == '#') continue;
+
+    const std::string item = s.substr(0, s.find_first_of(" ,\r"));
+    vstrNames.push_back(item + ".png");
+    vTimestamps.push_back(std::stod(item) / 1e9);
+  }
+}
+
+}  // namespace
+
+bool LoadEuRoC(const std::string& strSequence, const std::string& strTimes,
+               bool bStereo, bool bImu, DatasetIndex& index) {
+  index = DatasetIndex();
+
+  std::vector<std::string> vstrNames;
+  LoadNanosecondTimes(strTimes, vstrNames, index.vTimestamps);
+
+  const std::string strCam0 = strSequence + "/mav0/cam0/data/";
+  const std::string strCam1 = strSequence + "/mav0/cam1/data/";
+  for (const std::string& strName : vstrNames) {
+    index.vstrLeft.push_back(strCam0 + strName);
+    if (bStereo) index.vstrRight.push_back(strCam1 + strName);
+  }
+
+  if (bImu) {
+    std::vector<IMU::Point> vImu;
+    LoadImuCsv(strSequence + "/mav0/imu0/data.csv", vImu);
+    if (vImu.empty()) return false;
+    AssociateImu(vImu, index);
+  }
+
+  return !index.empty();
+}
+
+bool LoadTumVI(const std::string& strLeftImages,
+               const std::string& strRightImages, const std::string& strTimes,
+               const std::string& strImu, DatasetIndex& index) {
+  index = DatasetIndex();
+
+  std::vector<std::string> vstrNames;
+  LoadNanosecondTimes(strTimes, vstrNames, index.vTimestamps);
+
+  for (const std::string& strName : vstrNames) {
+    index.vstrLeft.push_back(strLeftImages + "/" + strName);
+    if (!strRightImages.empty())
+      index.vstrRight.push_back(strRightImages + "/" + strName);
+  }
+
+  if (!strImu.empty()) {
+    std::vector<IMU::Point> vImu;
+    LoadImuCsv(strImu, vImu);
+    if (vImu.empty()) return false;
+    AssociateImu(vImu, index);
+  }
+
+  return !index.empty();
+}
+
+bool LoadTumRgbd(const std::string& strSequence,
+                 const std::string& strAssociations, DatasetIndex& index) {
+  index = DatasetIndex();
+  index.bRightIsDepth = true;
+
+  std::ifstream fAssociation(strAssociations.c_str());
+  std::string s;
+  while (std::getline(fAssociation, s)) {
+    if (s.empty() || s[0] == '#') continue;
+
+    std::stringstream ss(s);
+    double t, tD;
+    std::string sRGB, sD;
+    if (!(ss >> t >> sRGB >> tD >> sD)) continue;
+
+    index.vTimestamps.push_back(t);
+    index.vstrLeft.push_back(strSequence + "/" + sRGB);
+    index.vstrRight.push_back(strSequence + "/" + sD);
+  }
+
+  return !index.empty();
+}
+
+bool LoadKitti(const std::string& strSequence, bool bStereo,
+               DatasetIndex& index) {
+  index = DatasetIndex();
+
+  std::ifstream fTimes((strSequence + "/times.txt").c_str());
+  std::string s;
+  while (std::getline(fTimes, s)) {
+    if (s.empty()) continue;
+    index.vTimestamps.push_back(std::stod(s));
+  }
+
+  const std::string strPrefixLeft = strSequence + "/image_0/";
+  const std::string strPrefixRight = strSequence + "/image_1/";
+  for (size_t i = 0; i < index.size(); ++i) {
+    std::stringstream ss;
+    ss << std::setfill('0') << std::setw(6) << i << ".png";
+    index.vstrLeft.push_back(strPrefixLeft + ss.str());
+    if (bStereo) index.vstrRight.push_back(strPrefixRight + ss.str());
+  }
+
+  return !index.empty();
+}
+
+DatasetReader::DatasetReader(const DatasetIndex& index, int nImreadFlags,
+                             ePacing pacing, int nRingSize, int nThreads)
+    : mIndex(index),
+      mnImreadFlags(nImreadFlags),
+      mPacing(pacing),
+      mbRectify(false),
+      mfScale(1.f),
+      mnNext(0),
+      mbStarted(false),
+      mvSlots(std::max(nRingSize, 2)),
+      mpPool(new ThreadPool(std::max(nThreads, 1))) {}
+
+DatasetReader::~DatasetReader() {
+  // Let the pool drain its queue while the slots are still alive
+  mpPool.reset();
+}
+
+void DatasetReader::SetRectification(const cv::Mat& M1l, const cv::Mat& M2l,
+                                     const cv::Mat& M1r, const cv::Mat& M2r) {
+  mM1l = M1l;
+  mM2l = M2l;
+  mM1r = M1r;
+  mM2r = M2r;
+  mbRectify = !mM1l.empty();
+}
+
+void DatasetReader::SetScale(float fScale) { mfScale = fScale; }
+
+void DatasetReader::SetPreprocessing(
+    const std::function<void(cv::Mat&)>& preprocess) {
+  mPreprocess = preprocess;
+}
+
+void DatasetReader::Schedule(size_t nFrame) {
+  Slot& slot = mvSlots[nFrame % mvSlots.size()];
+  slot.result = mpPool->Enqueue(
+      [this, nFrame, &slot]() { return Decode(nFrame, slot); });
+}
+
+bool DatasetReader::Decode(size_t nFrame, Slot& slot) {
+  if (!DecodeImage(mIndex.vstrLeft[nFrame], true, false, slot, slot.imLeft))
+    return false;
+  if (!mIndex.vstrRight.empty() &&
+      !DecodeImage(mIndex.vstrRight[nFrame], false, mIndex.bRightIsDepth, slot,
+                   slot.imRight))
+    return false;
+  return true;
+}
+
+bool DatasetReader::DecodeImage(const std::string& strPath, bool bLeft,
+                                bool bDepth, Slot& slot, cv::Mat& im) {
+  std::ifstream f(strPath.c_str(), std::ios::binary | std::ios::ate);
+  const std::streamsize nBytes = f ? std::streamsize(f.tellg()) : 0;
+  if (nBytes <= 0) {
+    slot.strError = "Failed to load image at: " + strPath;
+    return false;
+  }
+  // The buffer keeps its capacity, files are read without reallocating
+  slot.vBuffer.resize(nBytes);
+  f.seekg(0);
+  f.read(reinterpret_cast<char*>(slot.vBuffer.data()), nBytes);
+
+  const bool bRectify = mbRectify && !bDepth;
+  const bool bResize = mfScale != 1.f;
+
+  // Decode straight into the output unless it still has to be transformed.
+  // cv::imdecode and cv::remap reuse the destination when its size and type
+  // do not change, which is the case from the second lap of the ring on.
+  cv::Mat& imDecoded = (bRectify || bResize) ? slot.imDecoded : im;
+  cv::imdecode(slot.vBuffer, bDepth ? cv::IMREAD_UNCHANGED : mnImreadFlags,
+               &imDecoded);
+  if (imDecoded.empty()) {
+    slot.strError = "Failed to load image at: " + strPath;
+    return false;
+  }
+
+  if (!bDepth && mPreprocess) mPreprocess(imDecoded);
+
+  cv::Mat* pCurrent = &imDecoded;
+  if (bRectify) {
+    cv::Mat& imRectified = bResize ? slot.imRectified : im;
+    cv::remap(*pCurrent, imRectified, bLeft ? mM1l : mM1r,
+              bLeft ? mM2l : mM2r, cv::INTER_LINEAR);
+    pCurrent = &imRectified;
+  }
+
+  if (bResize) {
+    const cv::Size size(pCurrent->cols * mfScale, pCurrent->rows * mfScale);
+    cv::resize(*pCurrent, im, size);
+  }
+
+  return true;
+}
+
+bool DatasetReader::Next(DatasetFrame& frame) {
+  const size_t nRing = mvSlots.size();
+  if (!mbStarted) {
+    mbStarted = true;
+    for (size_t i = 0; i < std::min(nRing, mIndex.size()); ++i) Schedule(i);
+  } else if (mnNext > 0 && mnNext - 1 + nRing < mIndex.size()) {
+    // The previous frame has been released, its slot decodes the next lap
+    Schedule(mnNext - 1 + nRing);
+  }
+
+  if (mnNext >= mIndex.size()) return false;
+
+  Slot& slot = mvSlots[mnNext % nRing];
+  if (!slot.result.get()) {
+    mstrError = slot.strError;
+    mnNext = mIndex.size();
+    return false;
+  }
+
+  if (mPacing == REAL_TIME) {
+    // Keep the dataset rate between consecutive frames, without catching up
+    // if the caller fell behind
+    const std::chrono::steady_clock::time_point tNow =
+        std::chrono::steady_clock::now();
+    if (mnNext > 0) {
+      const double dt =
+          mIndex.vTimestamps[mnNext] - mIndex.vTimestamps[mnNext - 1];
+      const std::chrono::steady_clock::time_point tTarget =
+          mtLastDelivery + std::chrono::duration_cast<
+                               std::chrono::steady_clock::duration>(
+                               std::chrono::duration<double>(dt));
+      if (tNow < tTarget) std::this_thread::sleep_until(tTarget);
+    }
+    mtLastDelivery = std::chrono::steady_clock::now();
+  }
+
+  frame.nIndex = mnNext;
+  frame.timestamp = mIndex.vTimestamps[mnNext];
+  frame.imLeft = slot.imLeft;
+  frame.imRight = mIndex.vstrRight.empty() ? cv::Mat() : slot.imRight;
+  if (mIndex.vvImu.empty())
+    frame.vImuMeas.clear();
+  else
+    frame.vImuMeas = mIndex.vvImu[mnNext];
+
+  const std::string& strPath = mIndex.vstrLeft[mnNext];
+  const size_t nSlash = strPath.find_last_of('/');
+  frame.strName =
+      nSlash == std::string::npos ? strPath : strPath.substr(nSlash + 1);
+
+  mnNext++;
+  return true;
+}
+
+}  // namespace ORB_SLAM3
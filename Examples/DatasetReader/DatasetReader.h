@@ -0,0 +1,170 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATASETREADER_H
+#define DATASETREADER_H
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "ImuTypes.h"
+#include "ThreadPool.h"
+
+namespace ORB_SLAM3 {
+
+// Image paths, timestamps and IMU measurements of one sequence. The second
+// image is the right camera for stereo sequences and the depth map for RGB-D
+// ones; it is empty for monocular sequences.
+struct DatasetIndex {
+  std::vector<double> vTimestamps;
+  std::vector<std::string> vstrLeft;
+  std::vector<std::string> vstrRight;
+  bool bRightIsDepth = false;
+
+  // IMU measurements since the previous frame, empty without IMU
+  std::vector<std::vector<IMU::Point> > vvImu;
+
+  size_t size() const { return vTimestamps.size(); }
+  bool empty() const { return vTimestamps.empty(); }
+};
+
+// Loaders for the dataset layouts used by the examples. They return false if
+// no image (or, when requested, no IMU measurement) could be read.
+
+// EuRoC: <sequence>/mav0/cam{0,1}/data/<ns>.png listed in strTimes and
+// <sequence>/mav0/imu0/data.csv
+bool LoadEuRoC(const std::string& strSequence, const std::string& strTimes,
+               bool bStereo, bool bImu, DatasetIndex& index);
+
+// TUM-VI: <images>/<ns>.png listed in strTimes. strRightImages and strImu may
+// be empty for monocular or purely visual sequences.
+bool LoadTumVI(const std::string& strLeftImages,
+               const std::string& strRightImages, const std::string& strTimes,
+               const std::string& strImu, DatasetIndex& index);
+
+// TUM RGB-D: rgb/depth pairs listed in an association file, relative to
+// strSequence
+bool LoadTumRgbd(const std::string& strSequence,
+                 const std::string& strAssociations, DatasetIndex& index);
+
+// KITTI odometry: <sequence>/image_{0,1}/<%06d>.png and <sequence>/times.txt
+bool LoadKitti(const std::string& strSequence, bool bStereo,
+               DatasetIndex& index);
+
+// One decoded frame. The images point into the reader's ring buffer and stay
+// valid until the next call to DatasetReader::Next.
+struct DatasetFrame {
+  size_t nIndex;
+  double timestamp;
+  cv::Mat imLeft;
+  cv::Mat imRight;
+  std::vector<IMU::Point> vImuMeas;
+  std::string strName;
+};
+
+// Decodes the images of a sequence ahead of the tracking thread. Frames are
+// read and decoded by a small thread pool into a bounded ring of slots whose
+// cv::Mats are reused from one frame to the next, so that in steady state no
+// image memory is allocated. Optional rectification, resizing and
+// preprocessing (e.g. CLAHE) also run on the prefetch threads.
+class DatasetReader {
+ public:
+  enum ePacing {
+    REAL_TIME = 0,            // deliver frames at the dataset frame rate
+    AS_FAST_AS_POSSIBLE = 1,  // deliver frames as soon as they are decoded
+  };
+
+  // The index must outlive the reader. nImreadFlags applies to colour/grey
+  // images, depth maps are always read unchanged. nRingSize bounds the number
+  // of frames decoded ahead.
+  DatasetReader(const DatasetIndex& index, int nImreadFlags,
+                ePacing pacing = REAL_TIME, int nRingSize = 8,
+                int nThreads = 2);
+  ~DatasetReader();
+
+  DatasetReader(const DatasetReader&) = delete;
+  DatasetReader& operator=(const DatasetReader&) = delete;
+
+  // The following setters must be called before the first call to Next.
+
+  // Remap both images with maps computed once (see
+  // System::GetRectificationMaps).
+  void SetRectification(const cv::Mat& M1l, const cv::Mat& M2l,
+                        const cv::Mat& M1r, const cv::Mat& M2r);
+  // Resize every image (and depth map) by fScale, as System::GetImageScale
+  void SetScale(float fScale);
+  // Run on every colour/grey image after decoding. It is called concurrently
+  // from the prefetch threads and must be thread safe.
+  void SetPreprocessing(const std::function<void(cv::Mat&)>& preprocess);
+
+  // Returns false at the end of the sequence or if an image failed to load,
+  // in which case GetError describes the failure.
+  bool Next(DatasetFrame& frame);
+
+  size_t Size() const { return mIndex.size(); }
+  const std::string& GetError() const { return mstrError; }
+
+ protected:
+  struct Slot {
+    std::vector<uchar> vBuffer;
+    cv::Mat imDecoded;
+    cv::Mat imRectified;
+    cv::Mat imLeft;
+    cv::Mat imRight;
+    std::future<bool> result;
+    std::string strError;
+  };
+
+  void Schedule(size_t nFrame);
+  bool Decode(size_t nFrame, Slot& slot);
+  bool DecodeImage(const std::string& strPath, bool bLeft, bool bDepth,
+                   Slot& slot, cv::Mat& im);
+
+  const DatasetIndex& mIndex;
+  const int mnImreadFlags;
+  const ePacing mPacing;
+
+  cv::Mat mM1l, mM2l, mM1r, mM2r;
+  bool mbRectify;
+  float mfScale;
+  std::function<void(cv::Mat&)> mPreprocess;
+
+  // Next frame to hand out
+  size_t mnNext;
+  bool mbStarted;
+  std::string mstrError;
+  std::chrono::steady_clock::time_point mtLastDelivery;
+
+  std::vector<Slot> mvSlots;
+
+  // Declared last so that in-flight decodes finish before the slots die
+  std::unique_ptr<ThreadPool> mpPool;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // DATASETREADER_H
@@ -27,16 +27,11 @@
 
 #include<System.h>
 #include<Viewer.h>
+#include<DatasetReader.h>
 #include "ImuTypes.h"
 
 using namespace std;
 
-void LoadImagesTUMVI(const string &strImagePath, const string &strPathTimes,
-                vector<string> &vstrImages, vector<double> &vTimeStamps);
-
-void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps, vector<cv::Point3f> &vAcc, vector<cv::Point3f> &vGyro);
-
-
 double ttrack_tot = 0;
 int main(int argc, char **argv)
 {
@@ -60,49 +55,21 @@ int main(int argc, char **argv)
 
     // Load all sequences:
     int seq;
-    vector< vector<string> > vstrImageFilenames;
-    vector< vector<double> > vTimestampsCam;
-    vector< vector<cv::Point3f> > vAcc, vGyro;
-    vector< vector<double> > vTimestampsImu;
-    vector<int> nImages;
-    vector<int> nImu;
-    vector<int> first_imu(num_seq,0);
-
-    vstrImageFilenames.resize(num_seq);
-    vTimestampsCam.resize(num_seq);
-    vAcc.resize(num_seq);
-    vGyro.resize(num_seq);
-    vTimestampsImu.resize(num_seq);
-    nImages.resize(num_seq);
-    nImu.resize(num_seq);
+    vector<ORB_SLAM3::DatasetIndex> vIndex(num_seq);
 
     int tot_images = 0;
     for (seq = 0; seq<num_seq; seq++)
     {
-        cout << "Loading images for sequence " << seq << "...";
-        LoadImagesTUMVI(string(argv[3*(seq+1)]), string(argv[3*(seq+1)+1]), vstrImageFilenames[seq], vTimestampsCam[seq]);
-        cout << "LOADED!" << endl;
-
-        cout << "Loading IMU for sequence " << seq << "...";
-        LoadIMU(string(argv[3*(seq+1)+2]), vTimestampsImu[seq], vAcc[seq], vGyro[seq]);
-        cout << "LOADED!" << endl;
-
-        nImages[seq] = vstrImageFilenames[seq].size();
-        tot_images += nImages[seq];
-        nImu[seq] = vTimestampsImu[seq].size();
-
-        if((nImages[seq]<=0)||(nImu[seq]<=0))
+        cout << "Loading images and IMU for sequence " << seq << "...";
+        if(!ORB_SLAM3::LoadTumVI(string(argv[3*(seq+1)]), string(), string(argv[3*(seq+1)+1]),
+                                 string(argv[3*(seq+1)+2]), vIndex[seq]))
         {
             cerr << "ERROR: Failed to load images or IMU for sequence" << seq << endl;
             return 1;
         }
+        cout << "LOADED!" << endl;
 
-        // Find first imu to be considered, supposing imu measurements start first
-
-        while(vTimestampsImu[seq][first_imu[seq]]<=vTimestampsCam[seq][0])
-            first_imu[seq]++;
-        first_imu[seq]--; // first imu measurement to be considered
-
+        tot_images += vIndex[seq].size();
     }
 
     // Vector for tracking time statistics
@@ -112,114 +79,61 @@ int main(int argc, char **argv)
     cout << endl << "-------" << endl;
     cout.precision(17);
 
-    /*cout << "Start processing sequence ..." << endl;
-    cout << "Images in the sequence: " << nImages << endl;
-    cout << "IMU data in the sequence: " << nImu << endl << endl;*/
-
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM3::System_ptr SLAM = std::make_shared<ORB_SLAM3::System>(argv[1],argv[2],ORB_SLAM3::CameraType::IMU_MONOCULAR, file_name);
     ORB_SLAM3::Viewer viewer(SLAM, argv[2]);
     float imageScale = SLAM->GetImageScale();
 
+    // Offline mode feeds the frames as fast as the system absorbs them
+    const ORB_SLAM3::DatasetReader::ePacing pacing = SLAM->IsOfflineMode() ?
+        ORB_SLAM3::DatasetReader::AS_FAST_AS_POSSIBLE : ORB_SLAM3::DatasetReader::REAL_TIME;
+
 #ifdef REGISTER_TIMES
-    double t_resize = 0.f;
     double t_track = 0.f;
 #endif
     int proccIm = 0;
     for (seq = 0; seq<num_seq; seq++)
     {
 
-        // Main loop
-        cv::Mat im;
-        vector<ORB_SLAM3::IMU::Point> vImuMeas;
-        proccIm = 0;
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
-        for(int ni=0; ni<nImages[seq]; ni++, proccIm++)
+        // Main loop. CLAHE and resizing run on the prefetch threads, each
+        // with its own CLAHE instance as it keeps internal buffers.
+        ORB_SLAM3::DatasetReader reader(vIndex[seq], cv::IMREAD_GRAYSCALE, pacing);
+        reader.SetPreprocessing([](cv::Mat &im)
         {
-
-            // Read image from file
-            im = cv::imread(vstrImageFilenames[seq][ni],cv::IMREAD_GRAYSCALE); //,cv::IMREAD_GRAYSCALE);
-
-            // clahe
+            thread_local cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
             clahe->apply(im,im);
+        });
+        reader.SetScale(imageScale);
 
-
-            // cout << "mat type: " << im.type() << endl;
-            double tframe = vTimestampsCam[seq][ni];
-
-            if(im.empty())
-            {
-                cerr << endl << "Failed to load image at: "
-                     <<  vstrImageFilenames[seq][ni] << endl;
-                return 1;
-            }
-
-
-            // Load imu measurements from previous frame
-            vImuMeas.clear();
-
-            if(ni>0)
-            {
-                // cout << "t_cam " << tframe << endl;
-
-                while(vTimestampsImu[seq][first_imu[seq]]<=vTimestampsCam[seq][ni])
-                {
-                    vImuMeas.push_back(ORB_SLAM3::IMU::Point(vAcc[seq][first_imu[seq]].x,vAcc[seq][first_imu[seq]].y,vAcc[seq][first_imu[seq]].z,
-                                                             vGyro[seq][first_imu[seq]].x,vGyro[seq][first_imu[seq]].y,vGyro[seq][first_imu[seq]].z,
-                                                             vTimestampsImu[seq][first_imu[seq]]));
-                    // cout << "t_imu = " << fixed << vImuMeas.back().t << endl;
-                    first_imu[seq]++;
-                }
-            }
-
-            if(imageScale != 1.f)
-            {
-#ifdef REGISTER_TIMES
-                std::chrono::steady_clock::time_point t_Start_Resize = std::chrono::steady_clock::now();
-#endif
-                int width = im.cols * imageScale;
-                int height = im.rows * imageScale;
-                cv::resize(im, im, cv::Size(width, height));
-#ifdef REGISTER_TIMES
-                std::chrono::steady_clock::time_point t_End_Resize = std::chrono::steady_clock::now();
-                t_resize = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t_End_Resize - t_Start_Resize).count();
-                SLAM->InsertResizeTime(t_resize);
-#endif
-            }
-
-            // cout << "first imu: " << first_imu[seq] << endl;
-            /*cout << "first imu time: " << fixed << vTimestampsImu[first_imu] << endl;
-            cout << "size vImu: " << vImuMeas.size() << endl;*/
+        proccIm = 0;
+        ORB_SLAM3::DatasetFrame frame;
+        while(reader.Next(frame))
+        {
             std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
             // Pass the image to the SLAM system
-            // cout << "tframe = " << tframe << endl;
-            auto pos = SLAM->TrackMonocular(im,tframe,vImuMeas); // TODO change to monocular_inertial
+            auto pos = SLAM->TrackMonocular(frame.imLeft,frame.timestamp,frame.vImuMeas); // TODO change to monocular_inertial
 
             std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
             viewer.update(pos);
 #ifdef REGISTER_TIMES
-            t_track = t_resize + std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
+            t_track = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
             SLAM->InsertTrackTime(t_track);
 #endif
 
             double ttrack= std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
             ttrack_tot += ttrack;
-            // std::cout << "ttrack: " << ttrack << std::endl;
 
-            vTimesTrack[ni]=ttrack;
-
-            // Wait to load the next frame
-            double T=0;
-            if(ni<nImages[seq]-1)
-                T = vTimestampsCam[seq][ni+1]-tframe;
-            else if(ni>0)
-                T = tframe-vTimestampsCam[seq][ni-1];
-
-            if(ttrack<T)
-                usleep((T-ttrack)*1e6); // 1e6
+            vTimesTrack[frame.nIndex]=ttrack;
+            proccIm++;
+        }
 
+        if(!reader.GetError().empty())
+        {
+            cerr << endl << reader.GetError() << endl;
+            return 1;
         }
+
         if(seq < num_seq - 1)
         {
             cout << "Changing the dataset" << endl;
@@ -229,13 +143,10 @@ int main(int argc, char **argv)
 
     }
 
-    // cout << "ttrack_tot = " << ttrack_tot << std::endl;
     // Stop all threads
     // SLAM.Shutdown();
 
 
-    // Tracking time statistics
-
     // Save camera trajectory
 
     if (bFileName)
@@ -251,86 +162,17 @@ int main(int argc, char **argv)
         SLAM->SaveKeyFrameTrajectoryEuRoC("KeyFrameTrajectory.txt");
     }
 
-    sort(vTimesTrack.begin(),vTimesTrack.end());
+    // Tracking time statistics
+    const int nImages0 = vIndex[0].size();
+    sort(vTimesTrack.begin(),vTimesTrack.begin()+nImages0);
     float totaltime = 0;
-    for(int ni=0; ni<nImages[0]; ni++)
+    for(int ni=0; ni<nImages0; ni++)
     {
         totaltime+=vTimesTrack[ni];
     }
     cout << "-------" << endl << endl;
-    cout << "median tracking time: " << vTimesTrack[nImages[0]/2] << endl;
+    cout << "median tracking time: " << vTimesTrack[nImages0/2] << endl;
     cout << "mean tracking time: " << totaltime/proccIm << endl;
 
-    /*const string kf_file =  "kf_" + ss.str() + ".txt";
-    const string f_file =  "f_" + ss.str() + ".txt";
-
-    SLAM->SaveTrajectoryEuRoC(f_file);
-    SLAM->SaveKeyFrameTrajectoryEuRoC(kf_file);*/
-
     return 0;
 }
-
-void LoadImagesTUMVI(const string &strImagePath, const string &strPathTimes,
-                vector<string> &vstrImages, vector<double> &vTimeStamps)
-{
-    ifstream fTimes;
-    cout << strImagePath << endl;
-    cout << strPathTimes << endl;
-    fTimes.open(strPathTimes.c_str());
-    vTimeStamps.reserve(5000);
-    vstrImages.reserve(5000);
-    while(!fTimes.eof())
-    {
-        string s;
-        getline(fTimes,s);
-
-        if(!s.empty())
-        {
-            if (s[0] == '#')
-                continue;
-
-            int pos = s.find(' ');
-            string item = s.substr(0, pos);
-
-            vstrImages.push_back(strImagePath + "/" + item + ".png");
-            double t = stod(item);
-            vTimeStamps.push_back(t/1e9);
-        }
-    }
-}
-
-void LoadIMU(const string &strImuPath, vector<double> &vTimeStamps, vector<cv::Point3f> &vAcc, vector<cv::Point3f> &vGyro)
-{
-    ifstream fImu;
-    fImu.open(strImuPath.c_str());
-    vTimeStamps.reserve(5000);
-    vAcc.reserve(5000);
-    vGyro.reserve(5000);
-
-    while(!fImu.eof())
-    {
-        string s;
-        getline(fImu,s);
-        if (s[0] == '#')
-            continue;
-
-        if(!s.empty())
-        {
-            string item;
-            size_t pos = 0;
-            double data[7];
-            int count = 0;
-            while ((pos = s.find(',')) != string::npos) {
-                item = s.substr(0, pos);
-                data[count++] = stod(item);
-                s.erase(0, pos + 1);
-            }
-            item = s.substr(0, pos);
-            data[6] = stod(item);
-
-            vTimeStamps.push_back(data[0]/1e9);
-            vAcc.push_back(cv::Point3f(data[4],data[5],data[6]));
-            vGyro.push_back(cv::Point3f(data[1],data[2],data[3]));
-        }
-    }
-}
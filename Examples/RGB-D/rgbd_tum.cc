@@ -25,12 +25,10 @@
 
 #include <System.h>
 #include <Viewer.h>
+#include <DatasetReader.h>
 
 using namespace std;
 
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageFilenamesRGB,
-                vector<string> &vstrImageFilenamesD, vector<double> &vTimestamps);
-
 int main(int argc, char **argv)
 {
     if(argc != 5)
@@ -40,24 +38,13 @@ int main(int argc, char **argv)
     }
 
     // Retrieve paths to images
-    vector<string> vstrImageFilenamesRGB;
-    vector<string> vstrImageFilenamesD;
-    vector<double> vTimestamps;
-    string strAssociationFilename = string(argv[4]);
-    LoadImages(strAssociationFilename, vstrImageFilenamesRGB, vstrImageFilenamesD, vTimestamps);
-
-    // Check consistency in the number of images and depthmaps
-    int nImages = vstrImageFilenamesRGB.size();
-    if(vstrImageFilenamesRGB.empty())
+    ORB_SLAM3::DatasetIndex index;
+    if(!ORB_SLAM3::LoadTumRgbd(string(argv[3]), string(argv[4]), index))
     {
         cerr << endl << "No images found in provided path." << endl;
         return 1;
     }
-    else if(vstrImageFilenamesD.size()!=vstrImageFilenamesRGB.size())
-    {
-        cerr << endl << "Different number of images for rgb and depth." << endl;
-        return 1;
-    }
+    const int nImages = index.size();
 
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM3::System_ptr SLAM = std::make_shared<ORB_SLAM3::System>(argv[1],argv[2],ORB_SLAM3::CameraType::RGBD);
@@ -72,34 +59,21 @@ int main(int argc, char **argv)
     cout << "Start processing sequence ..." << endl;
     cout << "Images in the sequence: " << nImages << endl << endl;
 
-    // Main loop
-    cv::Mat imRGB, imD;
-    for(int ni=0; ni<nImages; ni++)
-    {
-        // Read image and depthmap from file
-        imRGB = cv::imread(string(argv[3])+"/"+vstrImageFilenamesRGB[ni],cv::IMREAD_UNCHANGED); //,cv::IMREAD_UNCHANGED);
-        imD = cv::imread(string(argv[3])+"/"+vstrImageFilenamesD[ni],cv::IMREAD_UNCHANGED); //,cv::IMREAD_UNCHANGED);
-        double tframe = vTimestamps[ni];
-
-        if(imRGB.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(argv[3]) << "/" << vstrImageFilenamesRGB[ni] << endl;
-            return 1;
-        }
-
-        if(imageScale != 1.f)
-        {
-            int width = imRGB.cols * imageScale;
-            int height = imRGB.rows * imageScale;
-            cv::resize(imRGB, imRGB, cv::Size(width, height));
-            cv::resize(imD, imD, cv::Size(width, height));
-        }
+    // Offline mode feeds the frames as fast as the system absorbs them
+    const ORB_SLAM3::DatasetReader::ePacing pacing = SLAM->IsOfflineMode() ?
+        ORB_SLAM3::DatasetReader::AS_FAST_AS_POSSIBLE : ORB_SLAM3::DatasetReader::REAL_TIME;
+
+    // Main loop. Images and depthmaps are decoded and resized ahead of tracking.
+    ORB_SLAM3::DatasetReader reader(index, cv::IMREAD_UNCHANGED, pacing);
+    reader.SetScale(imageScale);
 
+    ORB_SLAM3::DatasetFrame frame;
+    while(reader.Next(frame))
+    {
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
         // Pass the image to the SLAM system
-        auto pos = SLAM->TrackRGBD(imRGB,imD,tframe);
+        auto pos = SLAM->TrackRGBD(frame.imLeft,frame.imRight,frame.timestamp);
 
         std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
 
@@ -107,17 +81,13 @@ int main(int argc, char **argv)
 
         double ttrack= std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
 
-        vTimesTrack[ni]=ttrack;
-
-        // Wait to load the next frame
-        double T=0;
-        if(ni<nImages-1)
-            T = vTimestamps[ni+1]-tframe;
-        else if(ni>0)
-            T = tframe-vTimestamps[ni-1];
+        vTimesTrack[frame.nIndex]=ttrack;
+    }
 
-        if(ttrack<T)
-            usleep((T-ttrack)*1e6);
+    if(!reader.GetError().empty())
+    {
+        cerr << endl << reader.GetError() << endl;
+        return 1;
     }
 
     // Stop all threads
@@ -140,30 +110,3 @@ int main(int argc, char **argv)
 
     return 0;
 }
-
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageFilenamesRGB,
-                vector<string> &vstrImageFilenamesD, vector<double> &vTimestamps)
-{
-    ifstream fAssociation;
-    fAssociation.open(strAssociationFilename.c_str());
-    while(!fAssociation.eof())
-    {
-        string s;
-        getline(fAssociation,s);
-        if(!s.empty())
-        {
-            stringstream ss;
-            ss << s;
-            double t;
-            string sRGB, sD;
-            ss >> t;
-            vTimestamps.push_back(t);
-            ss >> sRGB;
-            vstrImageFilenamesRGB.push_back(sRGB);
-            ss >> t;
-            ss >> sD;
-            vstrImageFilenamesD.push_back(sD);
-
-        }
-    }
-}
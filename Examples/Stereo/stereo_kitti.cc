@@ -26,12 +26,10 @@
 
 #include<System.h>
 #include<Viewer.h>
+#include<DatasetReader.h>
 
 using namespace std;
 
-void LoadImages(const string &strPathToSequence, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimestamps);
-
 int main(int argc, char **argv)
 {
     if(argc != 4)
@@ -41,12 +39,14 @@ int main(int argc, char **argv)
     }
 
     // Retrieve paths to images
-    vector<string> vstrImageLeft;
-    vector<string> vstrImageRight;
-    vector<double> vTimestamps;
-    LoadImages(string(argv[3]), vstrImageLeft, vstrImageRight, vTimestamps);
+    ORB_SLAM3::DatasetIndex index;
+    if(!ORB_SLAM3::LoadKitti(string(argv[3]), true, index))
+    {
+        cerr << endl << "No images found in provided path." << endl;
+        return 1;
+    }
 
-    const int nImages = vstrImageLeft.size();
+    const int nImages = index.size();
 
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM3::System_ptr SLAM = std::make_shared<ORB_SLAM3::System>(argv[1],argv[2],ORB_SLAM3::CameraType::STEREO);
@@ -64,68 +64,42 @@ int main(int argc, char **argv)
 
 #ifdef REGISTER_TIMES
     double t_track = 0.f;
-    double t_resize = 0.f;
 #endif
 
-    // Main loop
-    cv::Mat imLeft, imRight;
-    for(int ni=0; ni<nImages; ni++)
-    {
-        // Read left and right images from file
-        imLeft = cv::imread(vstrImageLeft[ni],cv::IMREAD_UNCHANGED); //,cv::IMREAD_UNCHANGED);
-        imRight = cv::imread(vstrImageRight[ni],cv::IMREAD_UNCHANGED); //,cv::IMREAD_UNCHANGED);
-        double tframe = vTimestamps[ni];
-
-        if(imLeft.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(vstrImageLeft[ni]) << endl;
-            return 1;
-        }
-
-        if(imageScale != 1.f)
-        {
-#ifdef REGISTER_TIMES
-            std::chrono::steady_clock::time_point t_Start_Resize = std::chrono::steady_clock::now();
-#endif
-            int width = imLeft.cols * imageScale;
-            int height = imLeft.rows * imageScale;
-            cv::resize(imLeft, imLeft, cv::Size(width, height));
-            cv::resize(imRight, imRight, cv::Size(width, height));
-#ifdef REGISTER_TIMES
-            std::chrono::steady_clock::time_point t_End_Resize = std::chrono::steady_clock::now();
-            t_resize = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t_End_Resize - t_Start_Resize).count();
-            SLAM->InsertResizeTime(t_resize);
-#endif
-        }
+    // Offline mode feeds the frames as fast as the system absorbs them
+    const ORB_SLAM3::DatasetReader::ePacing pacing = SLAM->IsOfflineMode() ?
+        ORB_SLAM3::DatasetReader::AS_FAST_AS_POSSIBLE : ORB_SLAM3::DatasetReader::REAL_TIME;
 
+    // Main loop. Left and right images are decoded and resized ahead of tracking.
+    ORB_SLAM3::DatasetReader reader(index, cv::IMREAD_UNCHANGED, pacing);
+    reader.SetScale(imageScale);
+
+    ORB_SLAM3::DatasetFrame frame;
+    while(reader.Next(frame))
+    {
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
         // Pass the images to the SLAM system
-        auto pos = SLAM->TrackStereo(imLeft,imRight,tframe);
+        auto pos = SLAM->TrackStereo(frame.imLeft,frame.imRight,frame.timestamp);
 
         std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
 
         viewer.update(pos);
 
 #ifdef REGISTER_TIMES
-        t_track = t_resize + std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
+        t_track = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
         SLAM->InsertTrackTime(t_track);
 #endif
 
         double ttrack= std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
 
-        vTimesTrack[ni]=ttrack;
-
-        // Wait to load the next frame
-        double T=0;
-        if(ni<nImages-1)
-            T = vTimestamps[ni+1]-tframe;
-        else if(ni>0)
-            T = tframe-vTimestamps[ni-1];
+        vTimesTrack[frame.nIndex]=ttrack;
+    }
 
-        if(ttrack<T)
-            usleep((T-ttrack)*1e6);
+    if(!reader.GetError().empty())
+    {
+        cerr << endl << reader.GetError() << endl;
+        return 1;
     }
 
     // Stop all threads
@@ -147,39 +121,3 @@ int main(int argc, char **argv)
 
     return 0;
 }
-
-void LoadImages(const string &strPathToSequence, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimestamps)
-{
-    ifstream fTimes;
-    string strPathTimeFile = strPathToSequence + "/times.txt";
-    fTimes.open(strPathTimeFile.c_str());
-    while(!fTimes.eof())
-    {
-        string s;
-        getline(fTimes,s);
-        if(!s.empty())
-        {
-            stringstream ss;
-            ss << s;
-            double t;
-            ss >> t;
-            vTimestamps.push_back(t);
-        }
-    }
-
-    string strPrefixLeft = strPathToSequence + "/image_0/";
-    string strPrefixRight = strPathToSequence + "/image_1/";
-
-    const int nTimes = vTimestamps.size();
-    vstrImageLeft.resize(nTimes);
-    vstrImageRight.resize(nTimes);
-
-    for(int i=0; i<nTimes; i++)
-    {
-        stringstream ss;
-        ss << setfill('0') << setw(6) << i;
-        vstrImageLeft[i] = strPrefixLeft + ss.str() + ".png";
-        vstrImageRight[i] = strPrefixRight + ss.str() + ".png";
-    }
-}
@@ -23,14 +23,24 @@
 
 #include <boost/serialization/export.hpp>
 #include <boost/serialization/vector.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <string>
+#include <thread>
 
 #include "GeometricCamera.h"
+#include "IdCounter.h"
 #include "KannalaBrandt8.h"
 #include "KeyFrame.h"
 #include "Map.h"
 #include "MapPoint.h"
+#include "MapSection.h"
 #include "Pinhole.h"
 
 namespace ORB_SLAM3 {
@@ -38,6 +48,8 @@ class Map;
 class MapPoint;
 class KeyFrame;
 class KeyFrameDatabase;
+class KeyFrameStore;
+class ThreadPool;
 class Frame;
 class KannalaBrandt8;
 class Pinhole;
@@ -58,15 +70,45 @@ class Atlas {
     // ar & mspMaps;
     ar& mvpBackupMaps;
     ar& mvpCameras;
-    // Need to save/load the static Id from Frame, KeyFrame, MapPoint and Map
-    ar& Map::nNextId;
-    ar& Frame::nNextId;
-    ar& KeyFrame::nNextId;
-    ar& MapPoint::nNextId;
-    ar& GeometricCamera::nNextId;
+    // Need to save/load the Id counters of Frame, KeyFrame, MapPoint and Map
+    serializeIds(ar);
     ar& mnLastInitKFidMap;
   }
 
+  // Everything but the maps, which go in their own sections of the binary
+  // atlas file
+  template <class Archive>
+  void serializeHeader(Archive& ar, const unsigned int version) {
+    ar.template register_type<Pinhole>();
+    ar.template register_type<KannalaBrandt8>();
+
+    ar& mvpCameras;
+    serializeIds(ar);
+    ar& mnLastInitKFidMap;
+  }
+
+  template <class Archive>
+  void serializeIds(Archive& ar) {
+    long unsigned int nNextMapId = mIds.mMapIds.Peek();
+    long unsigned int nNextFrameId = mIds.mFrameIds.Peek();
+    long unsigned int nNextKeyFrameId = mIds.mKeyFrameIds.Peek();
+    long unsigned int nNextMapPointId = mIds.mMapPointIds.Peek();
+    long unsigned int nNextCameraId = GeometricCamera::nNextId.Peek();
+    ar& nNextMapId;
+    ar& nNextFrameId;
+    ar& nNextKeyFrameId;
+    ar& nNextMapPointId;
+    ar& nNextCameraId;
+    if (Archive::is_loading::value) {
+      mIds.mMapIds.Reset(nNextMapId);
+      mIds.mFrameIds.Reset(nNextFrameId);
+      mIds.mKeyFrameIds.Reset(nNextKeyFrameId);
+      mIds.mMapPointIds.Reset(nNextMapPointId);
+      // Other Systems may have created cameras in the meantime
+      GeometricCamera::nNextId.Advance(nNextCameraId);
+    }
+  }
+
  public:
   
 
@@ -79,6 +121,12 @@ class Atlas {
 
   unsigned long int GetLastInitKFid();
 
+  // Frame ids of this System
+  long unsigned int NewFrameId();
+  long unsigned int GetNextFrameId();
+  void ResetFrameAndKeyFrameIds();
+  IdCounters* GetIdCounters();
+
   // Method for change components in the current map
   void AddKeyFrame(KeyFrame* pKF);
   void AddMapPoint(MapPoint* pMP);
@@ -123,13 +171,58 @@ class Atlas {
   void PreSave();
   void PostLoad();
 
+  // Sectioned binary atlas file: a header section followed by the sections
+  // of every map, see MapSection. Map sections are captured in parallel and
+  // streamed in order, without PreSave. Loading must be followed by PostLoad
+  // and only reads the header and the position of the map sections, PostLoad
+  // then restores the maps in the background from strFileName
+  static bool IsSectionedFile(std::istream& is);
+  void SaveSections(std::ostream& os, const std::string& strVocabularyName,
+                    const std::string& strVocabularyChecksum);
+  bool LoadSections(std::istream& is, const std::string& strFileName,
+                    std::string& strVocabularyName,
+                    std::string& strVocabularyChecksum);
+
+  // Atlas log of delta checkpoints, see AtlasLog. Loaded like the sections
+  bool LoadLog(std::istream& is, const std::string& strFileName,
+               std::string& strVocabularyName,
+               std::string& strVocabularyChecksum);
+
+  // Checkpoint of a running session: the sections are captured in memory,
+  // one map at a time under its update mutex, and written later on without
+  // touching the atlas. With bChangedOnly only the sections changed since the
+  // previous checkpoint are kept, and only the maps changed since then (and
+  // the current one) are captured to find them
+  struct Checkpoint {
+    std::string strHeader;
+    // Sections to write, in file order
+    std::vector<std::shared_ptr<const MapSection> > vpSections;
+    // Every section of the atlas, sorted
+    std::vector<MapSection::Key> vSectionKeys;
+    // Every map of the atlas
+    std::vector<unsigned long> vnMapIds;
+  };
+  Checkpoint CaptureCheckpoint(const std::string& strVocabularyName,
+                               const std::string& strVocabularyChecksum,
+                               bool bChangedOnly = false);
+  // Sectioned file of a full checkpoint
+  static void WriteSections(std::ostream& os, const Checkpoint& checkpoint);
+
+  // Blocks until the stored maps of a loaded file are in the atlas, or drops
+  // the ones not restored yet
+  void WaitForPendingMaps(bool bAbort = false);
+
   map<long unsigned int, KeyFrame*> GetAtlasKeyframes();
 
   void SetKeyFrameDababase(KeyFrameDatabase* pKFDB);
   KeyFrameDatabase* GetKeyFrameDatabase();
 
-  void SetORBVocabulary(ORBVocabulary* pORBVoc);
-  ORBVocabulary* GetORBVocabulary();
+  void SetORBVocabulary(const ORBVocabulary* pORBVoc);
+  const ORBVocabulary* GetORBVocabulary();
+
+  // Optional memory budget for the keyframes, not owned by the atlas
+  void SetKeyFrameStore(KeyFrameStore* pKFStore);
+  KeyFrameStore* GetKeyFrameStore();
 
   long unsigned int GetNumLivedKF();
 
@@ -148,9 +241,71 @@ class Atlas {
 
   unsigned long int mnLastInitKFidMap;
 
+  // Id counters of everything that belongs to this System
+  IdCounters mIds;
+
   // Class references for the map reconstruction from the save file
   KeyFrameDatabase* mpKeyFrameDB;
-  ORBVocabulary* mpORBVocabulary;
+  const ORBVocabulary* mpORBVocabulary;
+  KeyFrameStore* mpKeyFrameStore;
+
+  // Non empty maps sorted by id, after waiting for the pending ones
+  std::vector<Map*> GetMapsToSave();
+  std::vector<std::future<std::shared_ptr<const MapSection> > >
+  CaptureSections(ThreadPool& pool, const std::vector<Map*>& vpMaps);
+  std::string SerializeHeader(const std::string& strVocabularyName,
+                              const std::string& strVocabularyChecksum);
+
+  // Stored maps of a sectioned file which are not restored yet
+  struct PendingSection {
+    MapSection::Type type;
+    uint64_t nOffset;
+    uint64_t nSize;
+    // XXH64 of the section, checked by the loader unless bChecked
+    uint64_t nHash;
+    bool bChecked;
+  };
+  struct PendingMap {
+    enum State { PENDING, LOADING, LOADED, FAILED };
+    Map* pMap;
+    unsigned long nMapId;
+    std::vector<PendingSection> vSections;
+    State state;
+  };
+  // Sections of the same map are consecutive
+  static void AddPendingSection(std::vector<PendingMap>& vPendingMaps,
+                                unsigned long nMapId,
+                                const PendingSection& section);
+  // Adds the keyframes of the stored maps to the keyframe database, before
+  // the maps themselves are restored
+  void IndexPendingMaps();
+  // Background restore of the stored maps, in file order
+  void LoadPendingMaps();
+  // Restores a stored map unless it is already, from the background thread
+  // or from a query of the keyframe database. True if it is in the atlas
+  bool RestorePendingMap(Map* pMap, ThreadPool& pool);
+  bool LoadPendingMap(const PendingMap& pendingMap, ThreadPool& pool);
+
+  void SetPendingMaps(const std::string& strHeader,
+                      std::vector<PendingMap>& vPendingMaps,
+                      const std::string& strFileName,
+                      std::string& strVocabularyName,
+                      std::string& strVocabularyChecksum);
+
+  std::string mStrPendingMapsFile;
+  std::vector<PendingMap> mvPendingMaps;
+  std::thread* mptPendingMaps;
+  std::atomic<bool> mbAbortPendingMaps;
+  std::mutex mMutexPendingMaps;
+  std::map<unsigned int, GeometricCamera*> mmPendingCams;
+  // Guards the state of the pending maps
+  std::mutex mMutexPendingStates;
+  std::condition_variable mcvPendingStates;
+
+  // Change stamp of every map and digest of every section at the last
+  // checkpoint
+  std::map<unsigned long, uint64_t> mmCheckpointStamps;
+  std::map<MapSection::Key, uint64_t> mmCheckpointDigests;
 
   // Mutex
   std::mutex mMutexAtlas;
@@ -0,0 +1,92 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ATLASLOG_H
+#define ATLASLOG_H
+
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Atlas.h"
+
+namespace ORB_SLAM3 {
+
+// Append-only atlas file for delta checkpoints. Every checkpoint appends the
+// atlas header, the sections changed since the previous checkpoint and a
+// commit record listing every section of the atlas. The latest committed
+// record of each listed section is its current state. Records after the last
+// commit belong to an interrupted checkpoint and are ignored, then
+// overwritten. The log is compacted by copying the live records to a new
+// file.
+class AtlasLog {
+ public:
+  // Position of a record payload in the file
+  struct Record {
+    uint64_t nMapId;
+    MapSection::Type sectionType;
+    uint64_t nChunk;
+    uint64_t nOffset;
+    uint64_t nSize;
+  };
+
+  struct Index {
+    Record header;
+    // Live map sections, sorted by section key
+    std::vector<Record> vRecords;
+    // Bytes up to the end of the last commit
+    uint64_t nCommittedSize;
+  };
+
+  static bool IsLogFile(std::istream& is);
+  static bool IsLogFile(const std::string& strFilename);
+
+  // Replays the records, checking their checksums. False if the file has no
+  // complete checkpoint
+  static bool ReadIndex(std::istream& is, Index& index);
+
+  explicit AtlasLog(const std::string& strFilename);
+
+  // Full checkpoint, replaces the file
+  bool Write(const Atlas::Checkpoint& checkpoint);
+  // Delta checkpoint, on top of the file written by this object
+  bool Append(const Atlas::Checkpoint& checkpoint);
+  // Rewrites the file with the live records only
+  bool Compact();
+
+  bool IsOpen() const { return mbOpen; }
+  // Bytes of the file which belong to the live records, and the rest
+  uint64_t LiveSize() const;
+  uint64_t GarbageSize() const;
+
+  const std::string& GetFilename() const { return mStrFilename; }
+
+ protected:
+  const std::string mStrFilename;
+  bool mbOpen;
+  Index mIndex;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // ATLASLOG_H
@@ -0,0 +1,133 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAMERAMODELS_CAMERAMODEL_H
+#define CAMERAMODELS_CAMERAMODEL_H
+
+#include <Eigen/Core>
+#include <cmath>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Concrete, copyable projection models. GeometricCamera::Visit hands one of
+// them to a generic lambda, so a loop dispatches on the camera type once and
+// the projection math is inlined in its body. Pinhole and KannalaBrandt8
+// implement their virtual functions with these same models.
+
+// [fx, fy, cx, cy]
+struct PinholeModel {
+  explicit PinholeModel(const std::vector<float>& vParameters)
+      : fx(vParameters[0]),
+        fy(vParameters[1]),
+        cx(vParameters[2]),
+        cy(vParameters[3]) {}
+
+  template <typename T>
+  Eigen::Matrix<T, 2, 1> project(const Eigen::Matrix<T, 3, 1>& v3D) const {
+    const T invz = T(1) / v3D[2];
+    return Eigen::Matrix<T, 2, 1>(fx * v3D[0] * invz + cx,
+                                  fy * v3D[1] * invz + cy);
+  }
+
+  template <typename T>
+  Eigen::Matrix<T, 2, 3> projectJac(const Eigen::Matrix<T, 3, 1>& v3D) const {
+    const T invz = T(1) / v3D[2];
+    Eigen::Matrix<T, 2, 3> Jac;
+    Jac(0, 0) = fx * invz;
+    Jac(0, 1) = T(0);
+    Jac(0, 2) = -fx * v3D[0] * invz * invz;
+    Jac(1, 0) = T(0);
+    Jac(1, 1) = fy * invz;
+    Jac(1, 2) = -fy * v3D[1] * invz * invz;
+    return Jac;
+  }
+
+  float fx, fy, cx, cy;
+};
+
+// [fx, fy, cx, cy, k0, k1, k2, k3]
+struct KannalaBrandt8Model {
+  explicit KannalaBrandt8Model(const std::vector<float>& vParameters)
+      : fx(vParameters[0]),
+        fy(vParameters[1]),
+        cx(vParameters[2]),
+        cy(vParameters[3]),
+        k0(vParameters[4]),
+        k1(vParameters[5]),
+        k2(vParameters[6]),
+        k3(vParameters[7]) {}
+
+  template <typename T>
+  Eigen::Matrix<T, 2, 1> project(const Eigen::Matrix<T, 3, 1>& v3D) const {
+    using std::atan2;
+    using std::sqrt;
+    const T r = sqrt(v3D[0] * v3D[0] + v3D[1] * v3D[1]);
+    const T theta = atan2(r, v3D[2]);
+    const T theta2 = theta * theta;
+    const T theta3 = theta * theta2;
+    const T theta5 = theta3 * theta2;
+    const T theta7 = theta5 * theta2;
+    const T theta9 = theta7 * theta2;
+    const T d = theta + k0 * theta3 + k1 * theta5 + k2 * theta7 + k3 * theta9;
+    // cos(psi) = x / r and sin(psi) = y / r, the optical axis maps to (cx, cy)
+    const T s = r > T(0) ? d / r : T(0);
+    return Eigen::Matrix<T, 2, 1>(fx * s * v3D[0] + cx, fy * s * v3D[1] + cy);
+  }
+
+  template <typename T>
+  Eigen::Matrix<T, 2, 3> projectJac(const Eigen::Matrix<T, 3, 1>& v3D) const {
+    using std::atan2;
+    using std::sqrt;
+    const T x2 = v3D[0] * v3D[0], y2 = v3D[1] * v3D[1], z2 = v3D[2] * v3D[2];
+    const T r2 = x2 + y2;
+    const T r = sqrt(r2);
+    const T r3 = r2 * r;
+    const T theta = atan2(r, v3D[2]);
+
+    const T theta2 = theta * theta, theta4 = theta2 * theta2;
+    const T theta6 = theta2 * theta4, theta8 = theta4 * theta4;
+
+    const T f = theta + k0 * theta2 * theta + k1 * theta4 * theta +
+                k2 * theta6 * theta + k3 * theta8 * theta;
+    const T fd = T(1) + 3 * k0 * theta2 + 5 * k1 * theta4 + 7 * k2 * theta6 +
+                 9 * k3 * theta8;
+
+    const T a = fd * v3D[2] / (r2 * (r2 + z2));
+    const T xy = v3D[0] * v3D[1];
+
+    Eigen::Matrix<T, 2, 3> Jac;
+    Jac(0, 0) = fx * (a * x2 + f * y2 / r3);
+    Jac(1, 0) = fy * (a * xy - f * xy / r3);
+    Jac(0, 1) = fx * (a * xy - f * xy / r3);
+    Jac(1, 1) = fy * (a * y2 + f * x2 / r3);
+    Jac(0, 2) = -fx * fd * v3D[0] / (r2 + z2);
+    Jac(1, 2) = -fy * fd * v3D[1] / (r2 + z2);
+    return Jac;
+  }
+
+  float fx, fy, cx, cy;
+  float k0, k1, k2, k3;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // CAMERAMODELS_CAMERAMODEL_H
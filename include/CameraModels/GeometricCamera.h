@@ -35,8 +35,10 @@
 #include <sophus/se3.hpp>
 #include <vector>
 
+#include "CameraModel.h"
 #include "Converter.h"
 #include "GeometricTools.h"
+#include "IdCounter.h"
 
 namespace ORB_SLAM3 {
 class GeometricCamera {
@@ -65,6 +67,14 @@ class GeometricCamera {
   virtual Eigen::Vector3f unprojectEig(const cv::Point2f& p2D) = 0;
   virtual cv::Point3f unproject(const cv::Point2f& p2D) = 0;
 
+  // Bearings (z = 1) of many keypoints in one pass
+  virtual void unprojectBatch(const std::vector<cv::KeyPoint>& vKeys,
+                              std::vector<Eigen::Vector3f>& vRays) {
+    vRays.resize(vKeys.size());
+    for (size_t i = 0; i < vKeys.size(); i++)
+      vRays[i] = unprojectEig(vKeys[i].pt);
+  }
+
   virtual Eigen::Matrix<double, 2, 3> projectJac(
       const Eigen::Vector3d& v3D) = 0;
 
@@ -84,6 +94,17 @@ class GeometricCamera {
                                  const Eigen::Matrix3f& R12,
                                  const Eigen::Vector3f& t12,
                                  const float sigmaLevel, const float unc) = 0;
+  // Same, with the bearings of both keypoints already computed
+  virtual bool epipolarConstrain(GeometricCamera* otherCamera,
+                                 const cv::KeyPoint& kp1,
+                                 const cv::KeyPoint& kp2,
+                                 const Eigen::Vector3f& r1,
+                                 const Eigen::Vector3f& r2,
+                                 const Eigen::Matrix3f& R12,
+                                 const Eigen::Vector3f& t12,
+                                 const float sigmaLevel, const float unc) {
+    return epipolarConstrain(otherCamera, kp1, kp2, R12, t12, sigmaLevel, unc);
+  }
 
   float getParameter(const int i) { return mvParameters[i]; }
   void setParameter(const float p, const size_t i) { mvParameters[i] = p; }
@@ -101,10 +122,25 @@ class GeometricCamera {
 
   unsigned int GetType() { return mnType; }
 
+  // Calls visitor with the concrete model of this camera (PinholeModel or
+  // KannalaBrandt8Model). Wrap a whole loop in a generic lambda to pay the
+  // dispatch once and let the compiler inline the projection:
+  //   pCamera->Visit([&](const auto& camera) {
+  //     for (...) uv = camera.project(x3Dc);
+  //   });
+  template <typename Visitor>
+  decltype(auto) Visit(Visitor&& visitor) const {
+    if (mnType == CAM_FISHEYE)
+      return visitor(KannalaBrandt8Model(mvParameters));
+    return visitor(PinholeModel(mvParameters));
+  }
+
   const static unsigned int CAM_PINHOLE = 0;
   const static unsigned int CAM_FISHEYE = 1;
 
-  static long unsigned int nNextId;
+  // Shared by all the Systems of the process, camera ids only have to be
+  // unique
+  static IdCounter nNextId;
 
  protected:
   std::vector<float> mvParameters;
@@ -24,6 +24,9 @@
 
 #include <assert.h>
 
+#include <memory>
+#include <mutex>
+
 #include "GeometricCamera.h"
 #include "TwoViewReconstruction.h"
 
@@ -40,7 +43,7 @@ class KannalaBrandt8 : public GeometricCamera {
  public:
   KannalaBrandt8() : precision(1e-6) {
     mvParameters.resize(8);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_FISHEYE;
   }
   KannalaBrandt8(const std::vector<float> _vParameters)
@@ -49,7 +52,7 @@ class KannalaBrandt8 : public GeometricCamera {
         precision(1e-6),
         tvr(nullptr) {
     assert(mvParameters.size() == 8);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_FISHEYE;
   }
 
@@ -58,7 +61,7 @@ class KannalaBrandt8 : public GeometricCamera {
         mvLappingArea(2, 0),
         precision(_precision) {
     assert(mvParameters.size() == 8);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_FISHEYE;
   }
   KannalaBrandt8(KannalaBrandt8* pKannala)
@@ -67,7 +70,7 @@ class KannalaBrandt8 : public GeometricCamera {
         precision(pKannala->precision),
         tvr(nullptr) {
     assert(mvParameters.size() == 8);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_FISHEYE;
   }
 
@@ -80,6 +83,8 @@ class KannalaBrandt8 : public GeometricCamera {
 
   Eigen::Vector3f unprojectEig(const cv::Point2f& p2D);
   cv::Point3f unproject(const cv::Point2f& p2D);
+  void unprojectBatch(const std::vector<cv::KeyPoint>& vKeys,
+                      std::vector<Eigen::Vector3f>& vRays);
 
   Eigen::Matrix<double, 2, 3> projectJac(const Eigen::Vector3d& v3D);
 
@@ -97,11 +102,22 @@ class KannalaBrandt8 : public GeometricCamera {
                          const cv::KeyPoint& kp2, const Eigen::Matrix3f& R12,
                          const Eigen::Vector3f& t12, const float sigmaLevel,
                          const float unc);
+  bool epipolarConstrain(GeometricCamera* pCamera2, const cv::KeyPoint& kp1,
+                         const cv::KeyPoint& kp2, const Eigen::Vector3f& r1,
+                         const Eigen::Vector3f& r2, const Eigen::Matrix3f& R12,
+                         const Eigen::Vector3f& t12, const float sigmaLevel,
+                         const float unc);
 
   float TriangulateMatches(GeometricCamera* pCamera2, const cv::KeyPoint& kp1,
                            const cv::KeyPoint& kp2, const Eigen::Matrix3f& R12,
                            const Eigen::Vector3f& t12, const float sigmaLevel,
                            const float unc, Eigen::Vector3f& p3D);
+  // With the bearings r1 and r2 of kp1 and kp2 already computed
+  float TriangulateMatches(GeometricCamera* pCamera2, const cv::KeyPoint& kp1,
+                           const cv::KeyPoint& kp2, const Eigen::Vector3f& r1,
+                           const Eigen::Vector3f& r2, const Eigen::Matrix3f& R12,
+                           const Eigen::Vector3f& t12, const float sigmaLevel,
+                           const float unc, Eigen::Vector3f& p3D);
 
   std::vector<int> mvLappingArea;
 
@@ -126,6 +142,23 @@ class KannalaBrandt8 : public GeometricCamera {
 
   TwoViewReconstruction* tvr;
 
+  // Undistorted angle theta as a function of the distorted one theta_d,
+  // sampled uniformly in [0, pi/2]. Interpolated and polished with a single
+  // Newton step instead of solving the polynomial for every keypoint
+  struct ThetaTable {
+    std::vector<float> vParameters;
+    std::vector<float> vTheta;
+    float fInvStep;
+  };
+  static const int kThetaTableSize = 1024;
+
+  // Built on first use, and again if the parameters change
+  std::shared_ptr<const ThetaTable> GetThetaTable();
+  inline float UnprojectScale(const ThetaTable& table, float theta_d) const;
+
+  std::shared_ptr<const ThetaTable> mpThetaTable;
+  std::mutex mMutexThetaTable;
+
   void Triangulate(const cv::Point2f& p1, const cv::Point2f& p2,
                    const Eigen::Matrix<float, 3, 4>& Tcw1,
                    const Eigen::Matrix<float, 3, 4>& Tcw2,
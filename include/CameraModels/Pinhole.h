@@ -39,20 +39,20 @@ class Pinhole : public GeometricCamera {
  public:
   Pinhole() {
     mvParameters.resize(4);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_PINHOLE;
   }
   Pinhole(const std::vector<float> _vParameters)
       : GeometricCamera(_vParameters), tvr(nullptr) {
     assert(mvParameters.size() == 4);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_PINHOLE;
   }
 
   Pinhole(Pinhole* pPinhole)
       : GeometricCamera(pPinhole->mvParameters), tvr(nullptr) {
     assert(mvParameters.size() == 4);
-    mnId = nNextId++;
+    mnId = nNextId.Next();
     mnType = CAM_PINHOLE;
   }
 
@@ -82,6 +82,7 @@ class Pinhole : public GeometricCamera {
   cv::Mat toK();
   Eigen::Matrix3f toK_();
 
+  using GeometricCamera::epipolarConstrain;
   bool epipolarConstrain(GeometricCamera* pCamera2, const cv::KeyPoint& kp1,
                          const cv::KeyPoint& kp2, const Eigen::Matrix3f& R12,
                          const Eigen::Vector3f& t12, const float sigmaLevel,
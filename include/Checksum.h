@@ -0,0 +1,72 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+
+#include <streambuf>
+#include <string>
+
+namespace ORB_SLAM3 {
+
+// Streaming XXH64 hash, used to fingerprint the vocabulary and the atlas files
+class Checksum {
+ public:
+  explicit Checksum(uint64_t seed = 0);
+
+  void Update(const void* pData, size_t nLength);
+  uint64_t Digest() const;
+  std::string HexDigest() const;
+
+  // Hash of the first nLength bytes of a file (the whole file if negative),
+  // read in large blocks. Empty if the file can not be read
+  static std::string FileChecksum(const std::string& strFilename,
+                                  long long nLength = -1);
+
+ protected:
+  uint64_t mAcc[4];
+  uint64_t mSeed;
+  uint64_t mnTotalLength;
+  unsigned char mBuffer[32];
+  size_t mnBufferSize;
+};
+
+// Output stream buffer that hashes every byte written before forwarding it
+class ChecksumStreamBuf : public std::streambuf {
+ public:
+  explicit ChecksumStreamBuf(std::streambuf* pSink) : mpSink(pSink) {}
+
+  const Checksum& GetChecksum() const { return mChecksum; }
+
+ protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+  int sync() override;
+
+  std::streambuf* mpSink;
+  Checksum mChecksum;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // CHECKSUM_H
@@ -0,0 +1,85 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DESCRIPTORMEDOID_H
+#define DESCRIPTORMEDOID_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <opencv2/core/core.hpp>
+#include <utility>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+class KeyFrame;
+
+// Set of ORB descriptors observing a map point with their pairwise Hamming
+// distances cached. Adding or removing a descriptor costs O(N) distance
+// computations instead of recomputing the whole N x N matrix.
+class DescriptorMedoid {
+ public:
+  // Keyframe and feature index of an observed descriptor
+  typedef std::pair<KeyFrame*, int> Feature;
+
+  DescriptorMedoid();
+
+  // Synchronise the set with the given features, only the new ones are
+  // compared against the rest
+  void Update(std::vector<Feature> vFeatures);
+
+  // Descriptor with the least median distance to the rest, empty if the set
+  // is empty
+  cv::Mat ComputeMedoid();
+
+  void Clear();
+  size_t Size() const { return mvFeatures.size(); }
+
+ protected:
+  void Insert(const Feature& feature);
+  void Erase(size_t i);
+  // Reallocates to exactly nCapacity descriptors, to grow or to shrink
+  void Reserve(size_t nCapacity);
+
+  // Position of the distance between i and j != i in mvDistances
+  static size_t Pair(size_t i, size_t j) {
+    return i < j ? j * (j - 1) / 2 + i : i * (i - 1) / 2 + j;
+  }
+
+  // ORB descriptors are 256 bits
+  static const int kWords = 4;
+  static const int kBytes = kWords * sizeof(uint64_t);
+
+  std::vector<Feature> mvFeatures;
+  std::vector<uint64_t> mvDescriptors;
+  // Packed triangle of the N (N - 1) / 2 distances, saturated at 255. Row j
+  // holds the distances from j to 0 .. j - 1, so inserting appends a row
+  std::vector<uint8_t> mvDistances;
+  size_t mnCapacity;
+
+  // Medoid of the current set, -1 after a change
+  int mnMedoid;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // DESCRIPTORMEDOID_H
@@ -21,7 +21,8 @@
 
 #pragma once
 
-#include <mutex>
+#include <atomic>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include "ImprovedTypes.hpp"
@@ -31,14 +32,36 @@ namespace ORB_SLAM3 {
 class MapPoint;
 class Viewer;
 
+// Immutable snapshot of the last processed frame. It is built by the tracking
+// thread and shared by every consumer, which never block tracking.
+struct FrameRecord {
+  int nState;
+  bool bOnlyTracking;
+  // Empty when no consumer asked for the image of this frame
+  cv::Mat im, imRight;
+  std::vector<cv::Point2f> vKeys, vKeysRight;
+  // Per key, left keys first: matched to a MapPoint of the map / to a
+  // "visual odometry" MapPoint created in the last frame
+  std::vector<bool> vbMap, vbVO;
+  // Initialization: reference keys and their matches in the current frame
+  std::vector<cv::Point2f> vIniKeys;
+  std::vector<int> vIniMatches;
+};
+
 class FrameDrawer {
  public:
   
   FrameDrawer(const Atlas_ptr &pAtlas);
 
-  // Update info from the last processed frame.
+  // Publish the last processed frame. Called from the tracking thread, the
+  // image is copied only if a consumer requested it since the last update.
   void Update(const Tracking_ptr &pTracker);
 
+  // Latest published record. With bRequestImage the next record will carry
+  // the image.
+  std::shared_ptr<const FrameRecord> GetLastRecord(
+      const bool bRequestImage = false);
+
   // Draw last processed frame.
   cv::Mat DrawFrame(float imageScale = 1.f);
   cv::Mat DrawRightFrame(float imageScale = 1.f);
@@ -47,25 +70,19 @@ class FrameDrawer {
 
  protected:
   bool both;
-  void DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText);
+  cv::Mat DrawRecord(const FrameRecord &record, const bool bRight,
+                     const float imageScale);
+  void DrawTextInfo(cv::Mat &im, int nState, bool bOnlyTracking, int nTracked,
+                    int nTrackedVO, cv::Mat &imText);
 
-  // Info of the frame to be drawn
-  cv::Mat mIm, mImRight;
-  int N;
-  std::vector<cv::KeyPoint> mvCurrentKeys, mvCurrentKeysRight;
-  std::vector<bool> mvbMap, mvbVO;
-  bool mbOnlyTracking;
-  int mnTracked, mnTrackedVO;
-  std::vector<cv::KeyPoint> mvIniKeys;
-  std::vector<int> mvIniMatches;
-  int mState;
-  std::vector<float> mvCurrentDepth;
-  float mThDepth;
+  // Last record with an image, the one drawn
+  std::shared_ptr<const FrameRecord> GetLastImageRecord();
 
   Atlas_ptr mpAtlas;
 
-  std::mutex mMutex;
-  std::vector<std::pair<cv::Point2f, cv::Point2f>> mvTracks;
+  std::shared_ptr<const FrameRecord> mpRecord;
+  std::shared_ptr<const FrameRecord> mpImageRecord;
+  std::atomic<bool> mbImageRequested;
 };
 
 }  // namespace ORB_SLAM3
@@ -0,0 +1,66 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDCOUNTER_H
+#define IDCOUNTER_H
+
+#include <atomic>
+
+namespace ORB_SLAM3 {
+
+// Thread-safe source of consecutive ids
+class IdCounter {
+ public:
+  IdCounter() : mnNextId(0) {}
+
+  long unsigned int Next() {
+    return mnNextId.fetch_add(1, std::memory_order_relaxed);
+  }
+  long unsigned int Peek() const {
+    return mnNextId.load(std::memory_order_relaxed);
+  }
+  void Reset(long unsigned int nNextId = 0) {
+    mnNextId.store(nNextId, std::memory_order_relaxed);
+  }
+  // Makes sure that ids below nId are never handed out again
+  void Advance(long unsigned int nId) {
+    long unsigned int nCur = Peek();
+    while (nCur < nId && !mnNextId.compare_exchange_weak(nCur, nId)) {
+    }
+  }
+
+ protected:
+  std::atomic<long unsigned int> mnNextId;
+};
+
+// Id counters owned by the Atlas of a System. Every object of a System takes
+// its id from here, so several Systems in the same process number their
+// frames, keyframes, points and maps independently.
+struct IdCounters {
+  IdCounter mMapIds;
+  IdCounter mFrameIds;
+  IdCounter mKeyFrameIds;
+  IdCounter mMapPointIds;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // IDCOUNTER_H
@@ -183,8 +183,16 @@ class Preintegrated {
   ~Preintegrated() {}
   void CopyFrom(Preintegrated *pImuPre);
   void Initialize(const Bias &b_);
+  // Also resets the noise, to recycle the object for a new preintegration
+  void Initialize(const Bias &b_, const Calib &calib);
   void IntegrateNewMeasurement(const Eigen::Vector3f &acceleration,
                                const Eigen::Vector3f &angVel, const float &dt);
+  // Integrates the same measurement into two preintegrations, computing the
+  // rotation increment once when both have the same gyro bias
+  static void IntegrateNewMeasurement(const Eigen::Vector3f &acceleration,
+                                      const Eigen::Vector3f &angVel,
+                                      const float &dt, Preintegrated *pFirst,
+                                      Preintegrated *pSecond);
   void Reintegrate();
   void MergePrevious(Preintegrated *pPrev);
   void SetNewBias(const Bias &bu_);
@@ -254,6 +262,10 @@ class Preintegrated {
 
   std::vector<integrable> mvMeasurements;
 
+  void Integrate(const Eigen::Vector3f &acceleration,
+                 const Eigen::Vector3f &angVel, const float &dt,
+                 const IntegratedRotation &dRi);
+
   std::mutex mMutex;
 };
 
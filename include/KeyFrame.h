@@ -25,6 +25,8 @@
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/type_traits/has_new_operator.hpp>
+#include <atomic>
 #include <mutex>
 
 #include "DBoW2/BowVector.h"
@@ -37,6 +39,7 @@
 #include "ORBVocabulary.h"
 #include "ORBextractor.h"
 #include "SerializationUtils.h"
+#include "SlotMap.h"
 
 namespace ORB_SLAM3 {
 
@@ -44,14 +47,18 @@ class Map;
 class MapPoint;
 class Frame;
 class KeyFrameDatabase;
+class KeyFrameStore;
 
 class GeometricCamera;
 
 class KeyFrame {
   friend class boost::serialization::access;
+  friend class MapSection;
 
   template <class Archive>
   void serialize(Archive& ar, const unsigned int version) {
+    // Spilled data is loaded back only while this keyframe is saved
+    ScopedSavePin pin(this);
     ar& mnId;
     ar& const_cast<long unsigned int&>(mnFrameId);
     ar& const_cast<double&>(mTimeStamp);
@@ -69,18 +76,6 @@ class KeyFrame {
     // ar & mnBAFixedForKF;
     // ar & mnNumberOfOpt;
     // Variables used by KeyFrameDatabase
-    // ar & mnLoopQuery;
-    // ar & mnLoopWords;
-    // ar & mLoopScore;
-    // ar & mnRelocQuery;
-    // ar & mnRelocWords;
-    // ar & mRelocScore;
-    // ar & mnMergeQuery;
-    // ar & mnMergeWords;
-    // ar & mMergeScore;
-    // ar & mnPlaceRecognitionQuery;
-    // ar & mnPlaceRecognitionWords;
-    // ar & mPlaceRecognitionScore;
     // ar & mbCurrentPlaceRecognition;
     // Variables of loop closing
     // serializeMatrix(ar,mTcwGBA,version);
@@ -193,6 +188,10 @@ class KeyFrame {
   KeyFrame();
   KeyFrame(Frame& F, Map* pMap, KeyFrameDatabase* pKFDB);
 
+  // Keyframes are allocated from a pool
+  static void* operator new(std::size_t nSize);
+  static void operator delete(void* p);
+
   // Pose functions
   void SetPose(const Sophus::SE3f& Tcw);
   void SetVelocity(const Eigen::Vector3f& Vw_);
@@ -212,13 +211,17 @@ class KeyFrame {
 
   // Bag of Words Representation
   void ComputeBoW();
+  void ComputeBearings();
 
   // Covisibility graph functions
   void AddConnection(KeyFrame* pKF, const int& weight);
   void EraseConnection(KeyFrame* pKF);
 
-  void UpdateConnections(bool upParent = true);
+  void UpdateConnections();
   void UpdateBestCovisibles();
+  // Number of map point matches of this keyframe that pKF also observes,
+  // maintained by the map points as observations are added and erased
+  void AddCovisibility(KeyFrame* pKF, int n);
   std::set<KeyFrame*> GetConnectedKeyFrames();
   std::vector<KeyFrame*> GetVectorCovisibleKeyFrames();
   std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int& N);
@@ -253,10 +256,38 @@ class KeyFrame {
   int TrackedMapPoints(const int& minObs);
   MapPoint* GetMapPoint(const size_t& idx);
 
-  // KeyPoint functions
+  // KeyPoint functions. The grid must be pinned
   std::vector<size_t> GetFeaturesInArea(const float& x, const float& y,
                                         const float& r,
                                         const bool bRight = false) const;
+
+  // Keep the descriptors, grids and feature vector in memory while they are
+  // read, loading them back if a KeyFrameStore spilled them to disk. Pin
+  // returns whether they were spilled, and Unpin can spill them again
+  bool Pin();
+  void Unpin(bool bRespill = false);
+
+  class ScopedPin {
+   public:
+    explicit ScopedPin(KeyFrame* pKF) : mpKF(pKF) { mpKF->Pin(); }
+    ~ScopedPin() { mpKF->Unpin(); }
+
+   private:
+    KeyFrame* mpKF;
+  };
+
+  // For saving the atlas, keyframes that were spilled are spilled again once
+  // written, so a save never holds more than one of them in memory
+  class ScopedSavePin {
+   public:
+    explicit ScopedSavePin(KeyFrame* pKF)
+        : mpKF(pKF), mbSpilled(pKF->Pin()) {}
+    ~ScopedSavePin() { mpKF->Unpin(mbSpilled); }
+
+   private:
+    KeyFrame* mpKF;
+    const bool mbSpilled;
+  };
   bool UnprojectStereo(int i, Eigen::Vector3f& x3D);
 
   // Image
@@ -282,6 +313,9 @@ class KeyFrame {
   Map* GetMap();
   void UpdateMap(Map* pMap);
 
+  // Lists the keyframe in the dirty lists of its map, see Map::SetDirtyTracking
+  void MarkDirty();
+
   void SetNewBias(const IMU::Bias& b);
   Eigen::Vector3f GetGyroBias();
 
@@ -293,13 +327,13 @@ class KeyFrame {
   bool ProjectPointUnDistort(MapPoint* pMP, cv::Point2f& kp, float& u,
                              float& v);
 
-  void PreSave(set<KeyFrame*>& spKF, set<MapPoint*>& spMP,
+  void PreSave(const SlotMap<KeyFrame>& spKF, const SlotMap<MapPoint>& spMP,
                set<GeometricCamera*>& spCam);
   void PostLoad(map<long unsigned int, KeyFrame*>& mpKFid,
                 map<long unsigned int, MapPoint*>& mpMPid,
                 map<unsigned int, GeometricCamera*>& mpCamId);
 
-  void SetORBVocabulary(ORBVocabulary* pORBVoc);
+  void SetORBVocabulary(const ORBVocabulary* pORBVoc);
   void SetKeyFrameDatabase(KeyFrameDatabase* pKFDB);
 
   bool bImu;
@@ -307,7 +341,6 @@ class KeyFrame {
   // The following variables are accesed from only 1 thread or never change (no
   // mutex needed).
  public:
-  static long unsigned int nNextId;
   long unsigned int mnId;
   const long unsigned int mnFrameId;
 
@@ -331,19 +364,6 @@ class KeyFrame {
   long unsigned int mnNumberOfOpt;
 
   // Variables used by the keyframe database
-  long unsigned int mnLoopQuery;
-  int mnLoopWords;
-  float mLoopScore;
-  long unsigned int mnRelocQuery;
-  int mnRelocWords;
-  float mRelocScore;
-  long unsigned int mnMergeQuery;
-  int mnMergeWords;
-  float mMergeScore;
-  long unsigned int mnPlaceRecognitionQuery;
-  int mnPlaceRecognitionWords;
-  float mPlaceRecognitionScore;
-
   bool mbCurrentPlaceRecognition;
 
   // Variables used by loop closing
@@ -380,7 +400,10 @@ class KeyFrame {
   const std::vector<cv::KeyPoint> mvKeysUn;
   const std::vector<float> mvuRight;  // negative value for monocular points
   const std::vector<float> mvDepth;   // negative value for monocular points
-  const cv::Mat mDescriptors;
+  // Bearings (z = 1) of the keypoints, for the triangulation
+  std::vector<Eigen::Vector3f> mvBearings;
+  // Can be released while the keyframe is not pinned
+  cv::Mat mDescriptors;
 
   // BoW
   DBoW2::BowVector mBowVec;
@@ -451,12 +474,15 @@ class KeyFrame {
 
   // BoW
   KeyFrameDatabase* mpKeyFrameDB;
-  ORBVocabulary* mpORBvocabulary;
+  const ORBVocabulary* mpORBvocabulary;
 
   // Grid over the image to speed up feature matching
   std::vector<std::vector<std::vector<size_t> > > mGrid;
 
   std::map<KeyFrame*, int> mConnectedKeyFrameWeights;
+  // Shared map points with every other keyframe, kept up to date. The
+  // connections above are taken from it in UpdateConnections
+  std::map<KeyFrame*, int> mCovisibilityCounts;
   std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
   std::vector<int> mvOrderedWeights;
   // For save relation without pointer, this is necessary for save/load function
@@ -499,6 +525,20 @@ class KeyFrame {
   std::mutex mMutexConnections;
   std::mutex mMutexFeatures;
   std::mutex mMutexMap;
+  std::mutex mMutexCovisibility;
+
+  // Residency of the spillable data
+  friend class KeyFrameStore;
+  KeyFrameStore* mpKeyFrameStore = nullptr;
+  int mnPins = 0;
+  bool mbSpilled = false;
+  bool mbSpillFileWritten = false;
+  std::atomic<unsigned long> mnLastUse{0};
+  std::mutex mMutexResidency;
+
+  // Dirty bits of the Map consumers, all set until added to a map
+  friend class Map;
+  std::atomic<unsigned char> mnDirty{0xFF};
 
  public:
   GeometricCamera *mpCamera, *mpCamera2;
@@ -541,4 +581,12 @@ class KeyFrame {
 
 }  // namespace ORB_SLAM3
 
+namespace boost {
+// Keyframes loaded from a file are created with the global operator new,
+// because boost releases them with the global operator delete on errors. The
+// pool gives that memory back to the global allocator.
+template <>
+struct has_new_operator<ORB_SLAM3::KeyFrame> : public false_type {};
+}  // namespace boost
+
 #endif  // KEYFRAME_H
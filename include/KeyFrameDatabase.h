@@ -25,9 +25,12 @@
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/list.hpp>
 #include <boost/serialization/vector.hpp>
+#include <functional>
 #include <list>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "Frame.h"
@@ -52,20 +55,40 @@ class KeyFrameDatabase {
  public:
   
 
-  KeyFrameDatabase() {}
+  KeyFrameDatabase() : mpVoc(NULL), mnPostings(0), mnDeadPostings(0) {}
   KeyFrameDatabase(const ORBVocabulary& voc);
+  // Database that can be shared by several Systems, it keeps the vocabulary
+  // alive. Every System only finds its own keyframes, except for the cross
+  // session queries
+  KeyFrameDatabase(const ORBVocabulary_ptr& pVoc);
+
+  const ORBVocabulary_ptr& GetSharedVocabulary() const { return mpSharedVoc; }
 
   void add(KeyFrame* pKF);
 
   void erase(KeyFrame* pKF);
 
+  // Keyframes of a stored map that is not restored yet, known only by their
+  // BoW vectors. A query that scores one of them restores the whole map with
+  // fRestore and runs again, so they are found as soon as they are indexed
+  void addPending(Map* pMap, const std::vector<DBoW2::BowVector>& vBowVecs,
+                  const std::function<void(Map*)>& fRestore);
+  // Publishes the keyframes of a restored map in place of its pending
+  // entries, in one step. Without keyframes the entries are only dropped
+  void replacePending(Map* pMap, const std::vector<KeyFrame*>& vpKFs);
+
   void clear();
   void clearMap(Map* pMap);
+  // Remove the keyframes of one System, identified by the id counters of its
+  // Atlas
+  void clearSession(const IdCounters* pSession);
 
   // Loop Detection(DEPRECATED)
   std::vector<KeyFrame*> DetectLoopCandidates(KeyFrame* pKF, float minScore);
 
-  // Loop and Merge Detection
+  // Loop and Merge Detection. Queries do not modify the keyframes, so they can
+  // run concurrently with each other. A stored map hit by a query is restored
+  // before the query returns
   void DetectCandidates(KeyFrame* pKF, float minScore,
                         vector<KeyFrame*>& vpLoopCand,
                         vector<KeyFrame*>& vpMergeCand);
@@ -78,22 +101,92 @@ class KeyFrameDatabase {
   // Relocalization
   std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F, Map* pMap);
 
+  // Place recognition against the keyframes of the other Systems sharing the
+  // database. Their stored maps are not restored
+  std::vector<KeyFrame*> DetectOtherSessionCandidates(KeyFrame* pKF,
+                                                      float minScore);
+
   void PreSave();
   void PostLoad(map<long unsigned int, KeyFrame*> mpKFid);
-  void SetORBVocabulary(ORBVocabulary* pORBVoc);
+  void SetORBVocabulary(const ORBVocabulary* pORBVoc);
 
  protected:
+  // Entry of the inverted file: compact slot of the keyframe and the weight of
+  // the word in its BoW vector
+  struct Posting {
+    unsigned int mnSlot;
+    float mWeight;
+  };
+
+  // Assign or look up the compact slot of a keyframe (mMutex must be held)
+  unsigned int AddSlot(KeyFrame* pKF);
+  unsigned int AddPendingSlot(Map* pMap);
+  void AddPostings(KeyFrame* pKF);
+  // Tombstone the slot of a keyframe, its postings are purged on compaction
+  void EraseSlot(unsigned int nSlot, KeyFrame* pKF);
+  void ErasePendingSlots(Map* pMap);
+  // Restores the pending maps hit by a query (mMutex must not be held).
+  // True if there were any, then the query must run again
+  bool RestorePendingHits(const std::set<Map*>& spPendingHits);
+  // Purge the postings of erased keyframes from the dirty words
+  void Compact();
+
+  // Query engine (mMutex must be held, at least shared). Every keyframe of
+  // pSession (all of them if NULL) sharing words with the query is assigned a
+  // group by fGroup (negative to discard), and the pending keyframes to
+  // nPendingGroup.
+  // Returns, per group, the covisibility accumulated score of every candidate
+  // with enough common words and a score over minScore, paired with the best
+  // scored keyframe of its covisibility group. Pending keyframes that would
+  // be candidates return their map in spPendingHits instead
+  void QueryAccScores(
+      const DBoW2::BowVector& vBowVec, const IdCounters* pSession,
+      const std::function<int(KeyFrame*)>& fGroup, const int nPendingGroup,
+      const int nGroups, const int nMinWords, const float minScore,
+      std::set<Map*>& spPendingHits,
+      std::vector<std::vector<std::pair<float, KeyFrame*> > >&
+          vvAccScoreAndMatch);
+  // Keyframes whose accumulated score is over 0.75 of the best one
+  static void RetainBestAccScores(
+      const std::vector<std::pair<float, KeyFrame*> >& vAccScoreAndMatch,
+      float bestAccScore, std::vector<KeyFrame*>& vpCandidates);
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
-
-  // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  ORBVocabulary_ptr mpSharedVoc;
+
+  // Inverted file, one contiguous posting array per word
+  std::vector<std::vector<Posting> > mvInvertedFile;
+
+  // Keyframe of every slot, NULL for erased keyframes, and the System it
+  // belongs to
+  std::vector<KeyFrame*> mvpSlotKeyFrames;
+  std::vector<const IdCounters*> mvpSlotSessions;
+  // Map of the slots of pending keyframes, NULL for the other ones
+  std::vector<Map*> mvpSlotPendingMaps;
+  struct PendingMap {
+    std::function<void(Map*)> fRestore;
+    std::vector<unsigned int> vnSlots;
+    // Words of the postings of the slots
+    std::vector<unsigned int> vnWords;
+  };
+  std::unordered_map<Map*, PendingMap> mmPendingMaps;
+  std::unordered_map<KeyFrame*, unsigned int> mmKeyFrameSlots;
+  // Slots that can be reused once their postings have been purged
+  std::vector<unsigned int> mvnFreeSlots;
+  std::vector<unsigned int> mvnPendingSlots;
+
+  // Words holding postings of erased keyframes
+  std::vector<unsigned int> mvnDirtyWords;
+  std::vector<bool> mvbDirtyWord;
+  size_t mnPostings;
+  size_t mnDeadPostings;
 
   // For save relation without pointer, this is necessary for save/load function
   std::vector<list<long unsigned int> > mvBackupInvertedFileId;
 
-  // Mutex
-  std::mutex mMutex;
+  // Mutex, shared by the queries
+  std::shared_mutex mMutex;
 };
 
 }  // namespace ORB_SLAM3
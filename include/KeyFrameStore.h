@@ -0,0 +1,80 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEYFRAMESTORE_H
+#define KEYFRAMESTORE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+class KeyFrame;
+
+// Memory budget for the keyframes of the atlas. When the feature data that is
+// only needed for matching (descriptors, grids and feature vector) exceeds the
+// budget, the least recently used keyframes are spilled to disk. Poses,
+// keypoints, BoW vectors and covisibility stay in memory, so the keyframe
+// database and the optimisations never page anything in. Matching functions
+// pin the keyframes they read, which loads them back on demand.
+class KeyFrameStore {
+ public:
+  KeyFrameStore(const std::string& strDirectory, size_t nBudgetBytes);
+  ~KeyFrameStore();
+
+  void AddKeyFrame(KeyFrame* pKF);
+
+  // Spill cold keyframes until the resident data fits in the budget
+  void Enforce();
+
+  unsigned long NextStamp() { return ++mnStamp; }
+
+  size_t ResidentBytes() const { return mnResidentBytes; }
+
+ protected:
+  friend class KeyFrame;
+
+  // Both are called with the residency mutex of the keyframe locked
+  void Spill(KeyFrame* pKF);
+  // Returns false if the spill file could not be read. The keyframe is then
+  // left without matching data, so matching skips it instead of failing
+  bool Restore(KeyFrame* pKF);
+
+  static size_t SpillableBytes(KeyFrame* pKF);
+  std::string FileName(KeyFrame* pKF) const;
+
+  const std::string mStrDirectory;
+  // Unique per store, the directory may be shared by several Systems
+  const std::string mStrPrefix;
+  const size_t mnBudgetBytes;
+
+  std::mutex mMutexStore;
+  std::vector<KeyFrame*> mvpKeyFrames;
+
+  std::atomic<size_t> mnResidentBytes;
+  std::atomic<unsigned long> mnStamp;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // KEYFRAMESTORE_H
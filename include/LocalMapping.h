@@ -21,7 +21,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #include "ImprovedTypes.hpp"
 #include "Atlas.h"
@@ -29,6 +32,7 @@
 #include "KeyFrameDatabase.h"
 #include "LoopClosing.h"
 #include "Settings.h"
+#include "StageTimes.h"
 #include "Tracking.h"
 
 namespace ORB_SLAM3 {
@@ -42,7 +46,8 @@ class LocalMapping {
  public:
   
   LocalMapping(System* pSys, const Atlas_ptr &pAtlas, const float bMonocular,
-               bool bInertial, const string& _strSeqName = std::string());
+               bool bInertial, const float thImuReintegration = 0.01f,
+               const string& _strSeqName = std::string());
 
   void SetLoopCloser(LoopClosing* pLoopCloser);
 
@@ -64,6 +69,9 @@ class LocalMapping {
   bool stopRequested();
   bool AcceptKeyFrames();
   void SetAcceptKeyFrames(bool flag);
+  // No keyframe queued or being processed and no IMU initialisation BA
+  // running. Only meaningful while tracking does not insert keyframes.
+  bool IsIdle();
   bool SetNotStop(bool flag);
 
   void InterruptBA();
@@ -110,6 +118,12 @@ class LocalMapping {
   bool mbFarPoints;
   float mThFarPoints;
 
+  // Gyro bias change that triggers the reintegration of a preintegration
+  const float mThImuReintegration;
+
+  // Time spent on each keyframe ("local_mapping") and in local BA
+  StageTimes mStageTimes;
+
 #ifdef REGISTER_TIMES
   vector<double> vdKFInsert_ms;
   vector<double> vdMPCulling_ms;
@@ -165,6 +179,7 @@ class LocalMapping {
   std::list<MapPoint*> mlpRecentAddedMapPoints;
 
   std::mutex mMutexNewKFs;
+  std::condition_variable mcvNewKFs;
 
   bool mbAbortBA;
 
@@ -174,12 +189,36 @@ class LocalMapping {
   std::mutex mMutexStop;
 
   bool mbAcceptKeyFrames;
+  bool mbIdle;
   std::mutex mMutexAccept;
+  void SetIdle(bool flag);
 
   void InitializeIMU(float priorG = 1e2, float priorA = 1e6,
                      bool bFirst = false);
   void ScaleRefinement();
 
+  // The full inertial BA that ends each IMU initialisation stage runs in its
+  // own thread, on the map as it was when the stage started. Local mapping
+  // keeps processing keyframes meanwhile and merges the result, like a global
+  // BA, once it is ready. Only then the stage is marked done in the map, so
+  // loop closing does not treat the map as initialised before (a discarded
+  // result runs the stage again)
+  void RunImuInitBA(Map* pMap, unsigned long nGBAid, float priorG,
+                    float priorA);
+  void MergeImuInitBA();
+  void AbortImuInitBA();
+  bool isRunningImuInitBA() { return mptImuInitBA != nullptr; }
+
+  std::thread* mptImuInitBA;
+  Map* mpImuInitBAMap;
+  unsigned long mnImuInitBAid;
+  int mnImuInitBABigChangeIdx;
+  // IMU initialisation stage of the running BA: 0 for the first one, then
+  // VIBA 1 and 2
+  int mnImuInitBAStage;
+  std::atomic<bool> mbAbortImuInitBA;
+  std::atomic<bool> mbImuInitBAFinished;
+
   bool bInitializing;
 
   Eigen::MatrixXd infoInertial;
@@ -27,8 +27,12 @@
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "StageTimes.h"
 
 #include <boost/algorithm/string.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include "g2o/types/types_seven_dof_expmap.h"
@@ -40,6 +44,7 @@ class Tracking;
 class LocalMapping;
 class KeyFrameDatabase;
 class Map;
+class ThreadPool;
 
 
 class LoopClosing
@@ -52,7 +57,9 @@ public:
 
 public:
 
-    LoopClosing(const Atlas_ptr &pAtlas, KeyFrameDatabase* pDB, ORBVocabulary* pVoc,const bool bFixScale, const bool bActiveLC);
+    LoopClosing(const Atlas_ptr &pAtlas, KeyFrameDatabase* pDB, const ORBVocabulary* pVoc,const bool bFixScale, const bool bActiveLC,
+                const float thImuReintegration = 0.01f);
+    ~LoopClosing();
 
     void SetTracker(Tracking* pTracker);
 
@@ -78,10 +85,20 @@ public:
         return mbFinishedGBA;
     }
 
+    // No keyframe queued or being processed and no global BA running
+    bool IsIdle();
+
     void RequestFinish();
 
     bool isFinished();
 
+    // Gyro bias change that triggers the reintegration of a preintegration
+    const float mThImuReintegration;
+
+    // Time spent in place recognition, loop correction, map merging and
+    // global BA
+    StageTimes mStageTimes;
+
 #ifdef REGISTER_TIMES
 
     vector<double> vdDataQuery_ms;
@@ -127,6 +144,19 @@ protected:
                                      int &nNumCoincidences, std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
     bool DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
                                             std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
+
+    // Geometric verification of a single BoW candidate (runs on the candidate pool)
+    struct BoWCandidateResult
+    {
+        int nNumProjOptMatches = 0;
+        int nNumCoincidences = 0;
+        KeyFrame* pMatchedKF = nullptr;
+        g2o::Sim3 g2oScw;
+        std::vector<MapPoint*> vpMapPoints;
+        std::vector<MapPoint*> vpMatchedMapPoints;
+    };
+    bool VerifyBoWCandidate(KeyFrame* pKFi, const size_t nIndex, const set<KeyFrame*> &spConnectedKeyFrames,
+                            const bool bFixedScale, std::atomic<size_t> &nFirstSuccess, BoWCandidateResult &result);
     int FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatchedKFw, g2o::Sim3 &g2oScw,
                                 set<MapPoint*> &spMatchedMPinOrigin, vector<MapPoint*> &vpMapPoints,
                                 vector<MapPoint*> &vpMatchedMapPoints);
@@ -158,13 +188,15 @@ protected:
     Tracking* mpTracker;
 
     KeyFrameDatabase* mpKeyFrameDB;
-    ORBVocabulary* mpORBVocabulary;
+    const ORBVocabulary* mpORBVocabulary;
 
     LocalMapping *mpLocalMapper;
 
     std::list<KeyFrame*> mlpLoopKeyFrameQueue;
 
     std::mutex mMutexLoopQueue;
+    std::condition_variable mcvLoopQueue;
+    std::atomic<bool> mbProcessingKF;
 
     // Loop detector parameters
     float mnCovisibilityConsistencyTh;
@@ -214,6 +246,10 @@ protected:
     bool mbStopGBA;
     std::mutex mMutexGBA;
     std::thread* mpThreadGBA;
+    // Global BA threads still alive, they are detached when aborted so the
+    // finish handshake waits on this count instead of joining them
+    int mnGBAThreads;
+    std::condition_variable mcvGBAThreads;
 
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
@@ -236,6 +272,11 @@ protected:
     // To (de)activate LC
     bool mbActiveLC = true;
 
+    // Number of loop/merge candidates retrieved from the KeyFrameDatabase per KF,
+    // verified concurrently in the candidate pool (only created if LC is active)
+    const int mnNumBoWCandidates = 3;
+    std::unique_ptr<ThreadPool> mpBoWCandidatePool;
+
 #ifdef REGISTER_LOOP
     string mstrFolderLoop;
 #endif
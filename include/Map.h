@@ -22,10 +22,14 @@
 
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "SlotMap.h"
+#include "IdCounter.h"
 
+#include <atomic>
 #include <set>
 #include <pangolin/pangolin.h>
 #include <mutex>
+#include <vector>
 
 #include <boost/serialization/base_object.hpp>
 
@@ -41,6 +45,7 @@ class KeyFrameDatabase;
 class Map
 {
     friend class boost::serialization::access;
+    friend class MapSection;
 
     template<class Archive>
     void serialize(Archive &ar, const unsigned int version)
@@ -70,7 +75,7 @@ class Map
 public:
     
     Map();
-    Map(int initKFid);
+    Map(int initKFid, IdCounters* pIds);
     ~Map();
 
     void AddKeyFrame(KeyFrame* pKF);
@@ -90,6 +95,14 @@ public:
 
     long unsigned int GetId();
 
+    // Ids for new KeyFrames and MapPoints of this map, taken from the counters
+    // of the Atlas
+    void SetIdCounters(IdCounters* pIds);
+    // Shared by all the maps of an Atlas, it identifies the System
+    IdCounters* GetIdCounters();
+    long unsigned int NewKeyFrameId();
+    long unsigned int NewMapPointId();
+
     long unsigned int GetInitKFid();
     void SetInitKFid(long unsigned int initKFif);
     long unsigned int GetMaxKFid();
@@ -109,6 +122,30 @@ public:
 
     int GetMapChangeIndex();
     void IncreaseChangeIndex();
+    // Counts insertions and removals of KeyFrames and MapPoints. Positions are
+    // covered by the map change index.
+    long unsigned int GetStructureChangeIndex();
+
+    // KeyFrames and MapPoints of the map modified since a consumer last took
+    // them: poses, positions and KeyFrame connections. Each consumer has its
+    // own dirty bit on the objects, so an object is listed at most once until
+    // it is taken. Nothing is recorded until a consumer enables it.
+    enum DirtyConsumer {
+        DIRTY_VIEWER = 0,
+        DIRTY_ATLAS_LOG,
+        NUM_DIRTY_CONSUMERS
+    };
+    void SetDirtyTracking(DirtyConsumer consumer, bool bEnable);
+    unsigned char GetDirtyMask();
+    void AddDirty(KeyFrame* pKF, unsigned char nBits);
+    void AddDirty(MapPoint* pMP, unsigned char nBits);
+    // The taken objects can be modified again (and listed again) right away,
+    // their state has to be read after these calls
+    void TakeDirtyKeyFrames(DirtyConsumer consumer,
+                            std::vector<KeyFrame*> &vpKFs);
+    void TakeDirtyMapPoints(DirtyConsumer consumer,
+                            std::vector<MapPoint*> &vpMPs);
+
     int GetLastMapChange();
     void SetLastMapChange(int currentChangeId);
 
@@ -131,7 +168,7 @@ public:
     unsigned int GetLowerKFID();
 
     void PreSave(std::set<GeometricCamera*> &spCams);
-    void PostLoad(KeyFrameDatabase* pKFDB, ORBVocabulary* pORBVoc/*, map<long unsigned int, KeyFrame*>& mpKeyFrameId*/, map<unsigned int, GeometricCamera*> &mpCams);
+    void PostLoad(KeyFrameDatabase* pKFDB, const ORBVocabulary* pORBVoc/*, map<long unsigned int, KeyFrame*>& mpKeyFrameId*/, map<unsigned int, GeometricCamera*> &mpCams);
 
     void printReprojectionError(list<KeyFrame*> &lpLocalWindowKFs, KeyFrame* mpCurrentKF, string &name, string &name_folder);
 
@@ -140,17 +177,12 @@ public:
     KeyFrame* mpFirstRegionKF;
     std::mutex mMutexMapUpdate;
 
-    // This avoid that two points are created simultaneously in separate threads (id conflict)
-    std::mutex mMutexPointCreation;
-
     bool mbFail;
 
     // Size of the thumbnail (always in power of 2)
     static const int THUMB_WIDTH = 512;
     static const int THUMB_HEIGHT = 512;
 
-    static long unsigned int nNextId;
-
     // DEBUG: show KFs which are used in LBA
     std::set<long unsigned int> msOptKFs;
     std::set<long unsigned int> msFixedKFs;
@@ -159,8 +191,10 @@ protected:
 
     long unsigned int mnId;
 
-    std::set<MapPoint*> mspMapPoints;
-    std::set<KeyFrame*> mspKeyFrames;
+    IdCounters* mpIds;
+
+    SlotMap<MapPoint> mspMapPoints;
+    SlotMap<KeyFrame> mspKeyFrames;
 
     // Save/load, the set structure is broken in libboost 1.58 for ubuntu 16.04, a vector is serializated
     std::vector<MapPoint*> mvpBackupMapPoints;
@@ -178,6 +212,7 @@ protected:
 
     int mnMapChange;
     int mnMapChangeNotified;
+    long unsigned int mnStructureChange;
 
     long unsigned int mnInitKFid;
     long unsigned int mnMaxKFid;
@@ -200,6 +235,11 @@ protected:
     // Mutex
     std::mutex mMutexMap;
 
+    std::atomic<unsigned char> mnDirtyMask{0};
+    std::mutex mMutexDirty;
+    std::vector<KeyFrame*> mvpDirtyKeyFrames[NUM_DIRTY_CONSUMERS];
+    std::vector<MapPoint*> mvpDirtyMapPoints[NUM_DIRTY_CONSUMERS];
+
 };
 
 } //namespace ORB_SLAM3
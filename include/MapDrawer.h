@@ -22,14 +22,20 @@
 #include "ImprovedTypes.hpp"
 #include "Settings.h"
 #include<pangolin/pangolin.h>
+#include<opencv2/core/core.hpp>
 
+#include<memory>
 #include<mutex>
+#include<unordered_map>
+#include<vector>
 
 namespace ORB_SLAM3
 {
 
 class Settings;
 class KeyFrame;
+class Map;
+class MapPoint;
 
 class MapDrawer
 {
@@ -56,6 +62,70 @@ class MapDrawer
                                 {1.0f, 1.0f, 0.0f},
                                 {0.0f, 1.0f, 1.0f}};
 
+    // Vertex cache of the active map, used only from the viewer thread.
+    // Structure changes (insertions, removals) add and drop single points.
+    // Only the points that BA, loop correction or scale updates moved are
+    // read again, as listed by the dirty tracking of the map, and only their
+    // slots are uploaded.
+    void UpdatePointCache(Map* pMap);
+    void UpdateReferencePoints(Map* pMap);
+    void MarkPointDirty(const size_t nSlot);
+
+    Map* mpCachedMap;
+    long unsigned int mnCachedMapId;
+    long unsigned int mnCachedStructure;
+    std::vector<MapPoint*> mvpCachedPoints;
+    std::unordered_map<MapPoint*, size_t> mmPointSlots;
+    std::vector<size_t> mvPointMarks;
+    size_t mnPointMark;
+    std::vector<MapPoint*> mvpDirtyPoints;
+    // xyz of every cached point, in the order of mvpCachedPoints
+    std::vector<float> mvPointVertices;
+    std::vector<float> mvRefPointVertices;
+
+    // Points modified since the last upload to mpPointBuffer
+    std::vector<size_t> mvDirtyPointSlots;
+    bool mbAllPointsDirty;
+    std::unique_ptr<pangolin::GlBuffer> mpPointBuffer;
+
+    // KeyFrame frustums and graph edges. The KeyFrames of the active map are
+    // cached like the points, only new and dirty ones (moved, or with new
+    // connections) are read again. Other maps are read again only when they
+    // change, which is rare. The vertex arrays are assembled from the cache.
+    struct KeyFrameSlot {
+        KeyFrame* pKF;
+        std::vector<float> vFrustum;
+        Eigen::Vector3f Ow;
+        bool bOrigin;
+        // Covisible (weight >= 100) and loop KeyFrames with a higher id, and
+        // the parent
+        std::vector<KeyFrame*> vpGraph;
+        KeyFrame* pPrevKF;
+    };
+    void UpdateKeyFrameCache(Map* pActiveMap, const bool bDrawOptLba);
+    bool UpdateActiveKeyFrames(Map* pActiveMap);
+    bool UpdateOtherKeyFrames(Map* pActiveMap);
+    void ReadKeyFrame(KeyFrameSlot &slot);
+
+    Map* mpCachedKFMap;
+    long unsigned int mnCachedKFMapId;
+    long unsigned int mnCachedKFStructure;
+    std::vector<KeyFrameSlot> mvKeyFrameSlots;
+    std::unordered_map<KeyFrame*, size_t> mmKeyFrameSlots;
+    std::vector<size_t> mvKeyFrameMarks;
+    size_t mnKeyFrameMark;
+    std::vector<KeyFrame*> mvpDirtyKeyFrames;
+
+    std::vector<long unsigned int> mvOtherMapsSignature;
+    std::vector<float> mvOtherKFVertices, mvOtherKFColors;
+    std::vector<float> mvOtherOriginKFVertices;
+
+    std::vector<long unsigned int> mvKeyFrameSignature;
+    std::vector<float> mvKFVertices, mvKFColors;
+    std::vector<float> mvOriginKFVertices;
+    std::vector<float> mvGraphVertices;
+    std::vector<float> mvInertialVertices;
+
 public:
     MapDrawer(const Atlas_ptr &pAtlas, const std::string &strSettingPath);
     MapDrawer(const Atlas_ptr &pAtlas, const Settings& settings);
@@ -66,6 +136,16 @@ public:
     void SetCurrentCameraPose(const Sophus::SE3f &Tcw);
     void SetReferenceKeyFrame(KeyFrame *pKF);
     void GetCurrentOpenGLCameraMatrix(pangolin::OpenGlMatrix &M, pangolin::OpenGlMatrix &MOw);
+    Sophus::SE3f GetCurrentCameraPose();
+
+    // Software rendering of the cached map into im (CV_8UC3) for a pinhole
+    // view with focal f, so the map can be monitored without a display.
+    void DrawMapSoftware(cv::Mat &im, const Sophus::SE3f &Tvw, const float f,
+                         const bool bDrawPoints, const bool bDrawKF,
+                         const bool bDrawGraph, const bool bDrawInertialGraph);
+
+    // Frees the GL buffers. Call it from the thread owning the GL context.
+    void ReleaseBuffers();
 
 };
 
@@ -24,15 +24,20 @@
 #include "Frame.h"
 #include "Map.h"
 #include "Converter.h"
+#include "DescriptorMedoid.h"
 
 #include "SerializationUtils.h"
+#include "SlotMap.h"
+#include "SmallVector.h"
 
 #include <opencv2/core/core.hpp>
+#include <atomic>
 #include <mutex>
 
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/array.hpp>
 #include <boost/serialization/map.hpp>
+#include <boost/type_traits/has_new_operator.hpp>
 
 namespace ORB_SLAM3
 {
@@ -45,6 +50,7 @@ class MapPoint
 {
 
     friend class boost::serialization::access;
+    friend class MapSection;
     template<class Archive>
     void serialize(Archive & ar, const unsigned int version)
     {
@@ -104,13 +110,22 @@ class MapPoint
 
 
 public:
-    
+    // Keyframe observing the point and index of the feature in its left and
+    // right images (-1 if not observed)
+    typedef std::pair<KeyFrame*,std::tuple<int,int> > Observation;
+    // Sorted by keyframe, most points are observed by a handful of keyframes
+    typedef SmallVector<Observation,6> ObservationVector;
+
     MapPoint();
 
     MapPoint(const Eigen::Vector3f &Pos, KeyFrame* pRefKF, Map* pMap);
     MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF, KeyFrame* pHostKF, Map* pMap);
     MapPoint(const Eigen::Vector3f &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
 
+    // Map points are allocated from a pool
+    static void* operator new(std::size_t nSize);
+    static void operator delete(void* p);
+
     void SetWorldPos(const Eigen::Vector3f &Pos);
     Eigen::Vector3f GetWorldPos();
 
@@ -119,9 +134,22 @@ public:
 
     KeyFrame* GetReferenceKeyFrame();
 
-    std::map<KeyFrame*,std::tuple<int,int>> GetObservations();
+    ObservationVector GetObservations();
+    // Copy into a buffer reused by the caller across points
+    void GetObservations(ObservationVector& vObservations);
     int Observations();
 
+    // Call f(const Observation&) for each observation without copying them.
+    // f runs with the observations locked, it must not lock other keyframes
+    // or map points
+    template <class F>
+    void ForEachObservation(F f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexFeatures);
+        for(const Observation& obs : mObservations)
+            f(obs);
+    }
+
     void AddObservation(KeyFrame* pKF,int idx);
     void EraseObservation(KeyFrame* pKF);
 
@@ -155,14 +183,16 @@ public:
     Map* GetMap();
     void UpdateMap(Map* pMap);
 
+    // Lists the point in the dirty lists of its map, see Map::SetDirtyTracking
+    void MarkDirty();
+
     void PrintObservations();
 
-    void PreSave(set<KeyFrame*>& spKF,set<MapPoint*>& spMP);
+    void PreSave(const SlotMap<KeyFrame>& spKF,const SlotMap<MapPoint>& spMP);
     void PostLoad(map<long unsigned int, KeyFrame*>& mpKFid, map<long unsigned int, MapPoint*>& mpMPid);
 
 public:
     long unsigned int mnId;
-    static long unsigned int nNextId;
     long int mnFirstKFid;
     long int mnFirstFrame;
     int nObs;
@@ -209,11 +239,17 @@ public:
 
 protected:
 
+     // Position of the observation of pKF, or where it should be inserted
+     ObservationVector::iterator FindObservation(KeyFrame* pKF);
+     // Add n shared points between every pair of observers, each counted once
+     // per keypoint of the keyframe that counts it
+     static void AddCovisibility(const ObservationVector& vObservations, int n);
+
      // Position in absolute coordinates
      Eigen::Vector3f mWorldPos;
 
      // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,std::tuple<int,int> > mObservations;
+     ObservationVector mObservations;
      // For save relation without pointer, this is necessary for save/load function
      std::map<long unsigned int, int> mBackupObservationsId1;
      std::map<long unsigned int, int> mBackupObservationsId2;
@@ -224,6 +260,11 @@ protected:
      // Best descriptor to fast matching
      cv::Mat mDescriptor;
 
+     // Observed descriptors and their distances, kept between calls to
+     // ComputeDistinctiveDescriptors
+     DescriptorMedoid mDescriptorMedoid;
+     std::mutex mMutexDescriptorMedoid;
+
      // Reference KeyFrame
      KeyFrame* mpRefKF;
      long unsigned int mBackupRefKFId;
@@ -244,6 +285,10 @@ protected:
 
      Map* mpMap;
 
+     // Dirty bits of the Map consumers, all set until added to a map
+     friend class Map;
+     std::atomic<unsigned char> mnDirty{0xFF};
+
      // Mutex
      std::mutex mMutexPos;
      std::mutex mMutexFeatures;
@@ -253,4 +298,10 @@ protected:
 
 } //namespace ORB_SLAM
 
+namespace boost {
+// Same as keyframes, loaded map points use the global operator new
+template <>
+struct has_new_operator<ORB_SLAM3::MapPoint> : public false_type {};
+} // namespace boost
+
 #endif // MAPPOINT_H
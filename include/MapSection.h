@@ -0,0 +1,148 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPSECTION_H
+#define MAPSECTION_H
+
+#include <stdint.h>
+
+#include <iostream>
+#include <set>
+#include <unordered_set>
+#include <vector>
+
+#include "DBoW2/BowVector.h"
+
+namespace ORB_SLAM3 {
+
+class GeometricCamera;
+class KeyFrame;
+class Map;
+class MapPoint;
+class SectionReader;
+
+// Section of a binary atlas file holding part of a map. Each field of the
+// keyframes or map points of the section is stored as one flat typed array,
+// so a section is written with a few large writes and read back without any
+// per-object archive. Large maps are split into several sections, which are
+// captured and restored in parallel.
+class MapSection {
+ public:
+  enum Type : uint8_t {
+    // Whole map as a boost archive, only written by older versions
+    MAP_ARCHIVE = 0,
+    // Fields of the map itself, one row
+    MAP = 1,
+    KEYFRAMES = 2,
+    MAPPOINTS = 3
+  };
+
+  // Id range of each section of a split map. A section keeps the same
+  // objects while the rest of the map changes, so an unchanged section is
+  // written again with the same bytes
+  static const size_t kKeyFramesPerSection = 256;
+  static const size_t kMapPointsPerSection = 16384;
+
+  // Identity of a section within its atlas: the id range of its objects is
+  // nChunk, always 0 for the map section
+  struct Key {
+    uint64_t nMapId;
+    Type type;
+    uint64_t nChunk;
+
+    bool operator<(const Key& other) const {
+      if (nMapId != other.nMapId) return nMapId < other.nMapId;
+      if (type != other.type) return type < other.type;
+      return nChunk < other.nChunk;
+    }
+  };
+
+  // Objects saved along with a map. As in PreSave, references to anything
+  // else are dropped
+  struct Scope {
+    std::unordered_set<KeyFrame*> spKeyFrames;
+    std::unordered_set<MapPoint*> spMapPoints;
+    std::set<GeometricCamera*> spCameras;
+  };
+
+  MapSection(Type type, unsigned long nMapId, uint64_t nChunk = 0);
+
+  Type GetType() const { return mType; }
+  unsigned long GetMapId() const { return mnMapId; }
+  uint64_t GetChunk() const { return mnChunk; }
+  Key GetKey() const {
+    Key key = {mnMapId, mType, mnChunk};
+    return key;
+  }
+  size_t Rows() const { return mnRows; }
+
+  // Append a row to a section of the matching type
+  void AddMap(Map* pMap);
+  void AddKeyFrame(KeyFrame* pKF, const Scope& scope);
+  void AddMapPoint(MapPoint* pMP, const Scope& scope);
+
+  // Payload of the section and its hash
+  uint64_t Size() const;
+  uint64_t Digest() const;
+  void Write(std::ostream& os) const;
+
+  // Objects read from the sections of a map, linked by Map::PostLoad
+  struct Contents {
+    std::vector<KeyFrame*> vpKeyFrames;
+    std::vector<MapPoint*> vpMapPoints;
+  };
+
+  // A map section sets the fields of pMap, the other ones create their
+  // objects. False if the payload is malformed
+  static bool Read(Type type, const char* pData, uint64_t nSize, Map* pMap,
+                   Contents& contents);
+  // Hands the objects over to the map, before its PostLoad
+  static void Assemble(Map* pMap, const Contents& contents);
+
+  // BoW vectors of the keyframes of a KEYFRAMES section stored at nOffset,
+  // reading only their columns. The section checksum is not verified, that
+  // is done when the whole section is read
+  static bool ReadBowVectors(std::istream& is, uint64_t nOffset,
+                             uint64_t nSize,
+                             std::vector<DBoW2::BowVector>& vBowVecs);
+
+ protected:
+  template <class T>
+  void Append(int nColumn, const T* pValues, size_t nValues);
+  template <class T>
+  void Append(int nColumn, const T& value) {
+    Append(nColumn, &value, 1);
+  }
+
+  static void ReadMap(SectionReader& reader, Map* pMap);
+  static KeyFrame* ReadKeyFrame(SectionReader& reader);
+  static MapPoint* ReadMapPoint(SectionReader& reader);
+
+  const Type mType;
+  const unsigned long mnMapId;
+  const uint64_t mnChunk;
+  uint64_t mnRows;
+  std::vector<std::vector<char> > mvColumns;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // MAPSECTION_H
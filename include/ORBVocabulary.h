@@ -22,6 +22,9 @@
 #ifndef ORBVOCABULARY_H
 #define ORBVOCABULARY_H
 
+#include <memory>
+#include <string>
+
 #include "DBoW2/FORB.h"
 #include "DBoW2/TemplatedVocabulary.h"
 
@@ -30,6 +33,19 @@ namespace ORB_SLAM3 {
 typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB>
     ORBVocabulary;
 
+// Immutable vocabulary, it is only read once loaded
+typedef std::shared_ptr<const ORBVocabulary> ORBVocabulary_ptr;
+
+// Loads a text vocabulary once per process: every caller with the same file
+// gets the same instance, which is released with its last handle. Returns an
+// empty handle if the file can not be loaded
+ORBVocabulary_ptr LoadSharedVocabulary(const std::string& strVocFile);
+
+// XXH64 fingerprint of the file a shared vocabulary was loaded from. It is
+// hashed the first time it is asked for and cached with the vocabulary, so
+// it is computed once per process. Empty if the file can not be read
+std::string SharedVocabularyFingerprint(const ORBVocabulary_ptr& pVocabulary);
+
 }  // namespace ORB_SLAM3
 
 #endif  // ORBVOCABULARY_H
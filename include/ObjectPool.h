@@ -0,0 +1,67 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+namespace ORB_SLAM3 {
+
+// Slab allocator for objects of a fixed size. Memory is taken from the system
+// in chunks of many objects and freed objects are reused; chunks are only
+// released when the pool is destroyed. Used through the class-specific
+// operator new of KeyFrame and MapPoint.
+class ObjectPool {
+ public:
+  ObjectPool(size_t nObjectSize, size_t nObjectsPerChunk = 256);
+  ~ObjectPool();
+
+  // Requests bigger than the object size go to the global allocator, as well
+  // as the release of memory that does not belong to the pool
+  void* Allocate(size_t nSize);
+  void Deallocate(void* p);
+
+  size_t Allocated();
+
+ protected:
+  void AddChunk();
+  bool Owns(void* p) const;
+
+  // Every object starts on a cache line, which also covers Eigen alignment
+  static const size_t kAlignment = 64;
+
+  const size_t mnSlotSize;
+  const size_t mnObjectsPerChunk;
+
+  std::mutex mMutexPool;
+  // Start address to end address of every chunk
+  std::map<char*, char*> mmChunks;
+  // Free slots are linked through their first bytes
+  void* mpFreeList;
+  size_t mnAllocated;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // OBJECTPOOL_H
@@ -24,6 +24,8 @@
 
 #include <math.h>
 
+#include <atomic>
+
 #include "Frame.h"
 #include "KeyFrame.h"
 #include "LoopClosing.h"
@@ -59,7 +61,8 @@ class Optimizer {
                              bool *pbStopFlag = NULL, bool bInit = false,
                              float priorG = 1e2, float priorA = 1e6,
                              Eigen::VectorXd *vSingVal = NULL,
-                             bool *bHess = NULL);
+                             bool *bHess = NULL,
+                             const std::atomic<bool> *pbAbort = NULL);
 
   void static LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap,
                                     int &num_fixedKF, int &num_OptKF,
@@ -128,10 +131,12 @@ class Optimizer {
                                    Eigen::Vector3d &ba, bool bMono,
                                    Eigen::MatrixXd &covInertial,
                                    bool bFixedVel = false, bool bGauss = false,
-                                   float priorG = 1e2, float priorA = 1e6);
+                                   float priorG = 1e2, float priorA = 1e6,
+                                   float thReintegration = 0.01f);
   void static InertialOptimization(Map *pMap, Eigen::Vector3d &bg,
                                    Eigen::Vector3d &ba, float priorG = 1e2,
-                                   float priorA = 1e6);
+                                   float priorA = 1e6,
+                                   float thReintegration = 0.01f);
   void static InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg,
                                    double &scale);
 
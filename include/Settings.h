@@ -97,6 +97,9 @@ class Settings {
   float imuFrequency() const { return imuFrequency_; }
   const Sophus::SE3f &Tbc() const { return Tbc_; }
   bool insertKFsWhenLost() const { return insertKFsWhenLost_; }
+  float imuReintegrationThreshold() const {
+    return imuReintegrationThreshold_;
+  }
 
   float depthMapFactor() const { return depthMapFactor_; }
 
@@ -117,6 +120,11 @@ class Settings {
   float viewPointZ() const { return viewPointZ_; }
   float viewPointF() const { return viewPointF_; }
   float imageViewerScale() const { return imageViewerScale_; }
+  bool viewerHeadless() const { return viewerHeadless_; }
+  const std::string &viewerHeadlessOutput() const {
+    return viewerHeadlessOutput_;
+  }
+  float viewerHeadlessPeriod() const { return viewerHeadlessPeriod_; }
 
   const std::string &atlasLoadFile() const { return sLoadFrom_; }
   const std::string &atlasSaveFile() const { return sSaveto_; }
@@ -199,6 +207,7 @@ class Settings {
   float imuFrequency_;
   Sophus::SE3f Tbc_;
   bool insertKFsWhenLost_;
+  float imuReintegrationThreshold_;
 
   /*
    * RGBD stuff
@@ -224,6 +233,9 @@ class Settings {
   float cameraLineWidth_;
   float viewPointX_, viewPointY_, viewPointZ_, viewPointF_;
   float imageViewerScale_;
+  bool viewerHeadless_;
+  std::string viewerHeadlessOutput_;
+  float viewerHeadlessPeriod_;
 
   /*
    * Save & load maps
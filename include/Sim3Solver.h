@@ -23,6 +23,7 @@
 #define SIM3SOLVER_H
 
 #include <opencv2/opencv.hpp>
+#include <random>
 #include <vector>
 
 #include "KeyFrame.h"
@@ -68,6 +69,9 @@ class Sim3Solver {
                          std::vector<Eigen::Vector2f> &vP2D,
                          GeometricCamera *pCamera);
 
+  // Random index in [0, n)
+  int RandomIndex(int n);
+
  protected:
   // KeyFrames and matches
   KeyFrame *mpKF1;
@@ -111,6 +115,10 @@ class Sim3Solver {
   // Indices for random selection
   std::vector<size_t> mvAllIndices;
 
+  // Per-solver generator seeded from the keyframe pair, so that RANSAC is
+  // reproducible and solvers can run concurrently
+  std::mt19937 mRandomGenerator;
+
   // Projections
   std::vector<Eigen::Vector2f> mvP1im1;
   std::vector<Eigen::Vector2f> mvP2im2;
@@ -0,0 +1,89 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Set of object pointers stored contiguously. Insertion, erasure and lookup
+// are O(1) and iteration walks a dense array; erasing moves the last element
+// into the freed slot, so the iteration order is not stable.
+template <class T>
+class SlotMap {
+ public:
+  typedef typename std::vector<T*>::const_iterator const_iterator;
+  typedef const_iterator iterator;
+
+  bool insert(T* p) {
+    if (!mmSlots.emplace(p, mvpElements.size()).second) return false;
+    mvpElements.push_back(p);
+    return true;
+  }
+
+  bool erase(T* p) {
+    typename std::unordered_map<T*, size_t>::iterator it = mmSlots.find(p);
+    if (it == mmSlots.end()) return false;
+
+    const size_t nSlot = it->second;
+    mmSlots.erase(it);
+    T* pLast = mvpElements.back();
+    mvpElements.pop_back();
+    if (pLast != p) {
+      mvpElements[nSlot] = pLast;
+      mmSlots[pLast] = nSlot;
+    }
+    return true;
+  }
+
+  const_iterator find(T* p) const {
+    typename std::unordered_map<T*, size_t>::const_iterator it =
+        mmSlots.find(p);
+    if (it == mmSlots.end()) return mvpElements.end();
+    return mvpElements.begin() + it->second;
+  }
+
+  size_t count(T* p) const { return mmSlots.count(p); }
+
+  const_iterator begin() const { return mvpElements.begin(); }
+  const_iterator end() const { return mvpElements.end(); }
+  size_t size() const { return mvpElements.size(); }
+  bool empty() const { return mvpElements.empty(); }
+
+  const std::vector<T*>& elements() const { return mvpElements; }
+
+  void clear() {
+    mvpElements.clear();
+    mmSlots.clear();
+  }
+
+ private:
+  std::vector<T*> mvpElements;
+  std::unordered_map<T*, size_t> mmSlots;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // SLOTMAP_H
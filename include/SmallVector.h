@@ -0,0 +1,133 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SMALLVECTOR_H
+#define SMALLVECTOR_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace ORB_SLAM3 {
+
+// Vector that stores up to N elements inline and only allocates on the heap
+// when it grows beyond that. Restricted to trivially copyable and destructible
+// elements, so it is meant for small records such as map point observations.
+template <class T, size_t N>
+class SmallVector {
+  static_assert(std::is_trivially_copy_constructible<T>::value &&
+                    std::is_trivially_destructible<T>::value,
+                "SmallVector only supports trivial elements");
+
+ public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  SmallVector() : mpData(Inline()), mnSize(0), mnCapacity(N) {}
+
+  SmallVector(const SmallVector& other)
+      : mpData(Inline()), mnSize(0), mnCapacity(N) {
+    Assign(other);
+  }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      mnSize = 0;
+      Assign(other);
+    }
+    return *this;
+  }
+
+  ~SmallVector() {
+    if (mpData != Inline()) ::operator delete(mpData);
+  }
+
+  iterator begin() { return mpData; }
+  iterator end() { return mpData + mnSize; }
+  const_iterator begin() const { return mpData; }
+  const_iterator end() const { return mpData + mnSize; }
+
+  size_t size() const { return mnSize; }
+  bool empty() const { return mnSize == 0; }
+  size_t capacity() const { return mnCapacity; }
+
+  T& operator[](size_t i) { return mpData[i]; }
+  const T& operator[](size_t i) const { return mpData[i]; }
+
+  void clear() { mnSize = 0; }
+
+  void reserve(size_t nCapacity) {
+    if (nCapacity <= mnCapacity) return;
+    T* pData = static_cast<T*>(::operator new(nCapacity * sizeof(T)));
+    for (size_t i = 0; i < mnSize; i++) new (pData + i) T(mpData[i]);
+    if (mpData != Inline()) ::operator delete(mpData);
+    mpData = pData;
+    mnCapacity = nCapacity;
+  }
+
+  void push_back(const T& value) {
+    if (mnSize == mnCapacity) {
+      // The value may live in the current buffer
+      const T copy(value);
+      reserve(2 * mnCapacity);
+      new (mpData + mnSize++) T(copy);
+    } else {
+      new (mpData + mnSize++) T(value);
+    }
+  }
+
+  iterator insert(const_iterator pos, const T& value) {
+    const size_t i = pos - mpData;
+    const T copy(value);
+    if (mnSize == mnCapacity) reserve(2 * mnCapacity);
+    for (size_t j = mnSize; j > i; j--) new (mpData + j) T(mpData[j - 1]);
+    new (mpData + i) T(copy);
+    mnSize++;
+    return mpData + i;
+  }
+
+  iterator erase(const_iterator pos) {
+    const size_t i = pos - mpData;
+    for (size_t j = i + 1; j < mnSize; j++) new (mpData + j - 1) T(mpData[j]);
+    mnSize--;
+    return mpData + i;
+  }
+
+ private:
+  T* Inline() { return reinterpret_cast<T*>(&mInline); }
+
+  void Assign(const SmallVector& other) {
+    reserve(other.mnSize);
+    for (size_t i = 0; i < other.mnSize; i++)
+      new (mpData + i) T(other.mpData[i]);
+    mnSize = other.mnSize;
+  }
+
+  T* mpData;
+  size_t mnSize;
+  size_t mnCapacity;
+  typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type mInline;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // SMALLVECTOR_H
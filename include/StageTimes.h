@@ -0,0 +1,113 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STAGETIMES_H
+#define STAGETIMES_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Thread-safe record of how long each run of a processing stage took, in
+// milliseconds. Disabled by default, every run is kept once enabled, so only
+// profiling tools such as the benchmark runner turn it on.
+class StageTimes {
+ public:
+  enum Stage {
+    TRACKING = 0,
+    BACKGROUND_WAIT,
+    LOCAL_MAPPING,
+    LOCAL_BA,
+    PLACE_RECOGNITION,
+    MAP_MERGE,
+    LOOP_CORRECTION,
+    GLOBAL_BA,
+    NUM_STAGES
+  };
+
+  typedef std::array<std::vector<double>, NUM_STAGES> Samples;
+
+  static const char* Name(Stage stage) {
+    static const char* const vNames[NUM_STAGES] = {
+        "tracking",        "background_wait", "local_mapping",
+        "local_ba",        "place_recognition", "map_merge",
+        "loop_correction", "global_ba"};
+    return vNames[stage];
+  }
+
+  // Records the lifetime of the object as one run of the stage
+  class Scope {
+   public:
+    Scope(StageTimes& times, Stage stage)
+        : mTimes(times), mStage(stage), mbEnabled(times.IsEnabled()) {
+      if (mbEnabled) mtStart = std::chrono::steady_clock::now();
+    }
+    ~Scope() {
+      if (!mbEnabled) return;
+      mTimes.Add(mStage, std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - mtStart)
+                             .count());
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   protected:
+    StageTimes& mTimes;
+    const Stage mStage;
+    const bool mbEnabled;
+    std::chrono::steady_clock::time_point mtStart;
+  };
+
+  StageTimes() : mbEnabled(false) {}
+
+  void SetEnabled(bool bEnabled) { mbEnabled = bEnabled; }
+  bool IsEnabled() const { return mbEnabled.load(std::memory_order_relaxed); }
+
+  void Add(Stage stage, double ms) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mTimes[stage].push_back(ms);
+  }
+
+  Samples Get() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mTimes;
+  }
+
+  void Clear() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (std::vector<double>& vTimes : mTimes)
+      std::vector<double>().swap(vTimes);
+  }
+
+ protected:
+  std::atomic<bool> mbEnabled;
+  std::mutex mMutex;
+  Samples mTimes;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // STAGETIMES_H
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string>
 #include <thread>
+#include <atomic>
 #include <opencv2/core/core.hpp>
 
 #include "ImprovedTypes.hpp"
@@ -33,9 +34,11 @@
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "KeyFrameDatabase.h"
+#include "KeyFrameStore.h"
 #include "ORBVocabulary.h"
 #include "ImuTypes.h"
 #include "Settings.h"
+#include "StageTimes.h"
 
 
 namespace ORB_SLAM3
@@ -53,23 +56,25 @@ public:
         VERBOSITY_DEBUG=4
     };
 
-    static eLevel th;
+    // Process wide, it is set by every System and read from all their threads
+    static std::atomic<eLevel> th;
 
 public:
     static void PrintMess(std::string str, eLevel lev)
     {
-        if(lev <= th)
+        if(lev <= th.load(std::memory_order_relaxed))
             cout << str << endl;
     }
 
     static void SetTh(eLevel _th)
     {
-        th = _th;
+        th.store(_th, std::memory_order_relaxed);
     }
 };
 
 class Viewer;
 class Atlas;
+class AtlasLog;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
@@ -88,7 +93,10 @@ public:
 public:
     
     // Initialize the SLAM system. It launches the Local Mapping, Loop Closing and Viewer threads.
-    System(const string &strVocFile, const string &strSettingsFile, const CameraType::eSensor sensor, const string &strSequence = std::string());
+    // Systems of the same process share the vocabulary loaded from the same file. They can also
+    // share a keyframe database (see GetKeyFrameDatabase), which must use that vocabulary.
+    System(const string &strVocFile, const string &strSettingsFile, const CameraType::eSensor sensor, const string &strSequence = std::string(),
+           const KeyFrameDatabase_ptr &pSharedKeyFrameDatabase = KeyFrameDatabase_ptr());
 
     // Proccess the given stereo frame. Images must be synchronized and rectified.
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
@@ -152,6 +160,15 @@ public:
     // See format details at: http://www.cvlibs.net/datasets/kitti/eval_odometry.php
     void SaveTrajectoryKITTI(const string &filename);
 
+    // Save a consistent copy of the atlas without stopping the session. Local mapping
+    // is paused while the atlas is serialised in memory, then the file is written in a
+    // low priority thread to a temporary file which is renamed over the target.
+    // With System.AtlasDeltaCheckpoints the target is an atlas log, and only the map
+    // sections changed since the previous checkpoint are appended to it.
+    // An empty filename uses System.SaveAtlasToFile. Returns false if a checkpoint
+    // is still being written.
+    bool RequestAtlasCheckpoint(const string &filename = string());
+
     // TODO: Save/Load functions
     // SaveMap(const string &filename);
     // LoadMap(const string &filename);
@@ -162,6 +179,15 @@ public:
     std::vector<MapPoint*> GetTrackedMapPoints();
     std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
+    // Place recognition of the last keyframe against the keyframes of the other
+    // Systems sharing the keyframe database. The returned keyframes belong to
+    // those Systems and are only valid until they are reset or destroyed.
+    std::vector<KeyFrame*> DetectOtherSessionCandidates(float minScore = 0.f);
+
+    // Vocabulary and keyframe database, to be shared with other Systems
+    ORBVocabulary_ptr GetVocabulary();
+    KeyFrameDatabase_ptr GetKeyFrameDatabase();
+
     // For debugging
     double GetTimeFromIMUInit();
     bool isLost();
@@ -171,6 +197,29 @@ public:
 
     float GetImageScale();
 
+    // Stereo rectification maps of the settings file, so that a caller can
+    // rectify the images itself (e.g. on a prefetch thread). Returns false if
+    // the input does not need rectification.
+    bool GetRectificationMaps(cv::Mat &M1l, cv::Mat &M2l, cv::Mat &M1r, cv::Mat &M2r);
+    // TrackStereo expects already rectified images
+    void SetExternalRectification(bool bExternal);
+
+    // Offline batch mode, for reprocessing recorded sequences as fast as possible
+    // and reproducibly. Each Track call returns once local mapping, loop closing
+    // and their background optimisations are done with the frame, so tracking
+    // back-pressures on the mapping queue instead of skipping keyframes and the
+    // result does not depend on timing. Also enabled by System.OfflineMode.
+    void SetOfflineMode(bool bOffline);
+    bool IsOfflineMode();
+
+    // Run times in ms of the processing stages, one entry per run: tracking
+    // (one per frame), background wait (offline mode) and the stages of
+    // local mapping and loop closing. Only recorded once enabled
+    void SetStageTimesEnabled(bool bEnabled);
+    StageTimes::Samples GetStageTimes();
+    // Number of maps, keyframes and map points over the whole atlas
+    void GetAtlasSize(int &nMaps, size_t &nKeyFrames, size_t &nMapPoints);
+
 #ifdef REGISTER_TIMES
     void InsertRectTime(double& time);
     void InsertResizeTime(double& time);
@@ -183,16 +232,23 @@ private:
     void SaveAtlas(int type);
     bool LoadAtlas(int type);
 
-    string CalculateCheckSum(string filename, int type);
+    // Fingerprint of the vocabulary stored in the atlas files. Only computed
+    // when an atlas is saved or loaded, and cached with the shared vocabulary
+    string GetVocabularyChecksum();
+    // MD5 checksum of sessions saved by older versions
+    string CalculateLegacyCheckSum(string filename);
 
     // Input sensor
     CameraType::eSensor mSensor;
 
     // ORB vocabulary used for place recognition and feature matching.
-    ORBVocabulary* mpVocabulary;
+    ORBVocabulary_ptr mpVocabulary;
 
     // KeyFrame database for place recognition (relocalization and loop detection).
-    KeyFrameDatabase* mpKeyFrameDatabase;
+    KeyFrameDatabase_ptr mpKeyFrameDatabase;
+
+    // Optional memory budget for the keyframes, spills cold ones to disk
+    KeyFrameStore* mpKeyFrameStore;
 
     // Map structure that stores the pointers to all KeyFrames and MapPoints.
     //Map* mpMap;
@@ -225,6 +281,18 @@ private:
     bool mbActivateLocalizationMode;
     bool mbDeactivateLocalizationMode;
 
+    // Last big change of the atlas reported by MapChanged
+    int mnLastBigChangeIdx;
+
+    // Images given to TrackStereo have been rectified by the caller
+    bool mbExternalRectification;
+
+    // Offline batch mode
+    bool mbOfflineMode;
+    void WaitForBackgroundStages();
+
+    StageTimes mStageTimes;
+
     // Tracking state
     int mTrackingState;
     std::vector<MapPoint*> mTrackedMapPoints;
@@ -238,6 +306,16 @@ private:
     string mStrVocabularyFilePath;
 
     Settings* settings_;
+
+    // Atlas checkpoint being written
+    std::thread* mptCheckpoint;
+    std::atomic<bool> mbCheckpointWriting;
+    std::mutex mMutexCheckpoint;
+
+    // Delta checkpoints, appended to an atlas log
+    bool mbDeltaCheckpoints;
+    std::atomic<bool> mbCheckpointFailed;
+    AtlasLog* mpAtlasLog;
 };
 
 }// namespace ORB_SLAM
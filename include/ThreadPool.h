@@ -0,0 +1,77 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+// Fixed-size pool of worker threads. Tasks are run in submission order by the
+// first idle worker; the returned future carries the result (or exception).
+class ThreadPool {
+ public:
+  // nThreads <= 0 uses the number of hardware threads
+  explicit ThreadPool(int nThreads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  template <typename F>
+  std::future<std::invoke_result_t<F> > Enqueue(F&& task) {
+    typedef std::invoke_result_t<F> Result;
+    std::shared_ptr<std::packaged_task<Result()> > pTask =
+        std::make_shared<std::packaged_task<Result()> >(std::forward<F>(task));
+    std::future<Result> result = pTask->get_future();
+    {
+      std::unique_lock<std::mutex> lock(mMutexQueue);
+      mlTasks.push_back([pTask]() { (*pTask)(); });
+    }
+    mcvQueue.notify_one();
+    return result;
+  }
+
+  size_t Size() const { return mvWorkers.size(); }
+
+ protected:
+  void Run();
+
+  std::vector<std::thread> mvWorkers;
+  std::list<std::function<void()> > mlTasks;
+
+  std::mutex mMutexQueue;
+  std::condition_variable mcvQueue;
+  bool mbFinishRequested;
+};
+
+}  // namespace ORB_SLAM3
+
+#endif  // THREADPOOL_H
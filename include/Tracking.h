@@ -50,7 +50,7 @@ class Settings;
 class Tracking {
  public:
   
-  Tracking(System* pSys, ORBVocabulary* pVoc,
+  Tracking(System* pSys, const ORBVocabulary* pVoc,
            const Atlas_ptr &pAtlas, KeyFrameDatabase* pKFDB,
            const string& strSettingPath, const int sensor, Settings* settings,
            const string& _nameSeq = std::string());
@@ -86,6 +86,9 @@ class Tracking {
   // to localize the camera.
   void InformOnlyTracking(const bool& flag);
 
+  // Offline batch mode, see System::SetOfflineMode
+  void InformOfflineMode(const bool& flag);
+
   void UpdateFrameIMU(const float s, const IMU::Bias& b,
                       KeyFrame* pCurrentKeyFrame);
   KeyFrame* GetLastKeyFrame() { return mpLastKeyFrame; }
@@ -150,6 +153,10 @@ class Tracking {
   // localization
   bool mbOnlyTracking;
 
+  // True if the background stages are idle whenever a frame is tracked, so
+  // keyframes are never skipped because local mapping is busy
+  bool mbOfflineMode;
+
   void Reset(bool bLocMap = false);
   void ResetActiveMap(bool bLocMap = false);
 
@@ -229,6 +236,13 @@ class Tracking {
   std::vector<IMU::Point> mvImuFromLastFrame;
   std::mutex mMutexImuQueue;
 
+  // Preintegrations from last frame are only read while their frame is the
+  // current or the last one, they are recycled from this ring instead of
+  // allocated for every frame
+  static const size_t kImuPreintegratedFramePoolSize = 3;
+  std::vector<IMU::Preintegrated*> mvpImuPreintegratedFramePool;
+  size_t mnNextImuPreintegratedFrame;
+
   // Imu calibration parameters
   IMU::Calib* mpImuCalib;
 
@@ -251,7 +265,7 @@ class Tracking {
   ORBextractor* mpIniORBextractor;
 
   // BoW
-  ORBVocabulary* mpORBVocabulary;
+  const ORBVocabulary* mpORBVocabulary;
   KeyFrameDatabase* mpKeyFrameDB;
 
   // Initalization (only for monocular)
@@ -23,6 +23,7 @@
 
 #include <mutex>
 #include <memory>
+#include <string>
 
 #include "ImprovedTypes.hpp"
 #include "FrameDrawer.h"
@@ -37,6 +38,11 @@ class Viewer {
   // the last processed frame. Drawing is refreshed according to the camera fps.
   // We use Pangolin.
   void Run();
+  // Without a display (Viewer.Headless: 1): the map is rendered in software
+  // next to the current frame and written to Viewer.HeadlessOutput every
+  // Viewer.HeadlessPeriod seconds.
+  void RunHeadless();
+  void WriteHeadlessView(const cv::Mat &im);
  public:
 
   Viewer(const System_ptr &pSystem, const std::string &strSettingPath);
@@ -46,6 +52,11 @@ class Viewer {
 
   void update(const Sophus::SE3f &pose);
 
+  // Last frame published by tracking, it never blocks the tracking thread.
+  // With bRequestImage the next record will also carry the image.
+  std::shared_ptr<const FrameRecord> GetLastFrameRecord(
+      const bool bRequestImage = false);
+
   void close();
   bool isClosed() const;
   bool isOpen() const;
@@ -71,6 +82,10 @@ class Viewer {
 
   float mViewpointX, mViewpointY, mViewpointZ, mViewpointF;
 
+  bool mbHeadless;
+  std::string mstrHeadlessOutput;
+  double mHeadlessPeriod;
+
   bool mbClosed;
 };
 
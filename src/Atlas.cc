@@ -21,21 +21,92 @@
 
 #include "Atlas.h"
 
+#include <stdint.h>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <sstream>
+
+#include "AtlasLog.h"
+#include "Checksum.h"
 #include "GeometricCamera.h"
 #include "KannalaBrandt8.h"
+#include "KeyFrameDatabase.h"
+#include "KeyFrameStore.h"
 #include "Pinhole.h"
+#include "ThreadPool.h"
 
 namespace ORB_SLAM3 {
 
-Atlas::Atlas() { mpCurrentMap = static_cast<Map*>(NULL); }
+// Layout of the sectioned atlas file (native endianness):
+//   char[8] magic, uint32 version, uint32 number of map sections,
+//   uint64 size, uint64 XXH64 + boost binary archive of the header,
+//   then the map sections, each one as uint8 type, uint64 map id,
+//   uint64 size, uint64 XXH64 + columns, see MapSection. The sections of a
+//   map are consecutive. Each section is checked when it is read, so loading
+//   never hashes the whole file up front
+static const char kAtlasMagic[8] = {'M', 'O', 'R', 'B', 'A', 'T', 'L', 'S'};
+static const uint32_t kAtlasVersion = 2;
+
+static uint64_t SectionDigest(const char* pData, uint64_t nSize) {
+  Checksum checksum;
+  checksum.Update(pData, nSize);
+  return checksum.Digest();
+}
+
+static void WriteSection(std::ostream& os, const std::string& strSection) {
+  const uint64_t nSize = strSection.size();
+  const uint64_t nHash = SectionDigest(strSection.data(), nSize);
+  os.write(reinterpret_cast<const char*>(&nSize), sizeof(nSize));
+  os.write(reinterpret_cast<const char*>(&nHash), sizeof(nHash));
+  os.write(strSection.data(), strSection.size());
+}
+
+// The columns are written straight from the section
+static void WriteSection(std::ostream& os, const MapSection& section) {
+  const uint8_t nType = section.GetType();
+  const uint64_t nMapId = section.GetMapId();
+  const uint64_t nSize = section.Size();
+  const uint64_t nHash = section.Digest();
+  os.write(reinterpret_cast<const char*>(&nType), sizeof(nType));
+  os.write(reinterpret_cast<const char*>(&nMapId), sizeof(nMapId));
+  os.write(reinterpret_cast<const char*>(&nSize), sizeof(nSize));
+  os.write(reinterpret_cast<const char*>(&nHash), sizeof(nHash));
+  section.Write(os);
+}
+
+static bool ReadSection(std::istream& is, std::string& strSection) {
+  uint64_t nSize, nHash;
+  is.read(reinterpret_cast<char*>(&nSize), sizeof(nSize));
+  if (!is.read(reinterpret_cast<char*>(&nHash), sizeof(nHash))) return false;
+  strSection.resize(nSize);
+  return is.read(&strSection[0], nSize) &&
+         SectionDigest(strSection.data(), nSize) == nHash;
+}
+
+Atlas::Atlas() : mptPendingMaps(NULL), mbAbortPendingMaps(false) {
+  mpCurrentMap = static_cast<Map*>(NULL);
+  mpKeyFrameDB = static_cast<KeyFrameDatabase*>(NULL);
+  mpKeyFrameStore = static_cast<KeyFrameStore*>(NULL);
+}
 
-Atlas::Atlas(int initKFid) : mnLastInitKFidMap(initKFid) {
+Atlas::Atlas(int initKFid)
+    : mnLastInitKFidMap(initKFid),
+      mptPendingMaps(NULL),
+      mbAbortPendingMaps(false) {
   mpCurrentMap = static_cast<Map*>(NULL);
+  mpKeyFrameDB = static_cast<KeyFrameDatabase*>(NULL);
+  mpKeyFrameStore = static_cast<KeyFrameStore*>(NULL);
   CreateNewMap();
 }
 
 Atlas::~Atlas() {
   std::cout << "deleting atlas" << std::endl;
+  WaitForPendingMaps(true);
   for (std::set<Map*>::iterator it = mspMaps.begin(), end = mspMaps.end();
        it != end;) {
     Map* pMi = *it;
@@ -52,7 +123,7 @@ Atlas::~Atlas() {
 
 void Atlas::CreateNewMap() {
   unique_lock<mutex> lock(mMutexAtlas);
-  cout << "Creation of new map with id: " << Map::nNextId << endl;
+  cout << "Creation of new map with id: " << mIds.mMapIds.Peek() << endl;
   if (mpCurrentMap) {
     if (!mspMaps.empty() && mnLastInitKFidMap < mpCurrentMap->GetMaxKFid())
       mnLastInitKFidMap = mpCurrentMap->GetMaxKFid() +
@@ -63,7 +134,7 @@ void Atlas::CreateNewMap() {
   }
   cout << "Creation of new map with last KF id: " << mnLastInitKFidMap << endl;
 
-  mpCurrentMap = new Map(mnLastInitKFidMap);
+  mpCurrentMap = new Map(mnLastInitKFidMap, &mIds);
   mpCurrentMap->SetCurrentMap();
   mspMaps.insert(mpCurrentMap);
 }
@@ -84,9 +155,21 @@ unsigned long int Atlas::GetLastInitKFid() {
   return mnLastInitKFidMap;
 }
 
+long unsigned int Atlas::NewFrameId() { return mIds.mFrameIds.Next(); }
+
+long unsigned int Atlas::GetNextFrameId() { return mIds.mFrameIds.Peek(); }
+
+IdCounters* Atlas::GetIdCounters() { return &mIds; }
+
+void Atlas::ResetFrameAndKeyFrameIds() {
+  mIds.mFrameIds.Reset();
+  mIds.mKeyFrameIds.Reset();
+}
+
 void Atlas::AddKeyFrame(KeyFrame* pKF) {
   Map* pMapKF = pKF->GetMap();
   pMapKF->AddKeyFrame(pKF);
+  if (mpKeyFrameStore) mpKeyFrameStore->AddKeyFrame(pKF);
 }
 
 void Atlas::AddMapPoint(MapPoint* pMP) {
@@ -190,6 +273,8 @@ void Atlas::clearMap() {
 }
 
 void Atlas::clearAtlas() {
+  WaitForPendingMaps(true);
+
   unique_lock<mutex> lock(mMutexAtlas);
   /*for(std::set<Map*>::iterator it=mspMaps.begin(), send=mspMaps.end();
   it!=send; it++)
@@ -248,33 +333,37 @@ bool Atlas::isImuInitialized() {
   return mpCurrentMap->isImuInitialized();
 }
 
-void Atlas::PreSave() {
+std::vector<Map*> Atlas::GetMapsToSave() {
+  // Stored maps still being loaded are saved too
+  WaitForPendingMaps();
+
   if (mpCurrentMap) {
     if (!mspMaps.empty() && mnLastInitKFidMap < mpCurrentMap->GetMaxKFid())
       mnLastInitKFidMap = mpCurrentMap->GetMaxKFid() +
                           1;  // The init KF is the next of current maximum
   }
 
-  struct compFunctor {
-    inline bool operator()(Map* elem1, Map* elem2) {
-      return elem1->GetId() < elem2->GetId();
-    }
-  };
-  std::copy(mspMaps.begin(), mspMaps.end(), std::back_inserter(mvpBackupMaps));
-  sort(mvpBackupMaps.begin(), mvpBackupMaps.end(), compFunctor());
-  std::set<GeometricCamera*> spCams(mvpCameras.begin(), mvpCameras.end());
-
-  for (Map* pMi : mvpBackupMaps) {
+  // Sorted by id. Also called for checkpoints of a running session, so the
+  // current map is never set bad
+  std::vector<Map*> vpMapsToSave;
+  for (Map* pMi : GetAllMaps()) {
     if (!pMi || pMi->IsBad()) continue;
 
-    if (pMi->GetAllKeyFrames().size() == 0) {
+    if (pMi->KeyFramesInMap() == 0) {
       // Empty map, erase before of save it.
-      SetMapBad(pMi);
+      if (pMi != mpCurrentMap) SetMapBad(pMi);
       continue;
     }
-    pMi->PreSave(spCams);
+    vpMapsToSave.push_back(pMi);
   }
   RemoveBadMaps();
+  return vpMapsToSave;
+}
+
+void Atlas::PreSave() {
+  std::set<GeometricCamera*> spCams(mvpCameras.begin(), mvpCameras.end());
+  mvpBackupMaps = GetMapsToSave();
+  for (Map* pMi : mvpBackupMaps) pMi->PreSave(spCams);
 }
 
 void Atlas::PostLoad() {
@@ -287,11 +376,541 @@ void Atlas::PostLoad() {
   unsigned long int numKF = 0, numMP = 0;
   for (Map* pMi : mvpBackupMaps) {
     mspMaps.insert(pMi);
+    pMi->SetIdCounters(&mIds);
     pMi->PostLoad(mpKeyFrameDB, mpORBVocabulary, mpCams);
     numKF += pMi->GetAllKeyFrames().size();
     numMP += pMi->GetAllMapPoints().size();
+    for (KeyFrame* pKFi : pMi->GetAllKeyFrames()) {
+      if (mpKeyFrameStore) mpKeyFrameStore->AddKeyFrame(pKFi);
+      if (!pKFi->isBad()) mpKeyFrameDB->add(pKFi);
+    }
   }
   mvpBackupMaps.clear();
+
+  // Maps of a sectioned file are restored without blocking tracking. Their
+  // keyframes are indexed right away, the first merge query that finds one
+  // restores its map on the spot
+  unique_lock<mutex> lock(mMutexPendingMaps);
+  if (mvPendingMaps.empty() || mptPendingMaps) return;
+  mmPendingCams = mpCams;
+  IndexPendingMaps();
+  mptPendingMaps = new std::thread(&Atlas::LoadPendingMaps, this);
+}
+
+bool Atlas::IsSectionedFile(std::istream& is) {
+  char magic[sizeof(kAtlasMagic)];
+  const std::streampos pos = is.tellg();
+  is.read(magic, sizeof(magic));
+  const bool bSectioned =
+      is.gcount() == sizeof(magic) &&
+      std::equal(magic, magic + sizeof(magic), kAtlasMagic);
+  is.clear();
+  is.seekg(pos);
+  return bSectioned;
+}
+
+static void WritePrologue(std::ostream& os, uint32_t nSections) {
+  os.write(kAtlasMagic, sizeof(kAtlasMagic));
+  os.write(reinterpret_cast<const char*>(&kAtlasVersion),
+           sizeof(kAtlasVersion));
+  os.write(reinterpret_cast<const char*>(&nSections), sizeof(nSections));
+}
+
+std::vector<std::future<std::shared_ptr<const MapSection> > >
+Atlas::CaptureSections(ThreadPool& pool, const std::vector<Map*>& vpMaps) {
+  const std::set<GeometricCamera*> spCams(mvpCameras.begin(),
+                                          mvpCameras.end());
+  std::vector<std::future<std::shared_ptr<const MapSection> > > vSections;
+  for (Map* pMi : vpMaps) {
+    // The sections of a map only reference its own objects, by id
+    std::shared_ptr<std::vector<KeyFrame*> > pvpKFs =
+        std::make_shared<std::vector<KeyFrame*> >();
+    for (KeyFrame* pKFi : pMi->GetAllKeyFrames()) {
+      if (pKFi && !pKFi->isBad()) pvpKFs->push_back(pKFi);
+    }
+    std::sort(pvpKFs->begin(), pvpKFs->end(), KeyFrame::lId);
+
+    std::shared_ptr<std::vector<MapPoint*> > pvpMPs =
+        std::make_shared<std::vector<MapPoint*> >();
+    for (MapPoint* pMPi : pMi->GetAllMapPoints()) {
+      if (pMPi && !pMPi->isBad()) pvpMPs->push_back(pMPi);
+    }
+    std::sort(pvpMPs->begin(), pvpMPs->end(),
+              [](MapPoint* pMP1, MapPoint* pMP2) {
+                return pMP1->mnId < pMP2->mnId;
+              });
+
+    std::shared_ptr<MapSection::Scope> pScope =
+        std::make_shared<MapSection::Scope>();
+    pScope->spKeyFrames.insert(pvpKFs->begin(), pvpKFs->end());
+    pScope->spMapPoints.insert(pvpMPs->begin(), pvpMPs->end());
+    pScope->spCameras = spCams;
+
+    const unsigned long nMapId = pMi->GetId();
+    vSections.push_back(pool.Enqueue([pMi, nMapId]() {
+      std::shared_ptr<MapSection> pSection =
+          std::make_shared<MapSection>(MapSection::MAP, nMapId);
+      pSection->AddMap(pMi);
+      return std::shared_ptr<const MapSection>(pSection);
+    }));
+
+    // Split by id ranges, the objects are sorted by id
+    for (size_t i = 0; i < pvpKFs->size();) {
+      const uint64_t nChunk =
+          (*pvpKFs)[i]->mnId / MapSection::kKeyFramesPerSection;
+      size_t nEnd = i + 1;
+      while (nEnd < pvpKFs->size() &&
+             (*pvpKFs)[nEnd]->mnId / MapSection::kKeyFramesPerSection ==
+                 nChunk)
+        nEnd++;
+      vSections.push_back(
+          pool.Enqueue([pvpKFs, pScope, nMapId, nChunk, i, nEnd]() {
+            std::shared_ptr<MapSection> pSection = std::make_shared<MapSection>(
+                MapSection::KEYFRAMES, nMapId, nChunk);
+            for (size_t j = i; j < nEnd; ++j)
+              pSection->AddKeyFrame((*pvpKFs)[j], *pScope);
+            return std::shared_ptr<const MapSection>(pSection);
+          }));
+      i = nEnd;
+    }
+
+    for (size_t i = 0; i < pvpMPs->size();) {
+      const uint64_t nChunk =
+          (*pvpMPs)[i]->mnId / MapSection::kMapPointsPerSection;
+      size_t nEnd = i + 1;
+      while (nEnd < pvpMPs->size() &&
+             (*pvpMPs)[nEnd]->mnId / MapSection::kMapPointsPerSection ==
+                 nChunk)
+        nEnd++;
+      vSections.push_back(
+          pool.Enqueue([pvpMPs, pScope, nMapId, nChunk, i, nEnd]() {
+            std::shared_ptr<MapSection> pSection = std::make_shared<MapSection>(
+                MapSection::MAPPOINTS, nMapId, nChunk);
+            for (size_t j = i; j < nEnd; ++j)
+              pSection->AddMapPoint((*pvpMPs)[j], *pScope);
+            return std::shared_ptr<const MapSection>(pSection);
+          }));
+      i = nEnd;
+    }
+  }
+  return vSections;
+}
+
+std::string Atlas::SerializeHeader(const std::string& strVocabularyName,
+                                   const std::string& strVocabularyChecksum) {
+  std::ostringstream ossHeader(std::ios::binary);
+  {
+    boost::archive::binary_oarchive oa(ossHeader);
+    oa << strVocabularyName;
+    oa << strVocabularyChecksum;
+    serializeHeader(oa, 0);
+  }
+  return ossHeader.str();
+}
+
+void Atlas::SaveSections(std::ostream& os, const std::string& strVocabularyName,
+                         const std::string& strVocabularyChecksum) {
+  // The sections read the maps directly, the boost backups of PreSave are
+  // not needed
+  ThreadPool pool;
+  std::vector<std::future<std::shared_ptr<const MapSection> > > vSections =
+      CaptureSections(pool, GetMapsToSave());
+
+  WritePrologue(os, vSections.size());
+  WriteSection(os, SerializeHeader(strVocabularyName, strVocabularyChecksum));
+
+  // Sections are streamed in order as soon as they are ready
+  for (std::future<std::shared_ptr<const MapSection> >& section : vSections)
+    WriteSection(os, *section.get());
+}
+
+// Changes when keyframes or map points are added or removed, and when loop
+// closing or map merging move the map. Local mapping only refines the current
+// map, which is always considered changed
+static uint64_t MapChangeStamp(Map* pMap) {
+  const uint64_t vnCounters[] = {
+      pMap->GetMaxKFid(), pMap->KeyFramesInMap(), pMap->MapPointsInMap(),
+      static_cast<uint64_t>(pMap->GetMapChangeIndex()),
+      static_cast<uint64_t>(pMap->GetLastBigChangeIdx())};
+  Checksum checksum;
+  checksum.Update(vnCounters, sizeof(vnCounters));
+  return checksum.Digest();
+}
+
+Atlas::Checkpoint Atlas::CaptureCheckpoint(
+    const std::string& strVocabularyName,
+    const std::string& strVocabularyChecksum, bool bChangedOnly) {
+  Checkpoint checkpoint;
+  checkpoint.strHeader =
+      SerializeHeader(strVocabularyName, strVocabularyChecksum);
+
+  // Loop closing may hold the update mutex of two maps, so they are never
+  // held together here
+  ThreadPool pool;
+  std::map<unsigned long, uint64_t> mnStamps;
+  std::map<MapSection::Key, uint64_t> mnDigests;
+  for (Map* pMi : GetMapsToSave()) {
+    const unsigned long nMapId = pMi->GetId();
+    checkpoint.vnMapIds.push_back(nMapId);
+
+    std::vector<std::shared_ptr<const MapSection> > vpSections;
+    {
+      unique_lock<mutex> lock(pMi->mMutexMapUpdate);
+      const uint64_t nStamp = MapChangeStamp(pMi);
+      mnStamps[nMapId] = nStamp;
+
+      std::map<unsigned long, uint64_t>::const_iterator it =
+          mmCheckpointStamps.find(nMapId);
+      if (bChangedOnly && pMi != mpCurrentMap &&
+          it != mmCheckpointStamps.end() && it->second == nStamp) {
+        // Its sections stay as they were written
+        const MapSection::Key first = {nMapId, MapSection::MAP, 0};
+        for (std::map<MapSection::Key, uint64_t>::const_iterator itDigest =
+                 mmCheckpointDigests.lower_bound(first);
+             itDigest != mmCheckpointDigests.end() &&
+             itDigest->first.nMapId == nMapId;
+             ++itDigest)
+          mnDigests.insert(*itDigest);
+        continue;
+      }
+
+      std::vector<std::future<std::shared_ptr<const MapSection> > >
+          vSections = CaptureSections(pool, std::vector<Map*>(1, pMi));
+      for (std::future<std::shared_ptr<const MapSection> >& section :
+           vSections)
+        vpSections.push_back(section.get());
+    }
+
+    // Most sections of the current map are not modified between
+    // checkpoints, only the ones whose bytes changed are written again
+    for (const std::shared_ptr<const MapSection>& pSection : vpSections) {
+      const uint64_t nDigest = pSection->Digest();
+      mnDigests[pSection->GetKey()] = nDigest;
+
+      std::map<MapSection::Key, uint64_t>::const_iterator it =
+          mmCheckpointDigests.find(pSection->GetKey());
+      if (bChangedOnly && it != mmCheckpointDigests.end() &&
+          it->second == nDigest)
+        continue;
+      checkpoint.vpSections.push_back(pSection);
+    }
+  }
+
+  for (const std::pair<const MapSection::Key, uint64_t>& digest : mnDigests)
+    checkpoint.vSectionKeys.push_back(digest.first);
+  mmCheckpointStamps = mnStamps;
+  mmCheckpointDigests = mnDigests;
+  return checkpoint;
+}
+
+void Atlas::WriteSections(std::ostream& os, const Checkpoint& checkpoint) {
+  WritePrologue(os, checkpoint.vpSections.size());
+  WriteSection(os, checkpoint.strHeader);
+  for (const std::shared_ptr<const MapSection>& pSection :
+       checkpoint.vpSections)
+    WriteSection(os, *pSection);
+}
+
+bool Atlas::LoadSections(std::istream& is, const std::string& strFileName,
+                         std::string& strVocabularyName,
+                         std::string& strVocabularyChecksum) {
+  char magic[sizeof(kAtlasMagic)];
+  uint32_t nVersion, nSections;
+  is.read(magic, sizeof(magic));
+  is.read(reinterpret_cast<char*>(&nVersion), sizeof(nVersion));
+  is.read(reinterpret_cast<char*>(&nSections), sizeof(nSections));
+  if (!is || !std::equal(magic, magic + sizeof(magic), kAtlasMagic)) {
+    std::cout << "Unknown atlas file format" << std::endl;
+    return false;
+  }
+  if (nVersion != kAtlasVersion) {
+    std::cout << "Unsupported atlas file version " << nVersion << std::endl;
+    return false;
+  }
+
+  std::string strHeader;
+  if (!ReadSection(is, strHeader)) {
+    std::cout << "The header of the atlas file is corrupted" << std::endl;
+    return false;
+  }
+
+  // Only the position of the map sections is read here, the maps themselves
+  // are loaded in the background after PostLoad
+  std::vector<PendingMap> vPendingMaps;
+  for (uint32_t i = 0; i < nSections; ++i) {
+    uint8_t nType;
+    uint64_t nMapId, nSize, nHash;
+    is.read(reinterpret_cast<char*>(&nType), sizeof(nType));
+    is.read(reinterpret_cast<char*>(&nMapId), sizeof(nMapId));
+    is.read(reinterpret_cast<char*>(&nSize), sizeof(nSize));
+    if (!is.read(reinterpret_cast<char*>(&nHash), sizeof(nHash))) return false;
+    PendingSection section;
+    section.type = static_cast<MapSection::Type>(nType);
+    section.nOffset = static_cast<uint64_t>(is.tellg());
+    section.nSize = nSize;
+    section.nHash = nHash;
+    section.bChecked = false;
+    if (!is.seekg(nSize, std::ios::cur)) return false;
+    AddPendingSection(vPendingMaps, nMapId, section);
+  }
+
+  SetPendingMaps(strHeader, vPendingMaps, strFileName, strVocabularyName,
+                 strVocabularyChecksum);
+  return true;
+}
+
+bool Atlas::LoadLog(std::istream& is, const std::string& strFileName,
+                    std::string& strVocabularyName,
+                    std::string& strVocabularyChecksum) {
+  AtlasLog::Index index;
+  if (!AtlasLog::ReadIndex(is, index)) {
+    std::cout << "The atlas log has no complete checkpoint" << std::endl;
+    return false;
+  }
+
+  is.clear();
+  is.seekg(index.header.nOffset);
+  std::string strHeader(index.header.nSize, '\0');
+  if (!is.read(&strHeader[0], strHeader.size())) return false;
+
+  std::vector<PendingMap> vPendingMaps;
+  for (const AtlasLog::Record& record : index.vRecords) {
+    PendingSection section;
+    section.type = record.sectionType;
+    section.nOffset = record.nOffset;
+    section.nSize = record.nSize;
+    // Replaying the log already checked every record
+    section.nHash = 0;
+    section.bChecked = true;
+    AddPendingSection(vPendingMaps, record.nMapId, section);
+  }
+
+  SetPendingMaps(strHeader, vPendingMaps, strFileName, strVocabularyName,
+                 strVocabularyChecksum);
+  return true;
+}
+
+void Atlas::SetPendingMaps(const std::string& strHeader,
+                           std::vector<PendingMap>& vPendingMaps,
+                           const std::string& strFileName,
+                           std::string& strVocabularyName,
+                           std::string& strVocabularyChecksum) {
+  // The maps are created here because Map() increases the static id counter,
+  // which is restored from the header
+  for (PendingMap& pendingMap : vPendingMaps) {
+    pendingMap.pMap = new Map();
+    pendingMap.pMap->SetIdCounters(&mIds);
+  }
+
+  {
+    std::istringstream iss(strHeader, std::ios::binary);
+    boost::archive::binary_iarchive ia(iss);
+    ia >> strVocabularyName;
+    ia >> strVocabularyChecksum;
+    serializeHeader(ia, 0);
+  }
+
+  mStrPendingMapsFile = strFileName;
+  unique_lock<mutex> lock(mMutexPendingStates);
+  mvPendingMaps = vPendingMaps;
+}
+
+void Atlas::AddPendingSection(std::vector<PendingMap>& vPendingMaps,
+                              unsigned long nMapId,
+                              const PendingSection& section) {
+  if (vPendingMaps.empty() || vPendingMaps.back().nMapId != nMapId) {
+    PendingMap pendingMap;
+    pendingMap.pMap = static_cast<Map*>(NULL);
+    pendingMap.nMapId = nMapId;
+    pendingMap.state = PendingMap::PENDING;
+    vPendingMaps.push_back(pendingMap);
+  }
+  vPendingMaps.back().vSections.push_back(section);
+}
+
+void Atlas::IndexPendingMaps() {
+  std::ifstream ifs(mStrPendingMapsFile, std::ios::binary);
+  for (const PendingMap& pendingMap : mvPendingMaps) {
+    std::vector<DBoW2::BowVector> vBowVecs;
+    bool bRead = true;
+    for (const PendingSection& section : pendingMap.vSections) {
+      if (section.type != MapSection::KEYFRAMES) continue;
+
+      std::vector<DBoW2::BowVector> vSectionBowVecs;
+      bRead = MapSection::ReadBowVectors(ifs, section.nOffset, section.nSize,
+                                         vSectionBowVecs);
+      if (!bRead) break;
+      vBowVecs.insert(vBowVecs.end(), vSectionBowVecs.begin(),
+                      vSectionBowVecs.end());
+    }
+    // Such a map is still restored in the background, it is only found later
+    if (!bRead) {
+      ifs.clear();
+      std::cout << "Keyframes of map " << pendingMap.nMapId
+                << " could not be indexed before restoring it" << std::endl;
+      continue;
+    }
+
+    mpKeyFrameDB->addPending(pendingMap.pMap, vBowVecs, [this](Map* pMap) {
+      ThreadPool pool;
+      RestorePendingMap(pMap, pool);
+    });
+  }
+}
+
+void Atlas::LoadPendingMaps() {
+  // The sections of a large map are restored in parallel
+  ThreadPool pool;
+  for (size_t i = 0; i < mvPendingMaps.size() && !mbAbortPendingMaps; ++i)
+    RestorePendingMap(mvPendingMaps[i].pMap, pool);
+
+  unsigned long int numKF = 0;
+  size_t nLoadedMaps = 0;
+  {
+    unique_lock<mutex> lock(mMutexPendingStates);
+    for (const PendingMap& pendingMap : mvPendingMaps) {
+      if (pendingMap.state != PendingMap::LOADED) continue;
+      numKF += pendingMap.pMap->KeyFramesInMap();
+      nLoadedMaps++;
+    }
+  }
+  std::cout << "Loaded " << nLoadedMaps << " stored maps with " << numKF
+            << " keyframes" << std::endl;
+}
+
+bool Atlas::RestorePendingMap(Map* pMap, ThreadPool& pool) {
+  size_t nIndex;
+  PendingMap pendingMap;
+  {
+    unique_lock<mutex> lock(mMutexPendingStates);
+    while (true) {
+      nIndex = 0;
+      while (nIndex < mvPendingMaps.size() &&
+             mvPendingMaps[nIndex].pMap != pMap)
+        nIndex++;
+      if (nIndex == mvPendingMaps.size()) return false;
+      if (mvPendingMaps[nIndex].state != PendingMap::LOADING) break;
+      mcvPendingStates.wait(lock);
+    }
+    if (mvPendingMaps[nIndex].state != PendingMap::PENDING)
+      return mvPendingMaps[nIndex].state == PendingMap::LOADED;
+    mvPendingMaps[nIndex].state = PendingMap::LOADING;
+    pendingMap = mvPendingMaps[nIndex];
+  }
+
+  const bool bLoaded = LoadPendingMap(pendingMap, pool);
+
+  // The pending maps are not dropped while one is loading
+  {
+    unique_lock<mutex> lock(mMutexPendingStates);
+    mvPendingMaps[nIndex].state =
+        bLoaded ? PendingMap::LOADED : PendingMap::FAILED;
+  }
+  mcvPendingStates.notify_all();
+  return bLoaded;
+}
+
+bool Atlas::LoadPendingMap(const PendingMap& pendingMap, ThreadPool& pool) {
+  std::ifstream ifs(mStrPendingMapsFile, std::ios::binary);
+
+  // Each section is restored while the next ones are read
+  Map* pMi = pendingMap.pMap;
+  const unsigned long nMapId = pendingMap.nMapId;
+  std::vector<std::future<bool> > vLoads;
+  std::vector<MapSection::Contents> vContents(pendingMap.vSections.size());
+  for (size_t j = 0; j < pendingMap.vSections.size(); ++j) {
+    if (mbAbortPendingMaps) break;
+
+    const PendingSection& section = pendingMap.vSections[j];
+    std::shared_ptr<std::string> pSection = std::make_shared<std::string>();
+    pSection->resize(section.nSize);
+    ifs.seekg(section.nOffset);
+    if (!ifs.read(&(*pSection)[0], section.nSize)) {
+      std::cout << "Error reading map sections from " << mStrPendingMapsFile
+                << std::endl;
+      break;
+    }
+
+    MapSection::Contents* pContents = &vContents[j];
+    vLoads.push_back(
+        pool.Enqueue([pMi, nMapId, pSection, pContents, section]() {
+          if (!section.bChecked &&
+              SectionDigest(pSection->data(), pSection->size()) !=
+                  section.nHash) {
+            std::cout << "Corrupted section of map " << nMapId
+                      << ", its checksum does not match" << std::endl;
+            return false;
+          }
+          return MapSection::Read(section.type, pSection->data(),
+                                  pSection->size(), pMi, *pContents);
+        }));
+  }
+
+  // Partially loaded maps are leaked instead of deleting half built graphs
+  bool bLoaded = vLoads.size() == pendingMap.vSections.size();
+  for (std::future<bool>& load : vLoads) {
+    try {
+      bLoaded = load.get() && bLoaded;
+    } catch (const std::exception& e) {
+      std::cout << "Error loading a map of the atlas: " << e.what()
+                << std::endl;
+      bLoaded = false;
+    }
+  }
+  if (!bLoaded || mbAbortPendingMaps) {
+    if (!mbAbortPendingMaps)
+      std::cout << "Map " << nMapId << " of the atlas could not be loaded"
+                << std::endl;
+    return false;
+  }
+
+  std::map<unsigned int, GeometricCamera*> mpCams = mmPendingCams;
+  for (const MapSection::Contents& contents : vContents)
+    MapSection::Assemble(pMi, contents);
+  pMi->PostLoad(mpKeyFrameDB, mpORBVocabulary, mpCams);
+  if (mpKeyFrameStore) {
+    for (KeyFrame* pKFi : pMi->GetAllKeyFrames())
+      mpKeyFrameStore->AddKeyFrame(pKFi);
+  }
+
+  // In the atlas before in the keyframe database, so the map of every
+  // keyframe a query returns is already known to the atlas
+  {
+    unique_lock<mutex> lock(mMutexAtlas);
+    mspMaps.insert(pMi);
+  }
+  mpKeyFrameDB->replacePending(pMi, pMi->GetAllKeyFrames());
+  return true;
+}
+
+void Atlas::WaitForPendingMaps(bool bAbort) {
+  unique_lock<mutex> lock(mMutexPendingMaps);
+  if (bAbort) mbAbortPendingMaps = true;
+  if (mptPendingMaps) {
+    mptPendingMaps->join();
+    delete mptPendingMaps;
+    mptPendingMaps = static_cast<std::thread*>(NULL);
+  }
+
+  // Maps restored by a query are awaited too. The keyframes of the ones not
+  // restored are dropped from the keyframe database
+  std::vector<PendingMap> vPendingMaps;
+  {
+    unique_lock<mutex> lockStates(mMutexPendingStates);
+    mcvPendingStates.wait(lockStates, [this]() {
+      for (const PendingMap& pendingMap : mvPendingMaps) {
+        if (pendingMap.state == PendingMap::LOADING) return false;
+      }
+      return true;
+    });
+    vPendingMaps.swap(mvPendingMaps);
+  }
+  for (const PendingMap& pendingMap : vPendingMaps) {
+    if (pendingMap.state != PendingMap::LOADED && mpKeyFrameDB)
+      mpKeyFrameDB->replacePending(pendingMap.pMap,
+                                   std::vector<KeyFrame*>());
+  }
+  mbAbortPendingMaps = false;
 }
 
 void Atlas::SetKeyFrameDababase(KeyFrameDatabase* pKFDB) {
@@ -300,11 +919,17 @@ void Atlas::SetKeyFrameDababase(KeyFrameDatabase* pKFDB) {
 
 KeyFrameDatabase* Atlas::GetKeyFrameDatabase() { return mpKeyFrameDB; }
 
-void Atlas::SetORBVocabulary(ORBVocabulary* pORBVoc) {
+void Atlas::SetKeyFrameStore(KeyFrameStore* pKFStore) {
+  mpKeyFrameStore = pKFStore;
+}
+
+KeyFrameStore* Atlas::GetKeyFrameStore() { return mpKeyFrameStore; }
+
+void Atlas::SetORBVocabulary(const ORBVocabulary* pORBVoc) {
   mpORBVocabulary = pORBVoc;
 }
 
-ORBVocabulary* Atlas::GetORBVocabulary() { return mpORBVocabulary; }
+const ORBVocabulary* Atlas::GetORBVocabulary() { return mpORBVocabulary; }
 
 long unsigned int Atlas::GetNumLivedKF() {
   unique_lock<mutex> lock(mMutexAtlas);
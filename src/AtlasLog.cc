@@ -0,0 +1,440 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AtlasLog.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "Checksum.h"
+
+namespace ORB_SLAM3 {
+
+// Layout of the log file (native endianness):
+//   char[8] magic, uint32 version,
+//   then records: uint8 type, uint64 map id, uint64 chunk,
+//   uint64 payload size, uint64 XXH64 of the payload, payload
+static const char kLogMagic[8] = {'M', 'O', 'R', 'B', 'A', 'L', 'O', 'G'};
+static const uint32_t kLogVersion = 2;
+static const uint64_t kPrologueSize = sizeof(kLogMagic) + sizeof(uint32_t);
+static const uint64_t kRecordHeaderSize = 1 + 4 * sizeof(uint64_t);
+static const uint64_t kCommitEntrySize = 3 * sizeof(uint64_t);
+
+enum RecordType : uint8_t {
+  RECORD_HEADER = 0,
+  // Payload: uint64 map id, section type and chunk of every live section
+  RECORD_COMMIT = 1,
+  // Map sections, see MapSection
+  RECORD_MAP = 2,
+  RECORD_KEYFRAMES = 3,
+  RECORD_MAPPOINTS = 4
+};
+
+static uint8_t SectionRecordType(MapSection::Type type) {
+  switch (type) {
+    case MapSection::KEYFRAMES:
+      return RECORD_KEYFRAMES;
+    case MapSection::MAPPOINTS:
+      return RECORD_MAPPOINTS;
+    default:
+      return RECORD_MAP;
+  }
+}
+
+static bool RecordSectionType(uint8_t nType, MapSection::Type& type) {
+  switch (nType) {
+    case RECORD_MAP:
+      type = MapSection::MAP;
+      return true;
+    case RECORD_KEYFRAMES:
+      type = MapSection::KEYFRAMES;
+      return true;
+    case RECORD_MAPPOINTS:
+      type = MapSection::MAPPOINTS;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void WritePrologue(std::ostream& os) {
+  os.write(kLogMagic, sizeof(kLogMagic));
+  os.write(reinterpret_cast<const char*>(&kLogVersion), sizeof(kLogVersion));
+}
+
+static MapSection::Key RecordKey(const AtlasLog::Record& record) {
+  MapSection::Key key = {record.nMapId, record.sectionType, record.nChunk};
+  return key;
+}
+
+static AtlasLog::Record WriteRecordHeader(std::ostream& os, uint64_t& nPos,
+                                          uint8_t nType, uint64_t nMapId,
+                                          uint64_t nChunk, uint64_t nSize,
+                                          uint64_t nHash) {
+  os.write(reinterpret_cast<const char*>(&nType), sizeof(nType));
+  os.write(reinterpret_cast<const char*>(&nMapId), sizeof(nMapId));
+  os.write(reinterpret_cast<const char*>(&nChunk), sizeof(nChunk));
+  os.write(reinterpret_cast<const char*>(&nSize), sizeof(nSize));
+  os.write(reinterpret_cast<const char*>(&nHash), sizeof(nHash));
+
+  AtlasLog::Record record;
+  record.nMapId = nMapId;
+  record.sectionType = MapSection::MAP;
+  RecordSectionType(nType, record.sectionType);
+  record.nChunk = nChunk;
+  record.nOffset = nPos + kRecordHeaderSize;
+  record.nSize = nSize;
+  nPos = record.nOffset + nSize;
+  return record;
+}
+
+// Writes a record at nPos and moves it past the record
+static AtlasLog::Record WriteRecord(std::ostream& os, uint64_t& nPos,
+                                    uint8_t nType, uint64_t nMapId,
+                                    uint64_t nChunk,
+                                    const std::string& strPayload) {
+  Checksum checksum;
+  checksum.Update(strPayload.data(), strPayload.size());
+  const AtlasLog::Record record =
+      WriteRecordHeader(os, nPos, nType, nMapId, nChunk, strPayload.size(),
+                        checksum.Digest());
+  os.write(strPayload.data(), strPayload.size());
+  return record;
+}
+
+// The columns are written straight from the section
+static AtlasLog::Record WriteRecord(std::ostream& os, uint64_t& nPos,
+                                    const MapSection& section) {
+  const AtlasLog::Record record = WriteRecordHeader(
+      os, nPos, SectionRecordType(section.GetType()), section.GetMapId(),
+      section.GetChunk(), section.Size(), section.Digest());
+  section.Write(os);
+  return record;
+}
+
+static uint64_t WriteCommit(std::ostream& os, uint64_t& nPos,
+                            const std::vector<MapSection::Key>& vKeys) {
+  std::vector<uint64_t> vnEntries;
+  vnEntries.reserve(3 * vKeys.size());
+  for (const MapSection::Key& key : vKeys) {
+    vnEntries.push_back(key.nMapId);
+    vnEntries.push_back(key.type);
+    vnEntries.push_back(key.nChunk);
+  }
+  const std::string strPayload(
+      reinterpret_cast<const char*>(vnEntries.data()),
+      vnEntries.size() * sizeof(uint64_t));
+  WriteRecord(os, nPos, RECORD_COMMIT, 0, 0, strPayload);
+  return nPos;
+}
+
+static bool ReadCommit(const std::string& strCommit,
+                       std::vector<MapSection::Key>& vKeys) {
+  if (strCommit.size() % kCommitEntrySize != 0) return false;
+  std::vector<uint64_t> vnEntries(strCommit.size() / sizeof(uint64_t));
+  std::copy(strCommit.begin(), strCommit.end(),
+            reinterpret_cast<char*>(vnEntries.data()));
+
+  vKeys.clear();
+  for (size_t i = 0; i < vnEntries.size(); i += 3) {
+    const uint64_t nType = vnEntries[i + 1];
+    if (nType != MapSection::MAP && nType != MapSection::KEYFRAMES &&
+        nType != MapSection::MAPPOINTS)
+      return false;
+    MapSection::Key key;
+    key.nMapId = vnEntries[i];
+    key.type = static_cast<MapSection::Type>(nType);
+    key.nChunk = vnEntries[i + 2];
+    vKeys.push_back(key);
+  }
+  return true;
+}
+
+// The records written in a checkpoint replace the previous ones of the same
+// sections, the sections not listed in the commit are dropped. False if a
+// listed section has no record
+static bool ApplyCommit(std::vector<AtlasLog::Record>& vRecords,
+                        const std::vector<AtlasLog::Record>& vWritten,
+                        const std::vector<MapSection::Key>& vKeys) {
+  std::map<MapSection::Key, AtlasLog::Record> mRecords;
+  for (const AtlasLog::Record& record : vRecords)
+    mRecords[RecordKey(record)] = record;
+  for (const AtlasLog::Record& record : vWritten)
+    mRecords[RecordKey(record)] = record;
+
+  vRecords.clear();
+  for (const MapSection::Key& key : vKeys) {
+    std::map<MapSection::Key, AtlasLog::Record>::const_iterator it =
+        mRecords.find(key);
+    if (it == mRecords.end()) return false;
+    vRecords.push_back(it->second);
+  }
+  return true;
+}
+
+// Keys of the live records
+static std::vector<MapSection::Key> RecordKeys(
+    const std::vector<AtlasLog::Record>& vRecords) {
+  std::vector<MapSection::Key> vKeys;
+  vKeys.reserve(vRecords.size());
+  for (const AtlasLog::Record& record : vRecords)
+    vKeys.push_back(RecordKey(record));
+  return vKeys;
+}
+
+static bool SyncAndRename(const std::string& strTmpFilename,
+                          const std::string& strFilename) {
+  const int fd = open(strTmpFilename.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  return std::rename(strTmpFilename.c_str(), strFilename.c_str()) == 0;
+}
+
+static bool SyncFile(const std::string& strFilename) {
+  const int fd = open(strFilename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  const bool bSynced = fsync(fd) == 0;
+  close(fd);
+  return bSynced;
+}
+
+bool AtlasLog::IsLogFile(std::istream& is) {
+  char magic[sizeof(kLogMagic)];
+  const std::streampos pos = is.tellg();
+  is.read(magic, sizeof(magic));
+  const bool bLog = is.gcount() == sizeof(magic) &&
+                    std::equal(magic, magic + sizeof(magic), kLogMagic);
+  is.clear();
+  is.seekg(pos);
+  return bLog;
+}
+
+bool AtlasLog::IsLogFile(const std::string& strFilename) {
+  std::ifstream ifs(strFilename, std::ios::binary);
+  return ifs.good() && IsLogFile(ifs);
+}
+
+bool AtlasLog::ReadIndex(std::istream& is, Index& index) {
+  char magic[sizeof(kLogMagic)];
+  uint32_t nVersion;
+  is.read(magic, sizeof(magic));
+  is.read(reinterpret_cast<char*>(&nVersion), sizeof(nVersion));
+  if (!is || !std::equal(magic, magic + sizeof(magic), kLogMagic) ||
+      nVersion != kLogVersion)
+    return false;
+
+  bool bCommitted = false;
+  std::vector<Record> vRecords, vPending;
+  Record header, pendingHeader;
+  bool bPendingHeader = false;
+  uint64_t nCommittedSize = 0;
+  uint64_t nPos = kPrologueSize;
+
+  std::vector<char> vBuffer(1 << 20);
+  while (true) {
+    uint8_t nType;
+    Record record;
+    uint64_t nHash;
+    is.read(reinterpret_cast<char*>(&nType), sizeof(nType));
+    is.read(reinterpret_cast<char*>(&record.nMapId), sizeof(record.nMapId));
+    is.read(reinterpret_cast<char*>(&record.nChunk), sizeof(record.nChunk));
+    is.read(reinterpret_cast<char*>(&record.nSize), sizeof(record.nSize));
+    is.read(reinterpret_cast<char*>(&nHash), sizeof(nHash));
+    if (!is) break;
+    record.nOffset = nPos + kRecordHeaderSize;
+    record.sectionType = MapSection::MAP;
+
+    // The payload is hashed in blocks, only commits are kept in memory
+    std::string strCommit;
+    Checksum checksum;
+    uint64_t nRemaining = record.nSize;
+    while (nRemaining > 0 && is) {
+      const size_t nBlock = std::min<uint64_t>(nRemaining, vBuffer.size());
+      is.read(vBuffer.data(), nBlock);
+      checksum.Update(vBuffer.data(), is.gcount());
+      if (nType == RECORD_COMMIT)
+        strCommit.append(vBuffer.data(), is.gcount());
+      nRemaining -= is.gcount();
+    }
+    // Truncated or corrupted record of an interrupted checkpoint
+    if (nRemaining > 0 || checksum.Digest() != nHash) break;
+    nPos = record.nOffset + record.nSize;
+
+    if (nType == RECORD_HEADER) {
+      pendingHeader = record;
+      bPendingHeader = true;
+    } else if (RecordSectionType(nType, record.sectionType)) {
+      vPending.push_back(record);
+    } else if (nType == RECORD_COMMIT) {
+      if (!bPendingHeader) break;
+      std::vector<MapSection::Key> vKeys;
+      if (!ReadCommit(strCommit, vKeys) ||
+          !ApplyCommit(vRecords, vPending, vKeys))
+        return false;
+
+      header = pendingHeader;
+      vPending.clear();
+      bPendingHeader = false;
+      nCommittedSize = nPos;
+      bCommitted = true;
+    } else {
+      break;
+    }
+  }
+
+  if (!bCommitted) return false;
+  index.header = header;
+  index.vRecords = vRecords;
+  index.nCommittedSize = nCommittedSize;
+  return true;
+}
+
+AtlasLog::AtlasLog(const std::string& strFilename)
+    : mStrFilename(strFilename), mbOpen(false) {}
+
+bool AtlasLog::Write(const Atlas::Checkpoint& checkpoint) {
+  const std::string strTmpFilename = mStrFilename + ".tmp";
+  Index index;
+  {
+    std::ofstream ofs(strTmpFilename, std::ios::binary | std::ios::trunc);
+    WritePrologue(ofs);
+    uint64_t nPos = kPrologueSize;
+    index.header = WriteRecord(ofs, nPos, RECORD_HEADER, 0, 0,
+                               checkpoint.strHeader);
+    std::vector<Record> vWritten;
+    for (const std::shared_ptr<const MapSection>& pSection :
+         checkpoint.vpSections)
+      vWritten.push_back(WriteRecord(ofs, nPos, *pSection));
+    index.nCommittedSize = WriteCommit(ofs, nPos, checkpoint.vSectionKeys);
+    const bool bApplied =
+        ApplyCommit(index.vRecords, vWritten, checkpoint.vSectionKeys);
+
+    ofs.flush();
+    if (!ofs || !bApplied) {
+      std::remove(strTmpFilename.c_str());
+      return false;
+    }
+  }
+
+  if (!SyncAndRename(strTmpFilename, mStrFilename)) return false;
+  mIndex = index;
+  mbOpen = true;
+  return true;
+}
+
+bool AtlasLog::Append(const Atlas::Checkpoint& checkpoint) {
+  if (!mbOpen) return false;
+
+  // Drops the records of an interrupted checkpoint
+  if (truncate(mStrFilename.c_str(), mIndex.nCommittedSize) != 0) return false;
+
+  Index index = mIndex;
+  {
+    std::ofstream ofs(mStrFilename, std::ios::binary | std::ios::app);
+    uint64_t nPos = mIndex.nCommittedSize;
+    index.header = WriteRecord(ofs, nPos, RECORD_HEADER, 0, 0,
+                               checkpoint.strHeader);
+    std::vector<Record> vWritten;
+    for (const std::shared_ptr<const MapSection>& pSection :
+         checkpoint.vpSections)
+      vWritten.push_back(WriteRecord(ofs, nPos, *pSection));
+    index.nCommittedSize = WriteCommit(ofs, nPos, checkpoint.vSectionKeys);
+    const bool bApplied =
+        ApplyCommit(index.vRecords, vWritten, checkpoint.vSectionKeys);
+
+    ofs.flush();
+    if (!ofs || !bApplied) return false;
+  }
+
+  if (!SyncFile(mStrFilename)) return false;
+  mIndex = index;
+  return true;
+}
+
+bool AtlasLog::Compact() {
+  if (!mbOpen) return false;
+
+  const std::string strTmpFilename = mStrFilename + ".tmp";
+  Index index;
+  {
+    std::ifstream ifs(mStrFilename, std::ios::binary);
+    std::ofstream ofs(strTmpFilename, std::ios::binary | std::ios::trunc);
+    WritePrologue(ofs);
+    uint64_t nPos = kPrologueSize;
+
+    // Live records are copied one at a time
+    std::string strPayload;
+    std::vector<Record> vRecords(1, mIndex.header);
+    vRecords.insert(vRecords.end(), mIndex.vRecords.begin(),
+                    mIndex.vRecords.end());
+    for (size_t i = 0; i < vRecords.size(); ++i) {
+      strPayload.resize(vRecords[i].nSize);
+      ifs.seekg(vRecords[i].nOffset);
+      if (!ifs.read(&strPayload[0], strPayload.size())) break;
+
+      if (i == 0) {
+        index.header =
+            WriteRecord(ofs, nPos, RECORD_HEADER, 0, 0, strPayload);
+      } else {
+        index.vRecords.push_back(WriteRecord(
+            ofs, nPos, SectionRecordType(vRecords[i].sectionType),
+            vRecords[i].nMapId, vRecords[i].nChunk, strPayload));
+      }
+    }
+    index.nCommittedSize = WriteCommit(ofs, nPos, RecordKeys(index.vRecords));
+
+    ofs.flush();
+    if (!ifs || !ofs || index.vRecords.size() != mIndex.vRecords.size()) {
+      std::remove(strTmpFilename.c_str());
+      return false;
+    }
+  }
+
+  if (!SyncAndRename(strTmpFilename, mStrFilename)) return false;
+  mIndex = index;
+  return true;
+}
+
+uint64_t AtlasLog::LiveSize() const {
+  // Prologue, header, map sections and commit of a compacted log
+  uint64_t nLiveSize = kPrologueSize + 2 * kRecordHeaderSize +
+                       mIndex.header.nSize +
+                       mIndex.vRecords.size() * kCommitEntrySize;
+  for (const Record& record : mIndex.vRecords)
+    nLiveSize += kRecordHeaderSize + record.nSize;
+  return nLiveSize;
+}
+
+uint64_t AtlasLog::GarbageSize() const {
+  const uint64_t nLiveSize = LiveSize();
+  return mIndex.nCommittedSize > nLiveSize ? mIndex.nCommittedSize - nLiveSize
+                                           : 0;
+}
+
+}  // namespace ORB_SLAM3
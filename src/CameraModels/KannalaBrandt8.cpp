@@ -21,6 +21,7 @@
 
 #include "KannalaBrandt8.h"
 
+#include <algorithm>
 #include <boost/serialization/export.hpp>
 
 // BOOST_CLASS_EXPORT_IMPLEMENT(ORB_SLAM3::KannalaBrandt8)
@@ -29,68 +30,16 @@ namespace ORB_SLAM3 {
 // BOOST_CLASS_EXPORT_GUID(KannalaBrandt8, "KannalaBrandt8")
 
 cv::Point2f KannalaBrandt8::project(const cv::Point3f &p3D) {
-  const float x2_plus_y2 = p3D.x * p3D.x + p3D.y * p3D.y;
-  const float theta = atan2f(sqrtf(x2_plus_y2), p3D.z);
-  const float psi = atan2f(p3D.y, p3D.x);
-
-  const float theta2 = theta * theta;
-  const float theta3 = theta * theta2;
-  const float theta5 = theta3 * theta2;
-  const float theta7 = theta5 * theta2;
-  const float theta9 = theta7 * theta2;
-  const float r = theta + mvParameters[4] * theta3 + mvParameters[5] * theta5 +
-                  mvParameters[6] * theta7 + mvParameters[7] * theta9;
-
-  return cv::Point2f(mvParameters[0] * r * cos(psi) + mvParameters[2],
-                     mvParameters[1] * r * sin(psi) + mvParameters[3]);
+  const Eigen::Vector2f uv = project(Eigen::Vector3f(p3D.x, p3D.y, p3D.z));
+  return cv::Point2f(uv(0), uv(1));
 }
 
 Eigen::Vector2d KannalaBrandt8::project(const Eigen::Vector3d &v3D) {
-  const double x2_plus_y2 = v3D[0] * v3D[0] + v3D[1] * v3D[1];
-  const double theta = atan2f(sqrtf(x2_plus_y2), v3D[2]);
-  const double psi = atan2f(v3D[1], v3D[0]);
-
-  const double theta2 = theta * theta;
-  const double theta3 = theta * theta2;
-  const double theta5 = theta3 * theta2;
-  const double theta7 = theta5 * theta2;
-  const double theta9 = theta7 * theta2;
-  const double r = theta + mvParameters[4] * theta3 + mvParameters[5] * theta5 +
-                   mvParameters[6] * theta7 + mvParameters[7] * theta9;
-
-  Eigen::Vector2d res;
-  res[0] = mvParameters[0] * r * cos(psi) + mvParameters[2];
-  res[1] = mvParameters[1] * r * sin(psi) + mvParameters[3];
-
-  return res;
+  return KannalaBrandt8Model(mvParameters).project(v3D);
 }
 
 Eigen::Vector2f KannalaBrandt8::project(const Eigen::Vector3f &v3D) {
-  const float x2_plus_y2 = v3D[0] * v3D[0] + v3D[1] * v3D[1];
-  const float theta = atan2f(sqrtf(x2_plus_y2), v3D[2]);
-  const float psi = atan2f(v3D[1], v3D[0]);
-
-  const float theta2 = theta * theta;
-  const float theta3 = theta * theta2;
-  const float theta5 = theta3 * theta2;
-  const float theta7 = theta5 * theta2;
-  const float theta9 = theta7 * theta2;
-  const float r = theta + mvParameters[4] * theta3 + mvParameters[5] * theta5 +
-                  mvParameters[6] * theta7 + mvParameters[7] * theta9;
-
-  Eigen::Vector2f res;
-  res[0] = mvParameters[0] * r * cos(psi) + mvParameters[2];
-  res[1] = mvParameters[1] * r * sin(psi) + mvParameters[3];
-
-  return res;
-
-  /*cv::Point2f cvres = this->project(cv::Point3f(v3D[0],v3D[1],v3D[2]));
-
-  Eigen::Vector2d res;
-  res[0] = cvres.x;
-  res[1] = cvres.y;
-
-  return res;*/
+  return KannalaBrandt8Model(mvParameters).project(v3D);
 }
 
 Eigen::Vector2f KannalaBrandt8::projectMat(const cv::Point3f &p3D) {
@@ -113,74 +62,102 @@ Eigen::Vector3f KannalaBrandt8::unprojectEig(const cv::Point2f &p2D) {
   return Eigen::Vector3f(ray.x, ray.y, ray.z);
 }
 
+std::shared_ptr<const KannalaBrandt8::ThetaTable>
+KannalaBrandt8::GetThetaTable() {
+  std::shared_ptr<const ThetaTable> pTable = std::atomic_load(&mpThetaTable);
+  if (pTable && pTable->vParameters == mvParameters) return pTable;
+
+  std::unique_lock<std::mutex> lock(mMutexThetaTable);
+  pTable = std::atomic_load(&mpThetaTable);
+  if (pTable && pTable->vParameters == mvParameters) return pTable;
+
+  std::shared_ptr<ThetaTable> pNewTable = std::make_shared<ThetaTable>();
+  pNewTable->vParameters = mvParameters;
+  pNewTable->vTheta.resize(kThetaTableSize + 1);
+  const double step = CV_PI / 2.0 / kThetaTableSize;
+  pNewTable->fInvStep = 1.0 / step;
+
+  // Use Newthon method to solve for theta with good precision, from the
+  // solution of the previous sample
+  const double k0 = mvParameters[4], k1 = mvParameters[5],
+               k2 = mvParameters[6], k3 = mvParameters[7];
+  double theta = 0.0;
+  for (int i = 0; i <= kThetaTableSize; i++) {
+    const double theta_d = i * step;
+    if (i > 0 && theta == 0.0) theta = theta_d;
+    for (int j = 0; j < 20; j++) {
+      const double theta2 = theta * theta, theta4 = theta2 * theta2,
+                   theta6 = theta4 * theta2, theta8 = theta4 * theta4;
+      const double theta_fix =
+          (theta * (1 + k0 * theta2 + k1 * theta4 + k2 * theta6 +
+                    k3 * theta8) -
+           theta_d) /
+          (1 + 3 * k0 * theta2 + 5 * k1 * theta4 + 7 * k2 * theta6 +
+           9 * k3 * theta8);
+      theta -= theta_fix;
+      if (fabs(theta_fix) < 1e-12) break;
+    }
+    pNewTable->vTheta[i] = theta;
+  }
+
+  pTable = pNewTable;
+  std::atomic_store(&mpThetaTable, pTable);
+  return pTable;
+}
+
+inline float KannalaBrandt8::UnprojectScale(const ThetaTable &table,
+                                            float theta_d) const {
+  if (theta_d <= 1e-8f) return 1.f;
+
+  const float *pTheta = table.vTheta.data();
+  const float fIdx = theta_d * table.fInvStep;
+  const int idx = std::min(static_cast<int>(fIdx), kThetaTableSize - 1);
+  const float w = fIdx - idx;
+  float theta = pTheta[idx] + w * (pTheta[idx + 1] - pTheta[idx]);
+
+  // Polish the interpolation
+  const float *k = table.vParameters.data() + 4;
+  const float theta2 = theta * theta, theta4 = theta2 * theta2,
+              theta6 = theta4 * theta2, theta8 = theta4 * theta4;
+  const float k0_theta2 = k[0] * theta2, k1_theta4 = k[1] * theta4;
+  const float k2_theta6 = k[2] * theta6, k3_theta8 = k[3] * theta8;
+  theta -= (theta * (1 + k0_theta2 + k1_theta4 + k2_theta6 + k3_theta8) -
+            theta_d) /
+           (1 + 3 * k0_theta2 + 5 * k1_theta4 + 7 * k2_theta6 + 9 * k3_theta8);
+
+  return std::tan(theta) / theta_d;
+}
+
 cv::Point3f KannalaBrandt8::unproject(const cv::Point2f &p2D) {
-  // Use Newthon method to solve for theta with good precision (err ~ e-6)
+  std::shared_ptr<const ThetaTable> pTable = GetThetaTable();
   cv::Point2f pw((p2D.x - mvParameters[2]) / mvParameters[0],
                  (p2D.y - mvParameters[3]) / mvParameters[1]);
-  float scale = 1.f;
   float theta_d = sqrtf(pw.x * pw.x + pw.y * pw.y);
-  theta_d = fminf(fmaxf(-CV_PI / 2.f, theta_d), CV_PI / 2.f);
-
-  if (theta_d > 1e-8) {
-    // Compensate distortion iteratively
-    float theta = theta_d;
-
-    for (int j = 0; j < 10; j++) {
-      float theta2 = theta * theta, theta4 = theta2 * theta2,
-            theta6 = theta4 * theta2, theta8 = theta4 * theta4;
-      float k0_theta2 = mvParameters[4] * theta2,
-            k1_theta4 = mvParameters[5] * theta4;
-      float k2_theta6 = mvParameters[6] * theta6,
-            k3_theta8 = mvParameters[7] * theta8;
-      float theta_fix =
-          (theta * (1 + k0_theta2 + k1_theta4 + k2_theta6 + k3_theta8) -
-           theta_d) /
-          (1 + 3 * k0_theta2 + 5 * k1_theta4 + 7 * k2_theta6 + 9 * k3_theta8);
-      theta = theta - theta_fix;
-      if (fabsf(theta_fix) < precision) break;
-    }
-    // scale = theta - theta_d;
-    scale = std::tan(theta) / theta_d;
-  }
+  theta_d = fminf(theta_d, CV_PI / 2.f);
+  const float scale = UnprojectScale(*pTable, theta_d);
 
   return cv::Point3f(pw.x * scale, pw.y * scale, 1.f);
 }
 
+void KannalaBrandt8::unprojectBatch(const std::vector<cv::KeyPoint> &vKeys,
+                                    std::vector<Eigen::Vector3f> &vRays) {
+  std::shared_ptr<const ThetaTable> pTable = GetThetaTable();
+  const float fx = mvParameters[0], fy = mvParameters[1];
+  const float cx = mvParameters[2], cy = mvParameters[3];
+
+  vRays.resize(vKeys.size());
+  for (size_t i = 0; i < vKeys.size(); i++) {
+    const float x = (vKeys[i].pt.x - cx) / fx;
+    const float y = (vKeys[i].pt.y - cy) / fy;
+    const float theta_d = fminf(sqrtf(x * x + y * y), CV_PI / 2.f);
+    const float scale = UnprojectScale(*pTable, theta_d);
+    vRays[i] = Eigen::Vector3f(x * scale, y * scale, 1.f);
+  }
+}
+
 Eigen::Matrix<double, 2, 3> KannalaBrandt8::projectJac(
     const Eigen::Vector3d &v3D) {
-  double x2 = v3D[0] * v3D[0], y2 = v3D[1] * v3D[1], z2 = v3D[2] * v3D[2];
-  double r2 = x2 + y2;
-  double r = sqrt(r2);
-  double r3 = r2 * r;
-  double theta = atan2(r, v3D[2]);
-
-  double theta2 = theta * theta, theta3 = theta2 * theta;
-  double theta4 = theta2 * theta2, theta5 = theta4 * theta;
-  double theta6 = theta2 * theta4, theta7 = theta6 * theta;
-  double theta8 = theta4 * theta4, theta9 = theta8 * theta;
-
-  double f = theta + theta3 * mvParameters[4] + theta5 * mvParameters[5] +
-             theta7 * mvParameters[6] + theta9 * mvParameters[7];
-  double fd = 1 + 3 * mvParameters[4] * theta2 + 5 * mvParameters[5] * theta4 +
-              7 * mvParameters[6] * theta6 + 9 * mvParameters[7] * theta8;
-
-  Eigen::Matrix<double, 2, 3> JacGood;
-  JacGood(0, 0) =
-      mvParameters[0] * (fd * v3D[2] * x2 / (r2 * (r2 + z2)) + f * y2 / r3);
-  JacGood(1, 0) =
-      mvParameters[1] * (fd * v3D[2] * v3D[1] * v3D[0] / (r2 * (r2 + z2)) -
-                         f * v3D[1] * v3D[0] / r3);
-
-  JacGood(0, 1) =
-      mvParameters[0] * (fd * v3D[2] * v3D[1] * v3D[0] / (r2 * (r2 + z2)) -
-                         f * v3D[1] * v3D[0] / r3);
-  JacGood(1, 1) =
-      mvParameters[1] * (fd * v3D[2] * y2 / (r2 * (r2 + z2)) + f * x2 / r3);
-
-  JacGood(0, 2) = -mvParameters[0] * fd * v3D[0] / (r2 + z2);
-  JacGood(1, 2) = -mvParameters[1] * fd * v3D[1] / (r2 + z2);
-
-  return JacGood;
+  return KannalaBrandt8Model(mvParameters).projectJac(v3D);
 }
 
 bool KannalaBrandt8::ReconstructWithTwoViews(
@@ -235,6 +212,16 @@ bool KannalaBrandt8::epipolarConstrain(
                                   p3D) > 0.0001f;
 }
 
+bool KannalaBrandt8::epipolarConstrain(
+    GeometricCamera *pCamera2, const cv::KeyPoint &kp1, const cv::KeyPoint &kp2,
+    const Eigen::Vector3f &r1, const Eigen::Vector3f &r2,
+    const Eigen::Matrix3f &R12, const Eigen::Vector3f &t12,
+    const float sigmaLevel, const float unc) {
+  Eigen::Vector3f p3D;
+  return this->TriangulateMatches(pCamera2, kp1, kp2, r1, r2, R12, t12,
+                                  sigmaLevel, unc, p3D) > 0.0001f;
+}
+
 bool KannalaBrandt8::matchAndtriangulate(
     const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, GeometricCamera *pOther,
     Sophus::SE3f &Tcw1, Sophus::SE3f &Tcw2, const float sigmaLevel1,
@@ -324,9 +311,16 @@ float KannalaBrandt8::TriangulateMatches(
     GeometricCamera *pCamera2, const cv::KeyPoint &kp1, const cv::KeyPoint &kp2,
     const Eigen::Matrix3f &R12, const Eigen::Vector3f &t12,
     const float sigmaLevel, const float unc, Eigen::Vector3f &p3D) {
-  Eigen::Vector3f r1 = this->unprojectEig(kp1.pt);
-  Eigen::Vector3f r2 = pCamera2->unprojectEig(kp2.pt);
+  return TriangulateMatches(pCamera2, kp1, kp2, this->unprojectEig(kp1.pt),
+                            pCamera2->unprojectEig(kp2.pt), R12, t12,
+                            sigmaLevel, unc, p3D);
+}
 
+float KannalaBrandt8::TriangulateMatches(
+    GeometricCamera *pCamera2, const cv::KeyPoint &kp1, const cv::KeyPoint &kp2,
+    const Eigen::Vector3f &r1, const Eigen::Vector3f &r2,
+    const Eigen::Matrix3f &R12, const Eigen::Vector3f &t12,
+    const float sigmaLevel, const float unc, Eigen::Vector3f &p3D) {
   // Check parallax
   Eigen::Vector3f r21 = R12 * r2;
 
@@ -28,27 +28,19 @@
 namespace ORB_SLAM3 {
 // BOOST_CLASS_EXPORT_GUID(Pinhole, "Pinhole")
 
-long unsigned int GeometricCamera::nNextId = 0;
+IdCounter GeometricCamera::nNextId;
 
 cv::Point2f Pinhole::project(const cv::Point3f &p3D) {
-  return cv::Point2f(mvParameters[0] * p3D.x / p3D.z + mvParameters[2],
-                     mvParameters[1] * p3D.y / p3D.z + mvParameters[3]);
+  const Eigen::Vector2f uv = project(Eigen::Vector3f(p3D.x, p3D.y, p3D.z));
+  return cv::Point2f(uv(0), uv(1));
 }
 
 Eigen::Vector2d Pinhole::project(const Eigen::Vector3d &v3D) {
-  Eigen::Vector2d res;
-  res[0] = mvParameters[0] * v3D[0] / v3D[2] + mvParameters[2];
-  res[1] = mvParameters[1] * v3D[1] / v3D[2] + mvParameters[3];
-
-  return res;
+  return PinholeModel(mvParameters).project(v3D);
 }
 
 Eigen::Vector2f Pinhole::project(const Eigen::Vector3f &v3D) {
-  Eigen::Vector2f res;
-  res[0] = mvParameters[0] * v3D[0] / v3D[2] + mvParameters[2];
-  res[1] = mvParameters[1] * v3D[1] / v3D[2] + mvParameters[3];
-
-  return res;
+  return PinholeModel(mvParameters).project(v3D);
 }
 
 Eigen::Vector2f Pinhole::projectMat(const cv::Point3f &p3D) {
@@ -71,15 +63,7 @@ cv::Point3f Pinhole::unproject(const cv::Point2f &p2D) {
 }
 
 Eigen::Matrix<double, 2, 3> Pinhole::projectJac(const Eigen::Vector3d &v3D) {
-  Eigen::Matrix<double, 2, 3> Jac;
-  Jac(0, 0) = mvParameters[0] / v3D[2];
-  Jac(0, 1) = 0.f;
-  Jac(0, 2) = -mvParameters[0] * v3D[0] / (v3D[2] * v3D[2]);
-  Jac(1, 0) = 0.f;
-  Jac(1, 1) = mvParameters[1] / v3D[2];
-  Jac(1, 2) = -mvParameters[1] * v3D[1] / (v3D[2] * v3D[2]);
-
-  return Jac;
+  return PinholeModel(mvParameters).projectJac(v3D);
 }
 
 bool Pinhole::ReconstructWithTwoViews(const std::vector<cv::KeyPoint> &vKeys1,
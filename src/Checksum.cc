@@ -0,0 +1,186 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Checksum.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+namespace ORB_SLAM3 {
+
+static const uint64_t kPrime1 = 11400714785074694791ULL;
+static const uint64_t kPrime2 = 14029467366897019727ULL;
+static const uint64_t kPrime3 = 1609587929392839161ULL;
+static const uint64_t kPrime4 = 9650029242287828579ULL;
+static const uint64_t kPrime5 = 2870177450012600261ULL;
+
+static inline uint64_t RotateLeft(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t Read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = RotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+static inline uint64_t MergeRound(uint64_t acc, uint64_t val) {
+  acc ^= Round(0, val);
+  return acc * kPrime1 + kPrime4;
+}
+
+Checksum::Checksum(uint64_t seed)
+    : mSeed(seed), mnTotalLength(0), mnBufferSize(0) {
+  mAcc[0] = seed + kPrime1 + kPrime2;
+  mAcc[1] = seed + kPrime2;
+  mAcc[2] = seed;
+  mAcc[3] = seed - kPrime1;
+}
+
+void Checksum::Update(const void* pData, size_t nLength) {
+  const unsigned char* p = static_cast<const unsigned char*>(pData);
+  const unsigned char* const pEnd = p + nLength;
+  mnTotalLength += nLength;
+
+  if (mnBufferSize + nLength < 32) {
+    memcpy(mBuffer + mnBufferSize, p, nLength);
+    mnBufferSize += nLength;
+    return;
+  }
+
+  if (mnBufferSize > 0) {
+    const size_t nFill = 32 - mnBufferSize;
+    memcpy(mBuffer + mnBufferSize, p, nFill);
+    for (int i = 0; i < 4; ++i)
+      mAcc[i] = Round(mAcc[i], Read64(mBuffer + 8 * i));
+    p += nFill;
+    mnBufferSize = 0;
+  }
+
+  // Stripes of 32 bytes, the 4 lanes are independent
+  for (; p + 32 <= pEnd; p += 32) {
+    mAcc[0] = Round(mAcc[0], Read64(p));
+    mAcc[1] = Round(mAcc[1], Read64(p + 8));
+    mAcc[2] = Round(mAcc[2], Read64(p + 16));
+    mAcc[3] = Round(mAcc[3], Read64(p + 24));
+  }
+
+  if (p < pEnd) {
+    mnBufferSize = pEnd - p;
+    memcpy(mBuffer, p, mnBufferSize);
+  }
+}
+
+uint64_t Checksum::Digest() const {
+  uint64_t h;
+  if (mnTotalLength >= 32) {
+    h = RotateLeft(mAcc[0], 1) + RotateLeft(mAcc[1], 7) +
+        RotateLeft(mAcc[2], 12) + RotateLeft(mAcc[3], 18);
+    for (int i = 0; i < 4; ++i) h = MergeRound(h, mAcc[i]);
+  } else {
+    h = mSeed + kPrime5;
+  }
+  h += mnTotalLength;
+
+  const unsigned char* p = mBuffer;
+  const unsigned char* const pEnd = mBuffer + mnBufferSize;
+  for (; p + 8 <= pEnd; p += 8) {
+    h ^= Round(0, Read64(p));
+    h = RotateLeft(h, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= pEnd) {
+    h ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+    h = RotateLeft(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < pEnd; ++p) {
+    h ^= (*p) * kPrime5;
+    h = RotateLeft(h, 11) * kPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+std::string Checksum::HexDigest() const {
+  char aux[17];
+  snprintf(aux, sizeof(aux), "%016llx",
+           static_cast<unsigned long long>(Digest()));
+  return std::string(aux);
+}
+
+std::string Checksum::FileChecksum(const std::string& strFilename,
+                                   long long nLength) {
+  std::ifstream f(strFilename.c_str(), std::ios::in | std::ios::binary);
+  if (!f.is_open()) return std::string();
+
+  Checksum checksum;
+  std::vector<char> vBuffer(1 << 22);
+  while (f && nLength != 0) {
+    std::streamsize nRequest = vBuffer.size();
+    if (nLength > 0) nRequest = std::min<long long>(nRequest, nLength);
+    f.read(vBuffer.data(), nRequest);
+    const std::streamsize nRead = f.gcount();
+    if (nRead <= 0) break;
+    checksum.Update(vBuffer.data(), nRead);
+    if (nLength > 0) nLength -= nRead;
+  }
+
+  if (nLength > 0) return std::string();  // Shorter than expected
+  return checksum.HexDigest();
+}
+
+ChecksumStreamBuf::int_type ChecksumStreamBuf::overflow(int_type c) {
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  const char ch = traits_type::to_char_type(c);
+  mChecksum.Update(&ch, 1);
+  return mpSink->sputc(ch);
+}
+
+std::streamsize ChecksumStreamBuf::xsputn(const char* s, std::streamsize n) {
+  mChecksum.Update(s, n);
+  return mpSink->sputn(s, n);
+}
+
+int ChecksumStreamBuf::sync() { return mpSink->pubsync(); }
+
+}  // namespace ORB_SLAM3
@@ -0,0 +1,169 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DescriptorMedoid.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "KeyFrame.h"
+
+namespace ORB_SLAM3 {
+
+// Distances from one descriptor to n consecutive ones. The loop has no
+// branches so the compiler can vectorise the popcounts.
+static void HammingDistances(const uint64_t* pA, const uint64_t* pB, size_t n,
+                             uint8_t* pDist) {
+  for (size_t i = 0; i < n; i++, pB += 4) {
+    const int dist =
+        __builtin_popcountll(pA[0] ^ pB[0]) +
+        __builtin_popcountll(pA[1] ^ pB[1]) +
+        __builtin_popcountll(pA[2] ^ pB[2]) +
+        __builtin_popcountll(pA[3] ^ pB[3]);
+    pDist[i] = static_cast<uint8_t>(std::min(dist, 255));
+  }
+}
+
+// Copies the vector into an allocation of exactly nCapacity elements
+template <class T>
+static void Reallocate(std::vector<T>& v, size_t nCapacity) {
+  std::vector<T> vNew;
+  vNew.reserve(nCapacity);
+  vNew.assign(v.begin(), v.end());
+  v.swap(vNew);
+}
+
+DescriptorMedoid::DescriptorMedoid() : mnCapacity(0), mnMedoid(-1) {}
+
+void DescriptorMedoid::Update(std::vector<Feature> vFeatures) {
+  std::sort(vFeatures.begin(), vFeatures.end());
+
+  // Backwards, so the element swapped into a removed slot is already checked
+  for (size_t i = mvFeatures.size(); i-- > 0;) {
+    if (!std::binary_search(vFeatures.begin(), vFeatures.end(), mvFeatures[i]))
+      Erase(i);
+  }
+
+  std::vector<Feature> vCurrent = mvFeatures;
+  std::sort(vCurrent.begin(), vCurrent.end());
+  for (const Feature& feature : vFeatures) {
+    if (!std::binary_search(vCurrent.begin(), vCurrent.end(), feature))
+      Insert(feature);
+  }
+}
+
+cv::Mat DescriptorMedoid::ComputeMedoid() {
+  const size_t N = mvFeatures.size();
+  if (N == 0) return cv::Mat();
+
+  if (mnMedoid < 0) {
+    // Take the descriptor with least median distance to the rest
+    std::vector<uint8_t> vDists(N);
+    const size_t nMedian = 0.5 * (N - 1);
+    int BestMedian = INT_MAX;
+    int BestIdx = 0;
+    for (size_t i = 0; i < N; i++) {
+      const uint8_t* pRow = mvDistances.data() + Pair(i, 0);
+      std::copy(pRow, pRow + i, vDists.begin());
+      vDists[i] = 0;
+      for (size_t j = i + 1; j < N; j++) vDists[j] = mvDistances[Pair(i, j)];
+      std::nth_element(vDists.begin(), vDists.begin() + nMedian, vDists.end());
+      const int median = vDists[nMedian];
+
+      if (median < BestMedian) {
+        BestMedian = median;
+        BestIdx = i;
+      }
+    }
+    mnMedoid = BestIdx;
+  }
+
+  cv::Mat descriptor(1, kBytes, CV_8U);
+  std::memcpy(descriptor.data, &mvDescriptors[mnMedoid * kWords],
+              kBytes);
+  return descriptor;
+}
+
+void DescriptorMedoid::Clear() {
+  std::vector<Feature>().swap(mvFeatures);
+  std::vector<uint64_t>().swap(mvDescriptors);
+  std::vector<uint8_t>().swap(mvDistances);
+  mnCapacity = 0;
+  mnMedoid = -1;
+}
+
+void DescriptorMedoid::Insert(const Feature& feature) {
+  KeyFrame::ScopedPin pin(feature.first);
+  const cv::Mat& descriptors = feature.first->mDescriptors;
+  // Lost if the spill file of the keyframe could not be read
+  if (descriptors.empty()) return;
+  CV_Assert(descriptors.type() == CV_8U &&
+            descriptors.cols == kBytes);
+
+  const size_t n = mvFeatures.size();
+  if (n == mnCapacity) Reserve(std::max<size_t>(8, 2 * mnCapacity));
+
+  mvFeatures.push_back(feature);
+  mvDescriptors.resize((n + 1) * kWords);
+  uint64_t* pDescriptor = &mvDescriptors[n * kWords];
+  std::memcpy(pDescriptor, descriptors.ptr(feature.second),
+              kBytes);
+
+  mvDistances.resize(mvDistances.size() + n);
+  HammingDistances(pDescriptor, mvDescriptors.data(), n,
+                   mvDistances.data() + Pair(n, 0));
+
+  mnMedoid = -1;
+}
+
+void DescriptorMedoid::Erase(size_t i) {
+  const size_t last = mvFeatures.size() - 1;
+  if (i != last) {
+    // Move the last element into the slot, its row is the last one of the
+    // triangle
+    mvFeatures[i] = mvFeatures[last];
+    const uint64_t* pLast = &mvDescriptors[last * kWords];
+    std::copy(pLast, pLast + kWords, &mvDescriptors[i * kWords]);
+    const uint8_t* pLastRow = mvDistances.data() + Pair(last, 0);
+    for (size_t j = 0; j < last; j++) {
+      if (j != i) mvDistances[Pair(i, j)] = pLastRow[j];
+    }
+  }
+
+  mvFeatures.pop_back();
+  mvDescriptors.resize(last * kWords);
+  mvDistances.resize(mvDistances.size() - last);
+  mnMedoid = -1;
+
+  // Points lose most of their observations when keyframes are culled
+  if (mnCapacity > 8 && 4 * last <= mnCapacity)
+    Reserve(std::max<size_t>(8, 2 * last));
+}
+
+void DescriptorMedoid::Reserve(size_t nCapacity) {
+  Reallocate(mvFeatures, nCapacity);
+  Reallocate(mvDescriptors, nCapacity * kWords);
+  Reallocate(mvDistances, nCapacity * (nCapacity - 1) / 2);
+  mnCapacity = nCapacity;
+}
+
+}  // namespace ORB_SLAM3
@@ -36,15 +36,6 @@
 
 namespace ORB_SLAM3 {
 
-long unsigned int Frame::nNextId = 0;
-bool Frame::mbInitialComputations = true;
-float Frame::cx, Frame::cy, Frame::fx, Frame::fy, Frame::invfx, Frame::invfy;
-float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
-float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
-
-// For stereo fisheye matching
-cv::BFMatcher Frame::BFmatcher = cv::BFMatcher(cv::NORM_HAMMING);
-
 Frame::Frame()
     : mpcpi(NULL),
       mbHasPose(false),
@@ -52,6 +43,7 @@ Frame::Frame()
       mpImuPreintegrated(NULL),
       mpPrevFrame(NULL),
       mpImuPreintegratedFrame(NULL),
+      mnId(0),
       mpReferenceKF(static_cast<KeyFrame *>(NULL)),
       mbIsSet(false),
       mbImuPreintegrated(false) {
@@ -77,6 +69,12 @@ Frame::Frame(const Frame &frame)
       mTimeStamp(frame.mTimeStamp),
       mK(frame.mK.clone()),
       mK_(Converter::toMatrix3f(frame.mK)),
+      fx(frame.fx),
+      fy(frame.fy),
+      cx(frame.cx),
+      cy(frame.cy),
+      invfx(frame.invfx),
+      invfy(frame.invfy),
       mDistCoef(frame.mDistCoef.clone()),
       mbf(frame.mbf),
       mb(frame.mb),
@@ -94,6 +92,8 @@ Frame::Frame(const Frame &frame)
       mDescriptorsRight(frame.mDescriptorsRight.clone()),
       mvbOutlier(frame.mvbOutlier),
       mnCloseMPs(frame.mnCloseMPs),
+      mfGridElementWidthInv(frame.mfGridElementWidthInv),
+      mfGridElementHeightInv(frame.mfGridElementHeightInv),
       mPredBias(frame.mPredBias),
       mImuBias(frame.mImuBias),
       mImuCalib(frame.mImuCalib),
@@ -110,6 +110,10 @@ Frame::Frame(const Frame &frame)
       mvInvScaleFactors(frame.mvInvScaleFactors),
       mvLevelSigma2(frame.mvLevelSigma2),
       mvInvLevelSigma2(frame.mvInvLevelSigma2),
+      mnMinX(frame.mnMinX),
+      mnMaxX(frame.mnMaxX),
+      mnMinY(frame.mnMinY),
+      mnMaxY(frame.mnMaxY),
       mNameFile(frame.mNameFile),
       mnDataset(frame.mnDataset),
       mbIsSet(frame.mbIsSet),
@@ -123,7 +127,8 @@ Frame::Frame(const Frame &frame)
       monoRight(frame.monoRight),
       mvLeftToRightMatch(frame.mvLeftToRightMatch),
       mvRightToLeftMatch(frame.mvRightToLeftMatch),
-      mvStereo3Dpoints(frame.mvStereo3Dpoints) {
+      mvStereo3Dpoints(frame.mvStereo3Dpoints),
+      mvBearings(frame.mvBearings) {
   for (int i = 0; i < FRAME_GRID_COLS; i++)
     for (int j = 0; j < FRAME_GRID_ROWS; j++) {
       mGrid[i][j] = frame.mGrid[i][j];
@@ -149,7 +154,7 @@ Frame::Frame(const Frame &frame)
 
 Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
              const double &timeStamp, ORBextractor *extractorLeft,
-             ORBextractor *extractorRight, ORBVocabulary *voc, cv::Mat &K,
+             ORBextractor *extractorRight, const ORBVocabulary *voc, cv::Mat &K,
              cv::Mat &distCoef, const float &bf, const float &thDepth,
              GeometricCamera *pCamera, Frame *pPrevF,
              const IMU::Calib &ImuCalib)
@@ -169,13 +174,28 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
       mpImuPreintegrated(NULL),
       mpPrevFrame(pPrevF),
       mpImuPreintegratedFrame(NULL),
+      mnId(0),
       mpReferenceKF(static_cast<KeyFrame *>(NULL)),
       mbIsSet(false),
       mbImuPreintegrated(false),
       mpCamera(pCamera),
       mpCamera2(nullptr) {
-  // Frame ID
-  mnId = nNextId++;
+  // Calibration and undistorted image bounds of this frame
+  ComputeImageBounds(imLeft);
+
+  mfGridElementWidthInv =
+      static_cast<float>(FRAME_GRID_COLS) / (mnMaxX - mnMinX);
+  mfGridElementHeightInv =
+      static_cast<float>(FRAME_GRID_ROWS) / (mnMaxY - mnMinY);
+
+  fx = K.at<float>(0, 0);
+  fy = K.at<float>(1, 1);
+  cx = K.at<float>(0, 2);
+  cy = K.at<float>(1, 2);
+  invfx = 1.0f / fx;
+  invfy = 1.0f / fy;
+
+  mb = mbf / fx;
 
   // Scale Level Info
   mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -230,28 +250,6 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
   mmProjectPoints.clear();
   mmMatchedInImage.clear();
 
-  // This is done only for the first Frame (or after a change in the
-  // calibration)
-  if (mbInitialComputations) {
-    ComputeImageBounds(imLeft);
-
-    mfGridElementWidthInv =
-        static_cast<float>(FRAME_GRID_COLS) / (mnMaxX - mnMinX);
-    mfGridElementHeightInv =
-        static_cast<float>(FRAME_GRID_ROWS) / (mnMaxY - mnMinY);
-
-    fx = K.at<float>(0, 0);
-    fy = K.at<float>(1, 1);
-    cx = K.at<float>(0, 2);
-    cy = K.at<float>(1, 2);
-    invfx = 1.0f / fx;
-    invfy = 1.0f / fy;
-
-    mbInitialComputations = false;
-  }
-
-  mb = mbf / fx;
-
   if (pPrevF) {
     if (pPrevF->HasVelocity()) SetVelocity(pPrevF->GetVelocity());
   } else {
@@ -274,9 +272,9 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
 
 Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth,
              const double &timeStamp, ORBextractor *extractor,
-             ORBVocabulary *voc, cv::Mat &K, cv::Mat &distCoef, const float &bf,
-             const float &thDepth, GeometricCamera *pCamera, Frame *pPrevF,
-             const IMU::Calib &ImuCalib)
+             const ORBVocabulary *voc, cv::Mat &K, cv::Mat &distCoef,
+             const float &bf, const float &thDepth, GeometricCamera *pCamera,
+             Frame *pPrevF, const IMU::Calib &ImuCalib)
     : mpcpi(NULL),
       mbHasPose(false),
       mbHasVelocity(false),
@@ -293,13 +291,28 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth,
       mpImuPreintegrated(NULL),
       mpPrevFrame(pPrevF),
       mpImuPreintegratedFrame(NULL),
+      mnId(0),
       mpReferenceKF(static_cast<KeyFrame *>(NULL)),
       mbIsSet(false),
       mbImuPreintegrated(false),
       mpCamera(pCamera),
       mpCamera2(nullptr) {
-  // Frame ID
-  mnId = nNextId++;
+  // Calibration and undistorted image bounds of this frame
+  ComputeImageBounds(imGray);
+
+  mfGridElementWidthInv = static_cast<float>(FRAME_GRID_COLS) /
+                          static_cast<float>(mnMaxX - mnMinX);
+  mfGridElementHeightInv = static_cast<float>(FRAME_GRID_ROWS) /
+                           static_cast<float>(mnMaxY - mnMinY);
+
+  fx = K.at<float>(0, 0);
+  fy = K.at<float>(1, 1);
+  cx = K.at<float>(0, 2);
+  cy = K.at<float>(1, 2);
+  invfx = 1.0f / fx;
+  invfy = 1.0f / fy;
+
+  mb = mbf / fx;
 
   // Scale Level Info
   mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -341,28 +354,6 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth,
 
   mvbOutlier = vector<bool>(N, false);
 
-  // This is done only for the first Frame (or after a change in the
-  // calibration)
-  if (mbInitialComputations) {
-    ComputeImageBounds(imGray);
-
-    mfGridElementWidthInv = static_cast<float>(FRAME_GRID_COLS) /
-                            static_cast<float>(mnMaxX - mnMinX);
-    mfGridElementHeightInv = static_cast<float>(FRAME_GRID_ROWS) /
-                             static_cast<float>(mnMaxY - mnMinY);
-
-    fx = K.at<float>(0, 0);
-    fy = K.at<float>(1, 1);
-    cx = K.at<float>(0, 2);
-    cy = K.at<float>(1, 2);
-    invfx = 1.0f / fx;
-    invfy = 1.0f / fy;
-
-    mbInitialComputations = false;
-  }
-
-  mb = mbf / fx;
-
   if (pPrevF) {
     if (pPrevF->HasVelocity()) SetVelocity(pPrevF->GetVelocity());
   } else {
@@ -384,7 +375,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth,
 }
 
 Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
-             ORBextractor *extractor, ORBVocabulary *voc,
+             ORBextractor *extractor, const ORBVocabulary *voc,
              GeometricCamera *pCamera, cv::Mat &distCoef, const float &bf,
              const float &thDepth, Frame *pPrevF, const IMU::Calib &ImuCalib)
     : mpcpi(NULL),
@@ -403,13 +394,28 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
       mpImuPreintegrated(NULL),
       mpPrevFrame(pPrevF),
       mpImuPreintegratedFrame(NULL),
+      mnId(0),
       mpReferenceKF(static_cast<KeyFrame *>(NULL)),
       mbIsSet(false),
       mbImuPreintegrated(false),
       mpCamera(pCamera),
       mpCamera2(nullptr) {
-  // Frame ID
-  mnId = nNextId++;
+  // Calibration and undistorted image bounds of this frame
+  ComputeImageBounds(imGray);
+
+  mfGridElementWidthInv = static_cast<float>(FRAME_GRID_COLS) /
+                          static_cast<float>(mnMaxX - mnMinX);
+  mfGridElementHeightInv = static_cast<float>(FRAME_GRID_ROWS) /
+                           static_cast<float>(mnMaxY - mnMinY);
+
+  fx = mpCamera->getParameter(0);
+  fy = mpCamera->getParameter(1);
+  cx = mpCamera->getParameter(2);
+  cy = mpCamera->getParameter(3);
+  invfx = 1.0f / fx;
+  invfy = 1.0f / fy;
+
+  mb = mbf / fx;
 
   // Scale Level Info
   mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -454,28 +460,6 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
 
   mvbOutlier = vector<bool>(N, false);
 
-  // This is done only for the first Frame (or after a change in the
-  // calibration)
-  if (mbInitialComputations) {
-    ComputeImageBounds(imGray);
-
-    mfGridElementWidthInv = static_cast<float>(FRAME_GRID_COLS) /
-                            static_cast<float>(mnMaxX - mnMinX);
-    mfGridElementHeightInv = static_cast<float>(FRAME_GRID_ROWS) /
-                             static_cast<float>(mnMaxY - mnMinY);
-
-    fx = static_cast<Pinhole *>(mpCamera)->toK().at<float>(0, 0);
-    fy = static_cast<Pinhole *>(mpCamera)->toK().at<float>(1, 1);
-    cx = static_cast<Pinhole *>(mpCamera)->toK().at<float>(0, 2);
-    cy = static_cast<Pinhole *>(mpCamera)->toK().at<float>(1, 2);
-    invfx = 1.0f / fx;
-    invfy = 1.0f / fy;
-
-    mbInitialComputations = false;
-  }
-
-  mb = mbf / fx;
-
   // Set no stereo fisheye information
   Nleft = -1;
   Nright = -1;
@@ -609,6 +593,14 @@ Eigen::Vector3f Frame::GetRelativePoseTlr_translation() {
 }
 
 bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit) {
+  return mpCamera->Visit([&](const auto &camera) {
+    return isInFrustum(pMP, viewingCosLimit, camera);
+  });
+}
+
+template <typename CameraModel>
+bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit,
+                        const CameraModel &camera) {
   if (Nleft == -1) {
     pMP->mbTrackInView = false;
     pMP->mTrackProjX = -1;
@@ -626,7 +618,7 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit) {
     const float invz = 1.0f / PcZ;
     if (PcZ < 0.0f) return false;
 
-    const Eigen::Vector2f uv = mpCamera->project(Pc);
+    const Eigen::Vector2f uv = camera.project(Pc);
 
     if (uv(0) < mnMinX || uv(0) > mnMaxX) return false;
     if (uv(1) < mnMinY || uv(1) > mnMaxY) return false;
@@ -677,6 +669,11 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit) {
   }
 }
 
+template bool Frame::isInFrustum<PinholeModel>(MapPoint *, float,
+                                               const PinholeModel &);
+template bool Frame::isInFrustum<KannalaBrandt8Model>(
+    MapPoint *, float, const KannalaBrandt8Model &);
+
 bool Frame::ProjectPointDistort(MapPoint *pMP, cv::Point2f &kp, float &u,
                                 float &v) {
   // 3D in absolute coordinates
@@ -1092,7 +1089,7 @@ void Frame::setIntegrated() {
 
 Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
              const double &timeStamp, ORBextractor *extractorLeft,
-             ORBextractor *extractorRight, ORBVocabulary *voc, cv::Mat &K,
+             ORBextractor *extractorRight, const ORBVocabulary *voc, cv::Mat &K,
              cv::Mat &distCoef, const float &bf, const float &thDepth,
              GeometricCamera *pCamera, GeometricCamera *pCamera2,
              Sophus::SE3f &Tlr, Frame *pPrevF, const IMU::Calib &ImuCalib)
@@ -1112,6 +1109,7 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
       mpImuPreintegrated(NULL),
       mpPrevFrame(pPrevF),
       mpImuPreintegratedFrame(NULL),
+      mnId(0),
       mpReferenceKF(static_cast<KeyFrame *>(NULL)),
       mbImuPreintegrated(false),
       mpCamera(pCamera),
@@ -1121,8 +1119,22 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
   imgLeft = imLeft.clone();
   imgRight = imRight.clone();
 
-  // Frame ID
-  mnId = nNextId++;
+  // Calibration and undistorted image bounds of this frame
+  ComputeImageBounds(imLeft);
+
+  mfGridElementWidthInv =
+      static_cast<float>(FRAME_GRID_COLS) / (mnMaxX - mnMinX);
+  mfGridElementHeightInv =
+      static_cast<float>(FRAME_GRID_ROWS) / (mnMaxY - mnMinY);
+
+  fx = K.at<float>(0, 0);
+  fy = K.at<float>(1, 1);
+  cx = K.at<float>(0, 2);
+  cy = K.at<float>(1, 2);
+  invfx = 1.0f / fx;
+  invfy = 1.0f / fy;
+
+  mb = mbf / fx;
 
   // Scale Level Info
   mnScaleLevels = mpORBextractorLeft->GetLevels();
@@ -1163,28 +1175,6 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
 
   if (N == 0) return;
 
-  // This is done only for the first Frame (or after a change in the
-  // calibration)
-  if (mbInitialComputations) {
-    ComputeImageBounds(imLeft);
-
-    mfGridElementWidthInv =
-        static_cast<float>(FRAME_GRID_COLS) / (mnMaxX - mnMinX);
-    mfGridElementHeightInv =
-        static_cast<float>(FRAME_GRID_ROWS) / (mnMaxY - mnMinY);
-
-    fx = K.at<float>(0, 0);
-    fy = K.at<float>(1, 1);
-    cx = K.at<float>(0, 2);
-    cy = K.at<float>(1, 2);
-    invfx = 1.0f / fx;
-    invfy = 1.0f / fy;
-
-    mbInitialComputations = false;
-  }
-
-  mb = mbf / fx;
-
   // Sophus/Eigen
   mTlr = Tlr;
   mTrl = mTlr.inverse();
@@ -1220,6 +1210,12 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight,
 }
 
 void Frame::ComputeStereoFishEyeMatches() {
+  mpCamera->unprojectBatch(mvKeys, mvBearings);
+  vector<Eigen::Vector3f> vBearingsRight;
+  mpCamera2->unprojectBatch(mvKeysRight, vBearingsRight);
+  mvBearings.insert(mvBearings.end(), vBearingsRight.begin(),
+                    vBearingsRight.end());
+
   // Speed it up by matching keypoints in the lapping area
   vector<cv::KeyPoint> stereoLeft(mvKeys.begin() + monoLeft, mvKeys.end());
   vector<cv::KeyPoint> stereoRight(mvKeysRight.begin() + monoRight,
@@ -1239,6 +1235,7 @@ void Frame::ComputeStereoFishEyeMatches() {
   // Perform a brute force between Keypoint in the left and right image
   vector<vector<cv::DMatch>> matches;
 
+  cv::BFMatcher BFmatcher(cv::NORM_HAMMING);
   BFmatcher.knnMatch(stereoDescLeft, stereoDescRight, matches, 2);
 
   int nMatches = 0;
@@ -1252,14 +1249,14 @@ void Frame::ComputeStereoFishEyeMatches() {
       // spurious matches
       Eigen::Vector3f p3D;
       descMatches++;
-      float
-          sigma1 = mvLevelSigma2[mvKeys[(*it)[0].queryIdx + monoLeft].octave],
-          sigma2 =
-              mvLevelSigma2[mvKeysRight[(*it)[0].trainIdx + monoRight].octave];
+      const int idxLeft = (*it)[0].queryIdx + monoLeft;
+      const int idxRight = (*it)[0].trainIdx + monoRight;
+      float sigma1 = mvLevelSigma2[mvKeys[idxLeft].octave],
+            sigma2 = mvLevelSigma2[mvKeysRight[idxRight].octave];
       float depth = static_cast<KannalaBrandt8 *>(mpCamera)->TriangulateMatches(
-          mpCamera2, mvKeys[(*it)[0].queryIdx + monoLeft],
-          mvKeysRight[(*it)[0].trainIdx + monoRight], mRlr, mtlr, sigma1,
-          sigma2, p3D);
+          mpCamera2, mvKeys[idxLeft], mvKeysRight[idxRight],
+          mvBearings[idxLeft], mvBearings[Nleft + idxRight], mRlr, mtlr,
+          sigma1, sigma2, p3D);
       if (depth > 0.0001f) {
         mvLeftToRightMatch[(*it)[0].queryIdx + monoLeft] =
             (*it)[0].trainIdx + monoRight;
@@ -21,7 +21,7 @@
 
 #include "FrameDrawer.h"
 
-#include <mutex>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include "ImprovedTypes.hpp"
 #include "MapPoint.h"
@@ -30,247 +30,120 @@
 
 namespace ORB_SLAM3 {
 
-FrameDrawer::FrameDrawer(const Atlas_ptr &pAtlas) : both(false), mpAtlas(pAtlas) {
-  mState = Tracker::SYSTEM_NOT_READY;
-  mIm = cv::Mat(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
-  mImRight = cv::Mat(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
+FrameDrawer::FrameDrawer(const Atlas_ptr &pAtlas)
+    : both(false), mpAtlas(pAtlas), mbImageRequested(true) {
+  std::shared_ptr<FrameRecord> pRecord = std::make_shared<FrameRecord>();
+  pRecord->nState = Tracker::SYSTEM_NOT_READY;
+  pRecord->bOnlyTracking = false;
+  pRecord->im = cv::Mat(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
+  pRecord->imRight = cv::Mat(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
+  mpRecord = pRecord;
+  mpImageRecord = pRecord;
 }
 
-cv::Mat FrameDrawer::DrawFrame(float imageScale) {
-  cv::Mat im;
-  // Initialization: KeyPoints in reference frame
-  std::vector<cv::KeyPoint> vIniKeys;
-  // Initialization: correspondeces with reference keypoints
-  std::vector<int> vMatches;
-  std::vector<cv::KeyPoint> vCurrentKeys;  // KeyPoints in current frame
-  std::vector<bool> vbVO, vbMap;           // Tracked MapPoints in current frame
-  std::vector<std::pair<cv::Point2f, cv::Point2f>> vTracks;
-  int state;  // Tracking state
-
-  cv::Scalar standardColor(0, 255, 0);
-  cv::Scalar odometryColor(255, 0, 0);
-
-  // Copy variables within scoped mutex
-  {
-    std::unique_lock<std::mutex> lock(mMutex);
-    state = mState;
-    if (state == Tracker::SYSTEM_NOT_READY) state = Tracker::NO_IMAGES_YET;
-
-    mIm.copyTo(im);
-
-    if (state == Tracker::NOT_INITIALIZED) {
-      vCurrentKeys = mvCurrentKeys;
-      vIniKeys = mvIniKeys;
-      vMatches = mvIniMatches;
-      vTracks = mvTracks;
-    } else if (state == Tracker::OK) {
-      vCurrentKeys = mvCurrentKeys;
-      vbVO = mvbVO;
-      vbMap = mvbMap;
-    } else if (state == Tracker::LOST) {
-      vCurrentKeys = mvCurrentKeys;
-    }
-  }
-
-  if (imageScale != 1.f) {
-    int imWidth = im.cols / imageScale;
-    int imHeight = im.rows / imageScale;
-    cv::resize(im, im, cv::Size(imWidth, imHeight));
-  }
-
-  if (im.channels() < 3)  // this should be always true
-    cv::cvtColor(im, im, cv::COLOR_GRAY2BGR);
-
-  // Draw
-  if (state == Tracker::NOT_INITIALIZED) {
-    for (unsigned int i = 0; i < vMatches.size(); i++) {
-      if (vMatches[i] >= 0) {
-        cv::Point2f pt1, pt2;
-        if (imageScale != 1.f) {
-          pt1 = vIniKeys[i].pt / imageScale;
-          pt2 = vCurrentKeys[vMatches[i]].pt / imageScale;
-        } else {
-          pt1 = vIniKeys[i].pt;
-          pt2 = vCurrentKeys[vMatches[i]].pt;
-        }
-        cv::line(im, pt1, pt2, standardColor);
-      }
-    }
-    for (auto it = vTracks.begin(); it != vTracks.end(); it++) {
-      cv::Point2f pt1, pt2;
-      if (imageScale != 1.f) {
-        pt1 = (*it).first / imageScale;
-        pt2 = (*it).second / imageScale;
-      } else {
-        pt1 = (*it).first;
-        pt2 = (*it).second;
-      }
-      cv::line(im, pt1, pt2, standardColor, 5);
-    }
-
-  } else if (state == Tracker::OK)  // TRACKING
-  {
-    mnTracked = 0;
-    mnTrackedVO = 0;
-    const float r = 5;
-    int n = vCurrentKeys.size();
-    for (int i = 0; i < n; i++) {
-      if (vbVO[i] || vbMap[i]) {
-        cv::Point2f pt1, pt2;
-        cv::Point2f point;
-        if (imageScale != 1.f) {
-          point = vCurrentKeys[i].pt / imageScale;
-          float px = vCurrentKeys[i].pt.x / imageScale;
-          float py = vCurrentKeys[i].pt.y / imageScale;
-          pt1.x = px - r;
-          pt1.y = py - r;
-          pt2.x = px + r;
-          pt2.y = py + r;
-        } else {
-          point = vCurrentKeys[i].pt;
-          pt1.x = vCurrentKeys[i].pt.x - r;
-          pt1.y = vCurrentKeys[i].pt.y - r;
-          pt2.x = vCurrentKeys[i].pt.x + r;
-          pt2.y = vCurrentKeys[i].pt.y + r;
-        }
-
-        // This is a match to a MapPoint in the map
-        if (vbMap[i]) {
-          cv::rectangle(im, pt1, pt2, standardColor);
-          cv::circle(im, point, 2, standardColor, -1);
-          mnTracked++;
-        } else  // This is match to a "visual odometry" MapPoint created in the
-                // last frame
-        {
-          cv::rectangle(im, pt1, pt2, odometryColor);
-          cv::circle(im, point, 2, odometryColor, -1);
-          mnTrackedVO++;
-        }
-      }
-    }
-  }
+std::shared_ptr<const FrameRecord> FrameDrawer::GetLastRecord(
+    const bool bRequestImage) {
+  if (bRequestImage) mbImageRequested = true;
+  return std::atomic_load(&mpRecord);
+}
 
-  cv::Mat imWithInfo;
-  DrawTextInfo(im, state, imWithInfo);
+std::shared_ptr<const FrameRecord> FrameDrawer::GetLastImageRecord() {
+  std::shared_ptr<const FrameRecord> pRecord = GetLastRecord(true);
+  if (pRecord->im.empty()) return std::atomic_load(&mpImageRecord);
+  return pRecord;
+}
 
-  return imWithInfo;
+cv::Mat FrameDrawer::DrawFrame(float imageScale) {
+  return DrawRecord(*GetLastImageRecord(), false, imageScale);
 }
 
 cv::Mat FrameDrawer::DrawRightFrame(float imageScale) {
-  cv::Mat im;
-  // Initialization: KeyPoints in reference frame
-  std::vector<cv::KeyPoint> vIniKeys;
-  // Initialization: correspondeces with reference keypoints
-  std::vector<int> vMatches;
-  std::vector<cv::KeyPoint> vCurrentKeys;  // KeyPoints in current frame
-  std::vector<bool> vbVO, vbMap;           // Tracked MapPoints in current frame
-  int state;                          // Tracking state
+  return DrawRecord(*GetLastImageRecord(), true, imageScale);
+}
 
-  // Copy variables within scoped mutex
-  {
-    std::unique_lock<std::mutex> lock(mMutex);
-    state = mState;
-    if (mState == Tracker::SYSTEM_NOT_READY) mState = Tracker::NO_IMAGES_YET;
+cv::Mat FrameDrawer::DrawRecord(const FrameRecord &record, const bool bRight,
+                                const float imageScale) {
+  const cv::Scalar standardColor(0, 255, 0);
+  const cv::Scalar odometryColor(255, 0, 0);
 
-    mImRight.copyTo(im);
+  int state = record.nState;  // Tracking state
+  if (state == Tracker::SYSTEM_NOT_READY) state = Tracker::NO_IMAGES_YET;
 
-    if (mState == Tracker::NOT_INITIALIZED) {
-      vCurrentKeys = mvCurrentKeysRight;
-      vIniKeys = mvIniKeys;
-      vMatches = mvIniMatches;
-    } else if (mState == Tracker::OK) {
-      vCurrentKeys = mvCurrentKeysRight;
-      vbVO = mvbVO;
-      vbMap = mvbMap;
-    } else if (mState == Tracker::LOST) {
-      vCurrentKeys = mvCurrentKeysRight;
-    }
-  }  // destroy scoped mutex -> release mutex
+  const std::vector<cv::Point2f> &vCurrentKeys =
+      bRight ? record.vKeysRight : record.vKeys;
+  // Right keys follow the left ones in vbMap and vbVO
+  const size_t nOffset = bRight ? record.vKeys.size() : 0;
 
+  cv::Mat im;
+  const cv::Mat &imSource = bRight ? record.imRight : record.im;
   if (imageScale != 1.f) {
-    int imWidth = im.cols / imageScale;
-    int imHeight = im.rows / imageScale;
-    cv::resize(im, im, cv::Size(imWidth, imHeight));
+    int imWidth = imSource.cols / imageScale;
+    int imHeight = imSource.rows / imageScale;
+    cv::resize(imSource, im, cv::Size(imWidth, imHeight));
+  } else {
+    imSource.copyTo(im);
   }
 
   if (im.channels() < 3)  // this should be always true
-    cvtColor(im, im, cv::COLOR_GRAY2BGR);
+    cv::cvtColor(im, im, cv::COLOR_GRAY2BGR);
 
-  // Draw
-  if (state == Tracker::NOT_INITIALIZED)  // INITIALIZING
-  {
-    for (unsigned int i = 0; i < vMatches.size(); i++) {
-      if (vMatches[i] >= 0) {
-        cv::Point2f pt1, pt2;
-        if (imageScale != 1.f) {
-          pt1 = vIniKeys[i].pt / imageScale;
-          pt2 = vCurrentKeys[vMatches[i]].pt / imageScale;
-        } else {
-          pt1 = vIniKeys[i].pt;
-          pt2 = vCurrentKeys[vMatches[i]].pt;
-        }
+  int nTracked = 0;
+  int nTrackedVO = 0;
 
-        cv::line(im, pt1, pt2, cv::Scalar(0, 255, 0));
+  // Draw
+  if (state == Tracker::NOT_INITIALIZED) {
+    const std::vector<int> &vMatches = record.vIniMatches;
+    for (size_t i = 0; i < vMatches.size(); i++) {
+      if (vMatches[i] >= 0 &&
+          static_cast<size_t>(vMatches[i]) < vCurrentKeys.size()) {
+        const cv::Point2f pt1 = record.vIniKeys[i] / imageScale;
+        const cv::Point2f pt2 = vCurrentKeys[vMatches[i]] / imageScale;
+        cv::line(im, pt1, pt2, standardColor);
       }
     }
   } else if (state == Tracker::OK)  // TRACKING
   {
-    mnTracked = 0;
-    mnTrackedVO = 0;
     const float r = 5;
-    const int n = mvCurrentKeysRight.size();
-    const int Nleft = mvCurrentKeys.size();
-
-    for (int i = 0; i < n; i++) {
-      if (vbVO[i + Nleft] || vbMap[i + Nleft]) {
-        cv::Point2f pt1, pt2;
-        cv::Point2f point;
-        if (imageScale != 1.f) {
-          point = mvCurrentKeysRight[i].pt / imageScale;
-          float px = mvCurrentKeysRight[i].pt.x / imageScale;
-          float py = mvCurrentKeysRight[i].pt.y / imageScale;
-          pt1.x = px - r;
-          pt1.y = py - r;
-          pt2.x = px + r;
-          pt2.y = py + r;
-        } else {
-          point = mvCurrentKeysRight[i].pt;
-          pt1.x = mvCurrentKeysRight[i].pt.x - r;
-          pt1.y = mvCurrentKeysRight[i].pt.y - r;
-          pt2.x = mvCurrentKeysRight[i].pt.x + r;
-          pt2.y = mvCurrentKeysRight[i].pt.y + r;
-        }
-
-        // This is a match to a MapPoint in the map
-        if (vbMap[i + Nleft]) {
-          cv::rectangle(im, pt1, pt2, cv::Scalar(0, 255, 0));
-          cv::circle(im, point, 2, cv::Scalar(0, 255, 0), -1);
-          mnTracked++;
-        } else  // This is match to a "visual odometry" MapPoint created in the
-                // last frame
-        {
-          cv::rectangle(im, pt1, pt2, cv::Scalar(255, 0, 0));
-          cv::circle(im, point, 2, cv::Scalar(255, 0, 0), -1);
-          mnTrackedVO++;
-        }
+    const size_t n = vCurrentKeys.size();
+    for (size_t i = 0; i < n; i++) {
+      const bool bMap = record.vbMap[i + nOffset];
+      if (!bMap && !record.vbVO[i + nOffset]) continue;
+
+      const cv::Point2f point = vCurrentKeys[i] / imageScale;
+      const cv::Point2f pt1(point.x - r, point.y - r);
+      const cv::Point2f pt2(point.x + r, point.y + r);
+
+      // This is a match to a MapPoint in the map
+      if (bMap) {
+        cv::rectangle(im, pt1, pt2, standardColor);
+        cv::circle(im, point, 2, standardColor, -1);
+        nTracked++;
+      } else  // This is match to a "visual odometry" MapPoint created in the
+              // last frame
+      {
+        cv::rectangle(im, pt1, pt2, odometryColor);
+        cv::circle(im, point, 2, odometryColor, -1);
+        nTrackedVO++;
       }
     }
   }
 
   cv::Mat imWithInfo;
-  DrawTextInfo(im, state, imWithInfo);
+  DrawTextInfo(im, state, record.bOnlyTracking, nTracked, nTrackedVO,
+               imWithInfo);
 
   return imWithInfo;
 }
 
-void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText) {
+void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, bool bOnlyTracking,
+                               int nTracked, int nTrackedVO, cv::Mat &imText) {
   std::stringstream s;
   if (nState == Tracker::NO_IMAGES_YET)
     s << " WAITING FOR IMAGES";
   else if (nState == Tracker::NOT_INITIALIZED)
     s << " TRYING TO INITIALIZE ";
   else if (nState == Tracker::OK) {
-    if (!mbOnlyTracking)
+    if (!bOnlyTracking)
       s << "SLAM MODE |  ";
     else
       s << "LOCALIZATION | ";
@@ -278,8 +151,8 @@ void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText) {
     int nKFs = mpAtlas->KeyFramesInMap();
     int nMPs = mpAtlas->MapPointsInMap();
     s << "Maps: " << nMaps << ", KFs: " << nKFs << ", MPs: " << nMPs
-      << ", Matches: " << mnTracked;
-    if (mnTrackedVO > 0) s << ", + VO matches: " << mnTrackedVO;
+      << ", Matches: " << nTracked;
+    if (nTrackedVO > 0) s << ", + VO matches: " << nTrackedVO;
   } else if (nState == Tracker::LOST) {
     s << " TRACK LOST. TRYING TO RELOCALIZE ";
   } else if (nState == Tracker::SYSTEM_NOT_READY) {
@@ -299,41 +172,52 @@ void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText) {
 }
 
 void FrameDrawer::Update(const Tracking_ptr &pTracker) {
-  std::unique_lock<std::mutex> lock(mMutex);
-  pTracker->mImGray.copyTo(mIm);
-  mvCurrentKeys = pTracker->mCurrentFrame.mvKeys;
-  mThDepth = pTracker->mCurrentFrame.mThDepth;
-  mvCurrentDepth = pTracker->mCurrentFrame.mvDepth;
+  std::shared_ptr<FrameRecord> pRecord = std::make_shared<FrameRecord>();
+  const Frame &frame = pTracker->mCurrentFrame;
+
+  // Only clone images somebody is going to draw
+  const bool bImage = mbImageRequested.exchange(false);
+  if (bImage) {
+    pTracker->mImGray.copyTo(pRecord->im);
+    if (both) pTracker->mImRight.copyTo(pRecord->imRight);
+  }
 
+  pRecord->vKeys.reserve(frame.mvKeys.size());
+  for (const cv::KeyPoint &kp : frame.mvKeys) pRecord->vKeys.push_back(kp.pt);
   if (both) {
-    mvCurrentKeysRight = pTracker->mCurrentFrame.mvKeysRight;
-    pTracker->mImRight.copyTo(mImRight);
-    N = mvCurrentKeys.size() + mvCurrentKeysRight.size();
-  } else {
-    N = mvCurrentKeys.size();
+    pRecord->vKeysRight.reserve(frame.mvKeysRight.size());
+    for (const cv::KeyPoint &kp : frame.mvKeysRight)
+      pRecord->vKeysRight.push_back(kp.pt);
   }
+  const size_t N = pRecord->vKeys.size() + pRecord->vKeysRight.size();
 
-  mvbVO = std::vector<bool>(N, false);
-  mvbMap = std::vector<bool>(N, false);
-  mbOnlyTracking = pTracker->mbOnlyTracking;
+  pRecord->vbVO = std::vector<bool>(N, false);
+  pRecord->vbMap = std::vector<bool>(N, false);
+  pRecord->bOnlyTracking = pTracker->mbOnlyTracking;
 
   if (pTracker->mLastProcessedState == Tracker::NOT_INITIALIZED) {
-    mvIniKeys = pTracker->mInitialFrame.mvKeys;
-    mvIniMatches = pTracker->mvIniMatches;
+    pRecord->vIniKeys.reserve(pTracker->mInitialFrame.mvKeys.size());
+    for (const cv::KeyPoint &kp : pTracker->mInitialFrame.mvKeys)
+      pRecord->vIniKeys.push_back(kp.pt);
+    pRecord->vIniMatches = pTracker->mvIniMatches;
   } else if (pTracker->mLastProcessedState == Tracker::OK) {
-    for (int i = 0; i < N; i++) {
-      MapPoint *pMP = pTracker->mCurrentFrame.mvpMapPoints[i];
+    for (size_t i = 0; i < N; i++) {
+      MapPoint *pMP = frame.mvpMapPoints[i];
       if (pMP) {
-        if (!pTracker->mCurrentFrame.mvbOutlier[i]) {
+        if (!frame.mvbOutlier[i]) {
           if (pMP->Observations() > 0)
-            mvbMap[i] = true;
+            pRecord->vbMap[i] = true;
           else
-            mvbVO[i] = true;
+            pRecord->vbVO[i] = true;
         }
       }
     }
   }
-  mState = static_cast<int>(pTracker->mLastProcessedState);
+  pRecord->nState = static_cast<int>(pTracker->mLastProcessedState);
+
+  std::shared_ptr<const FrameRecord> pPublished = pRecord;
+  if (bImage) std::atomic_store(&mpImageRecord, pPublished);
+  std::atomic_store(&mpRecord, pPublished);
 }
 
 }  // namespace ORB_SLAM3
@@ -173,73 +173,137 @@ void Preintegrated::Initialize(const Bias &b_) {
   mvMeasurements.clear();
 }
 
+void Preintegrated::Initialize(const Bias &b_, const Calib &calib) {
+  Nga = calib.Cov;
+  NgaWalk = calib.CovWalk;
+  Initialize(b_);
+}
+
 void Preintegrated::Reintegrate() {
   std::unique_lock<std::mutex> lock(mMutex);
-  const std::vector<integrable> aux = mvMeasurements;
+  // Initialize clears the measurements, keep them (and their storage) aside
+  std::vector<integrable> aux;
+  aux.swap(mvMeasurements);
   Initialize(bu);
-  for (size_t i = 0; i < aux.size(); i++)
-    IntegrateNewMeasurement(aux[i].a, aux[i].w, aux[i].t);
+  aux.swap(mvMeasurements);
+  for (size_t i = 0; i < mvMeasurements.size(); i++) {
+    const integrable &m = mvMeasurements[i];
+    Integrate(m.a, m.w, m.t, IntegratedRotation(m.w, b, m.t));
+  }
 }
 
 void Preintegrated::IntegrateNewMeasurement(const Eigen::Vector3f &acceleration,
                                             const Eigen::Vector3f &angVel,
                                             const float &dt) {
   mvMeasurements.push_back(integrable(acceleration, angVel, dt));
+  Integrate(acceleration, angVel, dt, IntegratedRotation(angVel, b, dt));
+}
 
+void Preintegrated::IntegrateNewMeasurement(const Eigen::Vector3f &acceleration,
+                                            const Eigen::Vector3f &angVel,
+                                            const float &dt,
+                                            Preintegrated *pFirst,
+                                            Preintegrated *pSecond) {
+  const IntegratedRotation dRi(angVel, pFirst->b, dt);
+  pFirst->mvMeasurements.push_back(integrable(acceleration, angVel, dt));
+  pFirst->Integrate(acceleration, angVel, dt, dRi);
+
+  pSecond->mvMeasurements.push_back(integrable(acceleration, angVel, dt));
+  const Bias &b1 = pFirst->b, &b2 = pSecond->b;
+  if (b1.bwx == b2.bwx && b1.bwy == b2.bwy && b1.bwz == b2.bwz)
+    pSecond->Integrate(acceleration, angVel, dt, dRi);
+  else
+    pSecond->Integrate(acceleration, angVel, dt,
+                       IntegratedRotation(angVel, b2, dt));
+}
+
+void Preintegrated::Integrate(const Eigen::Vector3f &acceleration,
+                              const Eigen::Vector3f &angVel, const float &dt,
+                              const IntegratedRotation &dRi) {
   // Position is updated firstly, as it depends on previously computed velocity
   // and rotation. Velocity is updated secondly, as it depends on previously
   // computed rotation. Rotation is the last to be updated.
 
-  // Matrices to compute covariance
-  Eigen::Matrix<float, 9, 9> A;
-  A.setIdentity();
-  Eigen::Matrix<float, 9, 6> B;
-  B.setZero();
-
   Eigen::Vector3f acc, accW;
   acc << acceleration(0) - b.bax, acceleration(1) - b.bay,
       acceleration(2) - b.baz;
   accW << angVel(0) - b.bwx, angVel(1) - b.bwy, angVel(2) - b.bwz;
 
-  avgA = (dT * avgA + dR * acc * dt) / (dT + dt);
+  const float dt2 = dt * dt;
+  const Eigen::Vector3f dRacc = dR * acc;
+
+  avgA = (dT * avgA + dRacc * dt) / (dT + dt);
   avgW = (dT * avgW + accW * dt) / (dT + dt);
 
   // Update delta position dP and velocity dV (rely on no-updated delta
   // rotation)
-  dP = dP + dV * dt + 0.5f * dR * acc * dt * dt;
-  dV = dV + dR * acc * dt;
-
-  // Compute velocity and position parts of matrices A and B (rely on
-  // non-updated delta rotation)
-  Eigen::Matrix<float, 3, 3> Wacc = Sophus::SO3f::hat(acc);
-
-  A.block<3, 3>(3, 0) = -dR * dt * Wacc;
-  A.block<3, 3>(6, 0) = -0.5f * dR * dt * dt * Wacc;
-  A.block<3, 3>(6, 3) = Eigen::DiagonalMatrix<float, 3>(dt, dt, dt);
-  B.block<3, 3>(3, 3) = dR * dt;
-  B.block<3, 3>(6, 3) = 0.5f * dR * dt * dt;
+  dP += dV * dt + 0.5f * dt2 * dRacc;
+  dV += dRacc * dt;
 
   // Update position and velocity jacobians wrt bias correction
-  JPa = JPa + JVa * dt - 0.5f * dR * dt * dt;
-  JPg = JPg + JVg * dt - 0.5f * dR * dt * dt * Wacc * JRg;
-  JVa = JVa - dR * dt;
-  JVg = JVg - dR * dt * Wacc * JRg;
+  const Eigen::Matrix3f dRWacc = dR * Sophus::SO3f::hat(acc);
+  const Eigen::Matrix3f dRWaccJRg = dRWacc * JRg;
+  JPa += JVa * dt - 0.5f * dt2 * dR;
+  JPg += JVg * dt - 0.5f * dt2 * dRWaccJRg;
+  JVa -= dt * dR;
+  JVg -= dt * dRWaccJRg;
+
+  // Update covariance. The state transition A and the noise matrix B are
+  // block sparse, with I the identity and Rt = dRi.deltaR^T:
+  //   A = [Rt        0     0]      B = [Jr*dt  0            ]
+  //       [Ma        I     0]          [0      dR*dt        ]
+  //       [Ma*dt/2   I*dt  I]          [0      dR*dt*dt/2   ]
+  // with Ma = -dR*dt*Wacc (non-updated delta rotation), so A*C*A^T and
+  // B*Nga*B^T are expanded on 3x3 blocks. C stays symmetric, only the upper
+  // blocks are computed
+  const Eigen::Matrix3f Ma = -dt * dRWacc;
+  const Eigen::Matrix3f Mb = 0.5f * dt * Ma;
+
+  // Row blocks of A*C
+  const Eigen::Matrix<float, 3, 9> TR =
+      dRi.deltaR.transpose() * C.block<3, 9>(0, 0);
+  const Eigen::Matrix<float, 3, 9> TV =
+      Ma * C.block<3, 9>(0, 0) + C.block<3, 9>(3, 0);
+  const Eigen::Matrix<float, 3, 9> TP = Mb * C.block<3, 9>(0, 0) +
+                                        dt * C.block<3, 9>(3, 0) +
+                                        C.block<3, 9>(6, 0);
+
+  const Eigen::Matrix3f MaT = Ma.transpose(), MbT = Mb.transpose();
+  const Eigen::Matrix3f Jr = dRi.rightJ * dt;
+  const Eigen::Matrix3f Q =
+      dR * Nga.diagonal().tail<3>().asDiagonal() * dR.transpose();
+
+  const Eigen::Matrix3f CRR =
+      TR.block<3, 3>(0, 0) * dRi.deltaR +
+      Jr * Nga.diagonal().head<3>().asDiagonal() * Jr.transpose();
+  const Eigen::Matrix3f CRV = TR.block<3, 3>(0, 0) * MaT + TR.block<3, 3>(0, 3);
+  const Eigen::Matrix3f CRP = TR.block<3, 3>(0, 0) * MbT +
+                              dt * TR.block<3, 3>(0, 3) + TR.block<3, 3>(0, 6);
+  const Eigen::Matrix3f CVV =
+      TV.block<3, 3>(0, 0) * MaT + TV.block<3, 3>(0, 3) + dt2 * Q;
+  const Eigen::Matrix3f CVP = TV.block<3, 3>(0, 0) * MbT +
+                              dt * TV.block<3, 3>(0, 3) +
+                              TV.block<3, 3>(0, 6) + 0.5f * dt2 * dt * Q;
+  const Eigen::Matrix3f CPP = TP.block<3, 3>(0, 0) * MbT +
+                              dt * TP.block<3, 3>(0, 3) +
+                              TP.block<3, 3>(0, 6) + 0.25f * dt2 * dt2 * Q;
+
+  C.block<3, 3>(0, 0) = CRR;
+  C.block<3, 3>(0, 3) = CRV;
+  C.block<3, 3>(3, 0) = CRV.transpose();
+  C.block<3, 3>(0, 6) = CRP;
+  C.block<3, 3>(6, 0) = CRP.transpose();
+  C.block<3, 3>(3, 3) = CVV;
+  C.block<3, 3>(3, 6) = CVP;
+  C.block<3, 3>(6, 3) = CVP.transpose();
+  C.block<3, 3>(6, 6) = CPP;
+  C.diagonal().tail<6>() += NgaWalk.diagonal();
 
   // Update delta rotation
-  IntegratedRotation dRi(angVel, b, dt);
   dR = NormalizeRotation(dR * dRi.deltaR);
 
-  // Compute rotation parts of matrices A and B
-  A.block<3, 3>(0, 0) = dRi.deltaR.transpose();
-  B.block<3, 3>(0, 0) = dRi.rightJ * dt;
-
-  // Update covariance
-  C.block<9, 9>(0, 0) =
-      A * C.block<9, 9>(0, 0) * A.transpose() + B * Nga * B.transpose();
-  C.block<6, 6>(9, 9) += NgaWalk;
-
   // Update rotation jacobian wrt bias correction
-  JRg = dRi.deltaR.transpose() * JRg - dRi.rightJ * dt;
+  JRg = dRi.deltaR.transpose() * JRg - Jr;
 
   // Total integrated time
   dT += dt;
@@ -25,10 +25,23 @@
 
 #include "Converter.h"
 #include "ImuTypes.h"
+#include "KeyFrameStore.h"
+#include "ObjectPool.h"
 
 namespace ORB_SLAM3 {
 
-long unsigned int KeyFrame::nNextId = 0;
+
+// Never destroyed, keyframes are not released before exit
+static ObjectPool* KeyFramePool() {
+  static ObjectPool* pPool = new ObjectPool(sizeof(KeyFrame), 64);
+  return pPool;
+}
+
+void* KeyFrame::operator new(std::size_t nSize) {
+  return KeyFramePool()->Allocate(nSize);
+}
+
+void KeyFrame::operator delete(void* p) { KeyFramePool()->Deallocate(p); }
 
 KeyFrame::KeyFrame()
     : mnFrameId(0),
@@ -42,15 +55,6 @@ KeyFrame::KeyFrame()
       mnBALocalForKF(0),
       mnBAFixedForKF(0),
       mnNumberOfOpt(0),
-      mnLoopQuery(0),
-      mnLoopWords(0),
-      mnRelocQuery(0),
-      mnRelocWords(0),
-      mnMergeQuery(0),
-      mnMergeWords(0),
-      mnPlaceRecognitionQuery(0),
-      mnPlaceRecognitionWords(0),
-      mPlaceRecognitionScore(0),
       mbCurrentPlaceRecognition(false),
       mnBAGlobalForKF(0),
       mnMergeCorrectedForKF(0),
@@ -104,13 +108,6 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
       mnBALocalForKF(0),
       mnBAFixedForKF(0),
       mnNumberOfOpt(0),
-      mnLoopQuery(0),
-      mnLoopWords(0),
-      mnRelocQuery(0),
-      mnRelocWords(0),
-      mnPlaceRecognitionQuery(0),
-      mnPlaceRecognitionWords(0),
-      mPlaceRecognitionScore(0),
       mbCurrentPlaceRecognition(false),
       mnBAGlobalForKF(0),
       mnMergeCorrectedForKF(0),
@@ -170,7 +167,7 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
       mvKeysRight(F.mvKeysRight),
       NLeft(F.Nleft),
       NRight(F.Nright) {
-  mnId = nNextId++;
+  mnId = pMap->NewKeyFrameId();
 
   mGrid.resize(mnGridCols);
   if (F.Nleft != -1) mGridRight.resize(mnGridCols);
@@ -197,10 +194,16 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
   SetPose(F.GetPose());
 
   mnOriginMapId = pMap->GetId();
+
+  // Stereo fisheye frames already have them
+  mvBearings = F.mvBearings;
+  if (mvBearings.size() != static_cast<size_t>(N)) ComputeBearings();
 }
 
 void KeyFrame::ComputeBoW() {
-  if (mBowVec.empty() || mFeatVec.empty()) {
+  ScopedPin pin(this);
+  // Without descriptors (spill file lost) the BoW vector is kept as it is
+  if ((mBowVec.empty() || mFeatVec.empty()) && !mDescriptors.empty()) {
     vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
     // Feature vector associate features with nodes in the 4th level (from
     // leaves up) We assume the vocabulary tree has 6 levels, change the 4
@@ -209,18 +212,51 @@ void KeyFrame::ComputeBoW() {
   }
 }
 
-void KeyFrame::SetPose(const Sophus::SE3f &Tcw) {
-  unique_lock<mutex> lock(mMutexPose);
+void KeyFrame::ComputeBearings() {
+  mpCamera->unprojectBatch(NLeft == -1 ? mvKeysUn : mvKeys, mvBearings);
+  if (NLeft != -1 && mpCamera2) {
+    vector<Eigen::Vector3f> vBearingsRight;
+    mpCamera2->unprojectBatch(mvKeysRight, vBearingsRight);
+    mvBearings.insert(mvBearings.end(), vBearingsRight.begin(),
+                      vBearingsRight.end());
+  }
+}
+
+bool KeyFrame::Pin() {
+  unique_lock<mutex> lock(mMutexResidency);
+  if (!mpKeyFrameStore) return false;
+
+  const bool bSpilled = mbSpilled;
+  if (mbSpilled) mpKeyFrameStore->Restore(this);
+  mnPins++;
+  mnLastUse = mpKeyFrameStore->NextStamp();
+  return bSpilled;
+}
 
-  mTcw = Tcw;
-  mRcw = mTcw.rotationMatrix();
-  mTwc = mTcw.inverse();
-  mRwc = mTwc.rotationMatrix();
+void KeyFrame::Unpin(bool bRespill) {
+  unique_lock<mutex> lock(mMutexResidency);
+  if (mnPins > 0) mnPins--;
+  // The spill file is already written, spilling only releases the memory
+  if (bRespill && mnPins == 0 && mpKeyFrameStore && !mbSpilled &&
+      mbSpillFileWritten)
+    mpKeyFrameStore->Spill(this);
+}
 
-  if (mImuCalib.mbIsSet)  // TODO Use a flag instead of the OpenCV matrix
+void KeyFrame::SetPose(const Sophus::SE3f &Tcw) {
   {
-    mOwb = mRwc * mImuCalib.mTcb.translation() + mTwc.translation();
+    unique_lock<mutex> lock(mMutexPose);
+
+    mTcw = Tcw;
+    mRcw = mTcw.rotationMatrix();
+    mTwc = mTcw.inverse();
+    mRwc = mTwc.rotationMatrix();
+
+    if (mImuCalib.mbIsSet)  // TODO Use a flag instead of the OpenCV matrix
+    {
+      mOwb = mRwc * mImuCalib.mTcb.translation() + mTwc.translation();
+    }
   }
+  MarkDirty();
 }
 
 void KeyFrame::SetVelocity(const Eigen::Vector3f &Vw) {
@@ -291,6 +327,7 @@ void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight) {
   }
 
   UpdateBestCovisibles();
+  MarkDirty();
 }
 
 void KeyFrame::UpdateBestCovisibles() {
@@ -440,36 +477,28 @@ MapPoint *KeyFrame::GetMapPoint(const size_t &idx) {
   return mvpMapPoints[idx];
 }
 
-void KeyFrame::UpdateConnections(bool upParent) {
-  map<KeyFrame *, int> KFcounter;
+void KeyFrame::AddCovisibility(KeyFrame *pKF, int n) {
+  unique_lock<mutex> lock(mMutexCovisibility);
+  int &count = mCovisibilityCounts[pKF];
+  count += n;
+  if (count <= 0) mCovisibilityCounts.erase(pKF);
+}
 
-  vector<MapPoint *> vpMP;
+void KeyFrame::UpdateConnections() {
+  map<KeyFrame *, int> KFcounter;
 
   {
-    unique_lock<mutex> lockMPs(mMutexFeatures);
-    vpMP = mvpMapPoints;
+    unique_lock<mutex> lock(mMutexCovisibility);
+    KFcounter = mCovisibilityCounts;
   }
 
-  // For all map points in keyframe check in which other keyframes are they seen
-  // Increase counter for those keyframes
-  for (vector<MapPoint *>::iterator vit = vpMP.begin(), vend = vpMP.end();
-       vit != vend; vit++) {
-    MapPoint *pMP = *vit;
-
-    if (!pMP) continue;
-
-    if (pMP->isBad()) continue;
-
-    map<KeyFrame *, tuple<int, int>> observations = pMP->GetObservations();
-
-    for (map<KeyFrame *, tuple<int, int>>::iterator mit = observations.begin(),
-                                                    mend = observations.end();
-         mit != mend; mit++) {
-      if (mit->first->mnId == mnId || mit->first->isBad() ||
-          mit->first->GetMap() != mpMap)
-        continue;
-      KFcounter[mit->first]++;
-    }
+  // Only keyframes of the same map count
+  for (map<KeyFrame *, int>::iterator mit = KFcounter.begin();
+       mit != KFcounter.end();) {
+    if (mit->first->isBad() || mit->first->GetMap() != mpMap)
+      mit = KFcounter.erase(mit);
+    else
+      mit++;
   }
 
   // This should not happen
@@ -484,13 +513,9 @@ void KeyFrame::UpdateConnections(bool upParent) {
 
   vector<pair<int, KeyFrame *>> vPairs;
   vPairs.reserve(KFcounter.size());
-  if (!upParent) cout << "UPDATE_CONN: current KF " << mnId << endl;
   for (map<KeyFrame *, int>::iterator mit = KFcounter.begin(),
                                       mend = KFcounter.end();
        mit != mend; mit++) {
-    if (!upParent)
-      cout << "  UPDATE_CONN: KF " << mit->first->mnId
-           << " ; num matches: " << mit->second << endl;
     if (mit->second > nmax) {
       nmax = mit->second;
       pKFmax = mit->first;
@@ -527,6 +552,7 @@ void KeyFrame::UpdateConnections(bool upParent) {
       mbFirstConnection = false;
     }
   }
+  MarkDirty();
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF) {
@@ -549,6 +575,7 @@ void KeyFrame::ChangeParent(KeyFrame *pKF) {
 
   mpParent = pKF;
   pKF->AddChild(this);
+  MarkDirty();
 }
 
 set<KeyFrame *> KeyFrame::GetChilds() {
@@ -575,6 +602,7 @@ void KeyFrame::AddLoopEdge(KeyFrame *pKF) {
   unique_lock<mutex> lockCon(mMutexConnections);
   mbNotErase = true;
   mspLoopEdges.insert(pKF);
+  MarkDirty();
 }
 
 set<KeyFrame *> KeyFrame::GetLoopEdges() {
@@ -723,7 +751,10 @@ void KeyFrame::EraseConnection(KeyFrame *pKF) {
     }
   }
 
-  if (bUpdate) UpdateBestCovisibles();
+  if (bUpdate) {
+    UpdateBestCovisibles();
+    MarkDirty();
+  }
 }
 
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y,
@@ -856,7 +887,19 @@ void KeyFrame::UpdateMap(Map *pMap) {
   mpMap = pMap;
 }
 
-void KeyFrame::PreSave(set<KeyFrame *> &spKF, set<MapPoint *> &spMP,
+void KeyFrame::MarkDirty() {
+  // Not in a map yet
+  if (mnDirty == 0xFF) return;
+
+  Map *pMap = GetMap();
+  if (!pMap) return;
+  const unsigned char nMask = pMap->GetDirtyMask();
+  const unsigned char nNew = nMask & ~mnDirty.fetch_or(nMask);
+  if (nNew) pMap->AddDirty(this, nNew);
+}
+
+void KeyFrame::PreSave(const SlotMap<KeyFrame> &spKF,
+                       const SlotMap<MapPoint> &spMP,
                        set<GeometricCamera *> &spCam) {
   // Save the id of each MapPoint in this KF, there can be null
   // pointer in the vector
@@ -1003,6 +1046,7 @@ void KeyFrame::PostLoad(map<long unsigned int, KeyFrame *> &mpKFid,
   if (mnBackupIdCamera2 >= 0) {
     mpCamera2 = mpCamId[mnBackupIdCamera2];
   }
+  if (mpCamera) ComputeBearings();
 
   // Inertial data
   if (mBackupPrevKFId != -1) {
@@ -1149,7 +1193,7 @@ Eigen::Vector3f KeyFrame::GetRightTranslation() {
   return (mTrl * mTcw).translation();
 }
 
-void KeyFrame::SetORBVocabulary(ORBVocabulary *pORBVoc) {
+void KeyFrame::SetORBVocabulary(const ORBVocabulary *pORBVoc) {
   mpORBvocabulary = pORBVoc;
 }
 
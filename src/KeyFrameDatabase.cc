@@ -21,6 +21,8 @@
 
 #include "KeyFrameDatabase.h"
 
+#include <algorithm>
+#include <cmath>
 #include <mutex>
 
 #include "DBoW2/BowVector.h"
@@ -30,796 +32,619 @@ using namespace std;
 
 namespace ORB_SLAM3 {
 
-KeyFrameDatabase::KeyFrameDatabase(const ORBVocabulary& voc) : mpVoc(&voc) {
+// Fraction of erased postings that triggers a compaction of the dirty words
+static const float kfCompactionRatio = 0.2f;
+static const size_t knMinPostingsToCompact = 1 << 16;
+
+KeyFrameDatabase::KeyFrameDatabase(const ORBVocabulary& voc)
+    : mpVoc(&voc), mnPostings(0), mnDeadPostings(0) {
   mvInvertedFile.resize(voc.size());
+  mvbDirtyWord.resize(voc.size(), false);
+}
+
+KeyFrameDatabase::KeyFrameDatabase(const ORBVocabulary_ptr& pVoc)
+    : KeyFrameDatabase(*pVoc) {
+  mpSharedVoc = pVoc;
 }
 
 void KeyFrameDatabase::add(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutex);
+  unique_lock<shared_mutex> lock(mMutex);
 
-  for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
-                                        vend = pKF->mBowVec.end();
-       vit != vend; vit++)
-    mvInvertedFile[vit->first].push_back(pKF);
+  AddPostings(pKF);
 }
 
-void KeyFrameDatabase::erase(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutex);
+void KeyFrameDatabase::AddPostings(KeyFrame* pKF) {
+  if (mmKeyFrameSlots.count(pKF)) return;
 
-  // Erase elements in the Inverse File for the entry
+  const unsigned int nSlot = AddSlot(pKF);
   for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
                                         vend = pKF->mBowVec.end();
-       vit != vend; vit++) {
-    // List of keyframes that share the word
-    list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
-
-    for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-         lit != lend; lit++) {
-      if (pKF == *lit) {
-        lKFs.erase(lit);
-        break;
-      }
-    }
-  }
-}
-
-void KeyFrameDatabase::clear() {
-  mvInvertedFile.clear();
-  mvInvertedFile.resize(mpVoc->size());
+       vit != vend; vit++)
+    mvInvertedFile[vit->first].push_back(
+        Posting{nSlot, static_cast<float>(vit->second)});
+  mnPostings += pKF->mBowVec.size();
 }
 
-void KeyFrameDatabase::clearMap(Map* pMap) {
-  unique_lock<mutex> lock(mMutex);
+void KeyFrameDatabase::erase(KeyFrame* pKF) {
+  unique_lock<shared_mutex> lock(mMutex);
 
-  // Erase elements in the Inverse File for the entry
-  for (std::vector<list<KeyFrame*> >::iterator vit = mvInvertedFile.begin(),
-                                               vend = mvInvertedFile.end();
-       vit != vend; vit++) {
-    // List of keyframes that share the word
-    list<KeyFrame*>& lKFs = *vit;
-
-    for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-         lit != lend;) {
-      KeyFrame* pKFi = *lit;
-      if (pMap == pKFi->GetMap()) {
-        lit = lKFs.erase(lit);
-        // Dont delete the KF because the class Map clean all the KF when it is
-        // destroyed
-      } else {
-        ++lit;
-      }
-    }
-  }
-}
+  std::unordered_map<KeyFrame*, unsigned int>::iterator it =
+      mmKeyFrameSlots.find(pKF);
+  if (it == mmKeyFrameSlots.end()) return;
 
-vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF,
-                                                         float minScore) {
-  set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-  list<KeyFrame*> lKFsSharingWords;
+  EraseSlot(it->second, pKF);
+  mmKeyFrameSlots.erase(it);
 
-  // Search all keyframes that share a word with current keyframes
-  // Discard keyframes connected to the query keyframe
-  {
-    unique_lock<mutex> lock(mMutex);
+  if (mnDeadPostings > knMinPostingsToCompact &&
+      mnDeadPostings > kfCompactionRatio * mnPostings)
+    Compact();
+}
 
-    for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
-                                          vend = pKF->mBowVec.end();
+void KeyFrameDatabase::addPending(
+    Map* pMap, const vector<DBoW2::BowVector>& vBowVecs,
+    const std::function<void(Map*)>& fRestore) {
+  unique_lock<shared_mutex> lock(mMutex);
+
+  PendingMap& pendingMap = mmPendingMaps[pMap];
+  pendingMap.fRestore = fRestore;
+  for (const DBoW2::BowVector& bowVec : vBowVecs) {
+    const unsigned int nSlot = AddPendingSlot(pMap);
+    pendingMap.vnSlots.push_back(nSlot);
+    for (DBoW2::BowVector::const_iterator vit = bowVec.begin(),
+                                          vend = bowVec.end();
          vit != vend; vit++) {
-      list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
-
-      for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-           lit != lend; lit++) {
-        KeyFrame* pKFi = *lit;
-        if (pKFi->GetMap() ==
-            pKF->GetMap())  // For consider a loop candidate it a candidate it
-                            // must be in the same map
-        {
-          if (pKFi->mnLoopQuery != pKF->mnId) {
-            pKFi->mnLoopWords = 0;
-            if (!spConnectedKeyFrames.count(pKFi)) {
-              pKFi->mnLoopQuery = pKF->mnId;
-              lKFsSharingWords.push_back(pKFi);
-            }
-          }
-          pKFi->mnLoopWords++;
-        }
-      }
+      // The vectors come from a file that is not verified yet
+      if (vit->first >= mvInvertedFile.size()) continue;
+      mvInvertedFile[vit->first].push_back(
+          Posting{nSlot, static_cast<float>(vit->second)});
+      pendingMap.vnWords.push_back(vit->first);
     }
   }
+  mnPostings += pendingMap.vnWords.size();
+}
 
-  if (lKFsSharingWords.empty()) return vector<KeyFrame*>();
+void KeyFrameDatabase::replacePending(Map* pMap,
+                                      const vector<KeyFrame*>& vpKFs) {
+  unique_lock<shared_mutex> lock(mMutex);
 
-  list<pair<float, KeyFrame*> > lScoreAndMatch;
+  ErasePendingSlots(pMap);
+  for (KeyFrame* pKFi : vpKFs) {
+    if (!pKFi || pKFi->isBad()) continue;
 
-  // Only compare against those keyframes that share enough words
-  int maxCommonWords = 0;
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    if ((*lit)->mnLoopWords > maxCommonWords)
-      maxCommonWords = (*lit)->mnLoopWords;
+    AddPostings(pKFi);
   }
 
-  int minCommonWords = maxCommonWords * 0.8f;
-
-  int nscores = 0;
-
-  // Compute similarity score. Retain the matches whose score is higher than
-  // minScore
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    KeyFrame* pKFi = *lit;
+  if (mnDeadPostings > knMinPostingsToCompact &&
+      mnDeadPostings > kfCompactionRatio * mnPostings)
+    Compact();
+}
 
-    if (pKFi->mnLoopWords > minCommonWords) {
-      nscores++;
+void KeyFrameDatabase::clear() {
+  unique_lock<shared_mutex> lock(mMutex);
 
-      float si = mpVoc->score(pKF->mBowVec, pKFi->mBowVec);
+  mvInvertedFile.clear();
+  mvInvertedFile.resize(mpVoc->size());
+  mvbDirtyWord.assign(mpVoc->size(), false);
+  mvnDirtyWords.clear();
+  mvpSlotKeyFrames.clear();
+  mvpSlotSessions.clear();
+  mvpSlotPendingMaps.clear();
+  mmPendingMaps.clear();
+  mmKeyFrameSlots.clear();
+  mvnFreeSlots.clear();
+  mvnPendingSlots.clear();
+  mnPostings = 0;
+  mnDeadPostings = 0;
+}
 
-      pKFi->mLoopScore = si;
-      if (si >= minScore) lScoreAndMatch.push_back(make_pair(si, pKFi));
+void KeyFrameDatabase::clearMap(Map* pMap) {
+  unique_lock<shared_mutex> lock(mMutex);
+
+  // Keyframes can be moved between maps after a merge, so the map is checked
+  // per slot. Only the words of the erased keyframes are compacted
+  for (unsigned int nSlot = 0; nSlot < mvpSlotKeyFrames.size(); ++nSlot) {
+    KeyFrame* pKFi = mvpSlotKeyFrames[nSlot];
+    if (pKFi && pMap == pKFi->GetMap()) {
+      // Dont delete the KF because the class Map clean all the KF when it is
+      // destroyed
+      EraseSlot(nSlot, pKFi);
+      mmKeyFrameSlots.erase(pKFi);
     }
   }
+  ErasePendingSlots(pMap);
 
-  if (lScoreAndMatch.empty()) return vector<KeyFrame*>();
+  Compact();
+}
 
-  list<pair<float, KeyFrame*> > lAccScoreAndMatch;
-  float bestAccScore = minScore;
+void KeyFrameDatabase::clearSession(const IdCounters* pSession) {
+  unique_lock<shared_mutex> lock(mMutex);
 
-  // Lets now accumulate score by covisibility
-  for (list<pair<float, KeyFrame*> >::iterator it = lScoreAndMatch.begin(),
-                                               itend = lScoreAndMatch.end();
-       it != itend; it++) {
-    KeyFrame* pKFi = it->second;
-    vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
-
-    float bestScore = it->first;
-    float accScore = it->first;
-    KeyFrame* pBestKF = pKFi;
-    for (vector<KeyFrame*>::iterator vit = vpNeighs.begin(),
-                                     vend = vpNeighs.end();
-         vit != vend; vit++) {
-      KeyFrame* pKF2 = *vit;
-      if (pKF2->mnLoopQuery == pKF->mnId &&
-          pKF2->mnLoopWords > minCommonWords) {
-        accScore += pKF2->mLoopScore;
-        if (pKF2->mLoopScore > bestScore) {
-          pBestKF = pKF2;
-          bestScore = pKF2->mLoopScore;
-        }
-      }
+  for (unsigned int nSlot = 0; nSlot < mvpSlotKeyFrames.size(); ++nSlot) {
+    KeyFrame* pKFi = mvpSlotKeyFrames[nSlot];
+    if (pKFi && mvpSlotSessions[nSlot] == pSession) {
+      EraseSlot(nSlot, pKFi);
+      mmKeyFrameSlots.erase(pKFi);
     }
-
-    lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
-    if (accScore > bestAccScore) bestAccScore = accScore;
   }
+  vector<Map*> vpPendingMaps;
+  for (const pair<Map* const, PendingMap>& pendingMap : mmPendingMaps) {
+    if (pendingMap.first->GetIdCounters() == pSession)
+      vpPendingMaps.push_back(pendingMap.first);
+  }
+  for (Map* pMap : vpPendingMaps) ErasePendingSlots(pMap);
 
-  // Return all those keyframes with a score higher than 0.75*bestScore
-  float minScoreToRetain = 0.75f * bestAccScore;
+  Compact();
+}
 
-  set<KeyFrame*> spAlreadyAddedKF;
-  vector<KeyFrame*> vpLoopCandidates;
-  vpLoopCandidates.reserve(lAccScoreAndMatch.size());
-
-  for (list<pair<float, KeyFrame*> >::iterator it = lAccScoreAndMatch.begin(),
-                                               itend = lAccScoreAndMatch.end();
-       it != itend; it++) {
-    if (it->first > minScoreToRetain) {
-      KeyFrame* pKFi = it->second;
-      if (!spAlreadyAddedKF.count(pKFi)) {
-        vpLoopCandidates.push_back(pKFi);
-        spAlreadyAddedKF.insert(pKFi);
-      }
-    }
+unsigned int KeyFrameDatabase::AddSlot(KeyFrame* pKF) {
+  // Keyframes never move to the Atlas of another System
+  const IdCounters* pSession = pKF->GetMap()->GetIdCounters();
+  unsigned int nSlot;
+  if (!mvnFreeSlots.empty()) {
+    nSlot = mvnFreeSlots.back();
+    mvnFreeSlots.pop_back();
+    mvpSlotKeyFrames[nSlot] = pKF;
+    mvpSlotSessions[nSlot] = pSession;
+    mvpSlotPendingMaps[nSlot] = static_cast<Map*>(NULL);
+  } else {
+    nSlot = mvpSlotKeyFrames.size();
+    mvpSlotKeyFrames.push_back(pKF);
+    mvpSlotSessions.push_back(pSession);
+    mvpSlotPendingMaps.push_back(static_cast<Map*>(NULL));
   }
-
-  return vpLoopCandidates;
+  mmKeyFrameSlots[pKF] = nSlot;
+  return nSlot;
 }
 
-void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,
-                                        vector<KeyFrame*>& vpLoopCand,
-                                        vector<KeyFrame*>& vpMergeCand) {
-  set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-  list<KeyFrame*> lKFsSharingWordsLoop, lKFsSharingWordsMerge;
+unsigned int KeyFrameDatabase::AddPendingSlot(Map* pMap) {
+  const IdCounters* pSession = pMap->GetIdCounters();
+  unsigned int nSlot;
+  if (!mvnFreeSlots.empty()) {
+    nSlot = mvnFreeSlots.back();
+    mvnFreeSlots.pop_back();
+    mvpSlotKeyFrames[nSlot] = static_cast<KeyFrame*>(NULL);
+    mvpSlotSessions[nSlot] = pSession;
+    mvpSlotPendingMaps[nSlot] = pMap;
+  } else {
+    nSlot = mvpSlotKeyFrames.size();
+    mvpSlotKeyFrames.push_back(static_cast<KeyFrame*>(NULL));
+    mvpSlotSessions.push_back(pSession);
+    mvpSlotPendingMaps.push_back(pMap);
+  }
+  return nSlot;
+}
 
-  // Search all keyframes that share a word with current keyframes
-  // Discard keyframes connected to the query keyframe
-  {
-    unique_lock<mutex> lock(mMutex);
+void KeyFrameDatabase::EraseSlot(unsigned int nSlot, KeyFrame* pKF) {
+  mvpSlotKeyFrames[nSlot] = static_cast<KeyFrame*>(NULL);
+  // The slot can not be reused while postings still reference it
+  mvnPendingSlots.push_back(nSlot);
 
-    for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
-                                          vend = pKF->mBowVec.end();
-         vit != vend; vit++) {
-      list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
-
-      for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-           lit != lend; lit++) {
-        KeyFrame* pKFi = *lit;
-        if (pKFi->GetMap() ==
-            pKF->GetMap())  // For consider a loop candidate it a candidate it
-                            // must be in the same map
-        {
-          if (pKFi->mnLoopQuery != pKF->mnId) {
-            pKFi->mnLoopWords = 0;
-            if (!spConnectedKeyFrames.count(pKFi)) {
-              pKFi->mnLoopQuery = pKF->mnId;
-              lKFsSharingWordsLoop.push_back(pKFi);
-            }
-          }
-          pKFi->mnLoopWords++;
-        } else if (!pKFi->GetMap()->IsBad()) {
-          if (pKFi->mnMergeQuery != pKF->mnId) {
-            pKFi->mnMergeWords = 0;
-            if (!spConnectedKeyFrames.count(pKFi)) {
-              pKFi->mnMergeQuery = pKF->mnId;
-              lKFsSharingWordsMerge.push_back(pKFi);
-            }
-          }
-          pKFi->mnMergeWords++;
-        }
-      }
+  for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
+                                        vend = pKF->mBowVec.end();
+       vit != vend; vit++) {
+    if (!mvbDirtyWord[vit->first]) {
+      mvbDirtyWord[vit->first] = true;
+      mvnDirtyWords.push_back(vit->first);
     }
   }
+  mnDeadPostings += pKF->mBowVec.size();
+}
 
-  if (lKFsSharingWordsLoop.empty() && lKFsSharingWordsMerge.empty()) return;
-
-  if (!lKFsSharingWordsLoop.empty()) {
-    list<pair<float, KeyFrame*> > lScoreAndMatch;
+void KeyFrameDatabase::ErasePendingSlots(Map* pMap) {
+  std::unordered_map<Map*, PendingMap>::iterator it = mmPendingMaps.find(pMap);
+  if (it == mmPendingMaps.end()) return;
 
-    // Only compare against those keyframes that share enough words
-    int maxCommonWords = 0;
-    for (list<KeyFrame*>::iterator lit = lKFsSharingWordsLoop.begin(),
-                                   lend = lKFsSharingWordsLoop.end();
-         lit != lend; lit++) {
-      if ((*lit)->mnLoopWords > maxCommonWords)
-        maxCommonWords = (*lit)->mnLoopWords;
+  for (unsigned int nSlot : it->second.vnSlots) {
+    mvpSlotPendingMaps[nSlot] = static_cast<Map*>(NULL);
+    mvnPendingSlots.push_back(nSlot);
+  }
+  for (unsigned int nWord : it->second.vnWords) {
+    if (!mvbDirtyWord[nWord]) {
+      mvbDirtyWord[nWord] = true;
+      mvnDirtyWords.push_back(nWord);
     }
+  }
+  mnDeadPostings += it->second.vnWords.size();
+  mmPendingMaps.erase(it);
+}
 
-    int minCommonWords = maxCommonWords * 0.8f;
-
-    int nscores = 0;
-
-    // Compute similarity score. Retain the matches whose score is higher than
-    // minScore
-    for (list<KeyFrame*>::iterator lit = lKFsSharingWordsLoop.begin(),
-                                   lend = lKFsSharingWordsLoop.end();
-         lit != lend; lit++) {
-      KeyFrame* pKFi = *lit;
-
-      if (pKFi->mnLoopWords > minCommonWords) {
-        nscores++;
-
-        float si = mpVoc->score(pKF->mBowVec, pKFi->mBowVec);
-
-        pKFi->mLoopScore = si;
-        if (si >= minScore) lScoreAndMatch.push_back(make_pair(si, pKFi));
-      }
+bool KeyFrameDatabase::RestorePendingHits(const set<Map*>& spPendingHits) {
+  for (Map* pMap : spPendingHits) {
+    std::function<void(Map*)> fRestore;
+    {
+      shared_lock<shared_mutex> lock(mMutex);
+      std::unordered_map<Map*, PendingMap>::const_iterator it =
+          mmPendingMaps.find(pMap);
+      if (it == mmPendingMaps.end()) continue;
+      fRestore = it->second.fRestore;
     }
 
-    if (!lScoreAndMatch.empty()) {
-      list<pair<float, KeyFrame*> > lAccScoreAndMatch;
-      float bestAccScore = minScore;
-
-      // Lets now accumulate score by covisibility
-      for (list<pair<float, KeyFrame*> >::iterator it = lScoreAndMatch.begin(),
-                                                   itend = lScoreAndMatch.end();
-           it != itend; it++) {
-        KeyFrame* pKFi = it->second;
-        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
-
-        float bestScore = it->first;
-        float accScore = it->first;
-        KeyFrame* pBestKF = pKFi;
-        for (vector<KeyFrame*>::iterator vit = vpNeighs.begin(),
-                                         vend = vpNeighs.end();
-             vit != vend; vit++) {
-          KeyFrame* pKF2 = *vit;
-          if (pKF2->mnLoopQuery == pKF->mnId &&
-              pKF2->mnLoopWords > minCommonWords) {
-            accScore += pKF2->mLoopScore;
-            if (pKF2->mLoopScore > bestScore) {
-              pBestKF = pKF2;
-              bestScore = pKF2->mLoopScore;
-            }
-          }
-        }
-
-        lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
-        if (accScore > bestAccScore) bestAccScore = accScore;
-      }
-
-      // Return all those keyframes with a score higher than 0.75*bestScore
-      float minScoreToRetain = 0.75f * bestAccScore;
-
-      set<KeyFrame*> spAlreadyAddedKF;
-      vpLoopCand.reserve(lAccScoreAndMatch.size());
-
-      for (list<pair<float, KeyFrame*> >::iterator
-               it = lAccScoreAndMatch.begin(),
-               itend = lAccScoreAndMatch.end();
-           it != itend; it++) {
-        if (it->first > minScoreToRetain) {
-          KeyFrame* pKFi = it->second;
-          if (!spAlreadyAddedKF.count(pKFi)) {
-            vpLoopCand.push_back(pKFi);
-            spAlreadyAddedKF.insert(pKFi);
-          }
-        }
-      }
-    }
+    // The restored map replaces its pending keyframes. If it could not be
+    // restored they are dropped, so a map is only tried once
+    fRestore(pMap);
+    replacePending(pMap, vector<KeyFrame*>());
   }
+  return !spPendingHits.empty();
+}
 
-  if (!lKFsSharingWordsMerge.empty()) {
-    list<pair<float, KeyFrame*> > lScoreAndMatch;
-
-    // Only compare against those keyframes that share enough words
-    int maxCommonWords = 0;
-    for (list<KeyFrame*>::iterator lit = lKFsSharingWordsMerge.begin(),
-                                   lend = lKFsSharingWordsMerge.end();
-         lit != lend; lit++) {
-      if ((*lit)->mnMergeWords > maxCommonWords)
-        maxCommonWords = (*lit)->mnMergeWords;
+void KeyFrameDatabase::Compact() {
+  for (unsigned int nWord : mvnDirtyWords) {
+    std::vector<Posting>& vPostings = mvInvertedFile[nWord];
+    size_t nKept = 0;
+    for (size_t i = 0; i < vPostings.size(); ++i) {
+      const unsigned int nSlot = vPostings[i].mnSlot;
+      if (mvpSlotKeyFrames[nSlot] || mvpSlotPendingMaps[nSlot])
+        vPostings[nKept++] = vPostings[i];
     }
+    mnPostings -= vPostings.size() - nKept;
+    vPostings.resize(nKept);
+    mvbDirtyWord[nWord] = false;
+  }
+  mvnDirtyWords.clear();
+  mnDeadPostings = 0;
 
-    int minCommonWords = maxCommonWords * 0.8f;
-
-    int nscores = 0;
-
-    // Compute similarity score. Retain the matches whose score is higher than
-    // minScore
-    for (list<KeyFrame*>::iterator lit = lKFsSharingWordsMerge.begin(),
-                                   lend = lKFsSharingWordsMerge.end();
-         lit != lend; lit++) {
-      KeyFrame* pKFi = *lit;
-
-      if (pKFi->mnMergeWords > minCommonWords) {
-        nscores++;
+  mvnFreeSlots.insert(mvnFreeSlots.end(), mvnPendingSlots.begin(),
+                      mvnPendingSlots.end());
+  mvnPendingSlots.clear();
+}
 
-        float si = mpVoc->score(pKF->mBowVec, pKFi->mBowVec);
+namespace {
+
+// Per-thread scratch buffers of the query engine, indexed by keyframe slot.
+// Only the touched entries are reset, so a query costs O(postings visited)
+struct QueryScratch {
+  std::vector<float> vAccScore;
+  std::vector<int> vnWords;
+  std::vector<signed char> vnGroup;
+  std::vector<bool> vbScored;
+  std::vector<unsigned int> vnTouched;
+
+  void Reserve(size_t nSlots) {
+    if (vnWords.size() >= nSlots) return;
+    vAccScore.resize(nSlots, 0.f);
+    vnWords.resize(nSlots, 0);
+    vnGroup.resize(nSlots, -1);
+    vbScored.resize(nSlots, false);
+  }
 
-        pKFi->mMergeScore = si;
-        if (si >= minScore) lScoreAndMatch.push_back(make_pair(si, pKFi));
-      }
-    }
-
-    if (!lScoreAndMatch.empty()) {
-      list<pair<float, KeyFrame*> > lAccScoreAndMatch;
-      float bestAccScore = minScore;
-
-      // Lets now accumulate score by covisibility
-      for (list<pair<float, KeyFrame*> >::iterator it = lScoreAndMatch.begin(),
-                                                   itend = lScoreAndMatch.end();
-           it != itend; it++) {
-        KeyFrame* pKFi = it->second;
-        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
-
-        float bestScore = it->first;
-        float accScore = it->first;
-        KeyFrame* pBestKF = pKFi;
-        for (vector<KeyFrame*>::iterator vit = vpNeighs.begin(),
-                                         vend = vpNeighs.end();
-             vit != vend; vit++) {
-          KeyFrame* pKF2 = *vit;
-          if (pKF2->mnMergeQuery == pKF->mnId &&
-              pKF2->mnMergeWords > minCommonWords) {
-            accScore += pKF2->mMergeScore;
-            if (pKF2->mMergeScore > bestScore) {
-              pBestKF = pKF2;
-              bestScore = pKF2->mMergeScore;
-            }
-          }
-        }
-
-        lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
-        if (accScore > bestAccScore) bestAccScore = accScore;
-      }
-
-      // Return all those keyframes with a score higher than 0.75*bestScore
-      float minScoreToRetain = 0.75f * bestAccScore;
-
-      set<KeyFrame*> spAlreadyAddedKF;
-      vpMergeCand.reserve(lAccScoreAndMatch.size());
-
-      for (list<pair<float, KeyFrame*> >::iterator
-               it = lAccScoreAndMatch.begin(),
-               itend = lAccScoreAndMatch.end();
-           it != itend; it++) {
-        if (it->first > minScoreToRetain) {
-          KeyFrame* pKFi = it->second;
-          if (!spAlreadyAddedKF.count(pKFi)) {
-            vpMergeCand.push_back(pKFi);
-            spAlreadyAddedKF.insert(pKFi);
-          }
-        }
-      }
+  void Reset() {
+    for (unsigned int nSlot : vnTouched) {
+      vAccScore[nSlot] = 0.f;
+      vnWords[nSlot] = 0;
+      vnGroup[nSlot] = -1;
+      vbScored[nSlot] = false;
     }
+    vnTouched.clear();
   }
+};
 
-  for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
-                                        vend = pKF->mBowVec.end();
-       vit != vend; vit++) {
-    list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
+thread_local QueryScratch tQueryScratch;
 
-    for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-         lit != lend; lit++) {
-      KeyFrame* pKFi = *lit;
-      pKFi->mnLoopQuery = -1;
-      pKFi->mnMergeQuery = -1;
-    }
-  }
+// Higher accumulated score first, ties by keyframe id to be deterministic
+bool CompareAccScore(const pair<float, KeyFrame*>& a,
+                     const pair<float, KeyFrame*>& b) {
+  if (a.first != b.first) return a.first > b.first;
+  return a.second->mnId < b.second->mnId;
 }
 
-void KeyFrameDatabase::DetectBestCandidates(KeyFrame* pKF,
-                                            vector<KeyFrame*>& vpLoopCand,
-                                            vector<KeyFrame*>& vpMergeCand,
-                                            int nMinWords) {
-  list<KeyFrame*> lKFsSharingWords;
-  set<KeyFrame*> spConnectedKF;
+}  // namespace
 
-  // Search all keyframes that share a word with current frame
-  {
-    unique_lock<mutex> lock(mMutex);
+void KeyFrameDatabase::QueryAccScores(
+    const DBoW2::BowVector& vBowVec, const IdCounters* pSession,
+    const std::function<int(KeyFrame*)>& fGroup, const int nPendingGroup,
+    const int nGroups, const int nMinWords, const float minScore,
+    set<Map*>& spPendingHits,
+    vector<vector<pair<float, KeyFrame*> > >& vvAccScoreAndMatch) {
+  spPendingHits.clear();
+  vvAccScoreAndMatch.assign(nGroups, vector<pair<float, KeyFrame*> >());
 
-    spConnectedKF = pKF->GetConnectedKeyFrames();
+  QueryScratch& scratch = tQueryScratch;
+  scratch.Reserve(mvpSlotKeyFrames.size());
 
-    for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
-                                          vend = pKF->mBowVec.end();
-         vit != vend; vit++) {
-      list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
-
-      for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-           lit != lend; lit++) {
-        KeyFrame* pKFi = *lit;
-        if (spConnectedKF.find(pKFi) != spConnectedKF.end()) {
-          continue;
-        }
-        if (pKFi->mnPlaceRecognitionQuery != pKF->mnId) {
-          pKFi->mnPlaceRecognitionWords = 0;
-          pKFi->mnPlaceRecognitionQuery = pKF->mnId;
-          lKFsSharingWords.push_back(pKFi);
-        }
-        pKFi->mnPlaceRecognitionWords++;
+  // With the L1 score (the one of the ORB vocabularies) the similarity is
+  // accumulated directly from the weights stored in the postings:
+  // s(v,w) = 1/2 * sum_i (|v_i| + |w_i| - |v_i - w_i|)
+  const bool bL1Score = mpVoc->getScoringType() == DBoW2::L1_NORM;
+
+  // Search all keyframes that share a word with the query
+  for (DBoW2::BowVector::const_iterator vit = vBowVec.begin(),
+                                        vend = vBowVec.end();
+       vit != vend; vit++) {
+    const float vi = vit->second;
+    for (const Posting& posting : mvInvertedFile[vit->first]) {
+      const unsigned int nSlot = posting.mnSlot;
+      KeyFrame* pKFi = mvpSlotKeyFrames[nSlot];
+      if (!pKFi && (nPendingGroup < 0 || !mvpSlotPendingMaps[nSlot])) continue;
+      if (pSession && mvpSlotSessions[nSlot] != pSession) continue;
+
+      if (scratch.vnWords[nSlot] == 0) {
+        scratch.vnTouched.push_back(nSlot);
+        scratch.vnGroup[nSlot] = pKFi ? fGroup(pKFi) : nPendingGroup;
       }
+      scratch.vnWords[nSlot]++;
+      if (bL1Score)
+        scratch.vAccScore[nSlot] += fabs(vi) + fabs(posting.mWeight) -
+                                    fabs(vi - posting.mWeight);
     }
   }
-  if (lKFsSharingWords.empty()) return;
 
   // Only compare against those keyframes that share enough words
-  int maxCommonWords = 0;
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    if ((*lit)->mnPlaceRecognitionWords > maxCommonWords)
-      maxCommonWords = (*lit)->mnPlaceRecognitionWords;
-  }
-
-  int minCommonWords = maxCommonWords * 0.8f;
-
-  if (minCommonWords < nMinWords) {
-    minCommonWords = nMinWords;
+  vector<int> vnMinCommonWords(nGroups, 0);
+  for (unsigned int nSlot : scratch.vnTouched) {
+    const int nGroup = scratch.vnGroup[nSlot];
+    if (nGroup >= 0 && scratch.vnWords[nSlot] > vnMinCommonWords[nGroup])
+      vnMinCommonWords[nGroup] = scratch.vnWords[nSlot];
   }
+  for (int& minCommonWords : vnMinCommonWords)
+    minCommonWords = max(static_cast<int>(minCommonWords * 0.8f), nMinWords);
+
+  // Compute similarity score
+  vector<unsigned int> vnScored;
+  for (unsigned int nSlot : scratch.vnTouched) {
+    const int nGroup = scratch.vnGroup[nSlot];
+    if (nGroup < 0 || scratch.vnWords[nSlot] <= vnMinCommonWords[nGroup])
+      continue;
 
-  list<pair<float, KeyFrame*> > lScoreAndMatch;
-
-  int nscores = 0;
-
-  // Compute similarity score.
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    KeyFrame* pKFi = *lit;
-
-    if (pKFi->mnPlaceRecognitionWords > minCommonWords) {
-      nscores++;
-      float si = mpVoc->score(pKF->mBowVec, pKFi->mBowVec);
-      pKFi->mPlaceRecognitionScore = si;
-      lScoreAndMatch.push_back(make_pair(si, pKFi));
+    // Without the L1 score a pending keyframe has no vector to be scored
+    // with, so it is a hit as soon as it shares enough words
+    Map* pPendingMap = mvpSlotPendingMaps[nSlot];
+    if (pPendingMap) {
+      if (!bL1Score || 0.5f * scratch.vAccScore[nSlot] >= minScore)
+        spPendingHits.insert(pPendingMap);
+      continue;
     }
-  }
-
-  if (lScoreAndMatch.empty()) return;
 
-  list<pair<float, KeyFrame*> > lAccScoreAndMatch;
-  float bestAccScore = 0;
+    float si = bL1Score
+                   ? 0.5f * scratch.vAccScore[nSlot]
+                   : mpVoc->score(vBowVec, mvpSlotKeyFrames[nSlot]->mBowVec);
+    scratch.vAccScore[nSlot] = si;
+    scratch.vbScored[nSlot] = true;
+    if (si >= minScore) vnScored.push_back(nSlot);
+  }
 
   // Lets now accumulate score by covisibility
-  for (list<pair<float, KeyFrame*> >::iterator it = lScoreAndMatch.begin(),
-                                               itend = lScoreAndMatch.end();
-       it != itend; it++) {
-    KeyFrame* pKFi = it->second;
+  for (unsigned int nSlot : vnScored) {
+    KeyFrame* pKFi = mvpSlotKeyFrames[nSlot];
+    const int nGroup = scratch.vnGroup[nSlot];
     vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
-    float bestScore = it->first;
+    float bestScore = scratch.vAccScore[nSlot];
     float accScore = bestScore;
     KeyFrame* pBestKF = pKFi;
-    for (vector<KeyFrame*>::iterator vit = vpNeighs.begin(),
-                                     vend = vpNeighs.end();
-         vit != vend; vit++) {
-      KeyFrame* pKF2 = *vit;
-      if (pKF2->mnPlaceRecognitionQuery != pKF->mnId) continue;
-
-      accScore += pKF2->mPlaceRecognitionScore;
-      if (pKF2->mPlaceRecognitionScore > bestScore) {
+    for (KeyFrame* pKF2 : vpNeighs) {
+      std::unordered_map<KeyFrame*, unsigned int>::const_iterator it =
+          mmKeyFrameSlots.find(pKF2);
+      if (it == mmKeyFrameSlots.end()) continue;
+
+      const unsigned int nSlot2 = it->second;
+      if (nSlot2 >= scratch.vbScored.size() || !scratch.vbScored[nSlot2] ||
+          scratch.vnGroup[nSlot2] != nGroup)
+        continue;
+
+      const float score2 = scratch.vAccScore[nSlot2];
+      accScore += score2;
+      if (score2 > bestScore) {
         pBestKF = pKF2;
-        bestScore = pKF2->mPlaceRecognitionScore;
+        bestScore = score2;
       }
     }
-    lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
-    if (accScore > bestAccScore) bestAccScore = accScore;
+    vvAccScoreAndMatch[nGroup].push_back(make_pair(accScore, pBestKF));
   }
 
+  scratch.Reset();
+}
+
+void KeyFrameDatabase::RetainBestAccScores(
+    const vector<pair<float, KeyFrame*> >& vAccScoreAndMatch,
+    float bestAccScore, vector<KeyFrame*>& vpCandidates) {
+  for (const pair<float, KeyFrame*>& accScoreAndMatch : vAccScoreAndMatch)
+    bestAccScore = max(bestAccScore, accScoreAndMatch.first);
+
   // Return all those keyframes with a score higher than 0.75*bestScore
-  float minScoreToRetain = 0.75f * bestAccScore;
+  const float minScoreToRetain = 0.75f * bestAccScore;
+
   set<KeyFrame*> spAlreadyAddedKF;
-  vpLoopCand.reserve(lAccScoreAndMatch.size());
-  vpMergeCand.reserve(lAccScoreAndMatch.size());
-  for (list<pair<float, KeyFrame*> >::iterator it = lAccScoreAndMatch.begin(),
-                                               itend = lAccScoreAndMatch.end();
-       it != itend; it++) {
-    const float& si = it->first;
-    if (si > minScoreToRetain) {
-      KeyFrame* pKFi = it->second;
-      if (!spAlreadyAddedKF.count(pKFi)) {
-        if (pKF->GetMap() == pKFi->GetMap()) {
-          vpLoopCand.push_back(pKFi);
-        } else {
-          vpMergeCand.push_back(pKFi);
-        }
-        spAlreadyAddedKF.insert(pKFi);
-      }
+  vpCandidates.reserve(vAccScoreAndMatch.size());
+  for (const pair<float, KeyFrame*>& accScoreAndMatch : vAccScoreAndMatch) {
+    if (accScoreAndMatch.first > minScoreToRetain) {
+      KeyFrame* pKFi = accScoreAndMatch.second;
+      if (spAlreadyAddedKF.insert(pKFi).second) vpCandidates.push_back(pKFi);
     }
   }
 }
 
-bool compFirst(const pair<float, KeyFrame*>& a,
-               const pair<float, KeyFrame*>& b) {
-  return a.first > b.first;
-}
-
-void KeyFrameDatabase::DetectNBestCandidates(KeyFrame* pKF,
-                                             vector<KeyFrame*>& vpLoopCand,
-                                             vector<KeyFrame*>& vpMergeCand,
-                                             int nNumCandidates) {
-  list<KeyFrame*> lKFsSharingWords;
-  set<KeyFrame*> spConnectedKF;
+vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF,
+                                                         float minScore) {
+  set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+  Map* pMap = pKF->GetMap();
 
-  // Search all keyframes that share a word with current frame
+  // Discard keyframes connected to the query keyframe. For consider a loop
+  // candidate it must be in the same map
+  vector<vector<pair<float, KeyFrame*> > > vvAccScoreAndMatch;
+  set<Map*> spPendingHits;
   {
-    unique_lock<mutex> lock(mMutex);
-
-    spConnectedKF = pKF->GetConnectedKeyFrames();
-
-    for (DBoW2::BowVector::const_iterator vit = pKF->mBowVec.begin(),
-                                          vend = pKF->mBowVec.end();
-         vit != vend; vit++) {
-      list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
-
-      for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-           lit != lend; lit++) {
-        KeyFrame* pKFi = *lit;
-
-        if (pKFi->mnPlaceRecognitionQuery != pKF->mnId) {
-          pKFi->mnPlaceRecognitionWords = 0;
-          if (!spConnectedKF.count(pKFi)) {
-            pKFi->mnPlaceRecognitionQuery = pKF->mnId;
-            lKFsSharingWords.push_back(pKFi);
-          }
-        }
-        pKFi->mnPlaceRecognitionWords++;
-      }
-    }
-  }
-  if (lKFsSharingWords.empty()) return;
-
-  // Only compare against those keyframes that share enough words
-  int maxCommonWords = 0;
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    if ((*lit)->mnPlaceRecognitionWords > maxCommonWords)
-      maxCommonWords = (*lit)->mnPlaceRecognitionWords;
+    shared_lock<shared_mutex> lock(mMutex);
+    QueryAccScores(
+        pKF->mBowVec, pMap->GetIdCounters(),
+        [&](KeyFrame* pKFi) {
+          return (pKFi->GetMap() == pMap && !spConnectedKeyFrames.count(pKFi))
+                     ? 0
+                     : -1;
+        },
+        -1, 1, 0, minScore, spPendingHits, vvAccScoreAndMatch);
   }
 
-  int minCommonWords = maxCommonWords * 0.8f;
-
-  list<pair<float, KeyFrame*> > lScoreAndMatch;
-
-  int nscores = 0;
+  vector<KeyFrame*> vpLoopCandidates;
+  RetainBestAccScores(vvAccScoreAndMatch[0], minScore, vpLoopCandidates);
+  return vpLoopCandidates;
+}
 
-  // Compute similarity score.
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    KeyFrame* pKFi = *lit;
+void KeyFrameDatabase::DetectCandidates(KeyFrame* pKF, float minScore,
+                                        vector<KeyFrame*>& vpLoopCand,
+                                        vector<KeyFrame*>& vpMergeCand) {
+  set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+  Map* pMap = pKF->GetMap();
+
+  // Group 0: loop candidates in the same map, group 1: merge candidates,
+  // stored maps not restored yet included
+  vector<vector<pair<float, KeyFrame*> > > vvAccScoreAndMatch;
+  set<Map*> spPendingHits;
+  do {
+    shared_lock<shared_mutex> lock(mMutex);
+    QueryAccScores(
+        pKF->mBowVec, pMap->GetIdCounters(),
+        [&](KeyFrame* pKFi) {
+          if (spConnectedKeyFrames.count(pKFi)) return -1;
+          Map* pMapi = pKFi->GetMap();
+          if (pMapi == pMap) return 0;
+          return pMapi->IsBad() ? -1 : 1;
+        },
+        1, 2, 0, minScore, spPendingHits, vvAccScoreAndMatch);
+  } while (RestorePendingHits(spPendingHits));
+
+  RetainBestAccScores(vvAccScoreAndMatch[0], minScore, vpLoopCand);
+  RetainBestAccScores(vvAccScoreAndMatch[1], minScore, vpMergeCand);
+}
 
-    if (pKFi->mnPlaceRecognitionWords > minCommonWords) {
-      nscores++;
-      float si = mpVoc->score(pKF->mBowVec, pKFi->mBowVec);
-      pKFi->mPlaceRecognitionScore = si;
-      lScoreAndMatch.push_back(make_pair(si, pKFi));
-    }
+void KeyFrameDatabase::DetectBestCandidates(KeyFrame* pKF,
+                                            vector<KeyFrame*>& vpLoopCand,
+                                            vector<KeyFrame*>& vpMergeCand,
+                                            int nMinWords) {
+  set<KeyFrame*> spConnectedKF = pKF->GetConnectedKeyFrames();
+  Map* pMap = pKF->GetMap();
+
+  vector<vector<pair<float, KeyFrame*> > > vvAccScoreAndMatch;
+  set<Map*> spPendingHits;
+  do {
+    shared_lock<shared_mutex> lock(mMutex);
+    QueryAccScores(
+        pKF->mBowVec, pMap->GetIdCounters(),
+        [&](KeyFrame* pKFi) { return spConnectedKF.count(pKFi) ? -1 : 0; }, 0,
+        1, nMinWords, 0.f, spPendingHits, vvAccScoreAndMatch);
+  } while (RestorePendingHits(spPendingHits));
+
+  vector<KeyFrame*> vpCandidates;
+  RetainBestAccScores(vvAccScoreAndMatch[0], 0.f, vpCandidates);
+
+  vpLoopCand.reserve(vpCandidates.size());
+  vpMergeCand.reserve(vpCandidates.size());
+  for (KeyFrame* pKFi : vpCandidates) {
+    if (pMap == pKFi->GetMap())
+      vpLoopCand.push_back(pKFi);
+    else
+      vpMergeCand.push_back(pKFi);
   }
+}
 
-  if (lScoreAndMatch.empty()) return;
-
-  list<pair<float, KeyFrame*> > lAccScoreAndMatch;
-  float bestAccScore = 0;
-
-  // Lets now accumulate score by covisibility
-  for (list<pair<float, KeyFrame*> >::iterator it = lScoreAndMatch.begin(),
-                                               itend = lScoreAndMatch.end();
-       it != itend; it++) {
-    KeyFrame* pKFi = it->second;
-    vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
-
-    float bestScore = it->first;
-    float accScore = bestScore;
-    KeyFrame* pBestKF = pKFi;
-    for (vector<KeyFrame*>::iterator vit = vpNeighs.begin(),
-                                     vend = vpNeighs.end();
-         vit != vend; vit++) {
-      KeyFrame* pKF2 = *vit;
-      if (pKF2->mnPlaceRecognitionQuery != pKF->mnId) continue;
-
-      accScore += pKF2->mPlaceRecognitionScore;
-      if (pKF2->mPlaceRecognitionScore > bestScore) {
-        pBestKF = pKF2;
-        bestScore = pKF2->mPlaceRecognitionScore;
-      }
-    }
-    lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
-    if (accScore > bestAccScore) bestAccScore = accScore;
+void KeyFrameDatabase::DetectNBestCandidates(KeyFrame* pKF,
+                                             vector<KeyFrame*>& vpLoopCand,
+                                             vector<KeyFrame*>& vpMergeCand,
+                                             int nNumCandidates) {
+  set<KeyFrame*> spConnectedKF = pKF->GetConnectedKeyFrames();
+  Map* pMap = pKF->GetMap();
+
+  vector<vector<pair<float, KeyFrame*> > > vvAccScoreAndMatch;
+  set<Map*> spPendingHits;
+  do {
+    shared_lock<shared_mutex> lock(mMutex);
+    QueryAccScores(
+        pKF->mBowVec, pMap->GetIdCounters(),
+        [&](KeyFrame* pKFi) { return spConnectedKF.count(pKFi) ? -1 : 0; }, 0,
+        1, 0, 0.f, spPendingHits, vvAccScoreAndMatch);
+  } while (RestorePendingHits(spPendingHits));
+  vector<pair<float, KeyFrame*> >& vAccScoreAndMatch = vvAccScoreAndMatch[0];
+  if (vAccScoreAndMatch.empty() || nNumCandidates <= 0) return;
+
+  // A keyframe can be the best of several groups, keep its best score
+  std::unordered_map<KeyFrame*, float> mBestAccScore;
+  for (const pair<float, KeyFrame*>& accScoreAndMatch : vAccScoreAndMatch) {
+    float& accScore = mBestAccScore[accScoreAndMatch.second];
+    accScore = max(accScore, accScoreAndMatch.first);
   }
 
-  lAccScoreAndMatch.sort(compFirst);
-
-  vpLoopCand.reserve(nNumCandidates);
-  vpMergeCand.reserve(nNumCandidates);
-  set<KeyFrame*> spAlreadyAddedKF;
-  size_t i = 0;
-  list<pair<float, KeyFrame*> >::iterator it = lAccScoreAndMatch.begin();
-  while ((i < lAccScoreAndMatch.size()) || (i < lAccScoreAndMatch.size() &&
-         (static_cast<int>(vpLoopCand.size()) < nNumCandidates ||
-          static_cast<int>(vpMergeCand.size()) < nNumCandidates))) {
-    KeyFrame* pKFi = it->second;
-    if (pKFi->isBad()){
-      i++;
-      it++;
-      continue;
+  // Bounded min-heaps with the N best loop and merge candidates
+  vector<pair<float, KeyFrame*> > vLoopHeap, vMergeHeap;
+  vLoopHeap.reserve(nNumCandidates + 1);
+  vMergeHeap.reserve(nNumCandidates + 1);
+  for (const pair<KeyFrame* const, float>& bestAccScore : mBestAccScore) {
+    KeyFrame* pKFi = bestAccScore.first;
+    if (pKFi->isBad()) continue;
+
+    vector<pair<float, KeyFrame*> >* pvHeap = &vLoopHeap;
+    Map* pMapi = pKFi->GetMap();
+    if (pMapi != pMap) {
+      if (pMapi->IsBad()) continue;
+      pvHeap = &vMergeHeap;
     }
 
-    if (!spAlreadyAddedKF.count(pKFi)) {
-      if (pKF->GetMap() == pKFi->GetMap() &&
-          static_cast<int>(vpLoopCand.size()) < nNumCandidates) {
-        vpLoopCand.push_back(pKFi);
-      } else if (pKF->GetMap() != pKFi->GetMap() &&
-                 static_cast<int>(vpMergeCand.size()) < nNumCandidates &&
-                 !pKFi->GetMap()->IsBad()) {
-        vpMergeCand.push_back(pKFi);
-      }
-      spAlreadyAddedKF.insert(pKFi);
+    pvHeap->push_back(make_pair(bestAccScore.second, pKFi));
+    push_heap(pvHeap->begin(), pvHeap->end(), CompareAccScore);
+    if (static_cast<int>(pvHeap->size()) > nNumCandidates) {
+      pop_heap(pvHeap->begin(), pvHeap->end(), CompareAccScore);
+      pvHeap->pop_back();
     }
-    i++;
-    it++;
   }
+
+  sort_heap(vLoopHeap.begin(), vLoopHeap.end(), CompareAccScore);
+  sort_heap(vMergeHeap.begin(), vMergeHeap.end(), CompareAccScore);
+
+  vpLoopCand.reserve(vLoopHeap.size());
+  for (const pair<float, KeyFrame*>& loopCand : vLoopHeap)
+    vpLoopCand.push_back(loopCand.second);
+  vpMergeCand.reserve(vMergeHeap.size());
+  for (const pair<float, KeyFrame*>& mergeCand : vMergeHeap)
+    vpMergeCand.push_back(mergeCand.second);
 }
 
 vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame* F,
                                                                    Map* pMap) {
-  list<KeyFrame*> lKFsSharingWords;
-
-  // Search all keyframes that share a word with current frame
+  // Only the keyframes of pMap are kept, so stored maps are not restored
+  vector<vector<pair<float, KeyFrame*> > > vvAccScoreAndMatch;
+  set<Map*> spPendingHits;
   {
-    unique_lock<mutex> lock(mMutex);
-
-    for (DBoW2::BowVector::const_iterator vit = F->mBowVec.begin(),
-                                          vend = F->mBowVec.end();
-         vit != vend; vit++) {
-      list<KeyFrame*>& lKFs = mvInvertedFile[vit->first];
-
-      for (list<KeyFrame*>::iterator lit = lKFs.begin(), lend = lKFs.end();
-           lit != lend; lit++) {
-        KeyFrame* pKFi = *lit;
-        if (pKFi->mnRelocQuery != F->mnId) {
-          pKFi->mnRelocWords = 0;
-          pKFi->mnRelocQuery = F->mnId;
-          lKFsSharingWords.push_back(pKFi);
-        }
-        pKFi->mnRelocWords++;
-      }
-    }
+    shared_lock<shared_mutex> lock(mMutex);
+    QueryAccScores(
+        F->mBowVec, pMap->GetIdCounters(), [](KeyFrame*) { return 0; }, -1, 1,
+        0, 0.f, spPendingHits, vvAccScoreAndMatch);
   }
-  if (lKFsSharingWords.empty()) return vector<KeyFrame*>();
-
-  // Only compare against those keyframes that share enough words
-  int maxCommonWords = 0;
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    if ((*lit)->mnRelocWords > maxCommonWords)
-      maxCommonWords = (*lit)->mnRelocWords;
-  }
-
-  int minCommonWords = maxCommonWords * 0.8f;
 
-  list<pair<float, KeyFrame*> > lScoreAndMatch;
+  vector<KeyFrame*> vpCandidates;
+  RetainBestAccScores(vvAccScoreAndMatch[0], 0.f, vpCandidates);
 
-  int nscores = 0;
-
-  // Compute similarity score.
-  for (list<KeyFrame*>::iterator lit = lKFsSharingWords.begin(),
-                                 lend = lKFsSharingWords.end();
-       lit != lend; lit++) {
-    KeyFrame* pKFi = *lit;
-
-    if (pKFi->mnRelocWords > minCommonWords) {
-      nscores++;
-      float si = mpVoc->score(F->mBowVec, pKFi->mBowVec);
-      pKFi->mRelocScore = si;
-      lScoreAndMatch.push_back(make_pair(si, pKFi));
-    }
+  vector<KeyFrame*> vpRelocCandidates;
+  vpRelocCandidates.reserve(vpCandidates.size());
+  for (KeyFrame* pKFi : vpCandidates) {
+    if (pKFi->GetMap() == pMap) vpRelocCandidates.push_back(pKFi);
   }
 
-  if (lScoreAndMatch.empty()) return vector<KeyFrame*>();
-
-  list<pair<float, KeyFrame*> > lAccScoreAndMatch;
-  float bestAccScore = 0;
-
-  // Lets now accumulate score by covisibility
-  for (list<pair<float, KeyFrame*> >::iterator it = lScoreAndMatch.begin(),
-                                               itend = lScoreAndMatch.end();
-       it != itend; it++) {
-    KeyFrame* pKFi = it->second;
-    vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
+  return vpRelocCandidates;
+}
 
-    float bestScore = it->first;
-    float accScore = bestScore;
-    KeyFrame* pBestKF = pKFi;
-    for (vector<KeyFrame*>::iterator vit = vpNeighs.begin(),
-                                     vend = vpNeighs.end();
-         vit != vend; vit++) {
-      KeyFrame* pKF2 = *vit;
-      if (pKF2->mnRelocQuery != F->mnId) continue;
+vector<KeyFrame*> KeyFrameDatabase::DetectOtherSessionCandidates(
+    KeyFrame* pKF, float minScore) {
+  const IdCounters* pSession = pKF->GetMap()->GetIdCounters();
 
-      accScore += pKF2->mRelocScore;
-      if (pKF2->mRelocScore > bestScore) {
-        pBestKF = pKF2;
-        bestScore = pKF2->mRelocScore;
-      }
-    }
-    lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
-    if (accScore > bestAccScore) bestAccScore = accScore;
-  }
-
-  // Return all those keyframes with a score higher than 0.75*bestScore
-  float minScoreToRetain = 0.75f * bestAccScore;
-  set<KeyFrame*> spAlreadyAddedKF;
-  vector<KeyFrame*> vpRelocCandidates;
-  vpRelocCandidates.reserve(lAccScoreAndMatch.size());
-  for (list<pair<float, KeyFrame*> >::iterator it = lAccScoreAndMatch.begin(),
-                                               itend = lAccScoreAndMatch.end();
-       it != itend; it++) {
-    const float& si = it->first;
-    if (si > minScoreToRetain) {
-      KeyFrame* pKFi = it->second;
-      if (pKFi->GetMap() != pMap) continue;
-      if (!spAlreadyAddedKF.count(pKFi)) {
-        vpRelocCandidates.push_back(pKFi);
-        spAlreadyAddedKF.insert(pKFi);
-      }
-    }
+  vector<vector<pair<float, KeyFrame*> > > vvAccScoreAndMatch;
+  set<Map*> spPendingHits;
+  {
+    shared_lock<shared_mutex> lock(mMutex);
+    QueryAccScores(
+        pKF->mBowVec, NULL,
+        [&](KeyFrame* pKFi) {
+          return pKFi->GetMap()->GetIdCounters() == pSession ? -1 : 0;
+        },
+        -1, 1, 0, minScore, spPendingHits, vvAccScoreAndMatch);
   }
 
-  return vpRelocCandidates;
+  vector<KeyFrame*> vpCandidates;
+  RetainBestAccScores(vvAccScoreAndMatch[0], minScore, vpCandidates);
+  return vpCandidates;
 }
 
-void KeyFrameDatabase::SetORBVocabulary(ORBVocabulary* pORBVoc) {
-  ORBVocabulary** ptr;
-  ptr = (ORBVocabulary**)(&mpVoc);
-  *ptr = pORBVoc;
+void KeyFrameDatabase::SetORBVocabulary(const ORBVocabulary* pORBVoc) {
+  mpVoc = pORBVoc;
 
-  mvInvertedFile.clear();
-  mvInvertedFile.resize(mpVoc->size());
+  clear();
 }
 
 }  // namespace ORB_SLAM3
@@ -0,0 +1,192 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "KeyFrameStore.h"
+
+#include <algorithm>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+#include "KeyFrame.h"
+#include "SerializationUtils.h"
+
+namespace ORB_SLAM3 {
+
+// Spill down to this fraction of the budget, so that the next keyframes do
+// not trigger a spill each
+static const double kSpillHysteresis = 0.9;
+
+static std::string NewStorePrefix() {
+  static std::atomic<unsigned int> nNextStore(0);
+  return "KF_" + std::to_string(getpid()) + "_" +
+         std::to_string(nNextStore++) + "_";
+}
+
+KeyFrameStore::KeyFrameStore(const std::string& strDirectory,
+                             size_t nBudgetBytes)
+    : mStrDirectory(strDirectory),
+      mStrPrefix(NewStorePrefix()),
+      mnBudgetBytes(nBudgetBytes),
+      mnResidentBytes(0),
+      mnStamp(0) {}
+
+KeyFrameStore::~KeyFrameStore() {
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  for (KeyFrame* pKF : mvpKeyFrames) {
+    std::unique_lock<std::mutex> lockKF(pKF->mMutexResidency);
+    if (pKF->mbSpillFileWritten) std::remove(FileName(pKF).c_str());
+    pKF->mpKeyFrameStore = static_cast<KeyFrameStore*>(NULL);
+  }
+}
+
+void KeyFrameStore::AddKeyFrame(KeyFrame* pKF) {
+  {
+    std::unique_lock<std::mutex> lockKF(pKF->mMutexResidency);
+    if (pKF->mpKeyFrameStore) return;
+    pKF->mpKeyFrameStore = this;
+    pKF->mnLastUse = NextStamp();
+    mnResidentBytes += SpillableBytes(pKF);
+  }
+
+  std::unique_lock<std::mutex> lock(mMutexStore);
+  mvpKeyFrames.push_back(pKF);
+}
+
+void KeyFrameStore::Enforce() {
+  if (mnResidentBytes <= mnBudgetBytes) return;
+
+  std::vector<KeyFrame*> vpCandidates;
+  {
+    std::unique_lock<std::mutex> lock(mMutexStore);
+    vpCandidates = mvpKeyFrames;
+  }
+
+  // Least recently used first
+  std::vector<std::pair<unsigned long, KeyFrame*> > vLastUses;
+  vLastUses.reserve(vpCandidates.size());
+  for (KeyFrame* pKF : vpCandidates)
+    vLastUses.push_back(std::make_pair(pKF->mnLastUse.load(), pKF));
+  std::sort(vLastUses.begin(), vLastUses.end());
+
+  const size_t nTarget = kSpillHysteresis * mnBudgetBytes;
+  for (size_t i = 0; i < vLastUses.size() && mnResidentBytes > nTarget; i++) {
+    KeyFrame* pKF = vLastUses[i].second;
+    std::unique_lock<std::mutex> lockKF(pKF->mMutexResidency);
+    if (pKF->mbSpilled || pKF->mnPins > 0) continue;
+    Spill(pKF);
+  }
+}
+
+void KeyFrameStore::Spill(KeyFrame* pKF) {
+  // The spilled data never changes, the file is written only once
+  if (!pKF->mbSpillFileWritten) {
+    std::ofstream ofs(FileName(pKF), std::ios::binary);
+    try {
+      // The archive is flushed into the stream when it is destroyed
+      boost::archive::binary_oarchive oa(ofs);
+      serializeMatrix(oa, pKF->mDescriptors, 0);
+      oa << pKF->mGrid;
+      oa << pKF->mGridRight;
+      oa << pKF->mFeatVec;
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      ofs.setstate(std::ios::failbit);
+    }
+    ofs.close();
+
+    // The data is only released once it is known to be on disk
+    if (!ofs) {
+      std::cerr << "Failed to spill KF " << pKF->mnId << " to "
+                << FileName(pKF) << std::endl;
+      std::remove(FileName(pKF).c_str());
+      return;
+    }
+    pKF->mbSpillFileWritten = true;
+  }
+
+  mnResidentBytes -= SpillableBytes(pKF);
+
+  pKF->mDescriptors.release();
+  std::vector<std::vector<std::vector<size_t> > >().swap(pKF->mGrid);
+  std::vector<std::vector<std::vector<size_t> > >().swap(pKF->mGridRight);
+  DBoW2::FeatureVector().swap(pKF->mFeatVec);
+  pKF->mbSpilled = true;
+}
+
+bool KeyFrameStore::Restore(KeyFrame* pKF) {
+  bool bRestored = false;
+  std::ifstream ifs(FileName(pKF), std::ios::binary);
+  if (ifs.good()) {
+    try {
+      boost::archive::binary_iarchive ia(ifs);
+      serializeMatrix(ia, pKF->mDescriptors, 0);
+      ia >> pKF->mGrid;
+      ia >> pKF->mGridRight;
+      ia >> pKF->mFeatVec;
+      bRestored = true;
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+
+  if (!bRestored) {
+    std::cerr << "Failed to restore KF " << pKF->mnId << " from "
+              << FileName(pKF) << ", it is no longer used for matching"
+              << std::endl;
+    // Empty cells, so that the grid lookups find no features
+    pKF->mDescriptors.release();
+    pKF->mGrid.assign(pKF->mnGridCols,
+                      std::vector<std::vector<size_t> >(pKF->mnGridRows));
+    if (pKF->NLeft != -1)
+      pKF->mGridRight.assign(
+          pKF->mnGridCols, std::vector<std::vector<size_t> >(pKF->mnGridRows));
+    DBoW2::FeatureVector().swap(pKF->mFeatVec);
+  }
+  pKF->mbSpilled = false;
+
+  mnResidentBytes += SpillableBytes(pKF);
+  return bRestored;
+}
+
+size_t KeyFrameStore::SpillableBytes(KeyFrame* pKF) {
+  size_t nBytes = pKF->mDescriptors.total() * pKF->mDescriptors.elemSize();
+  for (const std::vector<std::vector<std::vector<size_t> > >* pGrid :
+       {&pKF->mGrid, &pKF->mGridRight}) {
+    for (const std::vector<std::vector<size_t> >& column : *pGrid) {
+      for (const std::vector<size_t>& cell : column)
+        nBytes += sizeof(cell) + cell.capacity() * sizeof(size_t);
+    }
+  }
+  for (const std::pair<const DBoW2::NodeId, std::vector<unsigned int> >&
+           node : pKF->mFeatVec)
+    nBytes += sizeof(node) + node.second.capacity() * sizeof(unsigned int);
+  return nBytes;
+}
+
+std::string KeyFrameStore::FileName(KeyFrame* pKF) const {
+  return mStrDirectory + "/" + mStrPrefix + std::to_string(pKF->mnId) +
+         ".bin";
+}
+
+}  // namespace ORB_SLAM3
@@ -26,6 +26,7 @@
 
 #include "Converter.h"
 #include "GeometricTools.h"
+#include "KeyFrameStore.h"
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
@@ -33,7 +34,8 @@
 namespace ORB_SLAM3 {
 
 LocalMapping::LocalMapping(System* pSys, const Atlas_ptr &pAtlas, const float bMonocular,
-                           bool bInertial, const string& _strSeqName)
+                           bool bInertial, const float thImuReintegration,
+                           const string& _strSeqName)
     : mScale(1.0),
       mInitSect(0),
       mIdxInit(0),
@@ -42,6 +44,7 @@ LocalMapping::LocalMapping(System* pSys, const Atlas_ptr &pAtlas, const float bM
       mbNotBA1(true),
       mbNotBA2(true),
       mbBadImu(false),
+      mThImuReintegration(thImuReintegration),
 #ifdef REGISTER_TIMES
       nLBA_exec(0),
       nLBA_abort(0),
@@ -60,6 +63,14 @@ LocalMapping::LocalMapping(System* pSys, const Atlas_ptr &pAtlas, const float bM
       mbStopRequested(false),
       mbNotStop(false),
       mbAcceptKeyFrames(true),
+      mbIdle(true),
+      mptImuInitBA(nullptr),
+      mpImuInitBAMap(nullptr),
+      mnImuInitBAid(0),
+      mnImuInitBABigChangeIdx(0),
+      mnImuInitBAStage(0),
+      mbAbortImuInitBA(false),
+      mbImuInitBAFinished(false),
       bInitializing(false),
       infoInertial(Eigen::MatrixXd::Zero(9, 9)),
       mNumLM(0),
@@ -82,6 +93,8 @@ void LocalMapping::Run() {
 
     // Check if there are keyframes in the queue
     if (CheckNewKeyFrames() && !mbBadImu) {
+      SetIdle(false);
+      StageTimes::Scope timeKeyFrame(mStageTimes, StageTimes::LOCAL_MAPPING);
 #ifdef REGISTER_TIMES
       double timeLBA_ms = 0;
       double timeKFCulling_ms = 0;
@@ -144,6 +157,7 @@ void LocalMapping::Run() {
 
       if (!CheckNewKeyFrames() && !stopRequested()) {
         if (mpAtlas->KeyFramesInMap() > 2) {
+          StageTimes::Scope timeLBA(mStageTimes, StageTimes::LOCAL_BA);
           if (mbInertial && mpCurrentKeyFrame->GetMap()->isImuInitialized()) {
             float dist =
                 (mpCurrentKeyFrame->mPrevKF->GetCameraCenter() -
@@ -211,6 +225,7 @@ void LocalMapping::Run() {
 
         // Initialize IMU here
         if (!mpCurrentKeyFrame->GetMap()->isImuInitialized() && mbInertial) {
+          mnImuInitBAStage = 0;
           if (mbMonocular)
             InitializeIMU(1e2, 1e10, true);
           else
@@ -236,32 +251,40 @@ void LocalMapping::Run() {
               mpTracker->mState ==
                   Tracker::OK)  // Enter here everytime local-mapping is called
           {
-            if (!mpCurrentKeyFrame->GetMap()->GetIniertialBA1()) {
+            if (isRunningImuInitBA()) {
+              // The previous stage is still being optimised
+            } else if (!mpCurrentKeyFrame->GetMap()->GetIniertialBA1()) {
               if (mTinit > 5.0f) {
                 cout << "start VIBA 1" << endl;
-                mpCurrentKeyFrame->GetMap()->SetIniertialBA1();
+                mnImuInitBAStage = 1;
                 if (mbMonocular)
                   InitializeIMU(1.f, 1e5, true);
                 else
                   InitializeIMU(1.f, 1e5, true);
+                // Otherwise set once its full BA is merged
+                if (!isRunningImuInitBA())
+                  mpCurrentKeyFrame->GetMap()->SetIniertialBA1();
 
                 cout << "end VIBA 1" << endl;
               }
             } else if (!mpCurrentKeyFrame->GetMap()->GetIniertialBA2()) {
               if (mTinit > 15.0f) {
                 cout << "start VIBA 2" << endl;
-                mpCurrentKeyFrame->GetMap()->SetIniertialBA2();
+                mnImuInitBAStage = 2;
                 if (mbMonocular)
                   InitializeIMU(0.f, 0.f, true);
                 else
                   InitializeIMU(0.f, 0.f, true);
+                if (!isRunningImuInitBA())
+                  mpCurrentKeyFrame->GetMap()->SetIniertialBA2();
 
                 cout << "end VIBA 2" << endl;
               }
             }
 
             // scale refinement
-            if (((mpAtlas->KeyFramesInMap()) <= 200) &&
+            if (!isRunningImuInitBA() &&
+                ((mpAtlas->KeyFramesInMap()) <= 200) &&
                 ((mTinit > 25.0f && mTinit < 25.5f) ||
                  (mTinit > 35.0f && mTinit < 35.5f) ||
                  (mTinit > 45.0f && mTinit < 45.5f) ||
@@ -281,6 +304,10 @@ void LocalMapping::Run() {
 
       mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
 
+      // Keep the keyframes within the memory budget
+      if (KeyFrameStore* pKFStore = mpAtlas->GetKeyFrameStore())
+        pKFStore->Enforce();
+
 #ifdef REGISTER_TIMES
       std::chrono::steady_clock::time_point time_EndLocalMap =
           std::chrono::steady_clock::now();
@@ -301,21 +328,31 @@ void LocalMapping::Run() {
 
     ResetIfRequested();
 
+    if (mbImuInitBAFinished) MergeImuInitBA();
+
     // Tracking will see that Local Mapping is busy
     SetAcceptKeyFrames(true);
+    SetIdle(!isRunningImuInitBA());
 
     if (CheckFinish()) break;
 
-    usleep(3000);
+    // Wake up as soon as tracking inserts a keyframe
+    unique_lock<mutex> lock(mMutexNewKFs);
+    mcvNewKFs.wait_for(lock, std::chrono::milliseconds(3),
+                       [this] { return !mlNewKeyFrames.empty(); });
   }
 
+  AbortImuInitBA();
   SetFinish();
 }
 
 void LocalMapping::InsertKeyFrame(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutexNewKFs);
-  mlNewKeyFrames.push_back(pKF);
-  mbAbortBA = true;
+  {
+    unique_lock<mutex> lock(mMutexNewKFs);
+    mlNewKeyFrames.push_back(pKF);
+    mbAbortBA = true;
+  }
+  mcvNewKFs.notify_one();
 }
 
 bool LocalMapping::CheckNewKeyFrames() {
@@ -567,8 +604,8 @@ void LocalMapping::CreateNewMapPoints() {
       }
 
       // Check parallax between rays
-      Eigen::Vector3f xn1 = pCamera1->unprojectEig(kp1.pt);
-      Eigen::Vector3f xn2 = pCamera2->unprojectEig(kp2.pt);
+      const Eigen::Vector3f& xn1 = mpCurrentKeyFrame->mvBearings[idx1];
+      const Eigen::Vector3f& xn2 = pKF2->mvBearings[idx2];
 
       Eigen::Vector3f ray1 = Rwc1 * xn1;
       Eigen::Vector3f ray2 = Rwc2 * xn2;
@@ -628,9 +665,10 @@ void LocalMapping::CreateNewMapPoints() {
       const float invz1 = 1.0 / z1;
 
       if (!bStereo1) {
-        cv::Point2f uv1 = pCamera1->project(cv::Point3f(x1, y1, z1));
-        float errX1 = uv1.x - kp1.pt.x;
-        float errY1 = uv1.y - kp1.pt.y;
+        const Eigen::Vector2f uv1 =
+            pCamera1->project(Eigen::Vector3f(x1, y1, z1));
+        float errX1 = uv1(0) - kp1.pt.x;
+        float errY1 = uv1(1) - kp1.pt.y;
 
         if ((errX1 * errX1 + errY1 * errY1) > 5.991 * sigmaSquare1) continue;
 
@@ -652,9 +690,10 @@ void LocalMapping::CreateNewMapPoints() {
       const float y2 = Rcw2.row(1).dot(x3D) + tcw2(1);
       const float invz2 = 1.0 / z2;
       if (!bStereo2) {
-        cv::Point2f uv2 = pCamera2->project(cv::Point3f(x2, y2, z2));
-        float errX2 = uv2.x - kp2.pt.x;
-        float errY2 = uv2.y - kp2.pt.y;
+        const Eigen::Vector2f uv2 =
+            pCamera2->project(Eigen::Vector3f(x2, y2, z2));
+        float errX2 = uv2(0) - kp2.pt.x;
+        float errY2 = uv2(1) - kp2.pt.y;
         if ((errX2 * errX2 + errY2 * errY2) > 5.991 * sigmaSquare2) continue;
       } else {
         float u2 = fx2 * x2 * invz2 + cx2;
@@ -871,6 +910,20 @@ void LocalMapping::SetAcceptKeyFrames(bool flag) {
   mbAcceptKeyFrames = flag;
 }
 
+bool LocalMapping::IsIdle() {
+  // The queue is checked first, keyframes are only taken out of it after
+  // mbIdle has been cleared
+  if (CheckNewKeyFrames()) return false;
+
+  unique_lock<mutex> lock(mMutexAccept);
+  return mbIdle;
+}
+
+void LocalMapping::SetIdle(bool flag) {
+  unique_lock<mutex> lock(mMutexAccept);
+  mbIdle = flag;
+}
+
 bool LocalMapping::SetNotStop(bool flag) {
   unique_lock<mutex> lock(mMutexStop);
 
@@ -945,10 +998,10 @@ void LocalMapping::KeyFrameCulling() {
                                         : (static_cast<int>(i) < pKF->NLeft)
                                               ? pKF->mvKeys[i].octave
                                               : pKF->mvKeysRight[i].octave;
-            const map<KeyFrame*, tuple<int, int>> observations =
+            const MapPoint::ObservationVector observations =
                 pMP->GetObservations();
             int nObs = 0;
-            for (map<KeyFrame*, tuple<int, int>>::const_iterator
+            for (MapPoint::ObservationVector::const_iterator
                      mit = observations.begin(),
                      mend = observations.end();
                  mit != mend; mit++) {
@@ -998,6 +1051,7 @@ void LocalMapping::KeyFrameCulling() {
             pKF->mNextKF->mpImuPreintegrated->MergePrevious(
                 pKF->mpImuPreintegrated);
             pKF->mNextKF->mPrevKF = pKF->mPrevKF;
+            pKF->mNextKF->MarkDirty();
             pKF->mPrevKF->mNextKF = pKF->mNextKF;
             pKF->mNextKF = NULL;
             pKF->mPrevKF = NULL;
@@ -1009,6 +1063,7 @@ void LocalMapping::KeyFrameCulling() {
             pKF->mNextKF->mpImuPreintegrated->MergePrevious(
                 pKF->mpImuPreintegrated);
             pKF->mNextKF->mPrevKF = pKF->mPrevKF;
+            pKF->mNextKF->MarkDirty();
             pKF->mPrevKF->mNextKF = pKF->mNextKF;
             pKF->mNextKF = NULL;
             pKF->mPrevKF = NULL;
@@ -1070,6 +1125,8 @@ void LocalMapping::ResetIfRequested() {
       executed_reset = true;
 
       cout << "LM: Reseting Atlas in Local Mapping..." << endl;
+      // Before the tracker clears the map it optimises
+      AbortImuInitBA();
       mlNewKeyFrames.clear();
       mlpRecentAddedMapPoints.clear();
       mbResetRequested = false;
@@ -1089,6 +1146,7 @@ void LocalMapping::ResetIfRequested() {
     if (mbResetRequestedActiveMap) {
       executed_reset = true;
       cout << "LM: Reseting current map in Local Mapping..." << endl;
+      AbortImuInitBA();
       mlNewKeyFrames.clear();
       mlpRecentAddedMapPoints.clear();
 
@@ -1130,6 +1188,8 @@ bool LocalMapping::isFinished() {
 
 void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA) {
   if (mbResetRequested) return;
+  // A new map cannot be initialised until the BA of the previous one is done
+  if (isRunningImuInitBA()) return;
 
   float minTime = mbMonocular ? 2.0 : 1.0;
   size_t nMinKF = 10;
@@ -1204,7 +1264,7 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA) {
   // std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now(); // UNUSED
   Optimizer::InertialOptimization(mpAtlas->GetCurrentMap(), mRwg, mScale, mbg,
                                   mba, mbMonocular, infoInertial, false, false,
-                                  priorG, priorA);
+                                  priorG, priorA, mThImuReintegration);
   // std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now(); // UNUSED
 
   if (mScale < 1e-1) {
@@ -1238,39 +1298,76 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA) {
     mpCurrentKeyFrame->bImu = true;
   }
 
-  // std::chrono::steady_clock::time_point t4 = std::chrono::steady_clock::now(); // UNUSED
+  mnKFs = vpKF.size();
+  mpTracker->mState = Tracker::OK;
+  bInitializing = false;
+
   if (bFIBA) {
-    if (priorA != 0.f)
-      Optimizer::FullInertialBA(mpAtlas->GetCurrentMap(), 100, false,
-                                mpCurrentKeyFrame->mnId, NULL, true, priorG,
-                                priorA);
-    else
-      Optimizer::FullInertialBA(mpAtlas->GetCurrentMap(), 100, false,
-                                mpCurrentKeyFrame->mnId, NULL, false);
+    // The map is refined in the background, local mapping goes on
+    Map* pMap = mpAtlas->GetCurrentMap();
+    mpImuInitBAMap = pMap;
+    mnImuInitBAid = mpCurrentKeyFrame->mnId;
+    mnImuInitBABigChangeIdx = pMap->GetLastBigChangeIdx();
+    mbAbortImuInitBA = false;
+    mbImuInitBAFinished = false;
+    mptImuInitBA = new thread(&LocalMapping::RunImuInitBA, this, pMap,
+                              mnImuInitBAid, priorG, priorA);
+    return;
   }
 
-  // std::chrono::steady_clock::time_point t5 = std::chrono::steady_clock::now(); // UNUSED
+  mIdxInit++;
+  mpCurrentKeyFrame->GetMap()->IncreaseChangeIndex();
+}
 
-  Verbose::PrintMess("Global Bundle Adjustment finished\nUpdating map ...",
-                     Verbose::VERBOSITY_NORMAL);
+void LocalMapping::RunImuInitBA(Map* pMap, unsigned long nGBAid, float priorG,
+                                float priorA) {
+  if (priorA != 0.f)
+    Optimizer::FullInertialBA(pMap, 100, false, nGBAid, NULL, true, priorG,
+                              priorA, NULL, NULL, &mbAbortImuInitBA);
+  else
+    Optimizer::FullInertialBA(pMap, 100, false, nGBAid, NULL, false, 1e2, 1e6,
+                              NULL, NULL, &mbAbortImuInitBA);
 
-  // Get Map Mutex
-  unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
+  mbImuInitBAFinished = true;
+}
 
-  unsigned long GBAid = mpCurrentKeyFrame->mnId;
+void LocalMapping::AbortImuInitBA() {
+  if (!mptImuInitBA) return;
 
-  // Process keyframes in the queue
-  while (CheckNewKeyFrames()) {
-    ProcessNewKeyFrame();
-    vpKF.push_back(mpCurrentKeyFrame);
-    lpKF.push_back(mpCurrentKeyFrame);
+  mbAbortImuInitBA = true;
+  mptImuInitBA->join();
+  delete mptImuInitBA;
+  mptImuInitBA = nullptr;
+  mbImuInitBAFinished = false;
+}
+
+void LocalMapping::MergeImuInitBA() {
+  mptImuInitBA->join();
+  delete mptImuInitBA;
+  mptImuInitBA = nullptr;
+  mbImuInitBAFinished = false;
+
+  Map* pMap = mpImuInitBAMap;
+  // Loop closing or a merge moved the map while it was optimised
+  if (pMap != mpAtlas->GetCurrentMap() || pMap->IsBad() ||
+      pMap->GetLastBigChangeIdx() != mnImuInitBABigChangeIdx) {
+    Verbose::PrintMess("IMU init BA discarded, the map changed",
+                       Verbose::VERBOSITY_NORMAL);
+    return;
   }
 
-  // Correct keyframes starting at map first keyframe
-  list<KeyFrame*> lpKFtoCheck(
-      mpAtlas->GetCurrentMap()->mvpKeyFrameOrigins.begin(),
-      mpAtlas->GetCurrentMap()->mvpKeyFrameOrigins.end());
+  Verbose::PrintMess("Global Bundle Adjustment finished\nUpdating map ...",
+                     Verbose::VERBOSITY_NORMAL);
+
+  // Get Map Mutex
+  unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+
+  const unsigned long GBAid = mnImuInitBAid;
 
+  // Correct keyframes starting at map first keyframe. Those inserted during
+  // the BA follow the correction of their parent
+  list<KeyFrame*> lpKFtoCheck(pMap->mvpKeyFrameOrigins.begin(),
+                              pMap->mvpKeyFrameOrigins.end());
   while (!lpKFtoCheck.empty()) {
     KeyFrame* pKF = lpKFtoCheck.front();
     const set<KeyFrame*> sChilds = pKF->GetChilds();
@@ -1314,7 +1411,7 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA) {
   }
 
   // Correct MapPoints
-  const vector<MapPoint*> vpMPs = mpAtlas->GetCurrentMap()->GetAllMapPoints();
+  const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
 
   for (size_t i = 0; i < vpMPs.size(); i++) {
     MapPoint* pMP = vpMPs[i];
@@ -1338,25 +1435,16 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA) {
     }
   }
 
+  // The stage is done once its result is in the map
+  if (mnImuInitBAStage == 1)
+    pMap->SetIniertialBA1();
+  else if (mnImuInitBAStage == 2)
+    pMap->SetIniertialBA2();
+
   Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
 
-  mnKFs = vpKF.size();
   mIdxInit++;
-
-  for (list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(),
-                                 lend = mlNewKeyFrames.end();
-       lit != lend; lit++) {
-    (*lit)->SetBadFlag();
-    delete *lit;
-  }
-  mlNewKeyFrames.clear();
-
-  mpTracker->mState = Tracker::OK;
-  bInitializing = false;
-
-  mpCurrentKeyFrame->GetMap()->IncreaseChangeIndex();
-
-  return;
+  pMap->IncreaseChangeIndex();
 }
 
 void LocalMapping::ScaleRefinement() {
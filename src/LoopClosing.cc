@@ -21,6 +21,7 @@
 
 #include "LoopClosing.h"
 
+#include <chrono>
 #include <mutex>
 #include <thread>
 
@@ -30,13 +31,14 @@
 #include "ORBmatcher.h"
 #include "Optimizer.h"
 #include "Sim3Solver.h"
+#include "ThreadPool.h"
 
 namespace ORB_SLAM3 {
 
 LoopClosing::LoopClosing(const Atlas_ptr &pAtlas, KeyFrameDatabase* pDB,
-                         ORBVocabulary* pVoc, const bool bFixScale,
-                         const bool bActiveLC)
-    : 
+                         const ORBVocabulary* pVoc, const bool bFixScale,
+                         const bool bActiveLC, const float thImuReintegration)
+    : mThImuReintegration(thImuReintegration),
 #ifdef REGISTER_TIMES
       nMerges(0),
       nLoop(0),
@@ -50,6 +52,7 @@ LoopClosing::LoopClosing(const Atlas_ptr &pAtlas, KeyFrameDatabase* pDB,
       mpAtlas(pAtlas),
       mpKeyFrameDB(pDB),
       mpORBVocabulary(pVoc),
+      mbProcessingKF(false),
       mnCovisibilityConsistencyTh(3),
       mpLastCurrentKF(static_cast<KeyFrame*>(NULL)),
       mpMatchedKF(NULL),
@@ -63,15 +66,20 @@ LoopClosing::LoopClosing(const Atlas_ptr &pAtlas, KeyFrameDatabase* pDB,
       mbFinishedGBA(true),
       mbStopGBA(false),
       mpThreadGBA(NULL),
+      mnGBAThreads(0),
       mbFixScale(bFixScale),
       mnFullBAIdx(0),
       mstrFolderSubTraj("SubTrajectories/"),
       mnNumCorrection(0),
       mnCorrectionGBA(0),
-      mbActiveLC(bActiveLC) {
+      mbActiveLC(bActiveLC),
+      mpBoWCandidatePool(bActiveLC ? new ThreadPool(mnNumBoWCandidates)
+                                   : NULL) {
 
 }
 
+LoopClosing::~LoopClosing() {}
+
 void LoopClosing::SetTracker(Tracking* pTracker) { mpTracker = pTracker; }
 
 void LoopClosing::SetLocalMapper(LocalMapping* pLocalMapper) {
@@ -86,6 +94,7 @@ void LoopClosing::Run() {
     //----------------------------
 
     if (CheckNewKeyFrames()) {
+      mbProcessingKF = true;
       if (mpLastCurrentKF) {
         mpLastCurrentKF->mvpLoopCandKFs.clear();
         mpLastCurrentKF->mvpMergeCandKFs.clear();
@@ -95,7 +104,11 @@ void LoopClosing::Run() {
           std::chrono::steady_clock::now();
 #endif
 
-      bool bFindedRegion = NewDetectCommonRegions();
+      bool bFindedRegion;
+      {
+        StageTimes::Scope timePR(mStageTimes, StageTimes::PLACE_RECOGNITION);
+        bFindedRegion = NewDetectCommonRegions();
+      }
 
 #ifdef REGISTER_TIMES
       std::chrono::steady_clock::time_point time_EndPR =
@@ -137,6 +150,7 @@ void LoopClosing::Run() {
                 mbMergeDetected = false;
                 Verbose::PrintMess("scale bad estimated. Abort merging",
                                    Verbose::VERBOSITY_NORMAL);
+                mbProcessingKF = false;
                 continue;
               }
               // If inertial, force only yaw
@@ -168,12 +182,15 @@ void LoopClosing::Run() {
             nMerges += 1;
 #endif
             // TODO UNCOMMENT
-            if (mpTracker->mSensor == CameraType::IMU_MONOCULAR ||
-                mpTracker->mSensor == CameraType::IMU_STEREO ||
-                mpTracker->mSensor == CameraType::IMU_RGBD)
-              MergeLocal2();
-            else
-              MergeLocal();
+            {
+              StageTimes::Scope timeMerge(mStageTimes, StageTimes::MAP_MERGE);
+              if (mpTracker->mSensor == CameraType::IMU_MONOCULAR ||
+                  mpTracker->mSensor == CameraType::IMU_STEREO ||
+                  mpTracker->mSensor == CameraType::IMU_RGBD)
+                MergeLocal2();
+              else
+                MergeLocal();
+            }
 
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndMerge =
@@ -264,7 +281,11 @@ void LoopClosing::Run() {
             nLoop += 1;
 
 #endif
-            CorrectLoop();
+            {
+              StageTimes::Scope timeLoop(mStageTimes,
+                                         StageTimes::LOOP_CORRECTION);
+              CorrectLoop();
+            }
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndLoop =
                 std::chrono::steady_clock::now();
@@ -291,6 +312,7 @@ void LoopClosing::Run() {
         }
       }
       mpLastCurrentKF = mpCurrentKF;
+      mbProcessingKF = false;
     }
 
     ResetIfRequested();
@@ -299,15 +321,29 @@ void LoopClosing::Run() {
       break;
     }
 
-    usleep(5000);
+    // Wake up as soon as local mapping inserts a keyframe
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    mcvLoopQueue.wait_for(lock, std::chrono::milliseconds(5),
+                          [this] { return !mlpLoopKeyFrameQueue.empty(); });
+  }
+
+  // Abort a running global BA and wait for its thread, nothing touches the
+  // map once the loop closer is finished
+  {
+    unique_lock<mutex> lock(mMutexGBA);
+    mbStopGBA = true;
+    mcvGBAThreads.wait(lock, [this] { return mnGBAThreads == 0; });
   }
 
   SetFinish();
 }
 
 void LoopClosing::InsertKeyFrame(KeyFrame* pKF) {
-  unique_lock<mutex> lock(mMutexLoopQueue);
-  if (pKF->mnId != 0) mlpLoopKeyFrameQueue.push_back(pKF);
+  {
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    if (pKF->mnId != 0) mlpLoopKeyFrameQueue.push_back(pKF);
+  }
+  mcvLoopQueue.notify_one();
 }
 
 bool LoopClosing::CheckNewKeyFrames() {
@@ -315,6 +351,14 @@ bool LoopClosing::CheckNewKeyFrames() {
   return (!mlpLoopKeyFrameQueue.empty());
 }
 
+bool LoopClosing::IsIdle() {
+  // The queue is checked first, keyframes are only taken out of it once
+  // mbProcessingKF is set
+  if (CheckNewKeyFrames()) return false;
+
+  return !mbProcessingKF && !isRunningGBA();
+}
+
 bool LoopClosing::NewDetectCommonRegions() {
   // To deactivate placerecognition. No loopclosing nor merging will be
   // performed
@@ -482,7 +526,7 @@ bool LoopClosing::NewDetectCommonRegions() {
         std::chrono::steady_clock::now();
 #endif
     mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand,
-                                        vpMergeBowCand, 3);
+                                        vpMergeBowCand, mnNumBoWCandidates);
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndQuery =
         std::chrono::steady_clock::now();
@@ -592,322 +636,251 @@ bool LoopClosing::DetectCommonRegionsFromBoW(
     std::vector<KeyFrame*>& vpBowCand, KeyFrame*& pMatchedKF2,
     KeyFrame*& pLastCurrentKF, g2o::Sim3& g2oScw, int& nNumCoincidences,
     std::vector<MapPoint*>& vpMPs, std::vector<MapPoint*>& vpMatchedMPs) {
+  const set<KeyFrame*> spConnectedKeyFrames =
+      mpCurrentKF->GetConnectedKeyFrames();
+
+  bool bFixedScale = mbFixScale;
+  if (mpTracker->mSensor == CameraType::IMU_MONOCULAR &&
+      !mpCurrentKF->GetMap()->GetIniertialBA2())
+    bFixedScale = false;
+
+  // Every candidate is verified independently. The first candidate (in BoW
+  // score order) that is fully verified cancels all the ones ranked below it
+  const size_t numCandidates = vpBowCand.size();
+  vector<BoWCandidateResult> vResults(numCandidates);
+  std::atomic<size_t> nFirstSuccess(numCandidates);
+
+  if (numCandidates == 1) {
+    VerifyBoWCandidate(vpBowCand[0], 0, spConnectedKeyFrames, bFixedScale,
+                       nFirstSuccess, vResults[0]);
+  } else {
+    vector<std::future<void>> vVerifications;
+    vVerifications.reserve(numCandidates);
+    for (size_t i = 0; i < numCandidates; ++i) {
+      vVerifications.push_back(mpBoWCandidatePool->Enqueue([&, i]() {
+        VerifyBoWCandidate(vpBowCand[i], i, spConnectedKeyFrames, bFixedScale,
+                           nFirstSuccess, vResults[i]);
+      }));
+    }
+    for (std::future<void>& verification : vVerifications)
+      verification.get();
+  }
+
+  // The selection only depends on the candidate order, never on the thread
+  // timing: the best ranked verified candidate wins, otherwise the one with
+  // most reprojection matches (earliest on ties)
+  int nBestIdx = -1;
+  if (nFirstSuccess < numCandidates) {
+    nBestIdx = nFirstSuccess;
+  } else {
+    int nBestMatchesReproj = 0;
+    for (size_t i = 0; i < numCandidates; ++i) {
+      if (vResults[i].nNumProjOptMatches > nBestMatchesReproj) {
+        nBestMatchesReproj = vResults[i].nNumProjOptMatches;
+        nBestIdx = i;
+      }
+    }
+  }
+
+  if (nBestIdx >= 0) {
+    BoWCandidateResult& best = vResults[nBestIdx];
+    pLastCurrentKF = mpCurrentKF;
+    nNumCoincidences = best.nNumCoincidences;
+    pMatchedKF2 = best.pMatchedKF;
+    pMatchedKF2->SetNotErase();
+    g2oScw = best.g2oScw;
+    vpMPs = std::move(best.vpMapPoints);
+    vpMatchedMPs = std::move(best.vpMatchedMapPoints);
+
+    return nNumCoincidences >= 3;
+  }
+  return false;
+}
+
+bool LoopClosing::VerifyBoWCandidate(
+    KeyFrame* pKFi, const size_t nIndex,
+    const set<KeyFrame*>& spConnectedKeyFrames, const bool bFixedScale,
+    std::atomic<size_t>& nFirstSuccess, BoWCandidateResult& result) {
   int nBoWMatches = 20;  // lower this and try again
   int nBoWInliers = 15;
   int nSim3Inliers = 20;
   int nProjMatches = 50;
   int nProjOptMatches = 80;
 
-  set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
-
   int nNumCovisibles = 10;
 
+  // A better ranked candidate has already been verified
+  auto isCancelled = [&]() { return nFirstSuccess.load() < nIndex; };
+
+  if (!pKFi || pKFi->isBad()) return false;
+
   ORBmatcher matcherBoW(0.9, true);
   ORBmatcher matcher(0.75, true);
 
-  // Varibles to select the best numbe
-  KeyFrame* pBestMatchedKF;
-  int nBestMatchesReproj = 0;
-  int nBestNumCoindicendes = 0;
-  g2o::Sim3 g2oBestScw;
-  std::vector<MapPoint*> vpBestMapPoints;
-  std::vector<MapPoint*> vpBestMatchedMapPoints;
-
-  int numCandidates = vpBowCand.size();
-  vector<int> vnStage(numCandidates, 0);
-  vector<int> vnMatchesStage(numCandidates, 0);
-
-  int index = 0;
-  // Verbose::PrintMess("BoW candidates: There are " +
-  // to_string(vpBowCand.size()) + " possible candidates ",
-  // Verbose::VERBOSITY_DEBUG);
-  for (KeyFrame* pKFi : vpBowCand) {
-    if (!pKFi || pKFi->isBad()) continue;
+  // Current KF against KF with covisibles version
+  std::vector<KeyFrame*> vpCovKFi =
+      pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
+  if (vpCovKFi.empty()) {
+    std::cout << "Covisible list empty" << std::endl;
+    vpCovKFi.push_back(pKFi);
+  } else {
+    vpCovKFi.push_back(vpCovKFi[0]);
+    vpCovKFi[0] = pKFi;
+  }
 
-    // std::cout << "KF candidate: " << pKFi->mnId << std::endl;
-    // Current KF against KF with covisibles version
-    std::vector<KeyFrame*> vpCovKFi =
-        pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
-    if (vpCovKFi.empty()) {
-      std::cout << "Covisible list empty" << std::endl;
-      vpCovKFi.push_back(pKFi);
-    } else {
-      vpCovKFi.push_back(vpCovKFi[0]);
-      vpCovKFi[0] = pKFi;
-    }
+  for (size_t j = 0; j < vpCovKFi.size(); ++j) {
+    if (spConnectedKeyFrames.find(vpCovKFi[j]) != spConnectedKeyFrames.end())
+      return false;
+  }
 
-    bool bAbortByNearKF = false;
-    for (size_t j = 0; j < vpCovKFi.size(); ++j) {
-      if (spConnectedKeyFrames.find(vpCovKFi[j]) !=
-          spConnectedKeyFrames.end()) {
-        bAbortByNearKF = true;
-        break;
-      }
-    }
-    if (bAbortByNearKF) {
-      // std::cout << "Check BoW aborted because is close to the matched one "
-      // << std::endl;
-      continue;
-    }
-    // std::cout << "Check BoW continue because is far to the matched one " <<
-    // std::endl;
-
-    std::vector<std::vector<MapPoint*>> vvpMatchedMPs;
-    vvpMatchedMPs.resize(vpCovKFi.size());
-    std::set<MapPoint*> spMatchedMPi;
-    int numBoWMatches = 0;
-
-    KeyFrame* pMostBoWMatchesKF = pKFi;
-    int nMostBoWNumMatches = 0;
-
-    std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(
-        mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-    std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(
-        mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
-
-    // int nIndexMostBoWMatchesKF=0; // UNUSED
-    for (size_t j = 0; j < vpCovKFi.size(); ++j) {
-      if (!vpCovKFi[j] || vpCovKFi[j]->isBad()) continue;
-
-      int num =
-          matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
-      if (num > nMostBoWNumMatches) {
-        nMostBoWNumMatches = num;
-        // nIndexMostBoWMatchesKF = j; // UNUSED
-      }
-    }
+  std::vector<std::vector<MapPoint*>> vvpMatchedMPs;
+  vvpMatchedMPs.resize(vpCovKFi.size());
+  std::set<MapPoint*> spMatchedMPi;
+  int numBoWMatches = 0;
 
-    for (size_t j = 0; j < vpCovKFi.size(); ++j) {
-      for (size_t k = 0; k < vvpMatchedMPs[j].size(); ++k) {
-        MapPoint* pMPi_j = vvpMatchedMPs[j][k];
-        if (!pMPi_j || pMPi_j->isBad()) continue;
+  KeyFrame* pMostBoWMatchesKF = pKFi;
 
-        if (spMatchedMPi.find(pMPi_j) == spMatchedMPi.end()) {
-          spMatchedMPi.insert(pMPi_j);
-          numBoWMatches++;
+  std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(
+      mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+  std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(
+      mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
 
-          vpMatchedPoints[k] = pMPi_j;
-          vpKeyFrameMatchedMP[k] = vpCovKFi[j];
-        }
-      }
-    }
+  for (size_t j = 0; j < vpCovKFi.size(); ++j) {
+    if (!vpCovKFi[j] || vpCovKFi[j]->isBad()) continue;
 
-    // pMostBoWMatchesKF = vpCovKFi[pMostBoWMatchesKF];
+    matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
+  }
 
-    if (numBoWMatches >= nBoWMatches)  // TODO pick a good threshold
-    {
-      // Geometric validation
-      bool bFixedScale = mbFixScale;
-      if (mpTracker->mSensor == CameraType::IMU_MONOCULAR &&
-          !mpCurrentKF->GetMap()->GetIniertialBA2())
-        bFixedScale = false;
-
-      Sim3Solver solver =
-          Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints,
-                     bFixedScale, vpKeyFrameMatchedMP);
-      solver.SetRansacParameters(0.99, nBoWInliers,
-                                 300);  // at least 15 inliers
-
-      bool bNoMore = false;
-      vector<bool> vbInliers;
-      int nInliers;
-      bool bConverge = false;
-      Eigen::Matrix4f mTcm;
-      while (!bConverge && !bNoMore) {
-        mTcm = solver.iterate(20, bNoMore, vbInliers, nInliers, bConverge);
-        // Verbose::PrintMess("BoW guess: Solver achieve " + to_string(nInliers)
-        // + " geometrical inliers among " + to_string(nBoWInliers) + " BoW
-        // matches", Verbose::VERBOSITY_DEBUG);
+  for (size_t j = 0; j < vpCovKFi.size(); ++j) {
+    for (size_t k = 0; k < vvpMatchedMPs[j].size(); ++k) {
+      MapPoint* pMPi_j = vvpMatchedMPs[j][k];
+      if (!pMPi_j || pMPi_j->isBad()) continue;
+
+      if (spMatchedMPi.find(pMPi_j) == spMatchedMPi.end()) {
+        spMatchedMPi.insert(pMPi_j);
+        numBoWMatches++;
+
+        vpMatchedPoints[k] = pMPi_j;
+        vpKeyFrameMatchedMP[k] = vpCovKFi[j];
       }
+    }
+  }
 
-      if (bConverge) {
-        // std::cout << "Check BoW: SolverSim3 converged" << std::endl;
-
-        // Verbose::PrintMess("BoW guess: Convergende with " +
-        // to_string(nInliers) + " geometrical inliers among " +
-        // to_string(nBoWInliers) + " BoW matches", Verbose::VERBOSITY_DEBUG);
-        // Match by reprojection
-        vpCovKFi.clear();
-        vpCovKFi =
-            pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-        vpCovKFi.push_back(pMostBoWMatchesKF);
-        set<KeyFrame*> spCheckKFs(vpCovKFi.begin(), vpCovKFi.end());
-
-        // std::cout << "There are " << vpCovKFi.size() <<" near KFs" <<
-        // std::endl;
-
-        set<MapPoint*> spMapPoints;
-        vector<MapPoint*> vpMapPoints;
-        vector<KeyFrame*> vpKeyFrames;
-        for (KeyFrame* pCovKFi : vpCovKFi) {
-          for (MapPoint* pCovMPij : pCovKFi->GetMapPointMatches()) {
-            if (!pCovMPij || pCovMPij->isBad()) continue;
-
-            if (spMapPoints.find(pCovMPij) == spMapPoints.end()) {
-              spMapPoints.insert(pCovMPij);
-              vpMapPoints.push_back(pCovMPij);
-              vpKeyFrames.push_back(pCovKFi);
-            }
-          }
-        }
+  if (numBoWMatches < nBoWMatches || isCancelled())  // TODO pick a good threshold
+    return false;
 
-        // std::cout << "There are " << vpKeyFrames.size() <<" KFs which view
-        // all the mappoints" << std::endl;
-
-        g2o::Sim3 gScm(solver.GetEstimatedRotation().cast<double>(),
-                       solver.GetEstimatedTranslation().cast<double>(),
-                       (double)solver.GetEstimatedScale());
-        g2o::Sim3 gSmw(pMostBoWMatchesKF->GetRotation().cast<double>(),
-                       pMostBoWMatchesKF->GetTranslation().cast<double>(), 1.0);
-        g2o::Sim3 gScw =
-            gScm *
-            gSmw;  // Similarity matrix of current from the world position
-        Sophus::Sim3f mScw = Converter::toSophus(gScw);
-
-        vector<MapPoint*> vpMatchedMP;
-        vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(),
-                           static_cast<MapPoint*>(NULL));
-        vector<KeyFrame*> vpMatchedKF;
-        vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(),
-                           static_cast<KeyFrame*>(NULL));
-        int numProjMatches = matcher.SearchByProjection(
-            mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP,
-            vpMatchedKF, 8, 1.5);
-        // cout <<"BoW: " << numProjMatches << " matches between " <<
-        // vpMapPoints.size() << " points with coarse Sim3" << endl;
-
-        if (numProjMatches >= nProjMatches) {
-          // Optimize Sim3 transformation with every matches
-          Eigen::Matrix<double, 7, 7> mHessian7x7;
-
-          /* The bool below ('bFixedScale') is UNUSED and since all function calls below do not change state. this is not needed.
-          bool bFixedScale = mbFixScale; 
-          if(mpTracker->mSensor==CameraType::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-              bFixedScale=false;
-          */
-
-          int numOptMatches =
-              Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10,
-                                      mbFixScale, mHessian7x7, true);
-
-          if (numOptMatches >= nSim3Inliers) {
-            g2o::Sim3 gSmw(pMostBoWMatchesKF->GetRotation().cast<double>(),
-                           pMostBoWMatchesKF->GetTranslation().cast<double>(),
-                           1.0);
-            g2o::Sim3 gScw =
-                gScm *
-                gSmw;  // Similarity matrix of current from the world position
-            Sophus::Sim3f mScw = Converter::toSophus(gScw);
-
-            vector<MapPoint*> vpMatchedMP;
-            vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(),
-                               static_cast<MapPoint*>(NULL));
-            int numProjOptMatches = matcher.SearchByProjection(
-                mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
-
-            if (numProjOptMatches >= nProjOptMatches) {
-              int max_x = -1, min_x = 1000000;
-              int max_y = -1, min_y = 1000000;
-              for (MapPoint* pMPi : vpMatchedMP) {
-                if (!pMPi || pMPi->isBad()) {
-                  continue;
-                }
+  // Geometric validation
+  Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF,
+                                 vpMatchedPoints, bFixedScale,
+                                 vpKeyFrameMatchedMP);
+  solver.SetRansacParameters(0.99, nBoWInliers, 300);  // at least 15 inliers
 
-                tuple<size_t, size_t> indexes = pMPi->GetIndexInKeyFrame(pKFi);
-                int index = get<0>(indexes);
-                if (index >= 0) {
-                  int coord_x = pKFi->mvKeysUn[index].pt.x;
-                  if (coord_x < min_x) {
-                    min_x = coord_x;
-                  }
-                  if (coord_x > max_x) {
-                    max_x = coord_x;
-                  }
-                  int coord_y = pKFi->mvKeysUn[index].pt.y;
-                  if (coord_y < min_y) {
-                    min_y = coord_y;
-                  }
-                  if (coord_y > max_y) {
-                    max_y = coord_y;
-                  }
-                }
-              }
+  bool bNoMore = false;
+  vector<bool> vbInliers;
+  int nInliers;
+  bool bConverge = false;
+  while (!bConverge && !bNoMore) {
+    solver.iterate(20, bNoMore, vbInliers, nInliers, bConverge);
+  }
 
-              int nNumKFs = 0;
-              // vpMatchedMPs = vpMatchedMP;
-              // vpMPs = vpMapPoints;
-              // Check the Sim3 transformation with the current KeyFrame
-              // covisibles
-              vector<KeyFrame*> vpCurrentCovKFs =
-                  mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-
-              for (size_t j = 0; nNumKFs < 3 && j < vpCurrentCovKFs.size(); ++j) {
-                KeyFrame* pKFj = vpCurrentCovKFs[j];
-                Sophus::SE3d mTjc =
-                    (pKFj->GetPose() * mpCurrentKF->GetPoseInverse())
-                        .cast<double>();
-                g2o::Sim3 gSjc(mTjc.unit_quaternion(), mTjc.translation(), 1.0);
-                g2o::Sim3 gSjw = gSjc * gScw;
-                int numProjMatches_j = 0;
-                vector<MapPoint*> vpMatchedMPs_j;
-                bool bValid = DetectCommonRegionsFromLastKF(
-                    pKFj, pMostBoWMatchesKF, gSjw, numProjMatches_j,
-                    vpMapPoints, vpMatchedMPs_j);
-
-                if (bValid) {
-                  // Sophus::SE3f Tc_w = mpCurrentKF->GetPose(); // UNUSED
-                  // Sophus::SE3f Tw_cj = pKFj->GetPoseInverse(); // UNUSED
-                  // Sophus::SE3f Tc_cj = Tc_w * Tw_cj; // UNUSED
-                  // Eigen::Vector3f vector_dist = Tc_cj.translation(); // UNUSED
-                  nNumKFs++;
-                }
-              }
+  if (!bConverge || isCancelled()) return false;
 
-              if (nNumKFs < 3) {
-                vnStage[index] = 8;
-                vnMatchesStage[index] = nNumKFs;
-              }
+  // Match by reprojection
+  vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+  vpCovKFi.push_back(pMostBoWMatchesKF);
 
-              if (nBestMatchesReproj < numProjOptMatches) {
-                nBestMatchesReproj = numProjOptMatches;
-                nBestNumCoindicendes = nNumKFs;
-                pBestMatchedKF = pMostBoWMatchesKF;
-                g2oBestScw = gScw;
-                vpBestMapPoints = vpMapPoints;
-                vpBestMatchedMapPoints = vpMatchedMP;
-              }
-            }
-          }
-        }
+  set<MapPoint*> spMapPoints;
+  vector<MapPoint*> vpMapPoints;
+  vector<KeyFrame*> vpKeyFrames;
+  for (KeyFrame* pCovKFi : vpCovKFi) {
+    for (MapPoint* pCovMPij : pCovKFi->GetMapPointMatches()) {
+      if (!pCovMPij || pCovMPij->isBad()) continue;
+
+      if (spMapPoints.find(pCovMPij) == spMapPoints.end()) {
+        spMapPoints.insert(pCovMPij);
+        vpMapPoints.push_back(pCovMPij);
+        vpKeyFrames.push_back(pCovKFi);
       }
     }
-    index++;
   }
 
-  if (nBestMatchesReproj > 0) {
-    pLastCurrentKF = mpCurrentKF;
-    nNumCoincidences = nBestNumCoindicendes;
-    pMatchedKF2 = pBestMatchedKF;
-    pMatchedKF2->SetNotErase();
-    g2oScw = g2oBestScw;
-    vpMPs = vpBestMapPoints;
-    vpMatchedMPs = vpBestMatchedMapPoints;
+  g2o::Sim3 gScm(solver.GetEstimatedRotation().cast<double>(),
+                 solver.GetEstimatedTranslation().cast<double>(),
+                 (double)solver.GetEstimatedScale());
+  g2o::Sim3 gSmw(pMostBoWMatchesKF->GetRotation().cast<double>(),
+                 pMostBoWMatchesKF->GetTranslation().cast<double>(), 1.0);
+  g2o::Sim3 gScw =
+      gScm * gSmw;  // Similarity matrix of current from the world position
+  Sophus::Sim3f mScw = Converter::toSophus(gScw);
 
-    return nNumCoincidences >= 3;
-  /* Everything down here does not change any state and is UNUSED
-  } else {
-    int maxStage = -1;
-    int maxMatched;
-    for (size_t i = 0; i < vnStage.size(); ++i) {
-      if (vnStage[i] > maxStage) {
-        maxStage = vnStage[i];
-        maxMatched = vnMatchesStage[i];
-      }
-    }
+  vector<MapPoint*> vpMatchedMP;
+  vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(),
+                     static_cast<MapPoint*>(NULL));
+  vector<KeyFrame*> vpMatchedKF;
+  vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(),
+                     static_cast<KeyFrame*>(NULL));
+  int numProjMatches =
+      matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames,
+                                 vpMatchedMP, vpMatchedKF, 8, 1.5);
+
+  if (numProjMatches < nProjMatches || isCancelled()) return false;
+
+  // Optimize Sim3 transformation with every matches
+  Eigen::Matrix<double, 7, 7> mHessian7x7;
+
+  int numOptMatches = Optimizer::OptimizeSim3(
+      mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
+
+  if (numOptMatches < nSim3Inliers || isCancelled()) return false;
+
+  gScw = gScm * gSmw;  // Similarity matrix of current from the world position
+  mScw = Converter::toSophus(gScw);
+
+  vpMatchedMP.assign(mpCurrentKF->GetMapPointMatches().size(),
+                     static_cast<MapPoint*>(NULL));
+  int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw,
+                                                     vpMapPoints, vpMatchedMP,
+                                                     5, 1.0);
+
+  if (numProjOptMatches < nProjOptMatches) return false;
+
+  int nNumKFs = 0;
+  // Check the Sim3 transformation with the current KeyFrame covisibles
+  vector<KeyFrame*> vpCurrentCovKFs =
+      mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+
+  for (size_t j = 0; nNumKFs < 3 && j < vpCurrentCovKFs.size(); ++j) {
+    if (isCancelled()) return false;
+
+    KeyFrame* pKFj = vpCurrentCovKFs[j];
+    Sophus::SE3d mTjc =
+        (pKFj->GetPose() * mpCurrentKF->GetPoseInverse()).cast<double>();
+    g2o::Sim3 gSjc(mTjc.unit_quaternion(), mTjc.translation(), 1.0);
+    g2o::Sim3 gSjw = gSjc * gScw;
+    int numProjMatches_j = 0;
+    vector<MapPoint*> vpMatchedMPs_j;
+    bool bValid = DetectCommonRegionsFromLastKF(pKFj, pMostBoWMatchesKF, gSjw,
+                                                numProjMatches_j, vpMapPoints,
+                                                vpMatchedMPs_j);
+
+    if (bValid) nNumKFs++;
   }
-  */
+
+  result.nNumProjOptMatches = numProjOptMatches;
+  result.nNumCoincidences = nNumKFs;
+  result.pMatchedKF = pMostBoWMatchesKF;
+  result.g2oScw = gScw;
+  result.vpMapPoints = std::move(vpMapPoints);
+  result.vpMatchedMapPoints = std::move(vpMatchedMP);
+
+  if (nNumKFs < 3) return false;
+
+  // Keep the best ranked success, lower ranked ones stop at their next check
+  size_t nCurrentFirst = nFirstSuccess.load();
+  while (nIndex < nCurrentFirst &&
+         !nFirstSuccess.compare_exchange_weak(nCurrentFirst, nIndex)) {
   }
-  return false;
+  return true;
 }
 
 bool LoopClosing::DetectCommonRegionsFromLastKF(
@@ -1001,7 +974,7 @@ void LoopClosing::CorrectLoop() {
   }
 
   // Wait until Local Mapping has effectively stopped
-  while (!mpLocalMapper->isStopped()) {
+  while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished()) {
     usleep(1000);
   }
 
@@ -1233,6 +1206,10 @@ void LoopClosing::CorrectLoop() {
     mbStopGBA = false;
     mnCorrectionGBA = mnNumCorrection;
 
+    {
+      unique_lock<mutex> lock(mMutexGBA);
+      mnGBAThreads++;
+    }
     mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this,
                              pLoopMap, mpCurrentKF->mnId);
   }
@@ -1278,7 +1255,7 @@ void LoopClosing::MergeLocal() {
   // Verbose::VERBOSITY_DEBUG); cout << "Request Stop Local Mapping" << endl;
   mpLocalMapper->RequestStop();
   // Wait until Local Mapping has effectively stopped
-  while (!mpLocalMapper->isStopped()) {
+  while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished()) {
     usleep(1000);
   }
   // cout << "Local Map stopped" << endl;
@@ -1737,7 +1714,7 @@ void LoopClosing::MergeLocal() {
 
     mpLocalMapper->RequestStop();
     // Wait until Local Mapping has effectively stopped
-    while (!mpLocalMapper->isStopped()) {
+    while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished()) {
       usleep(1000);
     }
 
@@ -1802,6 +1779,10 @@ void LoopClosing::MergeLocal() {
     mbRunningGBA = true;
     mbFinishedGBA = false;
     mbStopGBA = false;
+    {
+      unique_lock<mutex> lock(mMutexGBA);
+      mnGBAThreads++;
+    }
     mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this,
                              pMergeMap, mpCurrentKF->mnId);
   }
@@ -1854,7 +1835,7 @@ void LoopClosing::MergeLocal2() {
   // cout << "Request Stop Local Mapping" << endl;
   mpLocalMapper->RequestStop();
   // Wait until Local Mapping has effectively stopped
-  while (!mpLocalMapper->isStopped()) {
+  while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished()) {
     usleep(1000);
   }
   // cout << "Local Map stopped" << endl;
@@ -1899,7 +1880,8 @@ void LoopClosing::MergeLocal2() {
     Eigen::Vector3d bg, ba;
     bg << 0., 0., 0.;
     ba << 0., 0., 0.;
-    Optimizer::InertialOptimization(pCurrentMap, bg, ba);
+    Optimizer::InertialOptimization(pCurrentMap, bg, ba, 1e2, 1e6,
+                                    mThImuReintegration);
     IMU::Bias b(ba[0], ba[1], ba[2], bg[0], bg[1], bg[2]);
     unique_lock<mutex> lock(mpAtlas->GetCurrentMap()->mMutexMapUpdate);
     mpTracker->UpdateFrameIMU(1.0f, b, mpTracker->GetLastKeyFrame());
@@ -2122,9 +2104,8 @@ void LoopClosing::CheckObservations(set<KeyFrame*>& spKFsMap1,
         continue;
       }
 
-      map<KeyFrame*, tuple<int, int>> mMPijObs = pMPij->GetObservations();
       for (KeyFrame* pKFi2 : spKFsMap2) {
-        if (mMPijObs.find(pKFi2) != mMPijObs.end()) {
+        if (pMPij->IsInKeyFrame(pKFi2)) {
           if (mMatchedMP.find(pKFi2) != mMatchedMP.end()) {
             mMatchedMP[pKFi2] = mMatchedMP[pKFi2] + 1;
           } else {
@@ -2286,6 +2267,16 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap,
   Verbose::PrintMess("Starting Global Bundle Adjustment",
                      Verbose::VERBOSITY_NORMAL);
 
+  // Signal the finish handshake on every return path
+  struct ThreadExit {
+    LoopClosing* mpLoopCloser;
+    ~ThreadExit() {
+      unique_lock<mutex> lock(mpLoopCloser->mMutexGBA);
+      mpLoopCloser->mnGBAThreads--;
+      mpLoopCloser->mcvGBAThreads.notify_all();
+    }
+  } threadExit{this};
+
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_StartFGBA =
       std::chrono::steady_clock::now();
@@ -2298,11 +2289,14 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap,
 
   const bool bImuInit = pActiveMap->isImuInitialized();
 
-  if (!bImuInit)
-    Optimizer::GlobalBundleAdjustemnt(pActiveMap, 10, &mbStopGBA, nLoopKF,
-                                      false);
-  else
-    Optimizer::FullInertialBA(pActiveMap, 7, false, nLoopKF, &mbStopGBA);
+  {
+    StageTimes::Scope timeGBA(mStageTimes, StageTimes::GLOBAL_BA);
+    if (!bImuInit)
+      Optimizer::GlobalBundleAdjustemnt(pActiveMap, 10, &mbStopGBA, nLoopKF,
+                                        false);
+    else
+      Optimizer::FullInertialBA(pActiveMap, 7, false, nLoopKF, &mbStopGBA);
+  }
 
 #ifdef REGISTER_TIMES
   std::chrono::steady_clock::time_point time_EndGBA =
@@ -25,14 +25,15 @@
 
 namespace ORB_SLAM3 {
 
-long unsigned int Map::nNextId = 0;
-
 Map::Map()
     : mpFirstRegionKF(static_cast<KeyFrame*>(NULL)),
       mbFail(false),
+      mnId(0),
+      mpIds(static_cast<IdCounters*>(NULL)),
       mbImuInitialized(false),
       mnMapChange(0),
       mnMapChangeNotified(0),
+      mnStructureChange(0),
       mnMaxKFid(0),
       mnBigChangeIdx(0),
       mIsInUse(false),
@@ -41,16 +42,17 @@ Map::Map()
       mbIsInertial(false),
       mbIMU_BA1(false),
       mbIMU_BA2(false) {
-  mnId = nNextId++;
   mThumbnail = static_cast<GLubyte*>(NULL);
 }
 
-Map::Map(int initKFid)
+Map::Map(int initKFid, IdCounters* pIds)
     : mpFirstRegionKF(static_cast<KeyFrame*>(NULL)),
       mbFail(false),
+      mpIds(pIds),
       mbImuInitialized(false),
       mnMapChange(0),
       mnMapChangeNotified(0),
+      mnStructureChange(0),
       mnInitKFid(initKFid),
       mnMaxKFid(initKFid),
       mnBigChangeIdx(0),
@@ -60,7 +62,7 @@ Map::Map(int initKFid)
       mbIsInertial(false),
       mbIMU_BA1(false),
       mbIMU_BA2(false) {
-  mnId = nNextId++;
+  mnId = mpIds->mMapIds.Next();
   mThumbnail = static_cast<GLubyte*>(NULL);
 }
 
@@ -87,6 +89,9 @@ void Map::AddKeyFrame(KeyFrame* pKF) {
     mpKFlowerID = pKF;
   }
   mspKeyFrames.insert(pKF);
+  mnStructureChange++;
+  // Changes are recorded from now on, also after moving to another map
+  pKF->mnDirty = 0;
   if (pKF->mnId > mnMaxKFid) {
     mnMaxKFid = pKF->mnId;
   }
@@ -98,6 +103,8 @@ void Map::AddKeyFrame(KeyFrame* pKF) {
 void Map::AddMapPoint(MapPoint* pMP) {
   unique_lock<mutex> lock(mMutexMap);
   mspMapPoints.insert(pMP);
+  mnStructureChange++;
+  pMP->mnDirty = 0;
 }
 
 void Map::SetImuInitialized() {
@@ -113,6 +120,7 @@ bool Map::isImuInitialized() {
 void Map::EraseMapPoint(MapPoint* pMP) {
   unique_lock<mutex> lock(mMutexMap);
   mspMapPoints.erase(pMP);
+  mnStructureChange++;
 
   // TODO: This only erase the pointer.
   // Delete the MapPoint
@@ -121,10 +129,10 @@ void Map::EraseMapPoint(MapPoint* pMP) {
 void Map::EraseKeyFrame(KeyFrame* pKF) {
   unique_lock<mutex> lock(mMutexMap);
   mspKeyFrames.erase(pKF);
+  mnStructureChange++;
   if (mspKeyFrames.size() > 0) {
     if (pKF->mnId == mpKFlowerID->mnId) {
-      vector<KeyFrame*> vpKFs =
-          vector<KeyFrame*>(mspKeyFrames.begin(), mspKeyFrames.end());
+      vector<KeyFrame*> vpKFs = mspKeyFrames.elements();
       sort(vpKFs.begin(), vpKFs.end(), KeyFrame::lId);
       mpKFlowerID = vpKFs[0];
     }
@@ -153,12 +161,12 @@ int Map::GetLastBigChangeIdx() {
 
 vector<KeyFrame*> Map::GetAllKeyFrames() {
   unique_lock<mutex> lock(mMutexMap);
-  return vector<KeyFrame*>(mspKeyFrames.begin(), mspKeyFrames.end());
+  return mspKeyFrames.elements();
 }
 
 vector<MapPoint*> Map::GetAllMapPoints() {
   unique_lock<mutex> lock(mMutexMap);
-  return vector<MapPoint*>(mspMapPoints.begin(), mspMapPoints.end());
+  return mspMapPoints.elements();
 }
 
 long unsigned int Map::MapPointsInMap() {
@@ -177,6 +185,18 @@ vector<MapPoint*> Map::GetReferenceMapPoints() {
 }
 
 long unsigned int Map::GetId() { return mnId; }
+
+void Map::SetIdCounters(IdCounters* pIds) { mpIds = pIds; }
+
+IdCounters* Map::GetIdCounters() { return mpIds; }
+
+long unsigned int Map::NewKeyFrameId() {
+  return mpIds->mKeyFrameIds.Next();
+}
+
+long unsigned int Map::NewMapPointId() {
+  return mpIds->mMapPointIds.Next();
+}
 long unsigned int Map::GetInitKFid() {
   unique_lock<mutex> lock(mMutexMap);
   return mnInitKFid;
@@ -203,8 +223,8 @@ void Map::clear() {
   //    send=mspMapPoints.end(); sit!=send; sit++)
   //        delete *sit;
 
-  for (set<KeyFrame*>::iterator sit = mspKeyFrames.begin(),
-                                send = mspKeyFrames.end();
+  for (SlotMap<KeyFrame>::const_iterator sit = mspKeyFrames.begin(),
+                                         send = mspKeyFrames.end();
        sit != send; sit++) {
     KeyFrame* pKF = *sit;
     pKF->UpdateMap(static_cast<Map*>(NULL));
@@ -213,6 +233,14 @@ void Map::clear() {
 
   mspMapPoints.clear();
   mspKeyFrames.clear();
+  mnStructureChange++;
+  {
+    unique_lock<mutex> lock(mMutexDirty);
+    for (int i = 0; i < NUM_DIRTY_CONSUMERS; i++) {
+      mvpDirtyKeyFrames[i].clear();
+      mvpDirtyMapPoints[i].clear();
+    }
+  }
   mnMaxKFid = mnInitKFid;
   mbImuInitialized = false;
   mvpReferenceMapPoints.clear();
@@ -236,7 +264,7 @@ void Map::ApplyScaledRotation(const Sophus::SE3f& T, const float s,
   Eigen::Matrix3f Ryw = Tyw.rotationMatrix();
   Eigen::Vector3f tyw = Tyw.translation();
 
-  for (set<KeyFrame*>::iterator sit = mspKeyFrames.begin();
+  for (SlotMap<KeyFrame>::const_iterator sit = mspKeyFrames.begin();
        sit != mspKeyFrames.end(); sit++) {
     KeyFrame* pKF = *sit;
     Sophus::SE3f Twc = pKF->GetPoseInverse();
@@ -250,7 +278,7 @@ void Map::ApplyScaledRotation(const Sophus::SE3f& T, const float s,
     else
       pKF->SetVelocity(Ryw * Vw * s);
   }
-  for (set<MapPoint*>::iterator sit = mspMapPoints.begin();
+  for (SlotMap<MapPoint>::const_iterator sit = mspMapPoints.begin();
        sit != mspMapPoints.end(); sit++) {
     MapPoint* pMP = *sit;
     pMP->SetWorldPos(s * Ryw * pMP->GetWorldPos() + tyw);
@@ -309,6 +337,64 @@ void Map::IncreaseChangeIndex() {
   mnMapChange++;
 }
 
+long unsigned int Map::GetStructureChangeIndex() {
+  unique_lock<mutex> lock(mMutexMap);
+  return mnStructureChange;
+}
+
+void Map::SetDirtyTracking(DirtyConsumer consumer, bool bEnable) {
+  const unsigned char nBit = 1 << consumer;
+  if (bEnable) {
+    mnDirtyMask |= nBit;
+    return;
+  }
+
+  mnDirtyMask &= ~nBit;
+  vector<KeyFrame*> vpKFs;
+  vector<MapPoint*> vpMPs;
+  TakeDirtyKeyFrames(consumer, vpKFs);
+  TakeDirtyMapPoints(consumer, vpMPs);
+}
+
+unsigned char Map::GetDirtyMask() { return mnDirtyMask; }
+
+void Map::AddDirty(KeyFrame* pKF, unsigned char nBits) {
+  unique_lock<mutex> lock(mMutexDirty);
+  for (int i = 0; i < NUM_DIRTY_CONSUMERS; i++)
+    if (nBits & (1 << i)) mvpDirtyKeyFrames[i].push_back(pKF);
+}
+
+void Map::AddDirty(MapPoint* pMP, unsigned char nBits) {
+  unique_lock<mutex> lock(mMutexDirty);
+  for (int i = 0; i < NUM_DIRTY_CONSUMERS; i++)
+    if (nBits & (1 << i)) mvpDirtyMapPoints[i].push_back(pMP);
+}
+
+void Map::TakeDirtyKeyFrames(DirtyConsumer consumer,
+                             vector<KeyFrame*>& vpKFs) {
+  vpKFs.clear();
+  {
+    unique_lock<mutex> lock(mMutexDirty);
+    vpKFs.swap(mvpDirtyKeyFrames[consumer]);
+  }
+
+  // A change after this is listed again
+  const unsigned char nClear = ~(1 << consumer);
+  for (KeyFrame* pKF : vpKFs) pKF->mnDirty &= nClear;
+}
+
+void Map::TakeDirtyMapPoints(DirtyConsumer consumer,
+                             vector<MapPoint*>& vpMPs) {
+  vpMPs.clear();
+  {
+    unique_lock<mutex> lock(mMutexDirty);
+    vpMPs.swap(mvpDirtyMapPoints[consumer]);
+  }
+
+  const unsigned char nClear = ~(1 << consumer);
+  for (MapPoint* pMP : vpMPs) pMP->mnDirty &= nClear;
+}
+
 int Map::GetLastMapChange() {
   unique_lock<mutex> lock(mMutexMap);
   return mnMapChangeNotified;
@@ -322,8 +408,7 @@ void Map::SetLastMapChange(int currentChangeId) {
 void Map::PreSave(std::set<GeometricCamera*>& spCams) {
   int nMPWithoutObs = 0;
 
-  std::set<MapPoint*> tmp_mspMapPoints;
-  tmp_mspMapPoints.insert(mspMapPoints.begin(), mspMapPoints.end());
+  std::vector<MapPoint*> tmp_mspMapPoints = mspMapPoints.elements();
 
   for (MapPoint* pMPi : tmp_mspMapPoints) {
     if (!pMPi || pMPi->isBad()) continue;
@@ -331,10 +416,10 @@ void Map::PreSave(std::set<GeometricCamera*>& spCams) {
     if (pMPi->GetObservations().size() == 0) {
       nMPWithoutObs++;
     }
-    map<KeyFrame*, std::tuple<int, int>> mpObs = pMPi->GetObservations();
+    MapPoint::ObservationVector mpObs = pMPi->GetObservations();
     // std::cout << "getting observations\n";
-    for (map<KeyFrame*, std::tuple<int, int>>::iterator it = mpObs.begin(),
-                                                        end = mpObs.end();
+    for (MapPoint::ObservationVector::const_iterator it = mpObs.begin(),
+                                                     end = mpObs.end();
          it != end; ++it) {
       if (it->first->GetMap() != this || it->first->isBad()) {
         pMPi->EraseObservation(it->first);
@@ -352,8 +437,7 @@ void Map::PreSave(std::set<GeometricCamera*>& spCams) {
   // Backup of MapPoints
   mvpBackupMapPoints.clear();
 
-  tmp_mspMapPoints.clear();
-  tmp_mspMapPoints.insert(mspMapPoints.begin(), mspMapPoints.end());
+  tmp_mspMapPoints = mspMapPoints.elements();
 
   for (MapPoint* pMPi : tmp_mspMapPoints) {
     if (!pMPi || pMPi->isBad()) continue;
@@ -384,13 +468,18 @@ void Map::PreSave(std::set<GeometricCamera*>& spCams) {
 
 void Map::PostLoad(
     KeyFrameDatabase* pKFDB,
-    ORBVocabulary*
+    const ORBVocabulary*
         pORBVoc /*, map<long unsigned int, KeyFrame*>& mpKeyFrameId*/,
     map<unsigned int, GeometricCamera*>& mpCams) {
-  std::copy(mvpBackupMapPoints.begin(), mvpBackupMapPoints.end(),
-            std::inserter(mspMapPoints, mspMapPoints.begin()));
-  std::copy(mvpBackupKeyFrames.begin(), mvpBackupKeyFrames.end(),
-            std::inserter(mspKeyFrames, mspKeyFrames.begin()));
+  for (MapPoint* pMPi : mvpBackupMapPoints) {
+    mspMapPoints.insert(pMPi);
+    pMPi->mnDirty = 0;
+  }
+  for (KeyFrame* pKFi : mvpBackupKeyFrames) {
+    mspKeyFrames.insert(pKFi);
+    pKFi->mnDirty = 0;
+  }
+  mnStructureChange++;
 
   map<long unsigned int, MapPoint*> mpMapPointId;
   for (MapPoint* pMPi : mspMapPoints) {
@@ -421,7 +510,6 @@ void Map::PostLoad(
     if (!pKFi || pKFi->isBad()) continue;
 
     pKFi->PostLoad(mpKeyFrameId, mpMapPointId, mpCams);
-    pKFDB->add(pKFi);
   }
 
   if (mnBackupKFinitialID != -1) {
@@ -23,6 +23,9 @@
 
 #include <pangolin/pangolin.h>
 
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
 #include <stdexcept>
 #include <mutex>
 
@@ -32,7 +35,136 @@
 
 namespace ORB_SLAM3 {
 
-MapDrawer::MapDrawer(const Atlas_ptr &pAtlas, const std::string &strSettingPath): mpAtlas(pAtlas){
+namespace {
+
+const float kBasicKFColor[3] = {0.0f, 0.0f, 1.0f};
+const float kOptKFColor[3] = {0.0f, 1.0f, 0.0f};    // Green -> Opt KFs
+const float kFixedKFColor[3] = {1.0f, 0.0f, 0.0f};  // Red -> Fixed KFs
+
+// Camera frustum as GL_LINES in the camera frame
+const int kFrustumVertices = 16;
+
+void AppendFrustum(const Eigen::Matrix4f &Twc, const float w, const float h,
+                   const float z, std::vector<float> &vVertices) {
+  const Eigen::Vector3f vCorners[kFrustumVertices] = {
+      {0, 0, 0},  {w, h, z},  {0, 0, 0},   {w, -h, z},
+      {0, 0, 0},  {-w, -h, z}, {0, 0, 0},  {-w, h, z},
+      {w, h, z},  {w, -h, z},  {-w, h, z}, {-w, -h, z},
+      {-w, h, z}, {w, h, z},   {-w, -h, z}, {w, -h, z}};
+
+  const Eigen::Matrix3f Rwc = Twc.block<3, 3>(0, 0);
+  const Eigen::Vector3f twc = Twc.block<3, 1>(0, 3);
+  for (const Eigen::Vector3f &x : vCorners) {
+    const Eigen::Vector3f xw = Rwc * x + twc;
+    vVertices.insert(vVertices.end(), xw.data(), xw.data() + 3);
+  }
+}
+
+void AppendLine(const Eigen::Vector3f &x1, const Eigen::Vector3f &x2,
+                std::vector<float> &vVertices) {
+  vVertices.insert(vVertices.end(), x1.data(), x1.data() + 3);
+  vVertices.insert(vVertices.end(), x2.data(), x2.data() + 3);
+}
+
+// Expects GL_VERTEX_ARRAY to be enabled
+void DrawLineArray(const std::vector<float> &vVertices) {
+  if (vVertices.empty()) return;
+  glVertexPointer(3, GL_FLOAT, 0, vVertices.data());
+  glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(vVertices.size() / 3));
+}
+
+// Pinhole projection of world vertices into an image, drawn in call order
+// without a depth buffer.
+class SoftwareCanvas {
+ public:
+  SoftwareCanvas(cv::Mat &im, const Sophus::SE3f &Tvw, const float f)
+      : mIm(im),
+        mRvw(Tvw.rotationMatrix()),
+        mtvw(Tvw.translation()),
+        mf(f),
+        mcx(0.5f * im.cols),
+        mcy(0.5f * im.rows) {}
+
+  void DrawLines(const std::vector<float> &vVertices,
+                 const std::vector<float> *pvColors, const float *color,
+                 const float fWidth) {
+    const int nThickness = std::max(1, cvRound(fWidth));
+    for (size_t i = 0; i + 6 <= vVertices.size(); i += 6) {
+      Eigen::Vector3f x1 = ToView(&vVertices[i]);
+      Eigen::Vector3f x2 = ToView(&vVertices[i + 3]);
+      if (!ClipToNearPlane(x1, x2)) continue;
+
+      const float *c = pvColors ? &(*pvColors)[i] : color;
+      cv::line(mIm, Project(x1), Project(x2), ToScalar(c), nThickness);
+    }
+  }
+
+  void DrawPoints(const std::vector<float> &vVertices, const float *color,
+                  const float fSize) {
+    const cv::Vec3b bgr(static_cast<uchar>(255 * color[2]),
+                        static_cast<uchar>(255 * color[1]),
+                        static_cast<uchar>(255 * color[0]));
+    const int r = std::max(0, cvRound(0.5f * fSize) - 1);
+    for (size_t i = 0; i + 3 <= vVertices.size(); i += 3) {
+      const Eigen::Vector3f x = ToView(&vVertices[i]);
+      if (x(2) < kNear) continue;
+
+      const cv::Point pt = Project(x);
+      for (int v = pt.y - r; v <= pt.y + r; v++) {
+        if (v < 0 || v >= mIm.rows) continue;
+        cv::Vec3b *row = mIm.ptr<cv::Vec3b>(v);
+        for (int u = pt.x - r; u <= pt.x + r; u++)
+          if (u >= 0 && u < mIm.cols) row[u] = bgr;
+      }
+    }
+  }
+
+ private:
+  static constexpr float kNear = 0.1f;
+
+  Eigen::Vector3f ToView(const float *xw) const {
+    return mRvw * Eigen::Map<const Eigen::Vector3f>(xw) + mtvw;
+  }
+
+  bool ClipToNearPlane(Eigen::Vector3f &x1, Eigen::Vector3f &x2) const {
+    if (x1(2) < kNear && x2(2) < kNear) return false;
+    if (x1(2) < kNear)
+      x1 = x2 + (x1 - x2) * ((x2(2) - kNear) / (x2(2) - x1(2)));
+    else if (x2(2) < kNear)
+      x2 = x1 + (x2 - x1) * ((x1(2) - kNear) / (x1(2) - x2(2)));
+    return true;
+  }
+
+  cv::Point Project(const Eigen::Vector3f &x) const {
+    // Clamp far outside the image, cv::line clips the rest
+    const float u = std::max(-1e6f, std::min(1e6f, mf * x(0) / x(2) + mcx));
+    const float v = std::max(-1e6f, std::min(1e6f, mf * x(1) / x(2) + mcy));
+    return cv::Point(cvRound(u), cvRound(v));
+  }
+
+  static cv::Scalar ToScalar(const float *c) {
+    return cv::Scalar(255 * c[2], 255 * c[1], 255 * c[0]);
+  }
+
+  cv::Mat &mIm;
+  const Eigen::Matrix3f mRvw;
+  const Eigen::Vector3f mtvw;
+  const float mf, mcx, mcy;
+};
+
+}  // namespace
+
+MapDrawer::MapDrawer(const Atlas_ptr &pAtlas, const std::string &strSettingPath)
+    : mpAtlas(pAtlas),
+      mpCachedMap(NULL),
+      mnCachedMapId(0),
+      mnCachedStructure(0),
+      mnPointMark(0),
+      mbAllPointsDirty(false),
+      mpCachedKFMap(NULL),
+      mnCachedKFMapId(0),
+      mnCachedKFStructure(0),
+      mnKeyFrameMark(0) {
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
     if (!ParseViewerParamFile(fSettings)) {
       std::cerr << "**ERROR in the config file, the format is not correct**"
@@ -40,7 +172,17 @@ MapDrawer::MapDrawer(const Atlas_ptr &pAtlas, const std::string &strSettingPath)
       throw std::runtime_error("**ERROR in the config file, the format is not correct**");
     }
 }
-MapDrawer::MapDrawer(const Atlas_ptr &pAtlas, const Settings& settings): mpAtlas(pAtlas){
+MapDrawer::MapDrawer(const Atlas_ptr &pAtlas, const Settings& settings)
+    : mpAtlas(pAtlas),
+      mpCachedMap(NULL),
+      mnCachedMapId(0),
+      mnCachedStructure(0),
+      mnPointMark(0),
+      mbAllPointsDirty(false),
+      mpCachedKFMap(NULL),
+      mnCachedKFMapId(0),
+      mnCachedKFStructure(0),
+      mnKeyFrameMark(0) {
   newParameterLoader(settings);
 }
 
@@ -119,238 +261,421 @@ bool MapDrawer::ParseViewerParamFile(cv::FileStorage &fSettings) {
   return !b_miss_params;
 }
 
+void MapDrawer::MarkPointDirty(const size_t nSlot) {
+  if (mbAllPointsDirty) return;
+  mvDirtyPointSlots.push_back(nSlot);
+  // Past this a single upload of every point is cheaper, and the list stays
+  // bounded when nothing is uploaded (software rendering)
+  if (mvDirtyPointSlots.size() >
+      std::max<size_t>(mvpCachedPoints.size(), 1024)) {
+    mvDirtyPointSlots.clear();
+    mbAllPointsDirty = true;
+  }
+}
+
+void MapDrawer::UpdatePointCache(Map *pMap) {
+  const long unsigned int nStructure = pMap->GetStructureChangeIndex();
+
+  bool bRescan = nStructure != mnCachedStructure;
+  if (pMap != mpCachedMap || pMap->GetId() != mnCachedMapId) {
+    mpCachedMap = pMap;
+    mnCachedMapId = pMap->GetId();
+    mvpCachedPoints.clear();
+    mmPointSlots.clear();
+    mvPointMarks.clear();
+    mvPointVertices.clear();
+    mvDirtyPointSlots.clear();
+    mbAllPointsDirty = false;
+    // The rescan reads every point, only the later moves are needed
+    pMap->SetDirtyTracking(Map::DIRTY_VIEWER, true);
+    bRescan = true;
+  }
+
+  // Points moved by BA, loop correction or scale updates. New points, and
+  // all of them after a map switch, are read by the rescan
+  pMap->TakeDirtyMapPoints(Map::DIRTY_VIEWER, mvpDirtyPoints);
+  for (MapPoint *pMP : mvpDirtyPoints) {
+    unordered_map<MapPoint *, size_t>::const_iterator it =
+        mmPointSlots.find(pMP);
+    if (it == mmPointSlots.end()) continue;
+
+    const Eigen::Vector3f pos = pMP->GetWorldPos();
+    std::copy(pos.data(), pos.data() + 3,
+              mvPointVertices.begin() + 3 * it->second);
+    MarkPointDirty(it->second);
+  }
+
+  if (bRescan) {
+    // Only the pointer array is copied under the map mutex
+    const vector<MapPoint *> vpMPs = pMap->GetAllMapPoints();
+    mnPointMark++;
+
+    for (MapPoint *pMP : vpMPs) {
+      if (pMP->isBad()) continue;
+      unordered_map<MapPoint *, size_t>::iterator it = mmPointSlots.find(pMP);
+      if (it != mmPointSlots.end()) {
+        mvPointMarks[it->second] = mnPointMark;
+        continue;
+      }
+
+      const size_t nSlot = mvpCachedPoints.size();
+      const Eigen::Vector3f pos = pMP->GetWorldPos();
+      mmPointSlots[pMP] = nSlot;
+      mvpCachedPoints.push_back(pMP);
+      mvPointMarks.push_back(mnPointMark);
+      mvPointVertices.insert(mvPointVertices.end(), pos.data(), pos.data() + 3);
+      MarkPointDirty(nSlot);
+    }
+
+    // Points no longer in the map: the last point takes the freed slot
+    size_t i = 0;
+    while (i < mvpCachedPoints.size()) {
+      if (mvPointMarks[i] == mnPointMark) {
+        i++;
+        continue;
+      }
+
+      const size_t nLast = mvpCachedPoints.size() - 1;
+      mmPointSlots.erase(mvpCachedPoints[i]);
+      if (i != nLast) {
+        mvpCachedPoints[i] = mvpCachedPoints[nLast];
+        mvPointMarks[i] = mvPointMarks[nLast];
+        std::copy(mvPointVertices.begin() + 3 * nLast,
+                  mvPointVertices.begin() + 3 * nLast + 3,
+                  mvPointVertices.begin() + 3 * i);
+        mmPointSlots[mvpCachedPoints[i]] = i;
+        MarkPointDirty(i);
+      }
+      mvpCachedPoints.pop_back();
+      mvPointMarks.pop_back();
+      mvPointVertices.resize(3 * nLast);
+    }
+  }
+
+  mnCachedStructure = nStructure;
+}
+
+void MapDrawer::UpdateReferencePoints(Map *pMap) {
+  const vector<MapPoint *> vpRefMPs = pMap->GetReferenceMapPoints();
+
+  mvRefPointVertices.clear();
+  mvRefPointVertices.reserve(3 * vpRefMPs.size());
+  for (MapPoint *pMP : vpRefMPs) {
+    if (!pMP || pMP->isBad()) continue;
+    const Eigen::Vector3f pos = pMP->GetWorldPos();
+    mvRefPointVertices.insert(mvRefPointVertices.end(), pos.data(),
+                              pos.data() + 3);
+  }
+}
+
 void MapDrawer::DrawMapPoints() {
   Map *pActiveMap = mpAtlas->GetCurrentMap();
   if (!pActiveMap) return;
 
-  const vector<MapPoint *> &vpMPs = pActiveMap->GetAllMapPoints();
-  const vector<MapPoint *> &vpRefMPs = pActiveMap->GetReferenceMapPoints();
+  UpdatePointCache(pActiveMap);
+  UpdateReferencePoints(pActiveMap);
 
-  set<MapPoint *> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
+  const size_t nPoints = mvpCachedPoints.size();
+  if (nPoints == 0) return;
 
-  if (vpMPs.empty()) return;
+  if (!mpPointBuffer || mpPointBuffer->num_elements < nPoints) {
+    // Grow geometrically so that new points rarely reallocate the buffer
+    const GLuint nCapacity =
+        static_cast<GLuint>(std::max<size_t>(2 * nPoints, 4096));
+    mpPointBuffer.reset(new pangolin::GlBuffer(
+        pangolin::GlArrayBuffer, nCapacity, GL_FLOAT, 3, GL_DYNAMIC_DRAW));
+    mbAllPointsDirty = true;
+  }
 
-  glPointSize(mPointSize);
-  glBegin(GL_POINTS);
-  glColor3f(0.0, 0.0, 0.0);
+  const size_t nStride = 3 * sizeof(float);
+  if (mbAllPointsDirty) {
+    mpPointBuffer->Upload(mvPointVertices.data(), nPoints * nStride, 0);
+  } else if (!mvDirtyPointSlots.empty()) {
+    // One upload per run of nearby slots, the gaps are uploaded again
+    const size_t kMaxGap = 64;
+    std::sort(mvDirtyPointSlots.begin(), mvDirtyPointSlots.end());
+    size_t nBegin = mvDirtyPointSlots.front(), nEnd = nBegin + 1;
+    for (size_t i = 1; i <= mvDirtyPointSlots.size(); i++) {
+      if (i < mvDirtyPointSlots.size() &&
+          mvDirtyPointSlots[i] <= nEnd + kMaxGap) {
+        nEnd = std::max(nEnd, mvDirtyPointSlots[i] + 1);
+        continue;
+      }
 
-  for (size_t i = 0, iend = vpMPs.size(); i < iend; i++) {
-    if (vpMPs[i]->isBad() || spRefMPs.count(vpMPs[i])) continue;
-    Eigen::Matrix<float, 3, 1> pos = vpMPs[i]->GetWorldPos();
-    glVertex3f(pos(0), pos(1), pos(2));
+      // Slots freed by removals are past the end
+      nEnd = std::min(nEnd, nPoints);
+      if (nBegin < nEnd)
+        mpPointBuffer->Upload(&mvPointVertices[3 * nBegin],
+                              (nEnd - nBegin) * nStride, nBegin * nStride);
+      if (i < mvDirtyPointSlots.size()) {
+        nBegin = mvDirtyPointSlots[i];
+        nEnd = nBegin + 1;
+      }
+    }
   }
-  glEnd();
+  mvDirtyPointSlots.clear();
+  mbAllPointsDirty = false;
 
   glPointSize(mPointSize);
-  glBegin(GL_POINTS);
-  glColor3f(1.0, 0.0, 0.0);
-
-  for (set<MapPoint *>::iterator sit = spRefMPs.begin(), send = spRefMPs.end();
-       sit != send; sit++) {
-    if ((*sit)->isBad()) continue;
-    Eigen::Matrix<float, 3, 1> pos = (*sit)->GetWorldPos();
-    glVertex3f(pos(0), pos(1), pos(2));
+  glColor3f(0.0, 0.0, 0.0);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  mpPointBuffer->Bind();
+  glVertexPointer(3, GL_FLOAT, 0, 0);
+  glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(nPoints));
+  mpPointBuffer->Unbind();
+
+  // Reference points are also in the buffer, drawn again on top of them
+  if (!mvRefPointVertices.empty()) {
+    glDepthFunc(GL_LEQUAL);
+    glColor3f(1.0, 0.0, 0.0);
+    glVertexPointer(3, GL_FLOAT, 0, mvRefPointVertices.data());
+    glDrawArrays(GL_POINTS, 0,
+                 static_cast<GLsizei>(mvRefPointVertices.size() / 3));
+    glDepthFunc(GL_LESS);
   }
-
-  glEnd();
+  glDisableClientState(GL_VERTEX_ARRAY);
 }
 
-void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph,
-                              const bool bDrawInertialGraph,
-                              const bool bDrawOptLba) {
+void MapDrawer::ReadKeyFrame(KeyFrameSlot &slot) {
+  KeyFrame *pKF = slot.pKF;
   const float &w = mKeyFrameSize;
   const float h = w * 0.75;
   const float z = w * 0.6;
 
-  Map *pActiveMap = mpAtlas->GetCurrentMap();
-  // DEBUG LBA
-  std::set<long unsigned int> sOptKFs = pActiveMap->msOptKFs;
-  std::set<long unsigned int> sFixedKFs = pActiveMap->msFixedKFs;
+  slot.vFrustum.clear();
+  AppendFrustum(pKF->GetPoseInverse().matrix(), w, h, z, slot.vFrustum);
+  slot.Ow = pKF->GetCameraCenter();
+
+  KeyFrame *pParent = pKF->GetParent();
+  slot.bOrigin = !pParent;
+
+  slot.vpGraph.clear();
+  // Covisibility Graph
+  const vector<KeyFrame *> vCovKFs = pKF->GetCovisiblesByWeight(100);
+  for (KeyFrame *pKFc : vCovKFs)
+    if (pKFc->mnId >= pKF->mnId) slot.vpGraph.push_back(pKFc);
+  // Spanning tree
+  if (pParent) slot.vpGraph.push_back(pParent);
+  // Loops
+  const set<KeyFrame *> sLoopKFs = pKF->GetLoopEdges();
+  for (KeyFrame *pKFl : sLoopKFs)
+    if (pKFl->mnId >= pKF->mnId) slot.vpGraph.push_back(pKFl);
+
+  // Inertial link
+  slot.pPrevKF = pKF->mPrevKF;
+}
 
-  if (!pActiveMap) return;
+bool MapDrawer::UpdateActiveKeyFrames(Map *pActiveMap) {
+  const long unsigned int nStructure = pActiveMap->GetStructureChangeIndex();
+
+  bool bChanged = false;
+  bool bRescan = nStructure != mnCachedKFStructure;
+  if (pActiveMap != mpCachedKFMap ||
+      pActiveMap->GetId() != mnCachedKFMapId) {
+    mpCachedKFMap = pActiveMap;
+    mnCachedKFMapId = pActiveMap->GetId();
+    mvKeyFrameSlots.clear();
+    mmKeyFrameSlots.clear();
+    mvKeyFrameMarks.clear();
+    pActiveMap->SetDirtyTracking(Map::DIRTY_VIEWER, true);
+    bChanged = bRescan = true;
+  }
 
-  const vector<KeyFrame *> vpKFs = pActiveMap->GetAllKeyFrames();
+  pActiveMap->TakeDirtyKeyFrames(Map::DIRTY_VIEWER, mvpDirtyKeyFrames);
+  for (KeyFrame *pKF : mvpDirtyKeyFrames) {
+    unordered_map<KeyFrame *, size_t>::const_iterator it =
+        mmKeyFrameSlots.find(pKF);
+    if (it == mmKeyFrameSlots.end()) continue;
+    ReadKeyFrame(mvKeyFrameSlots[it->second]);
+    bChanged = true;
+  }
 
-  if (bDrawKF) {
-    for (size_t i = 0; i < vpKFs.size(); i++) {
-      KeyFrame *pKF = vpKFs[i];
-      Eigen::Matrix4f Twc = pKF->GetPoseInverse().matrix();
-      // unsigned int index_color = pKF->mnOriginMapId; // UNUSED
-
-      glPushMatrix();
-
-      glMultMatrixf((GLfloat *)Twc.data());
-
-      if (!pKF->GetParent())  // It is the first KF in the map
-      {
-        glLineWidth(mKeyFrameLineWidth * 5);
-        glColor3f(1.0f, 0.0f, 0.0f);
-        glBegin(GL_LINES);
-      } else {
-        // cout << "Child KF: " << vpKFs[i]->mnId << endl;
-        glLineWidth(mKeyFrameLineWidth);
-        if (bDrawOptLba) {
-          if (sOptKFs.find(pKF->mnId) != sOptKFs.end()) {
-            glColor3f(0.0f, 1.0f, 0.0f);  // Green -> Opt KFs
-          } else if (sFixedKFs.find(pKF->mnId) != sFixedKFs.end()) {
-            glColor3f(1.0f, 0.0f, 0.0f);  // Red -> Fixed KFs
-          } else {
-            glColor3f(0.0f, 0.0f, 1.0f);  // Basic color
-          }
-        } else {
-          glColor3f(0.0f, 0.0f, 1.0f);  // Basic color
-        }
-        glBegin(GL_LINES);
+  if (bRescan) {
+    const vector<KeyFrame *> vpKFs = pActiveMap->GetAllKeyFrames();
+    mnKeyFrameMark++;
+
+    for (KeyFrame *pKF : vpKFs) {
+      unordered_map<KeyFrame *, size_t>::iterator it =
+          mmKeyFrameSlots.find(pKF);
+      if (it != mmKeyFrameSlots.end()) {
+        mvKeyFrameMarks[it->second] = mnKeyFrameMark;
+        continue;
       }
 
-      glVertex3f(0, 0, 0);
-      glVertex3f(w, h, z);
-      glVertex3f(0, 0, 0);
-      glVertex3f(w, -h, z);
-      glVertex3f(0, 0, 0);
-      glVertex3f(-w, -h, z);
-      glVertex3f(0, 0, 0);
-      glVertex3f(-w, h, z);
+      mmKeyFrameSlots[pKF] = mvKeyFrameSlots.size();
+      mvKeyFrameSlots.push_back(KeyFrameSlot());
+      mvKeyFrameSlots.back().pKF = pKF;
+      ReadKeyFrame(mvKeyFrameSlots.back());
+      mvKeyFrameMarks.push_back(mnKeyFrameMark);
+      bChanged = true;
+    }
 
-      glVertex3f(w, h, z);
-      glVertex3f(w, -h, z);
+    size_t i = 0;
+    while (i < mvKeyFrameSlots.size()) {
+      if (mvKeyFrameMarks[i] == mnKeyFrameMark) {
+        i++;
+        continue;
+      }
 
-      glVertex3f(-w, h, z);
-      glVertex3f(-w, -h, z);
+      const size_t nLast = mvKeyFrameSlots.size() - 1;
+      mmKeyFrameSlots.erase(mvKeyFrameSlots[i].pKF);
+      if (i != nLast) {
+        std::swap(mvKeyFrameSlots[i], mvKeyFrameSlots[nLast]);
+        mvKeyFrameMarks[i] = mvKeyFrameMarks[nLast];
+        mmKeyFrameSlots[mvKeyFrameSlots[i].pKF] = i;
+      }
+      mvKeyFrameSlots.pop_back();
+      mvKeyFrameMarks.pop_back();
+      bChanged = true;
+    }
+  }
 
-      glVertex3f(-w, h, z);
-      glVertex3f(w, h, z);
+  mnCachedKFStructure = nStructure;
+  return bChanged;
+}
 
-      glVertex3f(-w, -h, z);
-      glVertex3f(w, -h, z);
-      glEnd();
+bool MapDrawer::UpdateOtherKeyFrames(Map *pActiveMap) {
+  const vector<Map *> vpMaps = mpAtlas->GetAllMaps();
+
+  vector<long unsigned int> vSignature;
+  vSignature.reserve(1 + 3 * vpMaps.size());
+  vSignature.push_back(pActiveMap->GetId());
+  for (Map *pMap : vpMaps) {
+    if (pMap == pActiveMap) continue;
+    vSignature.push_back(pMap->GetId());
+    vSignature.push_back(pMap->GetMapChangeIndex());
+    vSignature.push_back(pMap->GetStructureChangeIndex());
+  }
+  if (vSignature == mvOtherMapsSignature) return false;
+  mvOtherMapsSignature.swap(vSignature);
 
-      glPopMatrix();
+  mvOtherKFVertices.clear();
+  mvOtherKFColors.clear();
+  mvOtherOriginKFVertices.clear();
 
-      glEnd();
-    }
-  }
+  const float &w = mKeyFrameSize;
+  const float h = w * 0.75;
+  const float z = w * 0.6;
 
-  if (bDrawGraph) {
-    glLineWidth(mGraphLineWidth);
-    glColor4f(0.0f, 1.0f, 0.0f, 0.6f);
-    glBegin(GL_LINES);
-
-    // cout << "-----------------Draw graph-----------------" << endl;
-    for (size_t i = 0; i < vpKFs.size(); i++) {
-      // Covisibility Graph
-      const vector<KeyFrame *> vCovKFs = vpKFs[i]->GetCovisiblesByWeight(100);
-      Eigen::Vector3f Ow = vpKFs[i]->GetCameraCenter();
-      if (!vCovKFs.empty()) {
-        for (vector<KeyFrame *>::const_iterator vit = vCovKFs.begin(),
-                                                vend = vCovKFs.end();
-             vit != vend; vit++) {
-          if ((*vit)->mnId < vpKFs[i]->mnId) continue;
-          Eigen::Vector3f Ow2 = (*vit)->GetCameraCenter();
-          glVertex3f(Ow(0), Ow(1), Ow(2));
-          glVertex3f(Ow2(0), Ow2(1), Ow2(2));
-        }
-      }
+  for (Map *pMap : vpMaps) {
+    if (pMap == pActiveMap) continue;
 
-      // Spanning tree
-      KeyFrame *pParent = vpKFs[i]->GetParent();
-      if (pParent) {
-        Eigen::Vector3f Owp = pParent->GetCameraCenter();
-        glVertex3f(Ow(0), Ow(1), Ow(2));
-        glVertex3f(Owp(0), Owp(1), Owp(2));
-      }
+    const vector<KeyFrame *> vpKFs = pMap->GetAllKeyFrames();
+    for (KeyFrame *pKF : vpKFs) {
+      const Eigen::Matrix4f Twc = pKF->GetPoseInverse().matrix();
 
-      // Loops
-      set<KeyFrame *> sLoopKFs = vpKFs[i]->GetLoopEdges();
-      for (set<KeyFrame *>::iterator sit = sLoopKFs.begin(),
-                                     send = sLoopKFs.end();
-           sit != send; sit++) {
-        if ((*sit)->mnId < vpKFs[i]->mnId) continue;
-        Eigen::Vector3f Owl = (*sit)->GetCameraCenter();
-        glVertex3f(Ow(0), Ow(1), Ow(2));
-        glVertex3f(Owl(0), Owl(1), Owl(2));
+      // The first KF in the map
+      if (!pKF->GetParent()) {
+        AppendFrustum(Twc, w, h, z, mvOtherOriginKFVertices);
+        continue;
       }
+
+      const float *color = mfFrameColors[pKF->mnOriginMapId % 6];
+      AppendFrustum(Twc, w, h, z, mvOtherKFVertices);
+      for (int i = 0; i < kFrustumVertices; i++)
+        mvOtherKFColors.insert(mvOtherKFColors.end(), color, color + 3);
     }
+  }
+  return true;
+}
+
+void MapDrawer::UpdateKeyFrameCache(Map *pActiveMap, const bool bDrawOptLba) {
+  const bool bActiveChanged = UpdateActiveKeyFrames(pActiveMap);
+  const bool bOtherChanged = UpdateOtherKeyFrames(pActiveMap);
+
+  // The LBA colors change with every local BA
+  vector<long unsigned int> vSignature;
+  vSignature.push_back(bDrawOptLba);
+  vSignature.push_back(bDrawOptLba ? pActiveMap->GetMapChangeIndex() : 0);
+  vSignature.push_back(pActiveMap->isImuInitialized());
+  if (!bActiveChanged && !bOtherChanged &&
+      vSignature == mvKeyFrameSignature)
+    return;
+  mvKeyFrameSignature.swap(vSignature);
+
+  // Assembled from the cache, no KeyFrame is read
+  mvKFVertices = mvOtherKFVertices;
+  mvKFColors = mvOtherKFColors;
+  mvOriginKFVertices = mvOtherOriginKFVertices;
+  mvGraphVertices.clear();
+  mvInertialVertices.clear();
 
-    glEnd();
+  // DEBUG LBA
+  std::set<long unsigned int> sOptKFs, sFixedKFs;
+  if (bDrawOptLba) {
+    sOptKFs = pActiveMap->msOptKFs;
+    sFixedKFs = pActiveMap->msFixedKFs;
   }
+  const bool bImuInitialized = pActiveMap->isImuInitialized();
+
+  for (const KeyFrameSlot &slot : mvKeyFrameSlots) {
+    if (slot.bOrigin) {
+      mvOriginKFVertices.insert(mvOriginKFVertices.end(),
+                                slot.vFrustum.begin(), slot.vFrustum.end());
+    } else {
+      const float *color = kBasicKFColor;
+      if (sOptKFs.count(slot.pKF->mnId))
+        color = kOptKFColor;
+      else if (sFixedKFs.count(slot.pKF->mnId))
+        color = kFixedKFColor;
+      mvKFVertices.insert(mvKFVertices.end(), slot.vFrustum.begin(),
+                          slot.vFrustum.end());
+      for (int i = 0; i < kFrustumVertices; i++)
+        mvKFColors.insert(mvKFColors.end(), color, color + 3);
+    }
 
-  if (bDrawInertialGraph && pActiveMap->isImuInitialized()) {
-    glLineWidth(mGraphLineWidth);
-    glColor4f(1.0f, 0.0f, 0.0f, 0.6f);
-    glBegin(GL_LINES);
-
-    // Draw inertial links
-    for (size_t i = 0; i < vpKFs.size(); i++) {
-      KeyFrame *pKFi = vpKFs[i];
-      Eigen::Vector3f Ow = pKFi->GetCameraCenter();
-      KeyFrame *pNext = pKFi->mNextKF;
-      if (pNext) {
-        Eigen::Vector3f Owp = pNext->GetCameraCenter();
-        glVertex3f(Ow(0), Ow(1), Ow(2));
-        glVertex3f(Owp(0), Owp(1), Owp(2));
-      }
+    for (KeyFrame *pKFn : slot.vpGraph) {
+      unordered_map<KeyFrame *, size_t>::const_iterator it =
+          mmKeyFrameSlots.find(pKFn);
+      if (it != mmKeyFrameSlots.end())
+        AppendLine(slot.Ow, mvKeyFrameSlots[it->second].Ow, mvGraphVertices);
     }
 
-    glEnd();
+    if (bImuInitialized && slot.pPrevKF) {
+      unordered_map<KeyFrame *, size_t>::const_iterator it =
+          mmKeyFrameSlots.find(slot.pPrevKF);
+      if (it != mmKeyFrameSlots.end())
+        AppendLine(mvKeyFrameSlots[it->second].Ow, slot.Ow,
+                   mvInertialVertices);
+    }
   }
+}
+
+void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph,
+                              const bool bDrawInertialGraph,
+                              const bool bDrawOptLba) {
+  Map *pActiveMap = mpAtlas->GetCurrentMap();
+  if (!pActiveMap) return;
 
-  vector<Map *> vpMaps = mpAtlas->GetAllMaps();
+  UpdateKeyFrameCache(pActiveMap, bDrawOptLba);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
 
   if (bDrawKF) {
-    for (Map *pMap : vpMaps) {
-      if (pMap == pActiveMap) continue;
-
-      vector<KeyFrame *> vpKFs = pMap->GetAllKeyFrames();
-
-      for (size_t i = 0; i < vpKFs.size(); i++) {
-        KeyFrame *pKF = vpKFs[i];
-        Eigen::Matrix4f Twc = pKF->GetPoseInverse().matrix();
-        unsigned int index_color = pKF->mnOriginMapId;
-
-        glPushMatrix();
-
-        glMultMatrixf((GLfloat *)Twc.data());
-
-        if (!vpKFs[i]->GetParent())  // It is the first KF in the map
-        {
-          glLineWidth(mKeyFrameLineWidth * 5);
-          glColor3f(1.0f, 0.0f, 0.0f);
-          glBegin(GL_LINES);
-        } else {
-          glLineWidth(mKeyFrameLineWidth);
-          glColor3f(mfFrameColors[index_color][0],
-                    mfFrameColors[index_color][1],
-                    mfFrameColors[index_color][2]);
-          glBegin(GL_LINES);
-        }
-
-        glVertex3f(0, 0, 0);
-        glVertex3f(w, h, z);
-        glVertex3f(0, 0, 0);
-        glVertex3f(w, -h, z);
-        glVertex3f(0, 0, 0);
-        glVertex3f(-w, -h, z);
-        glVertex3f(0, 0, 0);
-        glVertex3f(-w, h, z);
-
-        glVertex3f(w, h, z);
-        glVertex3f(w, -h, z);
-
-        glVertex3f(-w, h, z);
-        glVertex3f(-w, -h, z);
-
-        glVertex3f(-w, h, z);
-        glVertex3f(w, h, z);
-
-        glVertex3f(-w, -h, z);
-        glVertex3f(w, -h, z);
-        glEnd();
-
-        glPopMatrix();
-      }
-    }
+    glLineWidth(mKeyFrameLineWidth * 5);
+    glColor3f(1.0f, 0.0f, 0.0f);
+    DrawLineArray(mvOriginKFVertices);
+
+    glLineWidth(mKeyFrameLineWidth);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(3, GL_FLOAT, 0, mvKFColors.data());
+    DrawLineArray(mvKFVertices);
+    glDisableClientState(GL_COLOR_ARRAY);
+  }
+
+  if (bDrawGraph) {
+    glLineWidth(mGraphLineWidth);
+    glColor4f(0.0f, 1.0f, 0.0f, 0.6f);
+    DrawLineArray(mvGraphVertices);
+  }
+
+  if (bDrawInertialGraph) {
+    glLineWidth(mGraphLineWidth);
+    glColor4f(1.0f, 0.0f, 0.0f, 0.6f);
+    DrawLineArray(mvInertialVertices);
   }
+
+  glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 void MapDrawer::DrawCurrentCamera(pangolin::OpenGlMatrix &Twc) {
@@ -394,6 +719,56 @@ void MapDrawer::DrawCurrentCamera(pangolin::OpenGlMatrix &Twc) {
   glPopMatrix();
 }
 
+Sophus::SE3f MapDrawer::GetCurrentCameraPose() {
+  unique_lock<mutex> lock(mMutexCamera);
+  return mCameraPose;
+}
+
+void MapDrawer::DrawMapSoftware(cv::Mat &im, const Sophus::SE3f &Tvw,
+                                const float f, const bool bDrawPoints,
+                                const bool bDrawKF, const bool bDrawGraph,
+                                const bool bDrawInertialGraph) {
+  im.setTo(cv::Scalar(255, 255, 255));
+  SoftwareCanvas canvas(im, Tvw, f);
+
+  const float kRed[3] = {1.0f, 0.0f, 0.0f};
+  const float kGreen[3] = {0.0f, 1.0f, 0.0f};
+  const float kBlack[3] = {0.0f, 0.0f, 0.0f};
+
+  Map *pActiveMap = mpAtlas->GetCurrentMap();
+  if (pActiveMap) {
+    UpdateKeyFrameCache(pActiveMap, false);
+    if (bDrawGraph)
+      canvas.DrawLines(mvGraphVertices, NULL, kGreen, mGraphLineWidth);
+    if (bDrawInertialGraph)
+      canvas.DrawLines(mvInertialVertices, NULL, kRed, mGraphLineWidth);
+    if (bDrawKF) {
+      canvas.DrawLines(mvKFVertices, &mvKFColors, NULL, mKeyFrameLineWidth);
+      canvas.DrawLines(mvOriginKFVertices, NULL, kRed,
+                       mKeyFrameLineWidth * 5);
+    }
+
+    if (bDrawPoints) {
+      UpdatePointCache(pActiveMap);
+      UpdateReferencePoints(pActiveMap);
+      canvas.DrawPoints(mvPointVertices, kBlack, mPointSize);
+      canvas.DrawPoints(mvRefPointVertices, kRed, mPointSize);
+    }
+  }
+
+  const float &w = mCameraSize;
+  std::vector<float> vCamera;
+  AppendFrustum(GetCurrentCameraPose().matrix(), w, w * 0.75f, w * 0.6f,
+                vCamera);
+  canvas.DrawLines(vCamera, NULL, kGreen, mCameraLineWidth);
+}
+
+void MapDrawer::ReleaseBuffers() {
+  mpPointBuffer.reset();
+  mvDirtyPointSlots.clear();
+  mbAllPointsDirty = false;
+}
+
 void MapDrawer::SetCurrentCameraPose(const Sophus::SE3f &Tcw) {
   unique_lock<mutex> lock(mMutexCamera);
   mCameraPose = Tcw.inverse();
@@ -21,15 +21,39 @@
 
 #include "MapPoint.h"
 
+#include <algorithm>
+#include <functional>
 #include <mutex>
 
 #include "ORBmatcher.h"
+#include "ObjectPool.h"
 
 namespace ORB_SLAM3 {
 
-long unsigned int MapPoint::nNextId = 0;
+namespace {
+
+// Number of keypoints of the keyframe associated to the point (two when it is
+// seen by both cameras of a non rectified stereo keyframe)
+int NumIndexes(const tuple<int, int>& indexes) {
+  return (get<0>(indexes) != -1) + (get<1>(indexes) != -1);
+}
+
+}  // namespace
+
 mutex MapPoint::mGlobalMutex;
 
+// Never destroyed, map points are not released before exit
+static ObjectPool* MapPointPool() {
+  static ObjectPool* pPool = new ObjectPool(sizeof(MapPoint), 1024);
+  return pPool;
+}
+
+void* MapPoint::operator new(std::size_t nSize) {
+  return MapPointPool()->Allocate(nSize);
+}
+
+void MapPoint::operator delete(void* p) { MapPointPool()->Deallocate(p); }
+
 MapPoint::MapPoint()
     : mnFirstKFid(0),
       mnFirstFrame(0),
@@ -77,10 +101,9 @@ MapPoint::MapPoint(const Eigen::Vector3f& Pos, KeyFrame* pRefKF, Map* pMap)
   mbTrackInViewR = false;
   mbTrackInView = false;
 
-  // MapPoints can be created from Tracking and Local Mapping. This mutex avoid
-  // conflicts with id.
-  unique_lock<mutex> lock(mpMap->mMutexPointCreation);
-  mnId = nNextId++;
+  // MapPoints can be created from Tracking and Local Mapping, the id counter
+  // of the map is atomic.
+  mnId = mpMap->NewMapPointId();
 }
 
 MapPoint::MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF,
@@ -113,10 +136,9 @@ MapPoint::MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF,
   mNormalVector.setZero();
 
   // Worldpos is not set
-  // MapPoints can be created from Tracking and Local Mapping. This mutex avoid
-  // conflicts with id.
-  unique_lock<mutex> lock(mpMap->mMutexPointCreation);
-  mnId = nNextId++;
+  // MapPoints can be created from Tracking and Local Mapping, the id counter
+  // of the map is atomic.
+  mnId = mpMap->NewMapPointId();
 }
 
 MapPoint::MapPoint(const Eigen::Vector3f& Pos, Map* pMap, Frame* pFrame,
@@ -169,16 +191,18 @@ MapPoint::MapPoint(const Eigen::Vector3f& Pos, Map* pMap, Frame* pFrame,
 
   pFrame->mDescriptors.row(idxF).copyTo(mDescriptor);
 
-  // MapPoints can be created from Tracking and Local Mapping. This mutex avoid
-  // conflicts with id.
-  unique_lock<mutex> lock(mpMap->mMutexPointCreation);
-  mnId = nNextId++;
+  // MapPoints can be created from Tracking and Local Mapping, the id counter
+  // of the map is atomic.
+  mnId = mpMap->NewMapPointId();
 }
 
 void MapPoint::SetWorldPos(const Eigen::Vector3f& Pos) {
-  unique_lock<mutex> lock2(mGlobalMutex);
-  unique_lock<mutex> lock(mMutexPos);
-  mWorldPos = Pos;
+  {
+    unique_lock<mutex> lock2(mGlobalMutex);
+    unique_lock<mutex> lock(mMutexPos);
+    mWorldPos = Pos;
+  }
+  MarkDirty();
 }
 
 Eigen::Vector3f MapPoint::GetWorldPos() {
@@ -196,23 +220,38 @@ KeyFrame* MapPoint::GetReferenceKeyFrame() {
   return mpRefKF;
 }
 
+MapPoint::ObservationVector::iterator MapPoint::FindObservation(
+    KeyFrame* pKF) {
+  return lower_bound(mObservations.begin(), mObservations.end(), pKF,
+                     [](const Observation& obs, KeyFrame* pKFi) {
+                       return std::less<KeyFrame*>()(obs.first, pKFi);
+                     });
+}
+
 void MapPoint::AddObservation(KeyFrame* pKF, int idx) {
   unique_lock<mutex> lock(mMutexFeatures);
-  tuple<int, int> indexes;
-
-  if (mObservations.count(pKF)) {
-    indexes = mObservations[pKF];
-  } else {
-    indexes = tuple<int, int>(-1, -1);
+  ObservationVector::iterator it = FindObservation(pKF);
+  if (it == mObservations.end() || it->first != pKF) {
+    // The new keyframe shares this point with every other observer, which
+    // counts it once per keypoint of its own
+    for (const Observation& obs : mObservations)
+      obs.first->AddCovisibility(pKF, NumIndexes(obs.second));
+    it = mObservations.insert(it, Observation(pKF, tuple<int, int>(-1, -1)));
   }
 
+  const int nIndexes = NumIndexes(it->second);
   if (pKF->NLeft != -1 && idx >= pKF->NLeft) {
-    get<1>(indexes) = idx;
+    get<1>(it->second) = idx;
   } else {
-    get<0>(indexes) = idx;
+    get<0>(it->second) = idx;
   }
 
-  mObservations[pKF] = indexes;
+  // The keyframe counts the point once per keypoint, as its map point matches
+  const int nNewIndexes = NumIndexes(it->second) - nIndexes;
+  if (nNewIndexes != 0) {
+    for (const Observation& obs : mObservations)
+      if (obs.first != pKF) pKF->AddCovisibility(obs.first, nNewIndexes);
+  }
 
   if (!pKF->mpCamera2 && pKF->mvuRight[idx] >= 0)
     nObs += 2;
@@ -224,8 +263,9 @@ void MapPoint::EraseObservation(KeyFrame* pKF) {
   bool bBad = false;
   {
     unique_lock<mutex> lock(mMutexFeatures);
-    if (mObservations.count(pKF)) {
-      tuple<int, int> indexes = mObservations[pKF];
+    ObservationVector::iterator it = FindObservation(pKF);
+    if (it != mObservations.end() && it->first == pKF) {
+      tuple<int, int> indexes = it->second;
       int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
 
       if (leftIndex != -1) {
@@ -238,9 +278,15 @@ void MapPoint::EraseObservation(KeyFrame* pKF) {
         nObs--;
       }
 
-      mObservations.erase(pKF);
+      mObservations.erase(it);
+      const int nIndexes = NumIndexes(indexes);
+      for (const Observation& obs : mObservations) {
+        obs.first->AddCovisibility(pKF, -NumIndexes(obs.second));
+        pKF->AddCovisibility(obs.first, -nIndexes);
+      }
 
-      if (mpRefKF == pKF) mpRefKF = mObservations.begin()->first;
+      if (mpRefKF == pKF && !mObservations.empty())
+        mpRefKF = mObservations.begin()->first;
 
       // If only 2 observations or less, discard point
       if (nObs <= 2) bBad = true;
@@ -250,27 +296,48 @@ void MapPoint::EraseObservation(KeyFrame* pKF) {
   if (bBad) SetBadFlag();
 }
 
-std::map<KeyFrame*, std::tuple<int, int>> MapPoint::GetObservations() {
+MapPoint::ObservationVector MapPoint::GetObservations() {
   unique_lock<mutex> lock(mMutexFeatures);
   return mObservations;
 }
 
+void MapPoint::GetObservations(ObservationVector& vObservations) {
+  unique_lock<mutex> lock(mMutexFeatures);
+  vObservations = mObservations;
+}
+
+void MapPoint::AddCovisibility(const ObservationVector& vObservations,
+                               int n) {
+  for (size_t i = 0; i < vObservations.size(); i++) {
+    for (size_t j = i + 1; j < vObservations.size(); j++) {
+      vObservations[i].first->AddCovisibility(
+          vObservations[j].first, n * NumIndexes(vObservations[i].second));
+      vObservations[j].first->AddCovisibility(
+          vObservations[i].first, n * NumIndexes(vObservations[j].second));
+    }
+  }
+}
+
 int MapPoint::Observations() {
   unique_lock<mutex> lock(mMutexFeatures);
   return nObs;
 }
 
 void MapPoint::SetBadFlag() {
-  map<KeyFrame*, tuple<int, int>> obs;
+  ObservationVector obs;
   {
     unique_lock<mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
     mbBad = true;
     obs = mObservations;
     mObservations.clear();
+    AddCovisibility(obs, -1);
+  }
+  {
+    unique_lock<mutex> lock(mMutexDescriptorMedoid);
+    mDescriptorMedoid.Clear();
   }
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = obs.begin(),
-                                                 mend = obs.end();
+  for (ObservationVector::const_iterator mit = obs.begin(), mend = obs.end();
        mit != mend; mit++) {
     KeyFrame* pKF = mit->first;
     int leftIndex = get<0>(mit->second), rightIndex = get<1>(mit->second);
@@ -295,20 +362,24 @@ void MapPoint::Replace(MapPoint* pMP) {
   if (pMP->mnId == this->mnId) return;
 
   int nvisible, nfound;
-  map<KeyFrame*, tuple<int, int>> obs;
+  ObservationVector obs;
   {
     unique_lock<mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
     obs = mObservations;
     mObservations.clear();
+    AddCovisibility(obs, -1);
     mbBad = true;
     nvisible = mnVisible;
     nfound = mnFound;
     mpReplaced = pMP;
   }
+  {
+    unique_lock<mutex> lock(mMutexDescriptorMedoid);
+    mDescriptorMedoid.Clear();
+  }
 
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = obs.begin(),
-                                                 mend = obs.end();
+  for (ObservationVector::const_iterator mit = obs.begin(), mend = obs.end();
        mit != mend; mit++) {
     // Replace measurement in keyframe
     KeyFrame* pKF = mit->first;
@@ -365,72 +436,44 @@ float MapPoint::GetFoundRatio() {
 }
 
 void MapPoint::ComputeDistinctiveDescriptors() {
-  // Retrieve all observed descriptors
-  vector<cv::Mat> vDescriptors;
-
-  map<KeyFrame*, tuple<int, int>> observations;
+  // Retrieve all observed features
+  vector<DescriptorMedoid::Feature> vFeatures;
 
   {
     unique_lock<mutex> lock1(mMutexFeatures);
     if (mbBad) return;
-    observations = mObservations;
-  }
-
-  if (observations.empty()) return;
-
-  vDescriptors.reserve(observations.size());
-
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                 mend = observations.end();
-       mit != mend; mit++) {
-    KeyFrame* pKF = mit->first;
-
-    if (!pKF->isBad()) {
-      tuple<int, int> indexes = mit->second;
-      int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
 
-      if (leftIndex != -1) {
-        vDescriptors.push_back(pKF->mDescriptors.row(leftIndex));
-      }
-      if (rightIndex != -1) {
-        vDescriptors.push_back(pKF->mDescriptors.row(rightIndex));
-      }
+    vFeatures.reserve(2 * mObservations.size());
+    for (ObservationVector::const_iterator mit = mObservations.begin(),
+                                           mend = mObservations.end();
+         mit != mend; mit++) {
+      int leftIndex = get<0>(mit->second), rightIndex = get<1>(mit->second);
+      if (leftIndex != -1)
+        vFeatures.push_back(make_pair(mit->first, leftIndex));
+      if (rightIndex != -1)
+        vFeatures.push_back(make_pair(mit->first, rightIndex));
     }
   }
 
-  if (vDescriptors.empty()) return;
+  vFeatures.erase(remove_if(vFeatures.begin(), vFeatures.end(),
+                            [](const DescriptorMedoid::Feature& feature) {
+                              return feature.first->isBad();
+                            }),
+                  vFeatures.end());
 
-  // Compute distances between them
-  const size_t N = vDescriptors.size();
-
-  float Distances[N][N];
-  for (size_t i = 0; i < N; i++) {
-    Distances[i][i] = 0;
-    for (size_t j = i + 1; j < N; j++) {
-      int distij =
-          ORBmatcher::DescriptorDistance(vDescriptors[i], vDescriptors[j]);
-      Distances[i][j] = distij;
-      Distances[j][i] = distij;
-    }
-  }
+  if (vFeatures.empty()) return;
 
-  // Take the descriptor with least median distance to the rest
-  int BestMedian = INT_MAX;
-  int BestIdx = 0;
-  for (size_t i = 0; i < N; i++) {
-    vector<int> vDists(Distances[i], Distances[i] + N);
-    sort(vDists.begin(), vDists.end());
-    int median = vDists[0.5 * (N - 1)];
-
-    if (median < BestMedian) {
-      BestMedian = median;
-      BestIdx = i;
-    }
+  // Only the distances of the new observations are computed
+  cv::Mat descriptor;
+  {
+    unique_lock<mutex> lock(mMutexDescriptorMedoid);
+    mDescriptorMedoid.Update(vFeatures);
+    descriptor = mDescriptorMedoid.ComputeMedoid();
   }
 
   {
     unique_lock<mutex> lock(mMutexFeatures);
-    mDescriptor = vDescriptors[BestIdx].clone();
+    mDescriptor = descriptor;
   }
 }
 
@@ -441,19 +484,21 @@ cv::Mat MapPoint::GetDescriptor() {
 
 tuple<int, int> MapPoint::GetIndexInKeyFrame(KeyFrame* pKF) {
   unique_lock<mutex> lock(mMutexFeatures);
-  if (mObservations.count(pKF))
-    return mObservations[pKF];
+  ObservationVector::iterator it = FindObservation(pKF);
+  if (it != mObservations.end() && it->first == pKF)
+    return it->second;
   else
     return tuple<int, int>(-1, -1);
 }
 
 bool MapPoint::IsInKeyFrame(KeyFrame* pKF) {
   unique_lock<mutex> lock(mMutexFeatures);
-  return (mObservations.count(pKF));
+  ObservationVector::iterator it = FindObservation(pKF);
+  return it != mObservations.end() && it->first == pKF;
 }
 
 void MapPoint::UpdateNormalAndDepth() {
-  map<KeyFrame*, tuple<int, int>> observations;
+  ObservationVector observations;
   KeyFrame* pRefKF;
   Eigen::Vector3f Pos;
   {
@@ -470,8 +515,8 @@ void MapPoint::UpdateNormalAndDepth() {
   Eigen::Vector3f normal;
   normal.setZero();
   int n = 0;
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                 mend = observations.end();
+  for (ObservationVector::const_iterator mit = observations.begin(),
+                                         mend = observations.end();
        mit != mend; mit++) {
     KeyFrame* pKF = mit->first;
 
@@ -495,7 +540,15 @@ void MapPoint::UpdateNormalAndDepth() {
   Eigen::Vector3f PC = Pos - pRefKF->GetCameraCenter();
   const float dist = PC.norm();
 
-  tuple<int, int> indexes = observations[pRefKF];
+  // Sorted like mObservations, see FindObservation
+  tuple<int, int> indexes(0, 0);
+  ObservationVector::const_iterator itRef =
+      lower_bound(observations.begin(), observations.end(), pRefKF,
+                  [](const Observation& obs, KeyFrame* pKFi) {
+                    return std::less<KeyFrame*>()(obs.first, pKFi);
+                  });
+  if (itRef != observations.end() && itRef->first == pRefKF)
+    indexes = itRef->second;
   int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
   int level;
   if (pRefKF->NLeft == -1) {
@@ -567,8 +620,8 @@ int MapPoint::PredictScale(const float& currentDist, Frame* pF) {
 
 void MapPoint::PrintObservations() {
   cout << "MP_OBS: MP " << mnId << endl;
-  for (map<KeyFrame*, tuple<int, int>>::iterator mit = mObservations.begin(),
-                                                 mend = mObservations.end();
+  for (ObservationVector::const_iterator mit = mObservations.begin(),
+                                         mend = mObservations.end();
        mit != mend; mit++) {
     KeyFrame* pKFi = mit->first;
     // tuple<int,int> indexes = mit->second; // UNUSED
@@ -588,7 +641,19 @@ void MapPoint::UpdateMap(Map* pMap) {
   mpMap = pMap;
 }
 
-void MapPoint::PreSave(set<KeyFrame*>& spKF, set<MapPoint*>& spMP) {
+void MapPoint::MarkDirty() {
+  // Not in a map yet
+  if (mnDirty == 0xFF) return;
+
+  Map* pMap = GetMap();
+  if (!pMap) return;
+  const unsigned char nMask = pMap->GetDirtyMask();
+  const unsigned char nNew = nMask & ~mnDirty.fetch_or(nMask);
+  if (nNew) pMap->AddDirty(this, nNew);
+}
+
+void MapPoint::PreSave(const SlotMap<KeyFrame>& spKF,
+                       const SlotMap<MapPoint>& spMP) {
   mBackupReplacedId = -1;
 
   if (mpReplaced && spMP.find(mpReplaced) != spMP.end())
@@ -597,13 +662,11 @@ void MapPoint::PreSave(set<KeyFrame*>& spKF, set<MapPoint*>& spMP) {
   mBackupObservationsId1.clear();
   mBackupObservationsId2.clear();
 
-  std::map<KeyFrame*, std::tuple<int, int>> tmp_mObservations;
-  tmp_mObservations.insert(mObservations.begin(), mObservations.end());
+  ObservationVector tmp_mObservations = mObservations;
 
   // Save the id and position in each KF who view it
-  for (std::map<KeyFrame*, std::tuple<int, int>>::const_iterator
-           it = tmp_mObservations.begin(),
-           end = tmp_mObservations.end();
+  for (ObservationVector::const_iterator it = tmp_mObservations.begin(),
+                                         end = tmp_mObservations.end();
        it != end; ++it) {
     KeyFrame* pKFi = it->first;
     if (spKF.find(pKFi) != spKF.end()) {
@@ -646,10 +709,17 @@ void MapPoint::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid,
         mBackupObservationsId2.find(it->first);
     std::tuple<int, int> indexes = tuple<int, int>(it->second, it2->second);
     if (pKFi) {
-      mObservations[pKFi] = indexes;
+      ObservationVector::iterator itObs = FindObservation(pKFi);
+      if (itObs != mObservations.end() && itObs->first == pKFi)
+        itObs->second = indexes;
+      else
+        mObservations.insert(itObs, Observation(pKFi, indexes));
     }
   }
 
+  // Covisibility is not saved, it is rebuilt from the observations
+  AddCovisibility(mObservations, 1);
+
   mBackupObservationsId1.clear();
   mBackupObservationsId2.clear();
 }
@@ -0,0 +1,1135 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MapSection.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <boost/mpl/bool.hpp>
+#include <boost/serialization/access.hpp>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+#include "Checksum.h"
+#include "GeometricCamera.h"
+#include "KeyFrame.h"
+#include "Map.h"
+#include "MapPoint.h"
+
+namespace ORB_SLAM3 {
+
+// Layout of a section payload (native endianness):
+//   uint32 number of columns, uint64 number of rows,
+//   then every column as uint64 size + flat array of its values.
+// The columns of each type of section are listed below. The fixed size
+// fields of a row are packed in a few arrays, the variable size ones go to
+// their own arrays, with their lengths in the *_SIZES column of the row.
+
+enum MapColumn {
+  MAP_IDS = 0,  // uint64: id, initial KF id, max KF id
+  MAP_INDICES,  // int64: big change index, initial KF, lowest id KF
+  MAP_FLAGS,    // uint8: IMU initialized, inertial, IMU BA1, IMU BA2
+  MAP_SIZES,    // uint32: number of origins
+  MAP_ORIGINS,  // uint64 ids of the origin keyframes
+  NUM_MAP_COLUMNS
+};
+
+enum KeyFrameColumn {
+  KF_IDS = 0,         // uint64: id, frame id, origin map id
+  KF_TIMESTAMP,       // double
+  KF_INTS,            // int32, see kKeyFrameInts
+  KF_FLOATS,          // float, see kKeyFrameFloats
+  KF_FLAGS,           // uint8, see kKeyFrameFlags
+  KF_REFERENCES,      // int64: parent, previous KF, next KF, cameras
+  KF_SIZES,           // uint32, see KeyFrameSize
+  KF_DISTORTION,      // float
+  KF_KEYPOINTS,       // float: x, y, size, angle, response
+  KF_KEYPOINT_LEVELS, // int32: octave, class id
+  KF_STEREO,          // float: right coordinates, depths
+  KF_SCALES,          // float: scale factors, sigma2, inverse sigma2
+  KF_DESCRIPTORS,     // uint8
+  KF_BOW_WORDS,       // uint32
+  KF_BOW_WEIGHTS,     // double
+  KF_FEATURE_NODES,   // uint32
+  KF_FEATURE_SIZES,   // uint32
+  KF_FEATURE_INDICES, // uint32
+  KF_GRID_SIZES,      // uint32 per cell, left grid then right grid
+  KF_GRID_INDICES,    // uint32
+  KF_MAP_POINTS,      // int64 id per keypoint, -1 if none
+  KF_CONNECTIONS,     // uint64 ids of the covisible keyframes
+  KF_WEIGHTS,         // int32 covisibility weights
+  KF_EDGES,           // uint64 ids: children, loop edges, merge edges
+  KF_STEREO_MATCHES,  // int32: left to right, right to left
+  KF_IMU,             // float: bias, calibration and preintegration
+  KF_IMU_SIZES,       // uint32 sizes of the preintegration measurements
+  NUM_KF_COLUMNS
+};
+
+enum KeyFrameSize {
+  KF_N_DISTORTION_ROWS = 0,
+  KF_N_DISTORTION_COLS,
+  KF_N_KEYS,
+  KF_N_KEYS_UN,
+  KF_N_KEYS_RIGHT,
+  KF_N_URIGHT,
+  KF_N_DEPTH,
+  KF_N_SCALE_FACTORS,
+  KF_N_LEVEL_SIGMA2,
+  KF_N_INV_LEVEL_SIGMA2,
+  KF_N_DESCRIPTOR_ROWS,
+  KF_N_DESCRIPTOR_BYTES,
+  KF_N_BOW_WORDS,
+  KF_N_FEATURE_NODES,
+  KF_N_FEATURE_INDICES,
+  KF_N_GRID_COLS,
+  KF_N_GRID_ROWS,
+  KF_N_GRID_RIGHT_COLS,
+  KF_N_GRID_RIGHT_ROWS,
+  KF_N_GRID_INDICES,
+  KF_N_MAP_POINTS,
+  KF_N_CONNECTIONS,
+  KF_N_CHILDREN,
+  KF_N_LOOP_EDGES,
+  KF_N_MERGE_EDGES,
+  KF_N_LEFT_TO_RIGHT,
+  KF_N_RIGHT_TO_LEFT,
+  KF_N_IMU,
+  KF_N_IMU_SIZES,
+  NUM_KF_SIZES
+};
+
+// Grid size, N, NLeft, NRight, scale levels, image bounds
+static const size_t kKeyFrameInts = 10;
+// Grid cell size, scale, calibration, scale factors, half baseline, K,
+// Tcw, Tcp, Tlr, velocity, IMU position
+static const size_t kKeyFrameFloats = 15 + 9 + 3 * 7 + 3 + 3;
+// bImu, velocity, first connection, not erase, to be erased, bad,
+// preintegration
+static const size_t kKeyFrameFlags = 7;
+static const size_t kKeyFrameReferences = 5;
+
+enum MapPointColumn {
+  MP_IDS = 0,              // uint64: id
+  MP_FIRST,                // int64: first KF id, first frame id
+  MP_REFERENCES,           // int64: reference KF, replacement, -1 if none
+  MP_OBSERVATION_COUNT,    // int32
+  MP_FLOATS,               // float: position, normal, min and max distance
+  MP_FLAGS,                // uint8: bad
+  MP_SIZES,                // uint32: observations, descriptor rows, bytes
+  MP_OBSERVATIONS,         // uint64 KF ids
+  MP_OBSERVATION_INDICES,  // int32: left index, right index
+  MP_DESCRIPTOR,           // uint8
+  NUM_MP_COLUMNS
+};
+
+static size_t NumColumns(MapSection::Type type) {
+  switch (type) {
+    case MapSection::MAP:
+      return NUM_MAP_COLUMNS;
+    case MapSection::KEYFRAMES:
+      return NUM_KF_COLUMNS;
+    case MapSection::MAPPOINTS:
+      return NUM_MP_COLUMNS;
+    default:
+      return 0;
+  }
+}
+
+// Same convention as serializeSophusSE3: quaternion w, x, y, z, translation
+static void PutPose(float* pValues, const Sophus::SE3f& T) {
+  const Eigen::Quaternionf q = T.unit_quaternion();
+  pValues[0] = q.w();
+  pValues[1] = q.x();
+  pValues[2] = q.y();
+  pValues[3] = q.z();
+  std::copy(T.translation().data(), T.translation().data() + 3, pValues + 4);
+}
+
+static Sophus::SE3f GetPose(const float* pValues) {
+  const Eigen::Quaternionf q(pValues[0], pValues[1], pValues[2], pValues[3]);
+  return Sophus::SE3f(q, Eigen::Vector3f(pValues[4], pValues[5], pValues[6]));
+}
+
+// Columns of a section payload, read in order with bounds checks. Any read
+// past the end of a column marks the whole payload as malformed
+class SectionReader {
+ public:
+  bool Parse(const char* pData, uint64_t nSize, size_t nColumns) {
+    uint32_t nStored;
+    if (nSize < sizeof(nStored) + sizeof(mnRows)) return false;
+    memcpy(&nStored, pData, sizeof(nStored));
+    memcpy(&mnRows, pData + sizeof(nStored), sizeof(mnRows));
+    // Columns added by later versions are skipped
+    if (nStored < nColumns) return false;
+
+    uint64_t nPos = sizeof(nStored) + sizeof(mnRows);
+    mvColumns.resize(nColumns);
+    for (uint32_t i = 0; i < nStored; ++i) {
+      uint64_t nColumnSize;
+      if (nSize - nPos < sizeof(nColumnSize)) return false;
+      memcpy(&nColumnSize, pData + nPos, sizeof(nColumnSize));
+      nPos += sizeof(nColumnSize);
+      if (nSize - nPos < nColumnSize) return false;
+      if (i < nColumns) {
+        mvColumns[i].pData = pData + nPos;
+        mvColumns[i].nSize = nColumnSize;
+        mvColumns[i].nPos = 0;
+      }
+      nPos += nColumnSize;
+    }
+    mbFailed = false;
+    return true;
+  }
+
+  uint64_t Rows() const { return mnRows; }
+  bool Failed() const { return mbFailed; }
+  void Fail() { mbFailed = true; }
+
+  template <class T>
+  void Read(int nColumn, T* pValues, size_t nValues) {
+    Column& column = mvColumns[nColumn];
+    const uint64_t nBytes = nValues * sizeof(T);
+    if (column.nSize - column.nPos < nBytes) {
+      mbFailed = true;
+      std::fill(pValues, pValues + nValues, T());
+      return;
+    }
+    memcpy(pValues, column.pData + column.nPos, nBytes);
+    column.nPos += nBytes;
+  }
+
+  template <class T>
+  T Next(int nColumn) {
+    T value;
+    Read(nColumn, &value, 1);
+    return value;
+  }
+
+  // Checked before resizing, a malformed length must not allocate
+  template <class T>
+  void ReadVector(int nColumn, std::vector<T>& vValues, size_t nValues) {
+    const Column& column = mvColumns[nColumn];
+    if ((column.nSize - column.nPos) / sizeof(T) < nValues) {
+      mbFailed = true;
+      vValues.clear();
+      return;
+    }
+    vValues.resize(nValues);
+    if (nValues > 0) Read(nColumn, vValues.data(), nValues);
+  }
+
+ protected:
+  struct Column {
+    const char* pData;
+    uint64_t nSize;
+    uint64_t nPos;
+  };
+  std::vector<Column> mvColumns;
+  uint64_t mnRows;
+  bool mbFailed;
+};
+
+// The IMU types are flattened to floats through their boost serialize
+// methods, the sizes of their vectors go to a separate array
+class ImuWriter {
+ public:
+  typedef boost::mpl::bool_<false> is_loading;
+  typedef boost::mpl::bool_<true> is_saving;
+
+  ImuWriter(std::vector<float>& vValues, std::vector<uint32_t>& vSizes)
+      : mvValues(vValues), mvSizes(vSizes) {}
+
+  ImuWriter& operator&(const float& value) {
+    mvValues.push_back(value);
+    return *this;
+  }
+  ImuWriter& operator&(const bool& value) {
+    mvValues.push_back(value ? 1.f : 0.f);
+    return *this;
+  }
+  template <class T>
+  ImuWriter& operator&(const boost::serialization::array_wrapper<T>& array) {
+    mvValues.insert(mvValues.end(), array.address(),
+                    array.address() + array.count());
+    return *this;
+  }
+  template <class T>
+  ImuWriter& operator&(std::vector<T>& vElements) {
+    mvSizes.push_back(vElements.size());
+    for (T& element : vElements) *this & element;
+    return *this;
+  }
+  template <class T>
+  typename std::enable_if<std::is_class<T>::value, ImuWriter&>::type operator&(
+      T& object) {
+    boost::serialization::access::serialize(*this, object, 0);
+    return *this;
+  }
+
+ protected:
+  std::vector<float>& mvValues;
+  std::vector<uint32_t>& mvSizes;
+};
+
+class ImuReader {
+ public:
+  typedef boost::mpl::bool_<true> is_loading;
+  typedef boost::mpl::bool_<false> is_saving;
+
+  ImuReader(SectionReader& reader, uint32_t nValues, uint32_t nSizes)
+      : mReader(reader), mnValues(nValues), mnSizes(nSizes) {}
+
+  ImuReader& operator&(float& value) {
+    value = NextValue();
+    return *this;
+  }
+  ImuReader& operator&(bool& value) {
+    value = NextValue() != 0.f;
+    return *this;
+  }
+  template <class T>
+  ImuReader& operator&(const boost::serialization::array_wrapper<T>& array) {
+    for (size_t i = 0; i < array.count(); ++i) array.address()[i] = NextValue();
+    return *this;
+  }
+  template <class T>
+  ImuReader& operator&(std::vector<T>& vElements) {
+    uint32_t nElements = 0;
+    if (mnSizes > 0) {
+      nElements = mReader.Next<uint32_t>(KF_IMU_SIZES);
+      mnSizes--;
+    }
+    // Every element takes at least one value
+    vElements.resize(std::min(nElements, mnValues));
+    for (T& element : vElements) *this & element;
+    return *this;
+  }
+  template <class T>
+  typename std::enable_if<std::is_class<T>::value, ImuReader&>::type operator&(
+      T& object) {
+    boost::serialization::access::serialize(*this, object, 0);
+    return *this;
+  }
+
+  // Values or sizes left in the row
+  bool Complete() const { return mnValues == 0 && mnSizes == 0; }
+
+ protected:
+  float NextValue() {
+    if (mnValues == 0) return 0.f;
+    mnValues--;
+    return mReader.Next<float>(KF_IMU);
+  }
+
+  SectionReader& mReader;
+  uint32_t mnValues;
+  uint32_t mnSizes;
+};
+
+MapSection::MapSection(Type type, unsigned long nMapId, uint64_t nChunk)
+    : mType(type),
+      mnMapId(nMapId),
+      mnChunk(nChunk),
+      mnRows(0),
+      mvColumns(NumColumns(type)) {}
+
+template <class T>
+void MapSection::Append(int nColumn, const T* pValues, size_t nValues) {
+  const char* pBytes = reinterpret_cast<const char*>(pValues);
+  mvColumns[nColumn].insert(mvColumns[nColumn].end(), pBytes,
+                            pBytes + nValues * sizeof(T));
+}
+
+void MapSection::AddMap(Map* pMap) {
+  std::unique_lock<std::mutex> lock(pMap->mMutexMap);
+  const uint64_t vnIds[] = {pMap->mnId, pMap->mnInitKFid, pMap->mnMaxKFid};
+  Append(MAP_IDS, vnIds, 3);
+  const int64_t vnIndices[] = {
+      pMap->mnBigChangeIdx,
+      pMap->mpKFinitial ? static_cast<int64_t>(pMap->mpKFinitial->mnId) : -1,
+      pMap->mpKFlowerID ? static_cast<int64_t>(pMap->mpKFlowerID->mnId) : -1};
+  Append(MAP_INDICES, vnIndices, 3);
+  const uint8_t vbFlags[] = {pMap->mbImuInitialized, pMap->mbIsInertial,
+                             pMap->mbIMU_BA1, pMap->mbIMU_BA2};
+  Append(MAP_FLAGS, vbFlags, 4);
+
+  Append(MAP_SIZES, static_cast<uint32_t>(pMap->mvpKeyFrameOrigins.size()));
+  for (KeyFrame* pKFi : pMap->mvpKeyFrameOrigins)
+    Append(MAP_ORIGINS, static_cast<uint64_t>(pKFi->mnId));
+  mnRows++;
+}
+
+void MapSection::AddKeyFrame(KeyFrame* pKF, const Scope& scope) {
+  KeyFrame::ScopedSavePin pin(pKF);
+  uint32_t vnSizes[NUM_KF_SIZES];
+
+  const uint64_t vnIds[] = {pKF->mnId, pKF->mnFrameId, pKF->mnOriginMapId};
+  Append(KF_IDS, vnIds, 3);
+  Append(KF_TIMESTAMP, pKF->mTimeStamp);
+
+  const int32_t vnInts[kKeyFrameInts] = {
+      pKF->mnGridCols, pKF->mnGridRows, pKF->N,      pKF->NLeft,
+      pKF->NRight,     pKF->mnScaleLevels, pKF->mnMinX, pKF->mnMinY,
+      pKF->mnMaxX,     pKF->mnMaxY};
+  Append(KF_INTS, vnInts, kKeyFrameInts);
+
+  // Pose, velocity and biases
+  Sophus::SE3f Tcw;
+  Eigen::Vector3f Vw, Owb;
+  IMU::Bias bias;
+  bool bHasVelocity;
+  {
+    std::unique_lock<std::mutex> lock(pKF->mMutexPose);
+    Tcw = pKF->mTcw;
+    Vw = pKF->mVw;
+    Owb = pKF->mOwb;
+    bias = pKF->mImuBias;
+    bHasVelocity = pKF->mbHasVelocity;
+  }
+
+  // Spanning tree, covisibility graph and bad flags
+  std::vector<uint64_t> vnConnections, vnEdges;
+  std::vector<int32_t> vnWeights;
+  Sophus::SE3f Tcp;
+  KeyFrame* pParent;
+  bool bFirstConnection, bNotErase, bToBeErased, bBad;
+  {
+    std::unique_lock<std::mutex> lock(pKF->mMutexConnections);
+    for (const std::pair<KeyFrame* const, int>& connection :
+         pKF->mConnectedKeyFrameWeights) {
+      if (!scope.spKeyFrames.count(connection.first)) continue;
+      vnConnections.push_back(connection.first->mnId);
+      vnWeights.push_back(connection.second);
+    }
+    vnSizes[KF_N_CONNECTIONS] = vnConnections.size();
+
+    const std::set<KeyFrame*>* vpEdges[] = {
+        &pKF->mspChildrens, &pKF->mspLoopEdges, &pKF->mspMergeEdges};
+    const KeyFrameSize vnEdgeSizes[] = {KF_N_CHILDREN, KF_N_LOOP_EDGES,
+                                        KF_N_MERGE_EDGES};
+    for (size_t i = 0; i < 3; ++i) {
+      const size_t nEdges = vnEdges.size();
+      for (KeyFrame* pKFi : *vpEdges[i]) {
+        if (scope.spKeyFrames.count(pKFi)) vnEdges.push_back(pKFi->mnId);
+      }
+      vnSizes[vnEdgeSizes[i]] = vnEdges.size() - nEdges;
+    }
+
+    Tcp = pKF->mTcp;
+    pParent = pKF->mpParent;
+    bFirstConnection = pKF->mbFirstConnection;
+    bNotErase = pKF->mbNotErase;
+    bToBeErased = pKF->mbToBeErased;
+    bBad = pKF->mbBad;
+  }
+  Append(KF_CONNECTIONS, vnConnections.data(), vnConnections.size());
+  Append(KF_WEIGHTS, vnWeights.data(), vnWeights.size());
+  Append(KF_EDGES, vnEdges.data(), vnEdges.size());
+
+  float vfValues[kKeyFrameFloats];
+  float* pValue = vfValues;
+  const float vfScalars[] = {
+      pKF->mfGridElementWidthInv, pKF->mfGridElementHeightInv, pKF->mfScale,
+      pKF->fx, pKF->fy, pKF->cx, pKF->cy, pKF->invfx, pKF->invfy, pKF->mbf,
+      pKF->mb, pKF->mThDepth, pKF->mfScaleFactor, pKF->mfLogScaleFactor,
+      pKF->mHalfBaseline};
+  pValue = std::copy(vfScalars, vfScalars + 15, pValue);
+  pValue = std::copy(pKF->mK_.data(), pKF->mK_.data() + 9, pValue);
+  PutPose(pValue, Tcw);
+  PutPose(pValue + 7, Tcp);
+  PutPose(pValue + 14, pKF->mTlr);
+  pValue += 21;
+  pValue = std::copy(Vw.data(), Vw.data() + 3, pValue);
+  std::copy(Owb.data(), Owb.data() + 3, pValue);
+  Append(KF_FLOATS, vfValues, kKeyFrameFloats);
+
+  const uint8_t vbFlags[kKeyFrameFlags] = {
+      pKF->bImu,   bHasVelocity, bFirstConnection,
+      bNotErase,   bToBeErased,  bBad,
+      pKF->mpImuPreintegrated != NULL};
+  Append(KF_FLAGS, vbFlags, kKeyFrameFlags);
+
+  KeyFrame* pPrevKF = pKF->mPrevKF;
+  KeyFrame* pNextKF = pKF->mNextKF;
+  const int64_t vnReferences[kKeyFrameReferences] = {
+      pParent && scope.spKeyFrames.count(pParent)
+          ? static_cast<int64_t>(pParent->mnId)
+          : -1,
+      pPrevKF && scope.spKeyFrames.count(pPrevKF)
+          ? static_cast<int64_t>(pPrevKF->mnId)
+          : -1,
+      pNextKF && scope.spKeyFrames.count(pNextKF)
+          ? static_cast<int64_t>(pNextKF->mnId)
+          : -1,
+      pKF->mpCamera && scope.spCameras.count(pKF->mpCamera)
+          ? static_cast<int64_t>(pKF->mpCamera->GetId())
+          : -1,
+      pKF->mpCamera2 && scope.spCameras.count(pKF->mpCamera2)
+          ? static_cast<int64_t>(pKF->mpCamera2->GetId())
+          : -1};
+  Append(KF_REFERENCES, vnReferences, kKeyFrameReferences);
+
+  // Calibration
+  cv::Mat distortion = pKF->mDistCoef;
+  if (distortion.type() != CV_32F) distortion.convertTo(distortion, CV_32F);
+  if (!distortion.isContinuous()) distortion = distortion.clone();
+  vnSizes[KF_N_DISTORTION_ROWS] = distortion.rows;
+  vnSizes[KF_N_DISTORTION_COLS] = distortion.cols;
+  Append(KF_DISTORTION, distortion.ptr<float>(), distortion.total());
+
+  // Keypoints
+  const std::vector<cv::KeyPoint>* vpKeys[] = {&pKF->mvKeys, &pKF->mvKeysUn,
+                                               &pKF->mvKeysRight};
+  const KeyFrameSize vnKeySizes[] = {KF_N_KEYS, KF_N_KEYS_UN,
+                                     KF_N_KEYS_RIGHT};
+  std::vector<float> vfKeyPoints;
+  std::vector<int32_t> vnLevels;
+  for (size_t i = 0; i < 3; ++i) {
+    vnSizes[vnKeySizes[i]] = vpKeys[i]->size();
+    vfKeyPoints.reserve(vfKeyPoints.size() + 5 * vpKeys[i]->size());
+    vnLevels.reserve(vnLevels.size() + 2 * vpKeys[i]->size());
+    for (const cv::KeyPoint& kp : *vpKeys[i]) {
+      const float vfKeyPoint[] = {kp.pt.x, kp.pt.y, kp.size, kp.angle,
+                                  kp.response};
+      vfKeyPoints.insert(vfKeyPoints.end(), vfKeyPoint, vfKeyPoint + 5);
+      vnLevels.push_back(kp.octave);
+      vnLevels.push_back(kp.class_id);
+    }
+  }
+  Append(KF_KEYPOINTS, vfKeyPoints.data(), vfKeyPoints.size());
+  Append(KF_KEYPOINT_LEVELS, vnLevels.data(), vnLevels.size());
+
+  vnSizes[KF_N_URIGHT] = pKF->mvuRight.size();
+  vnSizes[KF_N_DEPTH] = pKF->mvDepth.size();
+  Append(KF_STEREO, pKF->mvuRight.data(), pKF->mvuRight.size());
+  Append(KF_STEREO, pKF->mvDepth.data(), pKF->mvDepth.size());
+
+  vnSizes[KF_N_SCALE_FACTORS] = pKF->mvScaleFactors.size();
+  vnSizes[KF_N_LEVEL_SIGMA2] = pKF->mvLevelSigma2.size();
+  vnSizes[KF_N_INV_LEVEL_SIGMA2] = pKF->mvInvLevelSigma2.size();
+  Append(KF_SCALES, pKF->mvScaleFactors.data(), pKF->mvScaleFactors.size());
+  Append(KF_SCALES, pKF->mvLevelSigma2.data(), pKF->mvLevelSigma2.size());
+  Append(KF_SCALES, pKF->mvInvLevelSigma2.data(),
+         pKF->mvInvLevelSigma2.size());
+
+  // Descriptors and bag of words
+  cv::Mat descriptors = pKF->mDescriptors;
+  if (!descriptors.isContinuous()) descriptors = descriptors.clone();
+  vnSizes[KF_N_DESCRIPTOR_ROWS] = descriptors.rows;
+  vnSizes[KF_N_DESCRIPTOR_BYTES] = descriptors.cols * descriptors.elemSize();
+  Append(KF_DESCRIPTORS, descriptors.data,
+         descriptors.total() * descriptors.elemSize());
+
+  vnSizes[KF_N_BOW_WORDS] = pKF->mBowVec.size();
+  for (const std::pair<const DBoW2::WordId, DBoW2::WordValue>& word :
+       pKF->mBowVec) {
+    Append(KF_BOW_WORDS, static_cast<uint32_t>(word.first));
+    Append(KF_BOW_WEIGHTS, static_cast<double>(word.second));
+  }
+
+  vnSizes[KF_N_FEATURE_NODES] = pKF->mFeatVec.size();
+  uint32_t nFeatureIndices = 0;
+  for (const std::pair<const DBoW2::NodeId, std::vector<unsigned int> >&
+           node : pKF->mFeatVec) {
+    Append(KF_FEATURE_NODES, static_cast<uint32_t>(node.first));
+    Append(KF_FEATURE_SIZES, static_cast<uint32_t>(node.second.size()));
+    Append(KF_FEATURE_INDICES, node.second.data(), node.second.size());
+    nFeatureIndices += node.second.size();
+  }
+  vnSizes[KF_N_FEATURE_INDICES] = nFeatureIndices;
+
+  // Grids, stored by cells
+  const std::vector<std::vector<std::vector<size_t> > >* vpGrids[] = {
+      &pKF->mGrid, &pKF->mGridRight};
+  const KeyFrameSize vnGridSizes[] = {KF_N_GRID_COLS, KF_N_GRID_RIGHT_COLS};
+  std::vector<uint32_t> vnCellSizes, vnCellIndices;
+  for (size_t i = 0; i < 2; ++i) {
+    const std::vector<std::vector<std::vector<size_t> > >& grid = *vpGrids[i];
+    vnSizes[vnGridSizes[i]] = grid.size();
+    vnSizes[vnGridSizes[i] + 1] = grid.empty() ? 0 : grid[0].size();
+    for (const std::vector<std::vector<size_t> >& column : grid) {
+      for (const std::vector<size_t>& cell : column) {
+        vnCellSizes.push_back(cell.size());
+        vnCellIndices.insert(vnCellIndices.end(), cell.begin(), cell.end());
+      }
+    }
+  }
+  vnSizes[KF_N_GRID_INDICES] = vnCellIndices.size();
+  Append(KF_GRID_SIZES, vnCellSizes.data(), vnCellSizes.size());
+  Append(KF_GRID_INDICES, vnCellIndices.data(), vnCellIndices.size());
+
+  // Map points seen, by keypoint
+  std::vector<int64_t> vnMapPoints;
+  {
+    std::unique_lock<std::mutex> lock(pKF->mMutexFeatures);
+    vnMapPoints.reserve(pKF->mvpMapPoints.size());
+    for (MapPoint* pMP : pKF->mvpMapPoints) {
+      if (pMP && scope.spMapPoints.count(pMP))
+        vnMapPoints.push_back(pMP->mnId);
+      else
+        vnMapPoints.push_back(-1);
+    }
+  }
+  vnSizes[KF_N_MAP_POINTS] = vnMapPoints.size();
+  Append(KF_MAP_POINTS, vnMapPoints.data(), vnMapPoints.size());
+
+  vnSizes[KF_N_LEFT_TO_RIGHT] = pKF->mvLeftToRightMatch.size();
+  vnSizes[KF_N_RIGHT_TO_LEFT] = pKF->mvRightToLeftMatch.size();
+  Append(KF_STEREO_MATCHES, pKF->mvLeftToRightMatch.data(),
+         pKF->mvLeftToRightMatch.size());
+  Append(KF_STEREO_MATCHES, pKF->mvRightToLeftMatch.data(),
+         pKF->mvRightToLeftMatch.size());
+
+  // Inertial data
+  std::vector<float> vfImu;
+  std::vector<uint32_t> vnImuSizes;
+  {
+    ImuWriter ar(vfImu, vnImuSizes);
+    ar & bias;
+    ar & pKF->mImuCalib;
+    if (pKF->mpImuPreintegrated) ar & *pKF->mpImuPreintegrated;
+  }
+  vnSizes[KF_N_IMU] = vfImu.size();
+  vnSizes[KF_N_IMU_SIZES] = vnImuSizes.size();
+  Append(KF_IMU, vfImu.data(), vfImu.size());
+  Append(KF_IMU_SIZES, vnImuSizes.data(), vnImuSizes.size());
+
+  Append(KF_SIZES, vnSizes, NUM_KF_SIZES);
+  mnRows++;
+}
+
+void MapSection::AddMapPoint(MapPoint* pMP, const Scope& scope) {
+  Append(MP_IDS, static_cast<uint64_t>(pMP->mnId));
+  const int64_t vnFirst[] = {pMP->mnFirstKFid, pMP->mnFirstFrame};
+  Append(MP_FIRST, vnFirst, 2);
+
+  float vfValues[8];
+  {
+    std::unique_lock<std::mutex> lock(pMP->mMutexPos);
+    std::copy(pMP->mWorldPos.data(), pMP->mWorldPos.data() + 3, vfValues);
+    std::copy(pMP->mNormalVector.data(), pMP->mNormalVector.data() + 3,
+              vfValues + 3);
+    vfValues[6] = pMP->mfMinDistance;
+    vfValues[7] = pMP->mfMaxDistance;
+  }
+  Append(MP_FLOATS, vfValues, 8);
+
+  std::vector<uint64_t> vnObservations;
+  std::vector<int32_t> vnIndices;
+  cv::Mat descriptor;
+  int64_t vnReferences[2];
+  int32_t nObs;
+  bool bBad;
+  {
+    std::unique_lock<std::mutex> lock1(pMP->mMutexFeatures);
+    std::unique_lock<std::mutex> lock2(pMP->mMutexPos);
+    nObs = pMP->nObs;
+    KeyFrame* pRefKF = pMP->mpRefKF;
+    if (!scope.spKeyFrames.count(pRefKF)) pRefKF = NULL;
+
+    for (const MapPoint::Observation& obs : pMP->mObservations) {
+      KeyFrame* pKFi = obs.first;
+      const int leftIndex = std::get<0>(obs.second);
+      const int rightIndex = std::get<1>(obs.second);
+      if (scope.spKeyFrames.count(pKFi)) {
+        vnObservations.push_back(pKFi->mnId);
+        vnIndices.push_back(leftIndex);
+        vnIndices.push_back(rightIndex);
+        if (!pRefKF) pRefKF = pKFi;
+        continue;
+      }
+
+      // Dropped as EraseObservation does, without touching the point
+      if (leftIndex != -1) {
+        if (!pKFi->mpCamera2 && pKFi->mvuRight[leftIndex] >= 0)
+          nObs -= 2;
+        else
+          nObs--;
+      }
+      if (rightIndex != -1) nObs--;
+    }
+
+    vnReferences[0] = pRefKF ? static_cast<int64_t>(pRefKF->mnId) : -1;
+    vnReferences[1] = pMP->mpReplaced && scope.spMapPoints.count(pMP->mpReplaced)
+                          ? static_cast<int64_t>(pMP->mpReplaced->mnId)
+                          : -1;
+    descriptor = pMP->mDescriptor.clone();
+    bBad = pMP->mbBad;
+  }
+  Append(MP_REFERENCES, vnReferences, 2);
+  Append(MP_OBSERVATION_COUNT, nObs);
+  Append(MP_FLAGS, static_cast<uint8_t>(bBad));
+
+  const uint32_t vnSizes[] = {
+      static_cast<uint32_t>(vnObservations.size()),
+      static_cast<uint32_t>(descriptor.rows),
+      static_cast<uint32_t>(descriptor.cols * descriptor.elemSize())};
+  Append(MP_SIZES, vnSizes, 3);
+  Append(MP_OBSERVATIONS, vnObservations.data(), vnObservations.size());
+  Append(MP_OBSERVATION_INDICES, vnIndices.data(), vnIndices.size());
+  Append(MP_DESCRIPTOR, descriptor.data,
+         descriptor.total() * descriptor.elemSize());
+  mnRows++;
+}
+
+uint64_t MapSection::Size() const {
+  uint64_t nSize = sizeof(uint32_t) + sizeof(mnRows);
+  for (const std::vector<char>& column : mvColumns)
+    nSize += sizeof(uint64_t) + column.size();
+  return nSize;
+}
+
+uint64_t MapSection::Digest() const {
+  Checksum checksum;
+  const uint32_t nColumns = mvColumns.size();
+  checksum.Update(&nColumns, sizeof(nColumns));
+  checksum.Update(&mnRows, sizeof(mnRows));
+  for (const std::vector<char>& column : mvColumns) {
+    const uint64_t nSize = column.size();
+    checksum.Update(&nSize, sizeof(nSize));
+    checksum.Update(column.data(), column.size());
+  }
+  return checksum.Digest();
+}
+
+void MapSection::Write(std::ostream& os) const {
+  const uint32_t nColumns = mvColumns.size();
+  os.write(reinterpret_cast<const char*>(&nColumns), sizeof(nColumns));
+  os.write(reinterpret_cast<const char*>(&mnRows), sizeof(mnRows));
+  for (const std::vector<char>& column : mvColumns) {
+    const uint64_t nSize = column.size();
+    os.write(reinterpret_cast<const char*>(&nSize), sizeof(nSize));
+    os.write(column.data(), column.size());
+  }
+}
+
+bool MapSection::Read(Type type, const char* pData, uint64_t nSize,
+                      Map* pMap, Contents& contents) {
+  SectionReader reader;
+  if (NumColumns(type) == 0 || !reader.Parse(pData, nSize, NumColumns(type)))
+    return false;
+
+  std::vector<KeyFrame*> vpKeyFrames;
+  std::vector<MapPoint*> vpMapPoints;
+  for (uint64_t i = 0; i < reader.Rows() && !reader.Failed(); ++i) {
+    if (type == MAP)
+      ReadMap(reader, pMap);
+    else if (type == KEYFRAMES)
+      vpKeyFrames.push_back(ReadKeyFrame(reader));
+    else
+      vpMapPoints.push_back(ReadMapPoint(reader));
+  }
+
+  // Nothing references the objects of the section yet
+  if (reader.Failed()) {
+    for (KeyFrame* pKFi : vpKeyFrames) delete pKFi;
+    for (MapPoint* pMPi : vpMapPoints) delete pMPi;
+    return false;
+  }
+
+  contents.vpKeyFrames.insert(contents.vpKeyFrames.end(), vpKeyFrames.begin(),
+                              vpKeyFrames.end());
+  contents.vpMapPoints.insert(contents.vpMapPoints.end(), vpMapPoints.begin(),
+                              vpMapPoints.end());
+  return true;
+}
+
+void MapSection::Assemble(Map* pMap, const Contents& contents) {
+  pMap->mvpBackupKeyFrames.insert(pMap->mvpBackupKeyFrames.end(),
+                                  contents.vpKeyFrames.begin(),
+                                  contents.vpKeyFrames.end());
+  pMap->mvpBackupMapPoints.insert(pMap->mvpBackupMapPoints.end(),
+                                  contents.vpMapPoints.begin(),
+                                  contents.vpMapPoints.end());
+}
+
+bool MapSection::ReadBowVectors(std::istream& is, uint64_t nOffset,
+                                uint64_t nSize,
+                                std::vector<DBoW2::BowVector>& vBowVecs) {
+  uint32_t nStored;
+  uint64_t nRows;
+  is.seekg(nOffset);
+  is.read(reinterpret_cast<char*>(&nStored), sizeof(nStored));
+  is.read(reinterpret_cast<char*>(&nRows), sizeof(nRows));
+  if (!is || nStored < NUM_KF_COLUMNS) return false;
+
+  // The other columns are skipped without reading them
+  const int vnColumns[] = {KF_SIZES, KF_BOW_WORDS, KF_BOW_WEIGHTS};
+  std::string vColumns[3];
+  uint64_t nPos = sizeof(nStored) + sizeof(nRows);
+  for (int i = 0; i <= KF_BOW_WEIGHTS; ++i) {
+    uint64_t nColumnSize;
+    if (nSize - nPos < sizeof(nColumnSize) ||
+        !is.read(reinterpret_cast<char*>(&nColumnSize), sizeof(nColumnSize)))
+      return false;
+    nPos += sizeof(nColumnSize);
+    if (nSize - nPos < nColumnSize) return false;
+    nPos += nColumnSize;
+
+    const int* pColumn = std::find(vnColumns, vnColumns + 3, i);
+    if (pColumn == vnColumns + 3) {
+      if (!is.seekg(nColumnSize, std::ios::cur)) return false;
+      continue;
+    }
+    std::string& column = vColumns[pColumn - vnColumns];
+    column.resize(nColumnSize);
+    if (!is.read(&column[0], nColumnSize)) return false;
+  }
+
+  const std::string& sizes = vColumns[0];
+  const std::string& words = vColumns[1];
+  const std::string& weights = vColumns[2];
+  const uint64_t nWords = words.size() / sizeof(uint32_t);
+  if (sizes.size() / (NUM_KF_SIZES * sizeof(uint32_t)) < nRows ||
+      weights.size() / sizeof(double) < nWords)
+    return false;
+
+  vBowVecs.resize(nRows);
+  uint64_t nWord = 0;
+  for (uint64_t i = 0; i < nRows; ++i) {
+    uint32_t nRowWords;
+    memcpy(&nRowWords,
+           sizes.data() + (i * NUM_KF_SIZES + KF_N_BOW_WORDS) *
+                              sizeof(uint32_t),
+           sizeof(nRowWords));
+    if (nWords - nWord < nRowWords) return false;
+
+    DBoW2::BowVector& bowVec = vBowVecs[i];
+    bowVec.clear();
+    for (uint32_t j = 0; j < nRowWords; ++j, ++nWord) {
+      uint32_t nWordId;
+      double weight;
+      memcpy(&nWordId, words.data() + nWord * sizeof(uint32_t),
+             sizeof(nWordId));
+      memcpy(&weight, weights.data() + nWord * sizeof(double), sizeof(weight));
+      bowVec.emplace_hint(bowVec.end(), nWordId, weight);
+    }
+  }
+  return true;
+}
+
+void MapSection::ReadMap(SectionReader& reader, Map* pMap) {
+  uint64_t vnIds[3];
+  reader.Read(MAP_IDS, vnIds, 3);
+  pMap->mnId = vnIds[0];
+  pMap->mnInitKFid = vnIds[1];
+  pMap->mnMaxKFid = vnIds[2];
+
+  int64_t vnIndices[3];
+  reader.Read(MAP_INDICES, vnIndices, 3);
+  pMap->mnBigChangeIdx = vnIndices[0];
+  pMap->mnBackupKFinitialID = vnIndices[1];
+  pMap->mnBackupKFlowerID = vnIndices[2];
+
+  uint8_t vbFlags[4];
+  reader.Read(MAP_FLAGS, vbFlags, 4);
+  pMap->mbImuInitialized = vbFlags[0];
+  pMap->mbIsInertial = vbFlags[1];
+  pMap->mbIMU_BA1 = vbFlags[2];
+  pMap->mbIMU_BA2 = vbFlags[3];
+
+  std::vector<uint64_t> vnOrigins;
+  reader.ReadVector(MAP_ORIGINS, vnOrigins,
+                    reader.Next<uint32_t>(MAP_SIZES));
+  pMap->mvBackupKeyFrameOriginsId.assign(vnOrigins.begin(), vnOrigins.end());
+}
+
+KeyFrame* MapSection::ReadKeyFrame(SectionReader& reader) {
+  KeyFrame* pKF = new KeyFrame();
+
+  uint64_t vnIds[3];
+  reader.Read(KF_IDS, vnIds, 3);
+  pKF->mnId = vnIds[0];
+  const_cast<long unsigned int&>(pKF->mnFrameId) = vnIds[1];
+  pKF->mnOriginMapId = vnIds[2];
+  const_cast<double&>(pKF->mTimeStamp) = reader.Next<double>(KF_TIMESTAMP);
+
+  int32_t vnInts[kKeyFrameInts];
+  reader.Read(KF_INTS, vnInts, kKeyFrameInts);
+  int* vpInts[kKeyFrameInts] = {
+      const_cast<int*>(&pKF->mnGridCols), const_cast<int*>(&pKF->mnGridRows),
+      const_cast<int*>(&pKF->N),          const_cast<int*>(&pKF->NLeft),
+      const_cast<int*>(&pKF->NRight),     const_cast<int*>(&pKF->mnScaleLevels),
+      const_cast<int*>(&pKF->mnMinX),     const_cast<int*>(&pKF->mnMinY),
+      const_cast<int*>(&pKF->mnMaxX),     const_cast<int*>(&pKF->mnMaxY)};
+  for (size_t i = 0; i < kKeyFrameInts; ++i) *vpInts[i] = vnInts[i];
+
+  float vfValues[kKeyFrameFloats];
+  reader.Read(KF_FLOATS, vfValues, kKeyFrameFloats);
+  float* vpScalars[] = {const_cast<float*>(&pKF->mfGridElementWidthInv),
+                        const_cast<float*>(&pKF->mfGridElementHeightInv),
+                        &pKF->mfScale,
+                        const_cast<float*>(&pKF->fx),
+                        const_cast<float*>(&pKF->fy),
+                        const_cast<float*>(&pKF->cx),
+                        const_cast<float*>(&pKF->cy),
+                        const_cast<float*>(&pKF->invfx),
+                        const_cast<float*>(&pKF->invfy),
+                        const_cast<float*>(&pKF->mbf),
+                        const_cast<float*>(&pKF->mb),
+                        const_cast<float*>(&pKF->mThDepth),
+                        const_cast<float*>(&pKF->mfScaleFactor),
+                        const_cast<float*>(&pKF->mfLogScaleFactor),
+                        &pKF->mHalfBaseline};
+  for (size_t i = 0; i < 15; ++i) *vpScalars[i] = vfValues[i];
+  pKF->mK_ = Eigen::Map<const Eigen::Matrix3f>(vfValues + 15);
+  pKF->mTcw = GetPose(vfValues + 24);
+  pKF->mTcp = GetPose(vfValues + 31);
+  pKF->mTlr = GetPose(vfValues + 38);
+  pKF->mVw = Eigen::Vector3f(vfValues[45], vfValues[46], vfValues[47]);
+  pKF->mOwb = Eigen::Vector3f(vfValues[48], vfValues[49], vfValues[50]);
+
+  uint8_t vbFlags[kKeyFrameFlags];
+  reader.Read(KF_FLAGS, vbFlags, kKeyFrameFlags);
+  pKF->bImu = vbFlags[0];
+  pKF->mbHasVelocity = vbFlags[1];
+  pKF->mbFirstConnection = vbFlags[2];
+  pKF->mbNotErase = vbFlags[3];
+  pKF->mbToBeErased = vbFlags[4];
+  pKF->mbBad = vbFlags[5];
+  const bool bPreintegrated = vbFlags[6];
+
+  int64_t vnReferences[kKeyFrameReferences];
+  reader.Read(KF_REFERENCES, vnReferences, kKeyFrameReferences);
+  pKF->mBackupParentId = vnReferences[0];
+  pKF->mBackupPrevKFId = vnReferences[1];
+  pKF->mBackupNextKFId = vnReferences[2];
+  pKF->mnBackupIdCamera = vnReferences[3];
+  pKF->mnBackupIdCamera2 = vnReferences[4];
+
+  uint32_t vnSizes[NUM_KF_SIZES];
+  reader.Read(KF_SIZES, vnSizes, NUM_KF_SIZES);
+
+  // Calibration
+  std::vector<float> vfDistortion;
+  reader.ReadVector(KF_DISTORTION, vfDistortion,
+                    static_cast<size_t>(vnSizes[KF_N_DISTORTION_ROWS]) *
+                        vnSizes[KF_N_DISTORTION_COLS]);
+  if (!vfDistortion.empty())
+    pKF->mDistCoef = cv::Mat(vnSizes[KF_N_DISTORTION_ROWS],
+                             vnSizes[KF_N_DISTORTION_COLS], CV_32F,
+                             vfDistortion.data())
+                         .clone();
+
+  // Keypoints
+  std::vector<cv::KeyPoint>* vpKeys[] = {
+      const_cast<std::vector<cv::KeyPoint>*>(&pKF->mvKeys),
+      const_cast<std::vector<cv::KeyPoint>*>(&pKF->mvKeysUn),
+      const_cast<std::vector<cv::KeyPoint>*>(&pKF->mvKeysRight)};
+  const KeyFrameSize vnKeySizes[] = {KF_N_KEYS, KF_N_KEYS_UN,
+                                     KF_N_KEYS_RIGHT};
+  std::vector<float> vfKeyPoints;
+  std::vector<int32_t> vnLevels;
+  for (size_t i = 0; i < 3; ++i) {
+    const size_t nKeys = vnSizes[vnKeySizes[i]];
+    reader.ReadVector(KF_KEYPOINTS, vfKeyPoints, 5 * nKeys);
+    reader.ReadVector(KF_KEYPOINT_LEVELS, vnLevels, 2 * nKeys);
+    if (reader.Failed()) break;
+
+    vpKeys[i]->resize(nKeys);
+    for (size_t j = 0; j < nKeys; ++j) {
+      cv::KeyPoint& kp = (*vpKeys[i])[j];
+      const float* pKeyPoint = &vfKeyPoints[5 * j];
+      kp.pt.x = pKeyPoint[0];
+      kp.pt.y = pKeyPoint[1];
+      kp.size = pKeyPoint[2];
+      kp.angle = pKeyPoint[3];
+      kp.response = pKeyPoint[4];
+      kp.octave = vnLevels[2 * j];
+      kp.class_id = vnLevels[2 * j + 1];
+    }
+  }
+
+  reader.ReadVector(KF_STEREO, const_cast<std::vector<float>&>(pKF->mvuRight),
+                    vnSizes[KF_N_URIGHT]);
+  reader.ReadVector(KF_STEREO, const_cast<std::vector<float>&>(pKF->mvDepth),
+                    vnSizes[KF_N_DEPTH]);
+
+  reader.ReadVector(KF_SCALES,
+                    const_cast<std::vector<float>&>(pKF->mvScaleFactors),
+                    vnSizes[KF_N_SCALE_FACTORS]);
+  reader.ReadVector(KF_SCALES,
+                    const_cast<std::vector<float>&>(pKF->mvLevelSigma2),
+                    vnSizes[KF_N_LEVEL_SIGMA2]);
+  reader.ReadVector(KF_SCALES,
+                    const_cast<std::vector<float>&>(pKF->mvInvLevelSigma2),
+                    vnSizes[KF_N_INV_LEVEL_SIGMA2]);
+
+  // Descriptors and bag of words
+  std::vector<uint8_t> vDescriptors;
+  reader.ReadVector(KF_DESCRIPTORS, vDescriptors,
+                    static_cast<size_t>(vnSizes[KF_N_DESCRIPTOR_ROWS]) *
+                        vnSizes[KF_N_DESCRIPTOR_BYTES]);
+  if (!vDescriptors.empty())
+    pKF->mDescriptors = cv::Mat(vnSizes[KF_N_DESCRIPTOR_ROWS],
+                                vnSizes[KF_N_DESCRIPTOR_BYTES], CV_8U,
+                                vDescriptors.data())
+                            .clone();
+
+  std::vector<uint32_t> vnWords;
+  std::vector<double> vWeights;
+  reader.ReadVector(KF_BOW_WORDS, vnWords, vnSizes[KF_N_BOW_WORDS]);
+  reader.ReadVector(KF_BOW_WEIGHTS, vWeights, vnSizes[KF_N_BOW_WORDS]);
+  for (size_t i = 0; i < vnWords.size() && i < vWeights.size(); ++i)
+    pKF->mBowVec.emplace_hint(pKF->mBowVec.end(), vnWords[i], vWeights[i]);
+
+  std::vector<uint32_t> vnNodes, vnNodeSizes, vnFeatures;
+  reader.ReadVector(KF_FEATURE_NODES, vnNodes, vnSizes[KF_N_FEATURE_NODES]);
+  reader.ReadVector(KF_FEATURE_SIZES, vnNodeSizes,
+                    vnSizes[KF_N_FEATURE_NODES]);
+  reader.ReadVector(KF_FEATURE_INDICES, vnFeatures,
+                    vnSizes[KF_N_FEATURE_INDICES]);
+  size_t nFeature = 0;
+  for (size_t i = 0; i < vnNodes.size() && i < vnNodeSizes.size(); ++i) {
+    if (vnFeatures.size() - nFeature < vnNodeSizes[i]) {
+      reader.Fail();
+      break;
+    }
+    pKF->mFeatVec.emplace_hint(
+        pKF->mFeatVec.end(), vnNodes[i],
+        std::vector<unsigned int>(vnFeatures.begin() + nFeature,
+                                  vnFeatures.begin() + nFeature +
+                                      vnNodeSizes[i]));
+    nFeature += vnNodeSizes[i];
+  }
+
+  // Grids, stored by cells
+  std::vector<std::vector<std::vector<size_t> > >* vpGrids[] = {
+      &pKF->mGrid, &pKF->mGridRight};
+  const KeyFrameSize vnGridSizes[] = {KF_N_GRID_COLS, KF_N_GRID_RIGHT_COLS};
+  const size_t nLeftCells =
+      static_cast<size_t>(vnSizes[KF_N_GRID_COLS]) * vnSizes[KF_N_GRID_ROWS];
+  const size_t nRightCells = static_cast<size_t>(
+                                 vnSizes[KF_N_GRID_RIGHT_COLS]) *
+                             vnSizes[KF_N_GRID_RIGHT_ROWS];
+  std::vector<uint32_t> vnCellSizes, vnCellIndices;
+  reader.ReadVector(KF_GRID_SIZES, vnCellSizes, nLeftCells + nRightCells);
+  reader.ReadVector(KF_GRID_INDICES, vnCellIndices,
+                    vnSizes[KF_N_GRID_INDICES]);
+  size_t nCell = 0, nIndex = 0;
+  for (size_t i = 0; i < 2 && !reader.Failed(); ++i) {
+    std::vector<std::vector<std::vector<size_t> > >& grid = *vpGrids[i];
+    grid.resize(vnSizes[vnGridSizes[i]]);
+    for (std::vector<std::vector<size_t> >& column : grid) {
+      column.resize(vnSizes[vnGridSizes[i] + 1]);
+      for (std::vector<size_t>& cell : column) {
+        const uint32_t nCellSize = vnCellSizes[nCell++];
+        if (vnCellIndices.size() - nIndex < nCellSize) {
+          reader.Fail();
+          break;
+        }
+        cell.assign(vnCellIndices.begin() + nIndex,
+                    vnCellIndices.begin() + nIndex + nCellSize);
+        nIndex += nCellSize;
+      }
+    }
+  }
+
+  // Map points seen, by keypoint
+  std::vector<int64_t> vnMapPoints;
+  reader.ReadVector(KF_MAP_POINTS, vnMapPoints, vnSizes[KF_N_MAP_POINTS]);
+  if (vnMapPoints.size() != static_cast<size_t>(std::max(pKF->N, 0)))
+    reader.Fail();
+  pKF->mvBackupMapPointsId.assign(vnMapPoints.begin(), vnMapPoints.end());
+
+  // Covisibility graph and spanning tree
+  std::vector<uint64_t> vnConnections, vnEdges;
+  std::vector<int32_t> vnWeights;
+  reader.ReadVector(KF_CONNECTIONS, vnConnections, vnSizes[KF_N_CONNECTIONS]);
+  reader.ReadVector(KF_WEIGHTS, vnWeights, vnSizes[KF_N_CONNECTIONS]);
+  for (size_t i = 0; i < vnConnections.size() && i < vnWeights.size(); ++i)
+    pKF->mBackupConnectedKeyFrameIdWeights[vnConnections[i]] = vnWeights[i];
+
+  std::vector<long unsigned int>* vpEdges[] = {&pKF->mvBackupChildrensId,
+                                               &pKF->mvBackupLoopEdgesId,
+                                               &pKF->mvBackupMergeEdgesId};
+  const KeyFrameSize vnEdgeSizes[] = {KF_N_CHILDREN, KF_N_LOOP_EDGES,
+                                      KF_N_MERGE_EDGES};
+  for (size_t i = 0; i < 3; ++i) {
+    reader.ReadVector(KF_EDGES, vnEdges, vnSizes[vnEdgeSizes[i]]);
+    vpEdges[i]->assign(vnEdges.begin(), vnEdges.end());
+  }
+
+  reader.ReadVector(KF_STEREO_MATCHES, pKF->mvLeftToRightMatch,
+                    vnSizes[KF_N_LEFT_TO_RIGHT]);
+  reader.ReadVector(KF_STEREO_MATCHES, pKF->mvRightToLeftMatch,
+                    vnSizes[KF_N_RIGHT_TO_LEFT]);
+
+  // Inertial data
+  ImuReader ar(reader, vnSizes[KF_N_IMU], vnSizes[KF_N_IMU_SIZES]);
+  ar & pKF->mImuBias;
+  ar & pKF->mImuCalib;
+  if (bPreintegrated) ar & pKF->mBackupImuPreintegrated;
+  if (!ar.Complete()) reader.Fail();
+
+  return pKF;
+}
+
+MapPoint* MapSection::ReadMapPoint(SectionReader& reader) {
+  MapPoint* pMP = new MapPoint();
+
+  pMP->mnId = reader.Next<uint64_t>(MP_IDS);
+  int64_t vnFirst[2];
+  reader.Read(MP_FIRST, vnFirst, 2);
+  pMP->mnFirstKFid = vnFirst[0];
+  pMP->mnFirstFrame = vnFirst[1];
+
+  int64_t vnReferences[2];
+  reader.Read(MP_REFERENCES, vnReferences, 2);
+  pMP->mBackupRefKFId = vnReferences[0];
+  pMP->mBackupReplacedId = vnReferences[1];
+  pMP->nObs = reader.Next<int32_t>(MP_OBSERVATION_COUNT);
+
+  float vfValues[8];
+  reader.Read(MP_FLOATS, vfValues, 8);
+  pMP->mWorldPos = Eigen::Vector3f(vfValues[0], vfValues[1], vfValues[2]);
+  pMP->mNormalVector = Eigen::Vector3f(vfValues[3], vfValues[4], vfValues[5]);
+  pMP->mfMinDistance = vfValues[6];
+  pMP->mfMaxDistance = vfValues[7];
+  pMP->mbBad = reader.Next<uint8_t>(MP_FLAGS);
+
+  uint32_t vnSizes[3];
+  reader.Read(MP_SIZES, vnSizes, 3);
+
+  std::vector<uint64_t> vnObservations;
+  std::vector<int32_t> vnIndices;
+  reader.ReadVector(MP_OBSERVATIONS, vnObservations, vnSizes[0]);
+  reader.ReadVector(MP_OBSERVATION_INDICES, vnIndices,
+                    2 * static_cast<size_t>(vnSizes[0]));
+  for (size_t i = 0; i < vnObservations.size() && 2 * i < vnIndices.size();
+       ++i) {
+    pMP->mBackupObservationsId1[vnObservations[i]] = vnIndices[2 * i];
+    pMP->mBackupObservationsId2[vnObservations[i]] = vnIndices[2 * i + 1];
+  }
+
+  std::vector<uint8_t> vDescriptor;
+  reader.ReadVector(MP_DESCRIPTOR, vDescriptor,
+                    static_cast<size_t>(vnSizes[1]) * vnSizes[2]);
+  if (!vDescriptor.empty())
+    pMP->mDescriptor =
+        cv::Mat(vnSizes[1], vnSizes[2], CV_8U, vDescriptor.data()).clone();
+
+  return pMP;
+}
+
+}  // namespace ORB_SLAM3
@@ -0,0 +1,110 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ORBVocabulary.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <map>
+#include <mutex>
+
+#include "Checksum.h"
+
+namespace ORB_SLAM3 {
+
+namespace {
+
+// A vocabulary file of the process. Its own mutex serialises loading and
+// hashing, so different files are loaded in parallel
+struct VocabularyEntry {
+  std::mutex mMutex;
+  std::string mStrFile;
+  // Written holding both mutexes
+  std::weak_ptr<const ORBVocabulary> mpVocabulary;
+  // Fingerprint of the file the live instance was loaded from
+  std::string mStrFingerprint;
+};
+
+std::mutex gMutexVocabularies;
+// Entries are never removed, there is one per vocabulary file
+std::map<std::string, std::shared_ptr<VocabularyEntry> > gmVocabularies;
+
+}  // namespace
+
+ORBVocabulary_ptr LoadSharedVocabulary(const std::string& strVocFile) {
+  // The same file can be reached through different paths
+  std::string strKey = strVocFile;
+  char path[PATH_MAX];
+  if (realpath(strVocFile.c_str(), path)) strKey = path;
+
+  std::shared_ptr<VocabularyEntry> pEntry;
+  {
+    std::unique_lock<std::mutex> lock(gMutexVocabularies);
+    std::shared_ptr<VocabularyEntry>& pSlot = gmVocabularies[strKey];
+    if (!pSlot) pSlot = std::make_shared<VocabularyEntry>();
+    pEntry = pSlot;
+  }
+
+  // Loading holds the lock of the file, so a concurrent request for the same
+  // file waits for it instead of loading it again
+  std::unique_lock<std::mutex> lock(pEntry->mMutex);
+  ORBVocabulary_ptr pVocabulary = pEntry->mpVocabulary.lock();
+  if (pVocabulary) return pVocabulary;
+
+  std::shared_ptr<ORBVocabulary> pNewVocabulary =
+      std::make_shared<ORBVocabulary>();
+  if (!pNewVocabulary->loadFromTextFile(strVocFile)) return ORBVocabulary_ptr();
+
+  pVocabulary = pNewVocabulary;
+  pEntry->mStrFile = strVocFile;
+  // The file may have changed since a previous instance was released
+  pEntry->mStrFingerprint.clear();
+  {
+    // Lookups by instance read the handles under the global lock
+    std::unique_lock<std::mutex> lockVocabularies(gMutexVocabularies);
+    pEntry->mpVocabulary = pVocabulary;
+  }
+  return pVocabulary;
+}
+
+std::string SharedVocabularyFingerprint(const ORBVocabulary_ptr& pVocabulary) {
+  if (!pVocabulary) return std::string();
+
+  std::shared_ptr<VocabularyEntry> pEntry;
+  {
+    std::unique_lock<std::mutex> lock(gMutexVocabularies);
+    for (const auto& entry : gmVocabularies) {
+      if (entry.second->mpVocabulary.lock() == pVocabulary) {
+        pEntry = entry.second;
+        break;
+      }
+    }
+  }
+  if (!pEntry) return std::string();
+
+  std::unique_lock<std::mutex> lock(pEntry->mMutex);
+  if (pEntry->mStrFingerprint.empty())
+    pEntry->mStrFingerprint = Checksum::FileChecksum(pEntry->mStrFile);
+  return pEntry->mStrFingerprint;
+}
+
+}  // namespace ORB_SLAM3
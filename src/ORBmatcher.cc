@@ -217,6 +217,8 @@ float ORBmatcher::RadiusByViewingCos(const float &viewCos) {
 
 int ORBmatcher::SearchByBoW(KeyFrame *pKF, Frame &F,
                             vector<MapPoint *> &vpMapPointMatches) {
+  KeyFrame::ScopedPin pin(pKF);
+
   const vector<MapPoint *> vpMapPointsKF = pKF->GetMapPointMatches();
 
   vpMapPointMatches = vector<MapPoint *>(F.N, static_cast<MapPoint *>(NULL));
@@ -398,6 +400,8 @@ int ORBmatcher::SearchByProjection(KeyFrame *pKF, Sophus::Sim3f &Scw,
                                    const vector<MapPoint *> &vpPoints,
                                    vector<MapPoint *> &vpMatched, int th,
                                    float ratioHamming) {
+  KeyFrame::ScopedPin pin(pKF);
+
   // Get Calibration Parameters for later projection
   // const float &fx = pKF->fx; // UNUSED
   // const float &fy = pKF->fy; // UNUSED
@@ -499,6 +503,8 @@ int ORBmatcher::SearchByProjection(KeyFrame *pKF, Sophus::Sim3<float> &Scw,
                                    std::vector<MapPoint *> &vpMatched,
                                    std::vector<KeyFrame *> &vpMatchedKF, int th,
                                    float ratioHamming) {
+  KeyFrame::ScopedPin pin(pKF);
+
   // Get Calibration Parameters for later projection
   const float &fx = pKF->fx;
   const float &fy = pKF->fy;
@@ -701,6 +707,8 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2,
 
 int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2,
                             vector<MapPoint *> &vpMatches12) {
+  KeyFrame::ScopedPin pin1(pKF1), pin2(pKF2);
+
   const vector<cv::KeyPoint> &vKeysUn1 = pKF1->mvKeysUn;
   const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
   const vector<MapPoint *> vpMapPoints1 = pKF1->GetMapPointMatches();
@@ -822,6 +830,8 @@ int ORBmatcher::SearchForTriangulation(
     KeyFrame *pKF1, KeyFrame *pKF2,
     vector<pair<size_t, size_t> > &vMatchedPairs, const bool bOnlyStereo,
     const bool bCoarse) {
+  KeyFrame::ScopedPin pin1(pKF1), pin2(pKF2);
+
   const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
   const DBoW2::FeatureVector &vFeatVec2 = pKF2->mFeatVec;
 
@@ -976,7 +986,9 @@ int ORBmatcher::SearchForTriangulation(
 
           if (bCoarse ||
               pCamera1->epipolarConstrain(
-                  pCamera2, kp1, kp2, R12, t12, pKF1->mvLevelSigma2[kp1.octave],
+                  pCamera2, kp1, kp2, pKF1->mvBearings[idx1],
+                  pKF2->mvBearings[idx2], R12, t12,
+                  pKF1->mvLevelSigma2[kp1.octave],
                   pKF2->mvLevelSigma2[kp2.octave]))  // MODIFICATION_2
           {
             bestIdx2 = idx2;
@@ -1043,6 +1055,8 @@ int ORBmatcher::SearchForTriangulation(
 
 int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
                      const float th, const bool bRight) {
+  KeyFrame::ScopedPin pin(pKF);
+
   GeometricCamera *pCamera;
   Sophus::SE3f Tcw;
   Eigen::Vector3f Ow;
@@ -1217,6 +1231,8 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints,
 int ORBmatcher::Fuse(KeyFrame *pKF, Sophus::Sim3f &Scw,
                      const vector<MapPoint *> &vpPoints, float th,
                      vector<MapPoint *> &vpReplacePoint) {
+  KeyFrame::ScopedPin pin(pKF);
+
   // Get Calibration Parameters for later projection
   // const float &fx = pKF->fx; // UNUSED
   // const float &fy = pKF->fy; // UNUSED
@@ -1323,6 +1339,8 @@ int ORBmatcher::Fuse(KeyFrame *pKF, Sophus::Sim3f &Scw,
 int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2,
                              std::vector<MapPoint *> &vpMatches12,
                              const Sophus::Sim3f &S12, const float th) {
+  KeyFrame::ScopedPin pin1(pKF1), pin2(pKF2);
+
   const float &fx = pKF1->fx;
   const float &fy = pKF1->fy;
   const float &cx = pKF1->cx;
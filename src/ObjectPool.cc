@@ -0,0 +1,92 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ObjectPool.h"
+
+#include <new>
+
+namespace ORB_SLAM3 {
+
+ObjectPool::ObjectPool(size_t nObjectSize, size_t nObjectsPerChunk)
+    : mnSlotSize((nObjectSize + kAlignment - 1) / kAlignment * kAlignment),
+      mnObjectsPerChunk(nObjectsPerChunk),
+      mpFreeList(NULL),
+      mnAllocated(0) {}
+
+ObjectPool::~ObjectPool() {
+  for (const std::pair<char* const, char*>& chunk : mmChunks)
+    ::operator delete(chunk.first, std::align_val_t(kAlignment));
+}
+
+void* ObjectPool::Allocate(size_t nSize) {
+  if (nSize > mnSlotSize) return ::operator new(nSize);
+
+  std::unique_lock<std::mutex> lock(mMutexPool);
+  if (!mpFreeList) AddChunk();
+
+  void* p = mpFreeList;
+  mpFreeList = *static_cast<void**>(p);
+  mnAllocated++;
+  return p;
+}
+
+void ObjectPool::Deallocate(void* p) {
+  if (!p) return;
+
+  std::unique_lock<std::mutex> lock(mMutexPool);
+  if (!Owns(p)) {
+    lock.unlock();
+    ::operator delete(p);
+    return;
+  }
+
+  *static_cast<void**>(p) = mpFreeList;
+  mpFreeList = p;
+  mnAllocated--;
+}
+
+size_t ObjectPool::Allocated() {
+  std::unique_lock<std::mutex> lock(mMutexPool);
+  return mnAllocated;
+}
+
+void ObjectPool::AddChunk() {
+  char* pChunk = static_cast<char*>(::operator new(
+      mnSlotSize * mnObjectsPerChunk, std::align_val_t(kAlignment)));
+  mmChunks[pChunk] = pChunk + mnSlotSize * mnObjectsPerChunk;
+
+  // Link the slots so that they are handed out in address order
+  for (size_t i = mnObjectsPerChunk; i-- > 0;) {
+    void* pSlot = pChunk + i * mnSlotSize;
+    *static_cast<void**>(pSlot) = mpFreeList;
+    mpFreeList = pSlot;
+  }
+}
+
+bool ObjectPool::Owns(void* p) const {
+  char* pc = static_cast<char*>(p);
+  std::map<char*, char*>::const_iterator it = mmChunks.upper_bound(pc);
+  if (it == mmChunks.begin()) return false;
+  --it;
+  return pc < it->second;
+}
+
+}  // namespace ORB_SLAM3
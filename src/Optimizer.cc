@@ -30,6 +30,7 @@
 #include "Converter.h"
 #include "G2oTypes.h"
 #include "OptimizableTypes.h"
+#include "ThreadPool.h"
 #include "g2o/core/block_solver.h"
 #include "g2o/core/optimization_algorithm_gauss_newton.h"
 #include "g2o/core/optimization_algorithm_levenberg.h"
@@ -40,6 +41,43 @@
 #include "g2o/types/types_six_dof_expmap.h"
 
 namespace ORB_SLAM3 {
+
+// Replays the preintegrations at their new bias, in parallel as they are
+// independent
+static void ReintegrateImu(const vector<IMU::Preintegrated*>& vpPreintegrated) {
+  if (vpPreintegrated.size() < 2) {
+    for (IMU::Preintegrated* pImuPreintegrated : vpPreintegrated)
+      pImuPreintegrated->Reintegrate();
+    return;
+  }
+
+  ThreadPool pool(std::min<int>(vpPreintegrated.size(),
+                                std::thread::hardware_concurrency()));
+  vector<std::future<void> > vResults;
+  vResults.reserve(vpPreintegrated.size());
+  for (IMU::Preintegrated* pImuPreintegrated : vpPreintegrated)
+    vResults.push_back(pool.Enqueue(
+        [pImuPreintegrated]() { pImuPreintegrated->Reintegrate(); }));
+  for (std::future<void>& result : vResults) result.get();
+}
+// Lets another thread stop g2o: the request is atomic and only the
+// optimising thread writes the flag g2o polls between iterations
+class AbortAction : public g2o::HyperGraphAction {
+ public:
+  AbortAction(const std::atomic<bool>* pbAbort, bool* pbStop)
+      : mpbAbort(pbAbort), mpbStop(pbStop) {}
+
+  HyperGraphAction* operator()(const g2o::HyperGraph*,
+                               Parameters*) override {
+    if (mpbAbort->load()) *mpbStop = true;
+    return this;
+  }
+
+ private:
+  const std::atomic<bool>* mpbAbort;
+  bool* mpbStop;
+};
+
 bool sortByVal(const pair<MapPoint*, int>& a, const pair<MapPoint*, int>& b) {
   return (a.second < b.second);
 }
@@ -137,11 +175,11 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame*>& vpKFs,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationVector observations = pMP->GetObservations();
 
     int nEdges = 0;
     // SET EDGES
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator mit =
+    for (MapPoint::ObservationVector::const_iterator mit =
              observations.begin();
          mit != observations.end(); mit++) {
       KeyFrame* pKF = mit->first;
@@ -365,7 +403,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
                                const long unsigned int nLoopId,
                                bool* pbStopFlag, bool bInit, float priorG,
                                float priorA, Eigen::VectorXd* vSingVal,
-                               bool* bHess) {
+                               bool* bHess, const std::atomic<bool>* pbAbort) {
   long unsigned int maxKFid = pMap->GetMaxKFid();
   const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
   const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
@@ -385,7 +423,14 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
   optimizer.setAlgorithm(solver);
   optimizer.setVerbose(false);
 
-  if (pbStopFlag) optimizer.setForceStopFlag(pbStopFlag);
+  bool bAborted = false;
+  AbortAction abortAction(pbAbort, &bAborted);
+  if (pbAbort) {
+    optimizer.setForceStopFlag(&bAborted);
+    optimizer.addPostIterationAction(&abortAction);
+  } else if (pbStopFlag) {
+    optimizer.setForceStopFlag(pbStopFlag);
+  }
 
   int nNonFixed = 0;
 
@@ -569,12 +614,12 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    const MapPoint::ObservationVector observations = pMP->GetObservations();
 
     bool bAllFixed = true;
 
     // Set edges
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationVector::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -688,6 +733,7 @@ void Optimizer::FullInertialBA(Map* pMap, int its, const bool bFixLocal,
 
   if (pbStopFlag)
     if (*pbStopFlag) return;
+  if (pbAbort && pbAbort->load()) return;
 
   optimizer.initializeOptimization();
   optimizer.optimize(its);
@@ -1097,12 +1143,14 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
   // Fixed Keyframes. Keyframes that see Local MapPoints but that are not Local
   // Keyframes
   list<KeyFrame*> lFixedCameras;
+  MapPoint::ObservationVector observations;
   for (list<MapPoint*>::iterator lit = lLocalMapPoints.begin(),
                                  lend = lLocalMapPoints.end();
        lit != lend; lit++) {
-    map<KeyFrame*, tuple<int, int>> observations = (*lit)->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    (*lit)->GetObservations(observations);
+    for (MapPoint::ObservationVector::const_iterator
+             mit = observations.begin(),
+             mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -1232,10 +1280,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag,
     optimizer.addVertex(vPoint);
     nPoints++;
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    pMP->GetObservations(observations);
 
     // Set edges
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationVector::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -2409,12 +2457,14 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, Map* pMap,
   // Fixed KFs which are not covisible optimizable
   const int maxFixKF = 200;
 
+  MapPoint::ObservationVector observations;
   for (list<MapPoint*>::iterator lit = lLocalMapPoints.begin(),
                                  lend = lLocalMapPoints.end();
        lit != lend; lit++) {
-    map<KeyFrame*, tuple<int, int>> observations = (*lit)->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    (*lit)->GetObservations(observations);
+    for (MapPoint::ObservationVector::const_iterator
+             mit = observations.begin(),
+             mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -2651,10 +2701,10 @@ void Optimizer::LocalInertialBA(KeyFrame* pKF, bool* pbStopFlag, Map* pMap,
     vPoint->setId(id);
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    pMP->GetObservations(observations);
 
     // Create visual constraints
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationVector::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -2981,7 +3031,7 @@ void Optimizer::InertialOptimization(Map* pMap, Eigen::Matrix3d& Rwg,
                                      Eigen::Vector3d& ba, bool bMono,
                                      Eigen::MatrixXd& covInertial,
                                      bool bFixedVel, bool bGauss, float priorG,
-                                     float priorA) {
+                                     float priorA, float thReintegration) {
   Verbose::PrintMess("inertial optimization", Verbose::VERBOSITY_NORMAL);
   int its = 200;
   long unsigned int maxKFid = pMap->GetMaxKFid();
@@ -3136,7 +3186,10 @@ void Optimizer::InertialOptimization(Map* pMap, Eigen::Matrix3d& Rwg,
   IMU::Bias b(vb[3], vb[4], vb[5], vb[0], vb[1], vb[2]);
   Rwg = VGDir->estimate().Rwg;
 
-  // Keyframes velocities and biases
+  // Keyframes velocities and biases. Preintegrations keep the first order
+  // correction of their Jacobians unless the gyro bias moved too far from their
+  // linearisation point
+  vector<IMU::Preintegrated*> vpToReintegrate;
   const size_t N = vpKFs.size();
   for (size_t i = 0; i < N; i++) {
     KeyFrame* pKFi = vpKFs[i];
@@ -3147,17 +3200,18 @@ void Optimizer::InertialOptimization(Map* pMap, Eigen::Matrix3d& Rwg,
     Eigen::Vector3d Vw = VV->estimate();  // Velocity is scaled after
     pKFi->SetVelocity(Vw.cast<float>());
 
-    if ((pKFi->GetGyroBias() - bg.cast<float>()).norm() > 0.01) {
-      pKFi->SetNewBias(b);
-      if (pKFi->mpImuPreintegrated) pKFi->mpImuPreintegrated->Reintegrate();
-    } else
-      pKFi->SetNewBias(b);
+    pKFi->SetNewBias(b);
+    if (pKFi->mpImuPreintegrated &&
+        pKFi->mpImuPreintegrated->GetDeltaBias().head<3>().norm() >
+            thReintegration)
+      vpToReintegrate.push_back(pKFi->mpImuPreintegrated);
   }
+  ReintegrateImu(vpToReintegrate);
 }
 
 void Optimizer::InertialOptimization(Map* pMap, Eigen::Vector3d& bg,
                                      Eigen::Vector3d& ba, float priorG,
-                                     float priorA) {
+                                     float priorA, float thReintegration) {
   int its = 200;  // Check number of iterations
   long unsigned int maxKFid = pMap->GetMaxKFid();
   const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
@@ -3294,7 +3348,10 @@ void Optimizer::InertialOptimization(Map* pMap, Eigen::Vector3d& bg,
 
   IMU::Bias b(vb[3], vb[4], vb[5], vb[0], vb[1], vb[2]);
 
-  // Keyframes velocities and biases
+  // Keyframes velocities and biases. Preintegrations keep the first order
+  // correction of their Jacobians unless the gyro bias moved too far from their
+  // linearisation point
+  vector<IMU::Preintegrated*> vpToReintegrate;
   const size_t N = vpKFs.size();
   for (size_t i = 0; i < N; i++) {
     KeyFrame* pKFi = vpKFs[i];
@@ -3305,12 +3362,13 @@ void Optimizer::InertialOptimization(Map* pMap, Eigen::Vector3d& bg,
     Eigen::Vector3d Vw = VV->estimate();
     pKFi->SetVelocity(Vw.cast<float>());
 
-    if ((pKFi->GetGyroBias() - bg.cast<float>()).norm() > 0.01) {
-      pKFi->SetNewBias(b);
-      if (pKFi->mpImuPreintegrated) pKFi->mpImuPreintegrated->Reintegrate();
-    } else
-      pKFi->SetNewBias(b);
+    pKFi->SetNewBias(b);
+    if (pKFi->mpImuPreintegrated &&
+        pKFi->mpImuPreintegrated->GetDeltaBias().head<3>().norm() >
+            thReintegration)
+      vpToReintegrate.push_back(pKFi->mpImuPreintegrated);
   }
+  ReintegrateImu(vpToReintegrate);
 }
 
 void Optimizer::InertialOptimization(Map* pMap, Eigen::Matrix3d& Rwg,
@@ -3562,11 +3620,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations =
-        pMPi->GetObservations();
+    const MapPoint::ObservationVector observations = pMPi->GetObservations();
     int nEdges = 0;
     // SET EDGES
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator mit =
+    for (MapPoint::ObservationVector::const_iterator mit =
              observations.begin();
          mit != observations.end(); mit++) {
       KeyFrame* pKF = mit->first;
@@ -3758,9 +3815,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame* pMainKF,
     MapPoint* pMPi = vpMPs[i];
     if (pMPi->isBad()) continue;
 
-    const map<KeyFrame*, tuple<int, int>> observations =
-        pMPi->GetObservations();
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator mit =
+    const MapPoint::ObservationVector observations = pMPi->GetObservations();
+    for (MapPoint::ObservationVector::const_iterator mit =
              observations.begin();
          mit != observations.end(); mit++) {
       KeyFrame* pKF = mit->first;
@@ -3958,14 +4014,15 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
   // Fixed Keyframes. Keyframes that see Local MapPoints but that are not Local
   // Keyframes
   int i = 0;
+  MapPoint::ObservationVector observations;
   for (vector<pair<MapPoint*, int>>::iterator lit = pairs.begin(),
                                               lend = pairs.end();
        lit != lend; lit++, i++) {
-    map<KeyFrame*, tuple<int, int>> observations =
-        lit->first->GetObservations();
     if (i >= maxCovKF) break;
-    for (map<KeyFrame*, tuple<int, int>>::iterator mit = observations.begin(),
-                                                   mend = observations.end();
+    lit->first->GetObservations(observations);
+    for (MapPoint::ObservationVector::const_iterator
+             mit = observations.begin(),
+             mend = observations.end();
          mit != mend; mit++) {
       KeyFrame* pKFi = mit->first;
 
@@ -4196,10 +4253,10 @@ void Optimizer::MergeInertialBA(KeyFrame* pCurrKF, KeyFrame* pMergeKF,
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame*, tuple<int, int>> observations = pMP->GetObservations();
+    pMP->GetObservations(observations);
 
     // Create visual constraints
-    for (map<KeyFrame*, tuple<int, int>>::const_iterator
+    for (MapPoint::ObservationVector::const_iterator
              mit = observations.begin(),
              mend = observations.end();
          mit != mend; mit++) {
@@ -456,6 +456,12 @@ void Settings::readIMU(cv::FileStorage& fSettings) {
   } else {
     insertKFsWhenLost_ = true;
   }
+
+  // Gyro bias change (rad/s) past which a preintegration is replayed instead
+  // of corrected to first order with its Jacobians
+  imuReintegrationThreshold_ = readParameter<float>(
+      fSettings, "IMU.ReintegrationThreshold", found, false);
+  if (!found) imuReintegrationThreshold_ = 0.01f;
 }
 
 void Settings::readRGBD(cv::FileStorage& fSettings) {
@@ -499,6 +505,15 @@ void Settings::readViewer(cv::FileStorage& fSettings) {
       readParameter<float>(fSettings, "Viewer.imageViewScale", found, false);
 
   if (!found) imageViewerScale_ = 1.0f;
+
+  viewerHeadless_ =
+      readParameter<int>(fSettings, "Viewer.Headless", found, false) != 0;
+  viewerHeadlessOutput_ = readParameter<std::string>(
+      fSettings, "Viewer.HeadlessOutput", found, false);
+  if (!found) viewerHeadlessOutput_ = "MapView.png";
+  viewerHeadlessPeriod_ =
+      readParameter<float>(fSettings, "Viewer.HeadlessPeriod", found, false);
+  if (!found) viewerHeadlessPeriod_ = 1.0f;
 }
 
 void Settings::readLoadAndSave(cv::FileStorage& fSettings) {
@@ -25,7 +25,6 @@
 #include <opencv2/core/core.hpp>
 #include <vector>
 
-#include "DUtils/Random.h"
 #include "KeyFrame.h"
 #include "ORBmatcher.h"
 
@@ -38,6 +37,8 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2,
     : mnIterations(0),
       mnBestInliers(0),
       mbFixScale(bFixScale),
+      mRandomGenerator(static_cast<std::mt19937::result_type>(
+          pKF1->mnId * 73856093ul ^ pKF2->mnId * 19349663ul)),
       pCamera1(pKF1->mpCamera),
       pCamera2(pKF2->mpCamera) {
   bool bDifferentKFs = false;
@@ -170,7 +171,7 @@ Eigen::Matrix4f Sim3Solver::iterate(int nIterations, bool &bNoMore,
 
     // Get min set of points
     for (short i = 0; i < 3; ++i) {
-      int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size() - 1);
+      int randi = RandomIndex(vAvailableIndices.size());
 
       int idx = vAvailableIndices[randi];
 
@@ -237,7 +238,7 @@ Eigen::Matrix4f Sim3Solver::iterate(int nIterations, bool &bNoMore,
 
     // Get min set of points
     for (short i = 0; i < 3; ++i) {
-      int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size() - 1);
+      int randi = RandomIndex(vAvailableIndices.size());
 
       int idx = vAvailableIndices[randi];
 
@@ -429,26 +430,30 @@ void Sim3Solver::Project(const vector<Eigen::Vector3f> &vP3Dw,
   Eigen::Matrix3f Rcw = Tcw.block<3, 3>(0, 0);
   Eigen::Vector3f tcw = Tcw.block<3, 1>(0, 3);
 
-  vP2D.clear();
-  vP2D.reserve(vP3Dw.size());
+  vP2D.resize(vP3Dw.size());
 
-  for (size_t i = 0, iend = vP3Dw.size(); i < iend; i++) {
-    Eigen::Vector3f P3Dc = Rcw * vP3Dw[i] + tcw;
-    Eigen::Vector2f pt2D = pCamera->project(P3Dc);
-    vP2D.push_back(pt2D);
-  }
+  pCamera->Visit([&](const auto &camera) {
+    for (size_t i = 0, iend = vP3Dw.size(); i < iend; i++) {
+      const Eigen::Vector3f P3Dc = Rcw * vP3Dw[i] + tcw;
+      vP2D[i] = camera.project(P3Dc);
+    }
+  });
 }
 
 void Sim3Solver::FromCameraToImage(const vector<Eigen::Vector3f> &vP3Dc,
                                    vector<Eigen::Vector2f> &vP2D,
                                    GeometricCamera *pCamera) {
-  vP2D.clear();
-  vP2D.reserve(vP3Dc.size());
+  vP2D.resize(vP3Dc.size());
 
-  for (size_t i = 0, iend = vP3Dc.size(); i < iend; i++) {
-    Eigen::Vector2f pt2D = pCamera->project(vP3Dc[i]);
-    vP2D.push_back(pt2D);
-  }
+  pCamera->Visit([&](const auto &camera) {
+    for (size_t i = 0, iend = vP3Dc.size(); i < iend; i++)
+      vP2D[i] = camera.project(vP3Dc[i]);
+  });
+}
+
+int Sim3Solver::RandomIndex(int n) {
+  std::uniform_int_distribution<int> distribution(0, n - 1);
+  return distribution(mRandomGenerator);
 }
 
 }  // namespace ORB_SLAM3
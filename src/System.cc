@@ -21,8 +21,11 @@
 
 #include "System.h"
 
-#include <openssl/md5.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
 #include <pangolin/pangolin.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "ImprovedTypes.hpp"
 #include <boost/archive/binary_iarchive.hpp>
@@ -40,21 +43,83 @@
 #include <string>
 #include <iostream>
 
+#include "AtlasLog.h"
+#include "Checksum.h"
 #include "Converter.h"
 
 namespace ORB_SLAM3 {
 
-Verbose::eLevel Verbose::th = Verbose::VERBOSITY_NORMAL;
+// Checksums written by previous versions are plain MD5 hex strings
+static const std::string kChecksumPrefix = "xxh64:";
+
+// Every atlas file ends with a fixed size trailer holding the hash of the
+// payload: "\nOSA-XXH64 <16 hex digits>\n"
+static const std::string kAtlasTrailerTag = "\nOSA-XXH64 ";
+static const size_t kAtlasTrailerSize = kAtlasTrailerTag.size() + 16 + 1;
+
+static bool ReadAtlasTrailer(const std::string& strFilename,
+                             std::string& strPayloadChecksum,
+                             long long& nPayloadSize) {
+  std::ifstream ifs(strFilename, std::ios::binary | std::ios::ate);
+  if (!ifs.good()) return false;
+  const long long nFileSize = ifs.tellg();
+  if (nFileSize < static_cast<long long>(kAtlasTrailerSize)) return false;
+
+  std::string strTrailer(kAtlasTrailerSize, '\0');
+  ifs.seekg(nFileSize - kAtlasTrailerSize);
+  ifs.read(&strTrailer[0], kAtlasTrailerSize);
+  if (!ifs || strTrailer.compare(0, kAtlasTrailerTag.size(),
+                                 kAtlasTrailerTag) != 0)
+    return false;
+
+  strPayloadChecksum = strTrailer.substr(kAtlasTrailerTag.size(), 16);
+  nPayloadSize = nFileSize - kAtlasTrailerSize;
+  return true;
+}
+
+// The checkpoint is written next to the target and renamed over it once it
+// is on disk, so the previous checkpoint survives a crash while writing
+static bool WriteAtlasCheckpoint(const std::string& strFilename,
+                                 const Atlas::Checkpoint& checkpoint) {
+  const std::string strTmpFilename = strFilename + ".tmp";
+  {
+    std::ofstream ofs(strTmpFilename, std::ios::binary | std::ios::trunc);
+    Atlas::WriteSections(ofs, checkpoint);
+    ofs.flush();
+    if (!ofs) {
+      std::remove(strTmpFilename.c_str());
+      return false;
+    }
+  }
+
+  const int fd = open(strTmpFilename.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  return std::rename(strTmpFilename.c_str(), strFilename.c_str()) == 0;
+}
+
+std::atomic<Verbose::eLevel> Verbose::th(Verbose::VERBOSITY_NORMAL);
 
 System::System(const std::string& strVocFile, const std::string& strSettingsFile,
                const CameraType::eSensor sensor,
-               const std::string& strSequence)
+               const std::string& strSequence,
+               const KeyFrameDatabase_ptr& pSharedKeyFrameDatabase)
     : mSensor(sensor),
       mpAtlas(std::make_shared<Atlas>(0)),
       mbReset(false),
       mbResetActiveMap(false),
       mbActivateLocalizationMode(false),
-      mbDeactivateLocalizationMode(false) {
+      mbDeactivateLocalizationMode(false),
+      mnLastBigChangeIdx(0),
+      mbExternalRectification(false),
+      mbOfflineMode(false),
+      mptCheckpoint(NULL),
+      mbCheckpointWriting(false),
+      mbDeltaCheckpoints(false),
+      mbCheckpointFailed(false),
+      mpAtlasLog(NULL) {
   // Output welcome message
   std::cout << std::endl
        << "ORB-SLAM3 Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, "
@@ -119,47 +184,76 @@ System::System(const std::string& strVocFile, const std::string& strSettingsFile
     activeLC = static_cast<int>(fsSettings["loopClosing"]) != 0;
   }
 
+  // Checkpoints append the changed maps to an atlas log instead of rewriting
+  // the whole atlas
+  node = fsSettings["System.AtlasDeltaCheckpoints"];
+  if (!node.empty()) mbDeltaCheckpoints = static_cast<int>(node) != 0;
+
+  // Offline batch mode, tracking waits for the background stages
+  node = fsSettings["System.OfflineMode"];
+  if (!node.empty()) mbOfflineMode = static_cast<int>(node) != 0;
+
+  // Memory budget in MB for the matching data of the keyframes, the least
+  // recently used ones are spilled to disk when it is exceeded
+  mpKeyFrameStore = static_cast<KeyFrameStore*>(NULL);
+  node = fsSettings["System.KeyFrameMemoryBudget"];
+  if (!node.empty() && static_cast<int>(node) > 0) {
+    const size_t nBudgetBytes = static_cast<size_t>(static_cast<int>(node))
+                                << 20;
+    string strSpillDirectory;
+    node = fsSettings["System.KeyFrameSpillDirectory"];
+    if (!node.empty() && node.isString()) {
+      strSpillDirectory = (string)node;
+    } else {
+      char pathTemplate[] = "/tmp/orbslam3_keyframes_XXXXXX";
+      if (mkdtemp(pathTemplate)) strSpillDirectory = pathTemplate;
+    }
+
+    if (strSpillDirectory.empty()) {
+      cerr << "Unable to create the keyframe spill directory, the memory "
+              "budget is disabled"
+           << endl;
+    } else {
+      cout << "Keyframe memory budget: " << (nBudgetBytes >> 20)
+           << " MB, spilling to " << strSpillDirectory << endl;
+      mpKeyFrameStore = new KeyFrameStore(strSpillDirectory, nBudgetBytes);
+      mpAtlas->SetKeyFrameStore(mpKeyFrameStore);
+    }
+  }
+
   mStrVocabularyFilePath = strVocFile;
 
-  // bool loadedAtlas = false; // UNUSED
+  // Load ORB Vocabulary, only the first System of the process with this file
+  // reads it
+  cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
 
-  if (mStrLoadAtlasFromFile.empty()) {
-    // Load ORB Vocabulary
-    cout << endl
-         << "Loading ORB Vocabulary. This could take a while..." << endl;
-
-    mpVocabulary = new ORBVocabulary();
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
-    if (!bVocLoad) {
-      cerr << "Wrong path to vocabulary. " << endl;
-      cerr << "Falied to open at: " << strVocFile << endl;
+  mpVocabulary = LoadSharedVocabulary(strVocFile);
+  if (!mpVocabulary) {
+    cerr << "Wrong path to vocabulary. " << endl;
+    cerr << "Falied to open at: " << strVocFile << endl;
+    exit(-1);
+  }
+  cout << "Vocabulary loaded!" << endl << endl;
+
+  // Create KeyFrame Database, or join the one of other Systems
+  if (pSharedKeyFrameDatabase) {
+    if (pSharedKeyFrameDatabase->GetSharedVocabulary() != mpVocabulary) {
+      cerr << "The shared keyframe database does not use the vocabulary "
+           << strVocFile << endl;
       exit(-1);
     }
-    cout << "Vocabulary loaded!" << endl << endl;
+    mpKeyFrameDatabase = pSharedKeyFrameDatabase;
+  } else {
+    mpKeyFrameDatabase = std::make_shared<KeyFrameDatabase>(mpVocabulary);
+  }
 
-    // Create KeyFrame Database
-    mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
+  // bool loadedAtlas = false; // UNUSED
 
+  if (mStrLoadAtlasFromFile.empty()) {
     // Create the Atlas
     cout << "Initialization of Atlas from scratch " << endl;
     // mpAtlas = new Atlas(0);
   } else {
-    // Load ORB Vocabulary
-    cout << endl
-         << "Loading ORB Vocabulary. This could take a while..." << endl;
-
-    mpVocabulary = new ORBVocabulary();
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
-    if (!bVocLoad) {
-      cerr << "Wrong path to vocabulary. " << endl;
-      cerr << "Falied to open at: " << strVocFile << endl;
-      exit(-1);
-    }
-    cout << "Vocabulary loaded!" << endl << endl;
-
-    // Create KeyFrame Database
-    mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
-
     cout << "Load File" << endl;
 
     // Load the file with an earlier session
@@ -197,15 +291,25 @@ System::System(const std::string& strVocFile, const std::string& strSettingsFile
   //(it will live in the main thread of execution, the one that called this
   // constructor)
   cout << "Seq. Name: " << strSequence << endl;
-  mpTracker = new Tracking(this, mpVocabulary,
-                           mpAtlas, mpKeyFrameDatabase, strSettingsFile,
+  mpTracker = new Tracking(this, mpVocabulary.get(),
+                           mpAtlas, mpKeyFrameDatabase.get(), strSettingsFile,
                            mSensor, settings_, strSequence);
 
+  // Gyro bias change that triggers the reintegration of a preintegration,
+  // fixed before the mapping threads start
+  float thImuReintegration = 0.01f;
+  if (settings_) {
+    thImuReintegration = settings_->imuReintegrationThreshold();
+  } else {
+    node = fsSettings["IMU.ReintegrationThreshold"];
+    if (!node.empty()) thImuReintegration = node.real();
+  }
+
   // Initialize the Local Mapping thread and launch
   mpLocalMapper = new LocalMapping(
       this, mpAtlas, mSensor == CameraType::MONOCULAR || mSensor == CameraType::IMU_MONOCULAR,
       mSensor == CameraType::IMU_MONOCULAR || mSensor == CameraType::IMU_STEREO || mSensor == CameraType::IMU_RGBD,
-      strSequence);
+      thImuReintegration, strSequence);
   mptLocalMapping = new thread(&ORB_SLAM3::LocalMapping::Run, mpLocalMapper);
   if (settings_)
     mpLocalMapper->mThFarPoints = settings_->thFarPoints();
@@ -221,8 +325,9 @@ System::System(const std::string& strVocFile, const std::string& strSettingsFile
   // Initialize the Loop Closing thread and launch
   // mSensor!=MONOCULAR && mSensor!=IMU_MONOCULAR
   mpLoopCloser =
-      new LoopClosing(mpAtlas, mpKeyFrameDatabase, mpVocabulary,
-                      mSensor != CameraType::MONOCULAR, activeLC);  // mSensor!=CameraType::MONOCULAR);
+      new LoopClosing(mpAtlas, mpKeyFrameDatabase.get(), mpVocabulary.get(),
+                      mSensor != CameraType::MONOCULAR, activeLC,
+                      thImuReintegration);  // mSensor!=CameraType::MONOCULAR);
   mptLoopClosing = new thread(&ORB_SLAM3::LoopClosing::Run, mpLoopCloser);
 
   // Set pointers between threads
@@ -235,6 +340,8 @@ System::System(const std::string& strVocFile, const std::string& strSettingsFile
   mpLoopCloser->SetTracker(mpTracker);
   mpLoopCloser->SetLocalMapper(mpLocalMapper);
 
+  mpTracker->InformOfflineMode(mbOfflineMode);
+
   // Fix verbosity
   Verbose::SetTh(Verbose::VERBOSITY_QUIET);
 }
@@ -251,7 +358,10 @@ Sophus::SE3f System::TrackStereo(const cv::Mat& imLeft, const cv::Mat& imRight,
   }
 
   cv::Mat imLeftToFeed, imRightToFeed;
-  if (settings_ && settings_->needToRectify()) {
+  if (settings_ && settings_->needToRectify() && mbExternalRectification) {
+    imLeftToFeed = imLeft.clone();
+    imRightToFeed = imRight.clone();
+  } else if (settings_ && settings_->needToRectify()) {
     cv::Mat M1l = settings_->M1l();
     cv::Mat M2l = settings_->M2l();
     cv::Mat M1r = settings_->M1r();
@@ -306,8 +416,13 @@ Sophus::SE3f System::TrackStereo(const cv::Mat& imLeft, const cv::Mat& imRight,
       mpTracker->GrabImuData(vImuMeas[i_imu]);
 
   // std::cout << "start GrabImageStereo" << std::endl;
-  Sophus::SE3f Tcw = mpTracker->GrabImageStereo(imLeftToFeed, imRightToFeed,
-                                                timestamp, filename);
+  Sophus::SE3f Tcw;
+  {
+    StageTimes::Scope timeTracking(mStageTimes, StageTimes::TRACKING);
+    Tcw = mpTracker->GrabImageStereo(imLeftToFeed, imRightToFeed, timestamp,
+                                     filename);
+  }
+  if (mbOfflineMode) WaitForBackgroundStages();
 
   // std::cout << "out grabber" << std::endl;
 
@@ -377,8 +492,13 @@ Sophus::SE3f System::TrackRGBD(const cv::Mat& im, const cv::Mat& depthmap,
     for (size_t i_imu = 0; i_imu < vImuMeas.size(); i_imu++)
       mpTracker->GrabImuData(vImuMeas[i_imu]);
 
-  Sophus::SE3f Tcw =
-      mpTracker->GrabImageRGBD(imToFeed, imDepthToFeed, timestamp, filename);
+  Sophus::SE3f Tcw;
+  {
+    StageTimes::Scope timeTracking(mStageTimes, StageTimes::TRACKING);
+    Tcw =
+        mpTracker->GrabImageRGBD(imToFeed, imDepthToFeed, timestamp, filename);
+  }
+  if (mbOfflineMode) WaitForBackgroundStages();
 
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
@@ -448,8 +568,12 @@ Sophus::SE3f System::TrackMonocular(const cv::Mat& im, const double& timestamp,
     for (size_t i_imu = 0; i_imu < vImuMeas.size(); i_imu++)
       mpTracker->GrabImuData(vImuMeas[i_imu]);
 
-  Sophus::SE3f Tcw =
-      mpTracker->GrabImageMonocular(imToFeed, timestamp, filename);
+  Sophus::SE3f Tcw;
+  {
+    StageTimes::Scope timeTracking(mStageTimes, StageTimes::TRACKING);
+    Tcw = mpTracker->GrabImageMonocular(imToFeed, timestamp, filename);
+  }
+  if (mbOfflineMode) WaitForBackgroundStages();
 
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
@@ -470,10 +594,9 @@ void System::DeactivateLocalizationMode() {
 }
 
 bool System::MapChanged() {
-  static int n = 0;
   int curn = mpAtlas->GetLastBigChangeIdx();
-  if (n < curn) {
-    n = curn;
+  if (mnLastBigChangeIdx < curn) {
+    mnLastBigChangeIdx = curn;
     return true;
   } else
     return false;
@@ -496,32 +619,37 @@ System::~System() {
   mpLocalMapper->RequestFinish();
   mpLoopCloser->RequestFinish();
 
-  // Wait until all thread have effectively stopped
-  /*while (!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished() ||
-         mpLoopCloser->isRunningGBA()) {
-    if (!mpLocalMapper->isFinished())
-      cout << "mpLocalMapper is not finished" << endl;
-    if (!mpLoopCloser->isFinished())
-      cout << "mpLoopCloser is not finished" << endl;
-    if (mpLoopCloser->isRunningGBA()) {
-      cout << "mpLoopCloser is running GBA" << endl;
-      cout << "break anyway..." << endl;
-      // break;
-    }
-    usleep(5000);
-  }*/
+  // Wait until all threads have effectively stopped. The loop closer aborts
+  // and waits for its global BA before its thread returns
+  if (mptLocalMapping->joinable()) mptLocalMapping->join();
+  if (mptLoopClosing->joinable()) mptLoopClosing->join();
+  delete mptLocalMapping;
+  delete mptLoopClosing;
 
   if (!mStrSaveAtlasToFile.empty()) {
     Verbose::PrintMess("Atlas saving to file " + mStrSaveAtlasToFile,
                        Verbose::VERBOSITY_DEBUG);
     SaveAtlas(FileType::BINARY_FILE);
   }
-  // if (mptLocalMapping->joinable()) {
-  //   mptLocalMapping->join();
-  // }
-  // if (mptLoopClosing->joinable()) {
-  //   mptLoopClosing->join();
-  // }
+
+  if (mptCheckpoint) {
+    mptCheckpoint->join();
+    delete mptCheckpoint;
+  }
+  delete mpAtlasLog;
+
+  // Stored maps still being restored use the keyframe database and store
+  mpAtlas->WaitForPendingMaps(true);
+
+  if (mpKeyFrameDatabase.use_count() > 1) {
+    // Other Systems keep using the database, drop the keyframes of this one
+    mpKeyFrameDatabase->clearSession(mpAtlas->GetIdCounters());
+  }
+
+  if (mpKeyFrameStore) {
+    mpAtlas->SetKeyFrameStore(static_cast<KeyFrameStore*>(NULL));
+    delete mpKeyFrameStore;
+  }
 
 #ifdef REGISTER_TIMES
   mpTracker->PrintTimeStats();
@@ -1333,6 +1461,18 @@ vector<cv::KeyPoint> System::GetTrackedKeyPointsUn() {
   return mTrackedKeyPointsUn;
 }
 
+vector<KeyFrame*> System::DetectOtherSessionCandidates(float minScore) {
+  KeyFrame* pKF = mpTracker->GetLastKeyFrame();
+  if (!pKF || pKF->isBad()) return vector<KeyFrame*>();
+  return mpKeyFrameDatabase->DetectOtherSessionCandidates(pKF, minScore);
+}
+
+ORBVocabulary_ptr System::GetVocabulary() { return mpVocabulary; }
+
+KeyFrameDatabase_ptr System::GetKeyFrameDatabase() {
+  return mpKeyFrameDatabase;
+}
+
 double System::GetTimeFromIMUInit() {
   double aux = mpLocalMapper->GetCurrKFTime() - mpLocalMapper->mFirstTs;
   if ((aux > 0.) && mpAtlas->isImuInitialized())
@@ -1367,6 +1507,70 @@ void System::ChangeDataset() {
 
 float System::GetImageScale() { return mpTracker->GetImageScale(); }
 
+bool System::GetRectificationMaps(cv::Mat& M1l, cv::Mat& M2l, cv::Mat& M1r,
+                                  cv::Mat& M2r) {
+  if (!settings_ || !settings_->needToRectify()) return false;
+
+  M1l = settings_->M1l();
+  M2l = settings_->M2l();
+  M1r = settings_->M1r();
+  M2r = settings_->M2r();
+  return true;
+}
+
+void System::SetExternalRectification(bool bExternal) {
+  mbExternalRectification = bExternal;
+}
+
+void System::SetOfflineMode(bool bOffline) {
+  mbOfflineMode = bOffline;
+  mpTracker->InformOfflineMode(bOffline);
+}
+
+bool System::IsOfflineMode() { return mbOfflineMode; }
+
+void System::WaitForBackgroundStages() {
+  StageTimes::Scope timeWait(mStageTimes, StageTimes::BACKGROUND_WAIT);
+  // Local mapping hands its keyframe to loop closing before it becomes idle,
+  // and a loop correction or global BA stops and then releases local
+  // mapping, so it is checked again last
+  while (!(mpLocalMapper->IsIdle() && mpLoopCloser->IsIdle() &&
+           mpLocalMapper->IsIdle())) {
+    if (mpLocalMapper->isFinished() || mpLoopCloser->isFinished()) return;
+    usleep(100);
+  }
+}
+
+void System::SetStageTimesEnabled(bool bEnabled) {
+  mStageTimes.SetEnabled(bEnabled);
+  mpLocalMapper->mStageTimes.SetEnabled(bEnabled);
+  mpLoopCloser->mStageTimes.SetEnabled(bEnabled);
+}
+
+StageTimes::Samples System::GetStageTimes() {
+  // Each stage is recorded by a single thread
+  StageTimes::Samples times = mStageTimes.Get();
+  for (const StageTimes::Samples& threadTimes :
+       {mpLocalMapper->mStageTimes.Get(), mpLoopCloser->mStageTimes.Get()}) {
+    for (int i = 0; i < StageTimes::NUM_STAGES; i++)
+      times[i].insert(times[i].end(), threadTimes[i].begin(),
+                      threadTimes[i].end());
+  }
+  return times;
+}
+
+void System::GetAtlasSize(int& nMaps, size_t& nKeyFrames,
+                          size_t& nMapPoints) {
+  vector<Map*> vpMaps = mpAtlas->GetAllMaps();
+  nMaps = vpMaps.size();
+  nKeyFrames = 0;
+  nMapPoints = 0;
+  for (Map* pMap : vpMaps) {
+    nKeyFrames += pMap->KeyFramesInMap();
+    nMapPoints += pMap->MapPointsInMap();
+  }
+}
+
 #ifdef REGISTER_TIMES
 void System::InsertRectTime(double& time) {
   mpTracker->vdRectStereo_ms.push_back(time);
@@ -1382,69 +1586,152 @@ void System::InsertTrackTime(double& time) {
 #endif
 
 void System::SaveAtlas(int type) {
-  std::cout << "Thread ID is: " << std::this_thread::get_id() << std::endl;
-  std::cout << "trying to save \n";
   if (!mStrSaveAtlasToFile.empty()) {
-    std::cout << "not empty\n";
     // clock_t start = clock();
 
     // Save the current session
-    mpAtlas->PreSave();
-    std::cout << "presaved\n";
     string pathSaveFileName = "./";
     pathSaveFileName = pathSaveFileName.append(mStrSaveAtlasToFile);
-    std::cout << "string append\n";
     auto time = std::chrono::system_clock::now();
     std::time_t time_time = std::chrono::system_clock::to_time_t(time);
     std::string str_time = std::ctime(&time_time);
     pathSaveFileName =
         "stereoFiles" + str_time + ".osa";  // pathSaveFileName.append(".osa");
 
-    std::cout << "About to Calculate \n";
-
-    string strVocabularyChecksum =
-        CalculateCheckSum(mStrVocabularyFilePath, TEXT_FILE);
-
-    std::cout << "Vocab checksum`" << strVocabularyChecksum << std::endl;
     std::size_t found = mStrVocabularyFilePath.find_last_of("/\\");
     string strVocabularyName = mStrVocabularyFilePath.substr(found + 1);
-    std::cout << "Type is of: " << type << std::endl;
+    if (type != TEXT_FILE && type != BINARY_FILE) return;
+
+    std::remove(pathSaveFileName.c_str());  // Deletes the file
+    std::ofstream ofs(pathSaveFileName, std::ios::binary);
+
     if (type == TEXT_FILE)  // File text
     {
       cout << "Starting to write the save text file " << endl;
-
-      int rval = std::remove(pathSaveFileName.c_str());  // Deletes the file
-      std::cout << "remove's output is: " << rval << std::endl;
-
-      std::ofstream ofs(pathSaveFileName, std::ios::binary);
-      boost::archive::text_oarchive oa(ofs);
-
-      oa << strVocabularyName;
-      oa << strVocabularyChecksum;
-      oa << *mpAtlas;
+      // The payload is hashed while it is written and the hash appended at
+      // the end of the file
+      ChecksumStreamBuf checksumBuf(ofs.rdbuf());
+      {
+        std::ostream os(&checksumBuf);
+        mpAtlas->PreSave();
+        boost::archive::text_oarchive oa(os);
+        oa << strVocabularyName;
+        oa << GetVocabularyChecksum();
+        oa << *mpAtlas;
+        os.flush();
+      }
+      ofs << kAtlasTrailerTag << checksumBuf.GetChecksum().HexDigest() << "\n";
       cout << "End to write the save text file" << endl;
-    } else if (type == BINARY_FILE)  // File binary
+    } else  // File binary
     {
+      // Every section carries its own checksum
       cout << "Starting to write the save binary file" << endl;
-      int rval = std::remove(pathSaveFileName.c_str());  // Deletes the file
-      std::cerr << errno << std::endl;
-      std::cout << "remove's output is: " << rval << std::endl;
-      std::ofstream ofs(pathSaveFileName, std::ios::binary);
-      std::cout << "bout to boost\n";
-      boost::archive::binary_oarchive oa(ofs);
-      std::cout << "streaming\n";
-      oa << strVocabularyName;
-      std::cout << "streamed name\n";
-      oa << strVocabularyChecksum;
-      std::cout << "streamed checksum\n";
-      oa << *mpAtlas;
+      mpAtlas->SaveSections(ofs, strVocabularyName, GetVocabularyChecksum());
       cout << "End to write save binary file" << endl;
-    } else {
-      std::cout << "no file to be saved I guess\n";
     }
   }
 }
 
+bool System::RequestAtlasCheckpoint(const string& filename) {
+  string strFilename = filename;
+  if (strFilename.empty() && !mStrSaveAtlasToFile.empty())
+    strFilename = mStrSaveAtlasToFile + ".osa";
+  if (strFilename.empty()) {
+    cerr << "No file to save the atlas checkpoint" << endl;
+    return false;
+  }
+
+  unique_lock<mutex> lock(mMutexCheckpoint);
+  if (mbCheckpointWriting) {
+    Verbose::PrintMess("Atlas checkpoint skipped, the previous one is still "
+                       "being written",
+                       Verbose::VERBOSITY_NORMAL);
+    return false;
+  }
+  if (mptCheckpoint) {
+    mptCheckpoint->join();
+    delete mptCheckpoint;
+    mptCheckpoint = static_cast<std::thread*>(NULL);
+  }
+
+  // Nothing that does not depend on the maps is computed while they are held
+  std::size_t found = mStrVocabularyFilePath.find_last_of("/\\");
+  const string strVocabularyName = mStrVocabularyFilePath.substr(found + 1);
+  const string strVocabularyChecksum = GetVocabularyChecksum();
+
+  std::chrono::steady_clock::time_point time_Start =
+      std::chrono::steady_clock::now();
+
+  // Local mapping is paused, unless it is already stopped (localization mode)
+  const bool bStopMapping = !mpLocalMapper->isStopped();
+  if (bStopMapping) {
+    mpLocalMapper->RequestStop();
+    while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
+      usleep(1000);
+  }
+
+  // Delta checkpoints only carry the sections changed since the previous one,
+  // which must have been written to the same log
+  if (mbDeltaCheckpoints &&
+      (!mpAtlasLog || mpAtlasLog->GetFilename() != strFilename)) {
+    delete mpAtlasLog;
+    mpAtlasLog = new AtlasLog(strFilename);
+  }
+  const bool bChangedOnly =
+      mbDeltaCheckpoints && mpAtlasLog->IsOpen() && !mbCheckpointFailed;
+
+  // Every map is captured holding only its own update mutex, so tracking and
+  // loop closing are blocked at most by the capture of one map
+  std::shared_ptr<Atlas::Checkpoint> pCheckpoint =
+      std::make_shared<Atlas::Checkpoint>(mpAtlas->CaptureCheckpoint(
+          strVocabularyName, strVocabularyChecksum, bChangedOnly));
+
+  if (bStopMapping) mpLocalMapper->Release();
+
+  double timeCapture_ms =
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli> >(
+          std::chrono::steady_clock::now() - time_Start)
+          .count();
+  Verbose::PrintMess("Atlas checkpoint captured in " +
+                         std::to_string(timeCapture_ms) + " ms",
+                     Verbose::VERBOSITY_NORMAL);
+
+  mbCheckpointWriting = true;
+  mptCheckpoint = new thread([this, strFilename, pCheckpoint,
+                              bChangedOnly]() {
+#ifdef __linux__
+    // Lowest priority, only this thread is affected
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+    bool bWritten;
+    if (!mbDeltaCheckpoints) {
+      bWritten = WriteAtlasCheckpoint(strFilename, *pCheckpoint);
+    } else if (bChangedOnly) {
+      bWritten = mpAtlasLog->Append(*pCheckpoint);
+      // Compacted once the outdated records outweigh the live ones
+      if (bWritten && mpAtlasLog->GarbageSize() > mpAtlasLog->LiveSize() &&
+          !mpAtlasLog->Compact())
+        cerr << "Failed to compact the atlas log " << strFilename << endl;
+    } else {
+      bWritten = mpAtlasLog->Write(*pCheckpoint);
+    }
+
+    // The next checkpoint is a full one if this one was lost
+    mbCheckpointFailed = !bWritten;
+    if (!bWritten)
+      cerr << "Failed to write the atlas checkpoint " << strFilename << endl;
+    else
+      Verbose::PrintMess("Atlas checkpoint written to " + strFilename + " (" +
+                             std::to_string(pCheckpoint->vpSections.size()) +
+                             " sections, " +
+                             std::to_string(pCheckpoint->vnMapIds.size()) +
+                             " maps)",
+                         Verbose::VERBOSITY_NORMAL);
+    mbCheckpointWriting = false;
+  });
+  return true;
+}
+
 bool System::LoadAtlas(int type) {
   string strFileVoc, strVocChecksum;
   bool isRead = false;
@@ -1453,7 +1740,43 @@ bool System::LoadAtlas(int type) {
   pathLoadFileName = pathLoadFileName.append(mStrLoadAtlasFromFile);
   pathLoadFileName = pathLoadFileName.append(".osa");
 
-  if (type == TEXT_FILE)  // File text
+  // Check the integrity of the payload before deserialising it. The records
+  // of an atlas log are checked while the log is replayed, and the sections
+  // of a sectioned file by the loader of each one
+  const bool bLog =
+      type == BINARY_FILE && AtlasLog::IsLogFile(pathLoadFileName);
+  bool bSectioned = false;
+  if (type == BINARY_FILE && !bLog) {
+    std::ifstream ifs(pathLoadFileName, std::ios::binary);
+    bSectioned = ifs.good() && Atlas::IsSectionedFile(ifs);
+  }
+  string strPayloadChecksum;
+  long long nPayloadSize;
+  if (!bLog && !bSectioned) {
+    if (ReadAtlasTrailer(pathLoadFileName, strPayloadChecksum,
+                         nPayloadSize)) {
+      if (Checksum::FileChecksum(pathLoadFileName, nPayloadSize) !=
+          strPayloadChecksum) {
+        cout << "The atlas file is corrupted, its checksum does not match"
+             << endl;
+        return false;
+      }
+    } else {
+      Verbose::PrintMess("Atlas file without checksum, integrity not checked",
+                         Verbose::VERBOSITY_NORMAL);
+    }
+  }
+
+  if (bLog) {
+    cout << "Starting to read the atlas log" << endl;
+    std::ifstream ifs(pathLoadFileName, std::ios::binary);
+    if (!mpAtlas->LoadLog(ifs, pathLoadFileName, strFileVoc, strVocChecksum)) {
+      cout << "Error loading the atlas log" << endl;
+      return false;
+    }
+    cout << "End to load the atlas log" << endl;
+    isRead = true;
+  } else if (type == TEXT_FILE)  // File text
   {
     cout << "Starting to read the save text file " << endl;
     std::ifstream ifs(pathLoadFileName, std::ios::binary);
@@ -1475,18 +1798,33 @@ bool System::LoadAtlas(int type) {
       cout << "Load file not found" << endl;
       return false;
     }
-    boost::archive::binary_iarchive ia(ifs);
-    ia >> strFileVoc;
-    ia >> strVocChecksum;
-    ia >> *mpAtlas;
+    if (bSectioned) {
+      if (!mpAtlas->LoadSections(ifs, pathLoadFileName, strFileVoc,
+                                  strVocChecksum)) {
+        cout << "Error loading the save binary file" << endl;
+        return false;
+      }
+    } else {
+      // Atlas saved as a single boost archive by older versions
+      boost::archive::binary_iarchive ia(ifs);
+      ia >> strFileVoc;
+      ia >> strVocChecksum;
+      ia >> *mpAtlas;
+    }
     cout << "End to load the save binary file" << endl;
     isRead = true;
   }
 
   if (isRead) {
-    // Check if the vocabulary is the same
-    string strInputVocabularyChecksum =
-        CalculateCheckSum(mStrVocabularyFilePath, TEXT_FILE);
+    // Check if the vocabulary is the same. Sessions saved by older versions
+    // carry an MD5 checksum, which is only computed for them
+    string strInputVocabularyChecksum;
+    if (strVocChecksum.compare(0, kChecksumPrefix.size(), kChecksumPrefix) ==
+        0)
+      strInputVocabularyChecksum = GetVocabularyChecksum();
+    else
+      strInputVocabularyChecksum =
+          CalculateLegacyCheckSum(mStrVocabularyFilePath);
     if (strInputVocabularyChecksum.compare(strVocChecksum) != 0) {
       cout << "The vocabulary load isn't the same which the load session was "
               "created "
@@ -1495,51 +1833,52 @@ bool System::LoadAtlas(int type) {
       return false;  // Both are differents
     }
 
-    mpAtlas->SetKeyFrameDababase(mpKeyFrameDatabase);
-    mpAtlas->SetORBVocabulary(mpVocabulary);
+    mpAtlas->SetKeyFrameDababase(mpKeyFrameDatabase.get());
+    mpAtlas->SetORBVocabulary(mpVocabulary.get());
     mpAtlas->PostLoad();
     return true;
   }
   return false;
 }
 
-string System::CalculateCheckSum(string filename, int type) {
-  string checksum = "";
-
-  unsigned char c[MD5_DIGEST_LENGTH];
+string System::GetVocabularyChecksum() {
+  string checksum = SharedVocabularyFingerprint(mpVocabulary);
+  if (checksum.empty()) {
+    cout << "[E] Unable to open the in file " << mStrVocabularyFilePath
+         << " for hashing." << endl;
+    return checksum;
+  }
 
-  std::ios_base::openmode flags = std::ios::in;
-  if (type == BINARY_FILE)  // Binary file
-    flags = std::ios::in | std::ios::binary;
+  return kChecksumPrefix + checksum;
+}
 
-  std::cout << "inside\n";
+string System::CalculateLegacyCheckSum(string filename) {
+  string checksum = "";
 
-  ifstream f(filename.c_str(), flags);
+  ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
   if (!f.is_open()) {
     cout << "[E] Unable to open the in file " << filename << " for Md5 hash."
          << endl;
     return checksum;
   }
 
-  MD5_CTX md5Context;
-  char buffer[1024];
-
-  std::cout << "buffer generated\n";
+  EVP_MD_CTX* pMd5Context = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(pMd5Context, EVP_md5(), NULL);
 
-  MD5_Init(&md5Context);
-
-  std::cout << "just initialized MD5\n";
-  while (int count = f.readsome(buffer, sizeof(buffer))) {
-    MD5_Update(&md5Context, buffer, count);
-    // std::cout << buffer;
+  std::vector<char> vBuffer(1 << 22);
+  while (f) {
+    f.read(vBuffer.data(), vBuffer.size());
+    if (f.gcount() <= 0) break;
+    EVP_DigestUpdate(pMd5Context, vBuffer.data(), f.gcount());
   }
-  std::cout << "about to close\n";
-
   f.close();
 
-  MD5_Final(c, &md5Context);
+  unsigned char c[EVP_MAX_MD_SIZE];
+  unsigned int nLength = 0;
+  EVP_DigestFinal_ex(pMd5Context, c, &nLength);
+  EVP_MD_CTX_free(pMd5Context);
 
-  for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+  for (unsigned int i = 0; i < nLength; i++) {
     char aux[10];
     sprintf(aux, "%02x", c[i]);
     checksum = checksum + aux;
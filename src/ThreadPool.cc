@@ -0,0 +1,60 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2021 Carlos Campos, Richard Elvira, Juan J. Gómez
+ * Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós,
+ * University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ORB-SLAM3. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThreadPool.h"
+
+namespace ORB_SLAM3 {
+
+ThreadPool::ThreadPool(int nThreads) : mbFinishRequested(false) {
+  if (nThreads <= 0) nThreads = std::thread::hardware_concurrency();
+  if (nThreads <= 0) nThreads = 1;
+
+  mvWorkers.reserve(nThreads);
+  for (int i = 0; i < nThreads; ++i)
+    mvWorkers.emplace_back(&ThreadPool::Run, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mbFinishRequested = true;
+  }
+  mcvQueue.notify_all();
+  for (std::thread& worker : mvWorkers) worker.join();
+}
+
+void ThreadPool::Run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mMutexQueue);
+      mcvQueue.wait(lock,
+                    [this] { return mbFinishRequested || !mlTasks.empty(); });
+      // Pending tasks are drained before the worker exits
+      if (mlTasks.empty()) return;
+      task = std::move(mlTasks.front());
+      mlTasks.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace ORB_SLAM3
@@ -39,15 +39,18 @@ using namespace std;
 
 namespace ORB_SLAM3 {
 
-Tracking::Tracking(System* pSys, ORBVocabulary* pVoc, const Atlas_ptr &pAtlas,
-                   KeyFrameDatabase* pKFDB, const string& strSettingPath,
-                   const int sensor, Settings* settings, const string& _nameSeq)
+Tracking::Tracking(System* pSys, const ORBVocabulary* pVoc,
+                   const Atlas_ptr& pAtlas, KeyFrameDatabase* pKFDB,
+                   const string& strSettingPath, const int sensor,
+                   Settings* settings, const string& _nameSeq)
     : mState(Tracker::NO_IMAGES_YET),
       mSensor(sensor),
       mTrackedFr(0),
       mbStep(false),
       mbOnlyTracking(false),
+      mbOfflineMode(false),
       mbMapUpdated(false),
+      mnNextImuPreintegratedFrame(0),
       mbVO(false),
       mpORBVocabulary(pVoc),
       mpKeyFrameDB(pKFDB),
@@ -551,6 +554,8 @@ void Tracking::PrintTimeStats() {
 
 Tracking::~Tracking() {
   // f_track_stats.close();
+  for (IMU::Preintegrated* pImuPreintegrated : mvpImuPreintegratedFramePool)
+    delete pImuPreintegrated;
 }
 
 void Tracking::newParameterLoader(Settings* settings) {
@@ -1412,6 +1417,7 @@ Sophus::SE3f Tracking::GrabImageStereo(const cv::Mat& imRectLeft,
 
   // cout << "Incoming frame ended" << endl;
 
+  mCurrentFrame.mnId = mpAtlas->NewFrameId();
   mCurrentFrame.mNameFile = filename;
   mCurrentFrame.mnDataset = mnNumDataset;
 
@@ -1456,6 +1462,7 @@ Sophus::SE3f Tracking::GrabImageRGBD(const cv::Mat& imRGB, const cv::Mat& imD,
         Frame(mImGray, imDepth, timestamp, mpORBextractorLeft, mpORBVocabulary,
               mK, mDistCoef, mbf, mThDepth, mpCamera, &mLastFrame, *mpImuCalib);
 
+  mCurrentFrame.mnId = mpAtlas->NewFrameId();
   mCurrentFrame.mNameFile = filename;
   mCurrentFrame.mnDataset = mnNumDataset;
 
@@ -1507,6 +1514,7 @@ Sophus::SE3f Tracking::GrabImageMonocular(const cv::Mat& im,
 
   if (mState == Tracker::NO_IMAGES_YET) t0 = timestamp;
 
+  mCurrentFrame.mnId = mpAtlas->NewFrameId();
   mCurrentFrame.mNameFile = filename;
   mCurrentFrame.mnDataset = mnNumDataset;
 
@@ -1571,8 +1579,14 @@ void Tracking::PreintegrateIMU() {
     return;
   }
 
+  if (mvpImuPreintegratedFramePool.size() < kImuPreintegratedFramePoolSize)
+    mvpImuPreintegratedFramePool.push_back(new IMU::Preintegrated());
   IMU::Preintegrated* pImuPreintegratedFromLastFrame =
-      new IMU::Preintegrated(mLastFrame.mImuBias, mCurrentFrame.mImuCalib);
+      mvpImuPreintegratedFramePool[mnNextImuPreintegratedFrame];
+  mnNextImuPreintegratedFrame =
+      (mnNextImuPreintegratedFrame + 1) % kImuPreintegratedFramePoolSize;
+  pImuPreintegratedFromLastFrame->Initialize(mLastFrame.mImuBias,
+                                             mCurrentFrame.mImuCalib);
 
   for (int i = 0; i < n; i++) {
     float tstep;
@@ -1615,8 +1629,9 @@ void Tracking::PreintegrateIMU() {
 
     if (!mpImuPreintegratedFromLastKF)
       cout << "mpImuPreintegratedFromLastKF does not exist" << endl;
-    mpImuPreintegratedFromLastKF->IntegrateNewMeasurement(acc, angVel, tstep);
-    pImuPreintegratedFromLastFrame->IntegrateNewMeasurement(acc, angVel, tstep);
+    IMU::Preintegrated::IntegrateNewMeasurement(acc, angVel, tstep,
+                                                mpImuPreintegratedFromLastKF,
+                                                pImuPreintegratedFromLastFrame);
   }
 
   mCurrentFrame.mpImuPreintegratedFrame = pImuPreintegratedFromLastFrame;
@@ -2876,8 +2891,9 @@ bool Tracking::NeedNewKeyFrame() {
   if (nKFs <= 2) nMinObs = 2;
   int nRefMatches = mpReferenceKF->TrackedMapPoints(nMinObs);
 
-  // Local Mapping accept keyframes?
-  bool bLocalMappingIdle = mpLocalMapper->AcceptKeyFrames();
+  // Local Mapping accept keyframes? In offline mode it has finished with the
+  // previous keyframe before this frame was grabbed.
+  bool bLocalMappingIdle = mbOfflineMode || mpLocalMapper->AcceptKeyFrames();
 
   // Check how many "close" points are being tracked and how many could be
   // potentially created.
@@ -3134,24 +3150,27 @@ void Tracking::SearchLocalPoints() {
 
   int nToMatch = 0;
 
-  // Project points in frame and check its visibility
-  for (vector<MapPoint*>::iterator vit = mvpLocalMapPoints.begin(),
-                                   vend = mvpLocalMapPoints.end();
-       vit != vend; vit++) {
-    MapPoint* pMP = *vit;
-
-    if (pMP->mnLastFrameSeen == mCurrentFrame.mnId) continue;
-    if (pMP->isBad()) continue;
-    // Project (this fills MapPoint variables for matching)
-    if (mCurrentFrame.isInFrustum(pMP, 0.5)) {
-      pMP->IncreaseVisible();
-      nToMatch++;
-    }
-    if (pMP->mbTrackInView) {
-      mCurrentFrame.mmProjectPoints[pMP->mnId] =
-          cv::Point2f(pMP->mTrackProjX, pMP->mTrackProjY);
+  // Project points in frame and check its visibility. The camera model is
+  // resolved once for the whole local map
+  mCurrentFrame.mpCamera->Visit([&](const auto& camera) {
+    for (vector<MapPoint*>::iterator vit = mvpLocalMapPoints.begin(),
+                                     vend = mvpLocalMapPoints.end();
+         vit != vend; vit++) {
+      MapPoint* pMP = *vit;
+
+      if (pMP->mnLastFrameSeen == mCurrentFrame.mnId) continue;
+      if (pMP->isBad()) continue;
+      // Project (this fills MapPoint variables for matching)
+      if (mCurrentFrame.isInFrustum(pMP, 0.5, camera)) {
+        pMP->IncreaseVisible();
+        nToMatch++;
+      }
+      if (pMP->mbTrackInView) {
+        mCurrentFrame.mmProjectPoints[pMP->mnId] =
+            cv::Point2f(pMP->mTrackProjX, pMP->mTrackProjY);
+      }
     }
-  }
+  });
 
   if (nToMatch > 0) {
     ORBmatcher matcher(0.8);
@@ -3226,13 +3245,10 @@ void Tracking::UpdateLocalKeyFrames() {
       MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
       if (pMP) {
         if (!pMP->isBad()) {
-          const map<KeyFrame*, tuple<int, int>> observations =
-              pMP->GetObservations();
-          for (map<KeyFrame*, tuple<int, int>>::const_iterator
-                   it = observations.begin(),
-                   itend = observations.end();
-               it != itend; it++)
-            keyframeCounter[it->first]++;
+          pMP->ForEachObservation(
+              [&keyframeCounter](const MapPoint::Observation& obs) {
+                keyframeCounter[obs.first]++;
+              });
         } else {
           mCurrentFrame.mvpMapPoints[i] = NULL;
         }
@@ -3245,13 +3261,10 @@ void Tracking::UpdateLocalKeyFrames() {
         MapPoint* pMP = mLastFrame.mvpMapPoints[i];
         if (!pMP) continue;
         if (!pMP->isBad()) {
-          const map<KeyFrame*, tuple<int, int>> observations =
-              pMP->GetObservations();
-          for (map<KeyFrame*, tuple<int, int>>::const_iterator
-                   it = observations.begin(),
-                   itend = observations.end();
-               it != itend; it++)
-            keyframeCounter[it->first]++;
+          pMP->ForEachObservation(
+              [&keyframeCounter](const MapPoint::Observation& obs) {
+                keyframeCounter[obs.first]++;
+              });
         } else {
           // MODIFICATION
           mLastFrame.mvpMapPoints[i] = NULL;
@@ -3530,7 +3543,7 @@ void Tracking::Reset(bool bLocMap) {
 
   // Clear BoW Database
   Verbose::PrintMess("Reseting Database...", Verbose::VERBOSITY_NORMAL);
-  mpKeyFrameDB->clear();
+  mpKeyFrameDB->clearSession(mpAtlas->GetIdCounters());
   Verbose::PrintMess("done", Verbose::VERBOSITY_NORMAL);
 
   // Clear Map (this erase MapPoints and KeyFrames)
@@ -3541,8 +3554,7 @@ void Tracking::Reset(bool bLocMap) {
     mpAtlas->SetInertialSensor();
   mnInitialFrameId = 0;
 
-  KeyFrame::nNextId = 0;
-  Frame::nNextId = 0;
+  mpAtlas->ResetFrameAndKeyFrameIds();
   mState = Tracker::NO_IMAGES_YET;
 
   mbReadyToInitializate = false;
@@ -3589,7 +3601,7 @@ void Tracking::ResetActiveMap(bool bLocMap) {
 
   // KeyFrame::nNextId = mpAtlas->GetLastInitKFid();
   // Frame::nNextId = mnLastInitFrameId;
-  mnLastInitFrameId = Frame::nNextId;
+  mnLastInitFrameId = mpAtlas->GetNextFrameId();
   // mnLastRelocFrameId = mnLastInitFrameId;
   mState = Tracker::NO_IMAGES_YET;  // Tracker::NOT_INITIALIZED;
 
@@ -3673,12 +3685,12 @@ void Tracking::ChangeCalibration(const string& strSettingPath) {
   DistCoef.copyTo(mDistCoef);
 
   mbf = fSettings["Camera.bf"];
-
-  Frame::mbInitialComputations = true;
 }
 
 void Tracking::InformOnlyTracking(const bool& flag) { mbOnlyTracking = flag; }
 
+void Tracking::InformOfflineMode(const bool& flag) { mbOfflineMode = flag; }
+
 void Tracking::UpdateFrameIMU(const float s, const IMU::Bias& b,
                               KeyFrame* pCurrentKeyFrame) {
   Map* pMap = pCurrentKeyFrame->GetMap();
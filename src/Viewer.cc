@@ -25,11 +25,13 @@
 
 #include "ImprovedTypes.hpp"
 #include <chrono>
+#include <cstdio>
 #include <ctime>
 #include <mutex>
 #include <stdexcept>
 #include <iostream>
 #include <string>
+#include <thread>
 #include "System.h"
 #include "Atlas.h"
 #include "Tracking.h"
@@ -90,6 +92,10 @@ void Viewer::newParameterLoader(const Settings &settings) {
   mViewpointZ = settings.viewPointZ();
   mViewpointF = settings.viewPointF();
 
+  mbHeadless = settings.viewerHeadless();
+  mstrHeadlessOutput = settings.viewerHeadlessOutput();
+  mHeadlessPeriod = settings.viewerHeadlessPeriod();
+
   if ((mpTracker->mSensor == CameraType::STEREO || mpTracker->mSensor == CameraType::IMU_STEREO ||
         mpTracker->mSensor == CameraType::IMU_RGBD || mpTracker->mSensor == CameraType::RGBD) &&
         settings.cameraType() == Settings::KannalaBrandt)
@@ -169,6 +175,18 @@ bool Viewer::ParseViewerParamFile(cv::FileStorage &fSettings) {
     b_miss_params = true;
   }
 
+  mbHeadless = false;
+  node = fSettings["Viewer.Headless"];
+  if (!node.empty()) mbHeadless = static_cast<int>(node) != 0;
+
+  mstrHeadlessOutput = "MapView.png";
+  node = fSettings["Viewer.HeadlessOutput"];
+  if (!node.empty()) mstrHeadlessOutput = node.string();
+
+  mHeadlessPeriod = 1.0;
+  node = fSettings["Viewer.HeadlessPeriod"];
+  if (!node.empty()) mHeadlessPeriod = node.real();
+
   if(!b_miss_params){
     std::string sCameraName = fSettings["Camera.type"];
     if ((mpTracker->mSensor == CameraType::STEREO || mpTracker->mSensor == CameraType::IMU_STEREO ||
@@ -187,7 +205,17 @@ void Viewer::update(const Sophus::SE3f &pose){
   }
 }
 
+std::shared_ptr<const FrameRecord> Viewer::GetLastFrameRecord(
+    const bool bRequestImage) {
+  return mpFrameDrawer.GetLastRecord(bRequestImage);
+}
+
 void Viewer::Run() {
+  if (mbHeadless) {
+    RunHeadless();
+    close();
+    return;
+  }
 
   pangolin::CreateWindowAndBind("ORB-SLAM3: Map Viewer", 1024, 768);
 
@@ -352,9 +380,93 @@ void Viewer::Run() {
       break;
   }
 
+  mpMapDrawer.ReleaseBuffers();
   close();
 }
 
+void Viewer::RunHeadless() {
+  // Same viewpoint as the Pangolin view following the camera: placed at
+  // (ViewpointX, ViewpointY, ViewpointZ) in the camera frame, looking at its
+  // origin with the image y axis pointing down
+  const Eigen::Vector3f eye(mViewpointX, mViewpointY, mViewpointZ);
+  const Eigen::Vector3f down(0.0f, 1.0f, 0.0f);
+  Eigen::Vector3f z = eye.norm() > 1e-6f ? Eigen::Vector3f(-eye.normalized())
+                                         : Eigen::Vector3f::UnitZ();
+  Eigen::Vector3f x = down.cross(z);
+  if (x.norm() < 1e-6f) x = Eigen::Vector3f::UnitX();
+  x.normalize();
+  const Eigen::Vector3f y = z.cross(x);
+
+  Eigen::Matrix3f Rvc;
+  Rvc.row(0) = x;
+  Rvc.row(1) = y;
+  Rvc.row(2) = z;
+  const Sophus::SE3f Tvc(Rvc, -Rvc * eye);
+
+  const float trackedImageScale = mpTracker->GetImageScale();
+  cv::Mat imMap(768, 1024, CV_8UC3);
+
+  std::cout << "Starting the Viewer without display, writing to "
+            << mstrHeadlessOutput << std::endl;
+  std::chrono::steady_clock::time_point tLastWrite;
+  bool bWritten = false;
+  while (isOpen()) {
+    const std::chrono::steady_clock::time_point tNow =
+        std::chrono::steady_clock::now();
+    const double tSinceWrite =
+        std::chrono::duration<double>(tNow - tLastWrite).count();
+    // Tracking only copies images on request: ask one tick ahead so that the
+    // written frame is current
+    if (tSinceWrite + 2e-3 * mT >= mHeadlessPeriod)
+      mpFrameDrawer.GetLastRecord(true);
+    if (!bWritten || tSinceWrite >= mHeadlessPeriod) {
+      const Sophus::SE3f Tcw = mpMapDrawer.GetCurrentCameraPose().inverse();
+      mpMapDrawer.DrawMapSoftware(imMap, Tvc * Tcw, mViewpointF, true, true,
+                                  true, true);
+
+      cv::Mat im = mpFrameDrawer.DrawFrame(trackedImageScale);
+      if (both) {
+        cv::Mat imLeft = im;
+        cv::Mat imRight = mpFrameDrawer.DrawRightFrame(trackedImageScale);
+        cv::hconcat(imLeft, imRight, im);
+      }
+
+      cv::Mat toShow = imMap;
+      if (!im.empty() && im.type() == imMap.type()) {
+        const int width = im.cols * imMap.rows / im.rows;
+        cv::resize(im, im, cv::Size(width, imMap.rows));
+        cv::hconcat(imMap, im, toShow);
+      }
+      WriteHeadlessView(toShow);
+
+      tLastWrite = tNow;
+      bWritten = true;
+    }
+
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(static_cast<long>(mT * 1e3)));
+  }
+}
+
+void Viewer::WriteHeadlessView(const cv::Mat &im) {
+  // Written next to the output and renamed, so readers never see a partial
+  // image
+  std::string strTmp = mstrHeadlessOutput + ".tmp";
+  const size_t nExt = mstrHeadlessOutput.find_last_of('.');
+  const size_t nDir = mstrHeadlessOutput.find_last_of('/');
+  if (nExt != std::string::npos &&
+      (nDir == std::string::npos || nExt > nDir)) {
+    strTmp = mstrHeadlessOutput.substr(0, nExt) + ".tmp" +
+             mstrHeadlessOutput.substr(nExt);
+  }
+
+  if (!cv::imwrite(strTmp, im) ||
+      std::rename(strTmp.c_str(), mstrHeadlessOutput.c_str()) != 0) {
+    std::cerr << "Viewer: could not write " << mstrHeadlessOutput
+              << std::endl;
+  }
+}
+
 bool Viewer::isClosed() const {
   return mbClosed;
 }